@@ -0,0 +1,121 @@
+// License: please see LICENSE1 file for more details.
+#include "Affinity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <sched.h>
+#elif defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#endif
+
+
+#ifdef __linux__
+
+// Parse a sysfs cpu list such as "0-7,16-23" into a cpu set
+static bool readNodeCpus(int node, cpu_set_t* cpus)
+{
+    char path[128];
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    CPU_ZERO(cpus);
+    bool any = false;
+    int first, last;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        int c = fgetc(file);
+        if (c == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            c = fgetc(file);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+        {
+            CPU_SET(cpu, cpus);
+            any = true;
+        }
+        if (c != ',')
+            break;
+    }
+    fclose(file);
+    return any;
+}
+
+int numaNodeCount()
+{
+    int count = 0;
+    cpu_set_t cpus;
+    while (count < 1024 && readNodeCpus(count, &cpus))
+        count++;
+    return count ? count : 1;
+}
+
+int numaNodeCpuCount(int node)
+{
+    cpu_set_t cpus;
+    if (!readNodeCpus(node, &cpus))
+        return 0;
+    return CPU_COUNT(&cpus);
+}
+
+bool pinThreadToNumaNode(int node)
+{
+    cpu_set_t cpus;
+    if (!readNodeCpus(node, &cpus))
+        return false;
+    return sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == 0;
+}
+
+#elif defined(_WIN32) || defined(WIN32)
+
+int numaNodeCount()
+{
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest))
+        return 1;
+    return (int)highest + 1;
+}
+
+int numaNodeCpuCount(int node)
+{
+    ULONGLONG mask = 0;
+    if (!GetNumaNodeProcessorMask((UCHAR)node, &mask))
+        return 0;
+    int count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+bool pinThreadToNumaNode(int node)
+{
+    ULONGLONG mask = 0;
+    if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || mask == 0)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
+
+#else
+
+int numaNodeCount()
+{
+    return 1;
+}
+
+int numaNodeCpuCount(int /*node*/)
+{
+    return 0;
+}
+
+bool pinThreadToNumaNode(int /*node*/)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,13 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+// Number of NUMA nodes on this host, 1 if it cannot be determined
+int numaNodeCount();
+
+// Number of processors of a NUMA node, 0 if the node is unknown
+int numaNodeCpuCount(int node);
+
+// Restrict the calling thread to the processors of a NUMA node, so that memory it
+// touches first is allocated on that node. Returns false if the node is unknown
+bool pinThreadToNumaNode(int node);
@@ -0,0 +1,136 @@
+// License: please see LICENSE1 file for more details.
+
+#include "BatchDecoder.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "codestream_image_types.h"
+#include <algorithm>
+#include <thread>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+
+BatchDecoder::BatchDecoder(Decoder* decoder, size_t depth) : decoder(decoder),
+									  parsed(depth),
+									  inFlight(depth),
+									  images(0),
+									  pixels(0)
+{
+	failed = false;
+}
+
+
+BatchDecoder::~BatchDecoder(void)
+{
+}
+
+static bool isImageFile(const std::string& name)
+{
+	size_t dot = name.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = name.substr(dot);
+	return ext == ".jp2" || ext == ".j2k" || ext == ".j2c" || ext == ".JP2" || ext == ".J2K" || ext == ".J2C";
+}
+
+/**
+ * @brief Collects the JPEG 2000 files (.jp2, .j2k, .j2c) of a directory, sorted by name.
+ * @return number of files found, -1 if the directory cannot be read
+ */
+int BatchDecoder::listImages(const std::string& directory, std::vector<std::string>& fileNames)
+{
+	size_t first = fileNames.size();
+#if defined(_WIN32) || defined(WIN32)
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE)
+		return -1;
+	do {
+		if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && isImageFile(entry.cFileName))
+			fileNames.push_back(directory + "\\" + entry.cFileName);
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return -1;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (isImageFile(entry->d_name))
+			fileNames.push_back(directory + "/" + entry->d_name);
+	}
+	closedir(dir);
+#endif
+	std::sort(fileNames.begin() + first, fileNames.end());
+	return (int)(fileNames.size() - first);
+}
+
+void BatchDecoder::parser(const std::vector<std::string>* fileNames)
+{
+	for (size_t i = 0; i < fileNames->size() && !failed; ++i) {
+		ParsedImage item;
+		item.fileName = &(*fileNames)[i];
+		item.img = decoder->parse(*item.fileName);
+		if (!item.img) {
+			LogError("Error: could not read %s\n", item.fileName->c_str());
+			continue;
+		}
+		parsed.push(item);
+	}
+	parsed.close();
+}
+
+void BatchDecoder::writer(BatchSink sink, void* userData)
+{
+	DecodeJob* job;
+	DecodedImage image;
+	while (inFlight.pop(job)) {
+		if (job->collect(&image) == 0) {
+			images++;
+			pixels += (double)image.width * image.height;
+			if (sink)
+				sink(job->getFileName(), image, userData);
+		} else {
+			LogError("Error: decoding %s failed\n", job->getFileName().c_str());
+		}
+		delete job;
+	}
+}
+
+/**
+ * @brief Decodes all images and reports the sustained throughput.
+ * @return number of images decoded
+ */
+int BatchDecoder::run(const std::vector<std::string>& fileNames, BatchSink sink, void* userData)
+{
+	images = 0;
+	pixels = 0;
+	failed = false;
+
+	double t1 = time_stamp();
+	std::thread parserThread(&BatchDecoder::parser, this, &fileNames);
+	std::thread writerThread(&BatchDecoder::writer, this, sink, userData);
+
+	ParsedImage item;
+	while (parsed.pop(item)) {
+		try {
+			inFlight.push(decoder->decodeAsync(item.img, *item.fileName));
+		} catch (const Error& error) {
+			LogError("Error: %s\n", error.what());
+			decoder->recycle(item.img);
+			failed = true;
+		}
+	}
+	inFlight.close();
+	parserThread.join();
+	writerThread.join();
+	double elapsed = time_stamp() - t1;
+
+	if (elapsed > 0)
+		printf("Batch: %d images in %.3f s, %.2f images/s, %.2f MPixel/s\n", images, elapsed, images / elapsed, pixels / elapsed / 1e6);
+	return images;
+}
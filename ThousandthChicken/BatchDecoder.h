@@ -0,0 +1,46 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "Decoder.h"
+#include "BoundedQueue.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Receives every decoded image of a batch on the writer thread
+typedef void (*BatchSink)(const std::string& fileName, DecodedImage& image, void* userData);
+
+/**
+ * @brief Decodes a list of images as a three stage pipeline.
+ *
+ * A parser thread runs ahead parsing the next images, the calling thread submits parsed
+ * images to the device, and a writer thread collects finished images. The queues between
+ * the stages are bounded: with the default depth of two, one image is on the device while
+ * the next is being submitted (double buffering), and parsing stays at most two images ahead.
+ */
+class BatchDecoder
+{
+public:
+	BatchDecoder(Decoder* decoder, size_t depth = 2);
+	~BatchDecoder(void);
+	int run(const std::vector<std::string>& fileNames, BatchSink sink = NULL, void* userData = NULL);
+	static int listImages(const std::string& directory, std::vector<std::string>& fileNames);
+
+private:
+	struct ParsedImage
+	{
+		type_image* img;
+		const std::string* fileName;
+	};
+
+	void parser(const std::vector<std::string>* fileNames);
+	void writer(BatchSink sink, void* userData);
+
+	Decoder* decoder;
+	BoundedQueue<ParsedImage> parsed;
+	BoundedQueue<DecodeJob*> inFlight;
+	int images;
+	double pixels;
+	std::atomic<bool> failed;
+};
@@ -0,0 +1,55 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief Fixed capacity queue between pipeline threads. push blocks while the queue is full,
+ * pop blocks while it is empty; after close, pop drains what is left and then fails.
+ */
+template <typename T> class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1), closed(false)
+	{}
+
+	void push(const T& item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (items.size() >= capacity)
+			notFull.wait(guard);
+		items.push_back(item);
+		notEmpty.notify_one();
+	}
+
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (items.empty() && !closed)
+			notEmpty.wait(guard);
+		if (items.empty())
+			return false;
+		item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex lock;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+};
@@ -6,6 +6,10 @@
 #include "codestream_image_types.h"
 
 #include "basic.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+#include <math.h>
+#include <string.h>
 
 #ifdef __linux__
 #include <sys/time.h>
@@ -27,158 +31,119 @@ CoefficientCoder::CoefficientCoder(KernelInitInfoBase initInfo) :
 						 d_decodedCoefficientsBuffers(0),
 						 d_codestreamBuffers(0),
 						 d_stBuffers(0),
-						 d_infos(0)
+						 d_infos(0),
+						 staging(NULL),
+						 useSVM(false)
 
 {
+	useSVM = SharedMemory::supported(device);
+	// two slots per tile component, so uploads of the next components overlap with decoding
+	if (!useSVM)
+		staging = new StagingRing(context, 8);
 }
 
 
 CoefficientCoder::~CoefficientCoder(void)
 {
 	if (d_infos) {
-		cl_int err = clReleaseMemObject(d_infos);
+		cl_int err = ResourceCounters::releaseBuffer(d_infos);
 		SAMPLE_CHECK_ERRORS(err);
 	}
 
 	if (d_stBuffers) {
-		cl_int err = clReleaseMemObject(d_stBuffers);
+		cl_int err = ResourceCounters::releaseBuffer(d_stBuffers);
 		SAMPLE_CHECK_ERRORS(err);
 
 	}
 
 	if (d_codestreamBuffers) {
-		cl_int err = clReleaseMemObject(d_codestreamBuffers);
+		cl_int err = ResourceCounters::releaseBuffer(d_codestreamBuffers);
 		SAMPLE_CHECK_ERRORS(err);
 
 	}
 
-	if (h_infos)
-	   aligned_free(h_infos);
-	if (h_codestreamBuffers)
-	   aligned_free(h_codestreamBuffers);
+	if (useSVM) {
+		SharedMemory::free(context, h_codestreamBuffers);
+		SharedMemory::free(context, h_infos);
+	}
+	delete staging;
 }
 
 
-void CoefficientCoder::decode_tile(type_tile *tile)
+tDeviceRC CoefficientCoder::decode_tile(type_tile *tile)
 {
-//	println_start(INFO);
-
-	std::list<type_codeblock *> cblks;
-	extract_cblks(tile, cblks);
-
-	EntropyCodingTaskInfo *tasks = (EntropyCodingTaskInfo *) calloc( cblks.size(),sizeof(EntropyCodingTaskInfo));
-
-	std::list<type_codeblock *>::iterator ii = cblks.begin();
-
-	int num_tasks = 0;
-	int offset = 0;
-	for(; ii != cblks.end(); ++ii)
-	{
-		convert_to_decoding_task(tasks[num_tasks++], *(*ii),offset);
+	for(int i = 0; i < tile->parent_img->num_components; i++) {
+		tDeviceRC err = decode_tile_comp(&(tile->tile_comp[i]));
+		if (err != DeviceSuccess)
+			return err;
 	}
-
-//	printf("%d\n", num_tasks);
-	decodeInit(tasks, num_tasks, &tile->coefficients);
-	float t = decode(num_tasks);
-
-	printf("coefficient decoder kernel consumption: %f ms\n", t);
-	free(tasks);
-
-//	println_end(INFO);
+	return DeviceSuccess;
 }
 
-void CoefficientCoder::extract_cblks(type_tile *tile, std::list<type_codeblock *> &out_cblks)
-{
-	for(int i = 0; i < tile->parent_img->num_components; i++)
-	{
-		type_tile_comp *tile_comp = &(tile->tile_comp[i]);
-		for(int j = 0; j < tile_comp->num_rlvls; j++)
-		{
-			type_res_lvl *res_lvl = &(tile_comp->res_lvls[j]);
-			for(int k = 0; k < res_lvl->num_subbands; k++)
-			{
-				type_subband *sb = &(res_lvl->subbands[k]);
-				for(unsigned int l = 0; l < sb->num_cblks; l++)
-					out_cblks.push_back(&(sb->cblks[l]));
-			}
-		}
-	}
-}
-void CoefficientCoder::convert_to_decoding_task(EntropyCodingTaskInfo &task, type_codeblock &cblk, int& offset)
+/**
+ * @brief Decodes the code-blocks of a tile component into its coefficients.
+ * @return DeviceSuccess, otherwise the coefficients have been released
+ */
+tDeviceRC CoefficientCoder::decode_tile_comp(type_tile_comp *tile_comp)
 {
-	switch(cblk.parent_sb->orient)
-	{
-	case LL:
-	case LH:
-		task.subband = 0;
-		break;
-	case HL:
-		task.subband = 1;
-		break;
-	case HH:
-		task.subband = 2;
-		break;
-	}
-
-	task.width = cblk.width;
-	task.height = cblk.height;
-
-	task.nominalWidth = cblk.parent_sb->parent_res_lvl->parent_tile_comp->cblk_w;
-	task.nominalHeight = cblk.parent_sb->parent_res_lvl->parent_tile_comp->cblk_h;
-
-	cblk.d_coefficientsOffset = offset;
-	offset += task.nominalWidth * task.nominalHeight;
+//	println_start(INFO);
 
-	task.magbits = cblk.parent_sb->mag_bits;
+	decodeInit(tile_comp);
+	tDeviceRC err = decode(tile_comp->num_cblks);
+	if (err != DeviceSuccess) {
+		// nothing will dequantize them
+		ResourceCounters::releaseBuffer((cl_mem)tile_comp->coefficients);
+		tile_comp->coefficients = NULL;
+	}
 
-	task.codestream = cblk.codestream;
-	task.length = cblk.length;
-	task.significantBits = cblk.significant_bits;
+//	println_end(INFO);
+	return err;
 }
 
-
-void CoefficientCoder::decodeInit(EntropyCodingTaskInfo *infos, int count, void** coefficients)
+/**
+ * @brief Stages the code-blocks of a tile component and allocates its coefficients.
+ *
+ * The geometry of the code-block infos was laid out with the image tree, see init_code_block_infos,
+ * so only the codestreams, their lengths and significant bits are filled in here.
+ */
+void CoefficientCoder::decodeInit(type_tile_comp *tile_comp)
 {
     cl_int err = CL_SUCCESS;
 
-	int codeBlocks = count;
+	int codeBlocks = tile_comp->num_cblks;
 	int maxOutLength = MAX_CODESTREAM_SIZE;
+	size_t coefficientsOffset = tile_comp->coefficients_size;
+	size_t magconOffset = tile_comp->state_size;
+
+	// stage codestreams and infos in pinned host memory, or in memory the kernel reads directly
+	if (useSVM) {
+		h_codestreamBuffers = (unsigned char*)SharedMemory::alloc(context, codeBlocks * maxOutLength);
+		h_infos = (CodeBlockAdditionalInfo *)SharedMemory::alloc(context, sizeof(CodeBlockAdditionalInfo) * codeBlocks);
+	} else {
+		h_codestreamBuffers = (unsigned char*)staging->acquire(queue, codeBlocks * maxOutLength);
+		h_infos = (CodeBlockAdditionalInfo *)staging->acquire(queue, sizeof(CodeBlockAdditionalInfo) * codeBlocks);
+	}
 
-    // execute kernel
-	cl_uint dev_alignment = requiredOpenCLAlignment(device);
-
-	// allocate codestream buffer on host
-	h_codestreamBuffers = (unsigned char*)aligned_malloc(codeBlocks * maxOutLength,dev_alignment);
-    if (h_codestreamBuffers == NULL)
-        throw Error("Failed to create h_codestreamBuffer Buffer!");
-
-
-	// allocate h_infos on host
-	h_infos = (CodeBlockAdditionalInfo *) aligned_malloc(sizeof(CodeBlockAdditionalInfo) * codeBlocks,dev_alignment);
-	   if (h_infos == NULL)
-        throw Error("Failed to create h_infos Buffer!");
-
-    //initialize h_infos
-	int magconOffset = 0;
-	int coefficientsOffset = 0;
-	for(int i = 0; i < codeBlocks; i++)
+    //initialize h_infos from the tree's template
+	TraceSpan span("stage code-blocks");
+	memcpy(h_infos, tile_comp->cblk_infos, sizeof(CodeBlockAdditionalInfo) * codeBlocks);
+	int i = 0;
+	for(int j = 0; j < tile_comp->num_rlvls; j++)
 	{
-		h_infos[i].width = infos[i].width;
-		h_infos[i].height = infos[i].height;
-		h_infos[i].nominalWidth = infos[i].nominalWidth;
-		h_infos[i].nominalHeight = infos[i].nominalHeight;
-		h_infos[i].stripeNo = ceil(infos[i].height / 4.0f);
-		h_infos[i].subband = infos[i].subband;
-		h_infos[i].magconOffset = magconOffset + infos[i].width;
-		h_infos[i].magbits = infos[i].magbits;
-		h_infos[i].length = infos[i].length;
-		h_infos[i].significantBits = infos[i].significantBits;
-		h_infos[i].d_coefficientsOffset = coefficientsOffset;
-		coefficientsOffset +=  infos[i].nominalWidth * infos[i].nominalHeight;
-
-	    //copy each code block codestream buffer to host memory block
-		memcpy(h_codestreamBuffers + i * maxOutLength, infos[i].codestream, infos[i].length);
-		magconOffset += h_infos[i].width * (h_infos[i].stripeNo + 2);
+		type_res_lvl *res_lvl = &(tile_comp->res_lvls[j]);
+		for(int k = 0; k < res_lvl->num_subbands; k++)
+		{
+			type_subband *sb = &(res_lvl->subbands[k]);
+			for(unsigned int l = 0; l < sb->num_cblks; l++, i++)
+			{
+				type_codeblock *cblk = &(sb->cblks[l]);
+				h_infos[i].length = cblk->length;
+				h_infos[i].significantBits = cblk->significant_bits;
+
+				//copy each code block codestream buffer to host memory block
+				memcpy(h_codestreamBuffers + i * maxOutLength, cblk->codestream, cblk->length);
+			}
+		}
 	}
 
 	//allocate d_coefficients on device
@@ -186,68 +151,112 @@ void CoefficientCoder::decodeInit(EntropyCodingTaskInfo *infos, int count, void*
     SAMPLE_CHECK_ERRORS(err);
     if (d_decodedCoefficientsBuffers == (cl_mem)0)
         throw Error("Failed to create d_decodedCoefficientsBuffers Buffer!");
+	ResourceCounters::bufferCreated(d_decodedCoefficientsBuffers);
 
-	//allocate d_codestreamBuffer on device and pin to host memory
-	d_codestreamBuffers = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, codeBlocks * maxOutLength, h_codestreamBuffers, &err);
-    SAMPLE_CHECK_ERRORS(err);
-    if (d_codestreamBuffers == (cl_mem)0)
-        throw Error("Failed to create d_codestreamBuffers Buffer!");
+	//allocate d_codestreamBuffer on device and upload the staged codestreams
+	if (!useSVM) {
+		d_codestreamBuffers = clCreateBuffer(context, CL_MEM_READ_ONLY, codeBlocks * maxOutLength, NULL, &err);
+		SAMPLE_CHECK_ERRORS(err);
+		if (d_codestreamBuffers == (cl_mem)0)
+			throw Error("Failed to create d_codestreamBuffers Buffer!");
+		ResourceCounters::bufferCreated(d_codestreamBuffers);
+		err = staging->upload(queue, h_codestreamBuffers, d_codestreamBuffers, codeBlocks * maxOutLength);
+		SAMPLE_CHECK_ERRORS(err);
+		h_codestreamBuffers = NULL;
+	}
 
 	//allocate d_stBuffers on device and initialize it to zero
 	d_stBuffers = clCreateBuffer(context, CL_MEM_READ_WRITE ,  sizeof(unsigned int) * magconOffset, NULL, &err);
     SAMPLE_CHECK_ERRORS(err);
     if (d_stBuffers == (cl_mem)0)
         throw Error("Failed to create d_infos Buffer!");
+	ResourceCounters::bufferCreated(d_stBuffers);
 	cl_int pattern = 0;
-	clEnqueueFillBuffer(queue, d_stBuffers, &pattern, sizeof(cl_int), 0, sizeof(unsigned int) * magconOffset, 0, NULL, NULL);
-
-    //allocate d_infos on device and pin to host memory
-	d_infos = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,  sizeof(CodeBlockAdditionalInfo) * codeBlocks, h_infos, &err);
+	cl_event traceEvent;
+	err = clEnqueueFillBuffer(queue, d_stBuffers, &pattern, sizeof(cl_int), 0, sizeof(unsigned int) * magconOffset, 0, NULL, Tracer::event(&traceEvent));
     SAMPLE_CHECK_ERRORS(err);
-    if (d_infos == (cl_mem)0)
-        throw Error("Failed to create d_infos Buffer!");
+	Tracer::device(traceEvent, "fill state buffer");
+	ResourceCounters::add(COUNTER_FILLS);
+	ResourceCounters::add(COUNTER_FILL_BYTES, sizeof(unsigned int) * magconOffset);
+
+    //allocate d_infos on device and upload the staged infos
+	if (!useSVM) {
+		d_infos = clCreateBuffer(context, CL_MEM_READ_ONLY,  sizeof(CodeBlockAdditionalInfo) * codeBlocks, NULL, &err);
+		SAMPLE_CHECK_ERRORS(err);
+		if (d_infos == (cl_mem)0)
+			throw Error("Failed to create d_infos Buffer!");
+		ResourceCounters::bufferCreated(d_infos);
+		err = staging->upload(queue, h_infos, d_infos, sizeof(CodeBlockAdditionalInfo) * codeBlocks);
+		SAMPLE_CHECK_ERRORS(err);
+		h_infos = NULL;
+	}
 
-	*coefficients = d_decodedCoefficientsBuffers;
+	tile_comp->coefficients = d_decodedCoefficientsBuffers;
 
 }
 
-float CoefficientCoder::decode(int codeBlocks)
+/**
+ * @brief Enqueues the Tier-1 kernel and releases the staged code-blocks, also if that fails.
+ * The decoded coefficients buffer is handed over to the tile component.
+ */
+tDeviceRC CoefficientCoder::decode(int codeBlocks)
 {
-    cl_int err = CL_SUCCESS;
-
 	int maxOutLength = MAX_CODESTREAM_SIZE;
 
 	int argNum = 0;
-	err = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem),  &d_stBuffers);
-    SAMPLE_CHECK_ERRORS(err);
-	
-	err = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_codestreamBuffers);
-    SAMPLE_CHECK_ERRORS(err);
-	
-	err = clSetKernelArg(myKernel, argNum++, sizeof(int),  &maxOutLength);
-    SAMPLE_CHECK_ERRORS(err);
-
-	err = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_infos);
-    SAMPLE_CHECK_ERRORS(err);
-
-	err = clSetKernelArg(myKernel, argNum++, sizeof(int),  &codeBlocks);
-    SAMPLE_CHECK_ERRORS(err);
-
-	err = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_decodedCoefficientsBuffers);
-    SAMPLE_CHECK_ERRORS(err);
+	cl_int kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem),  &d_stBuffers);
+	if (CL_SUCCESS == kernelErr) {
+		if (useSVM)
+			kernelErr = SharedMemory::setKernelArg(myKernel, argNum++, h_codestreamBuffers);
+		else
+			kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_codestreamBuffers);
+	}
+	if (CL_SUCCESS == kernelErr)
+		kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(int),  &maxOutLength);
+	if (CL_SUCCESS == kernelErr) {
+		if (useSVM)
+			kernelErr = SharedMemory::setKernelArg(myKernel, argNum++, h_infos);
+		else
+			kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_infos);
+	}
+	if (CL_SUCCESS == kernelErr)
+		kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(int),  &codeBlocks);
+	if (CL_SUCCESS == kernelErr)
+		kernelErr = clSetKernelArg(myKernel, argNum++, sizeof(cl_mem), &d_decodedCoefficientsBuffers);
+
+	if (CL_SUCCESS == kernelErr) {
+		const int THREADS = 4;
+		int groups = (int) ceil((float) codeBlocks / THREADS);
+
+		size_t global_work_size[1] = {(size_t)groups * THREADS};
+		size_t local_work_size[1] = {THREADS};
+		// execute kernel
+		kernelErr = enqueue(1, global_work_size, local_work_size);
+	}
+	if (CL_SUCCESS != kernelErr)
+		LogError("Error: coefficient decoder kernel returned %s.\n", TranslateOpenCLError(kernelErr));
 
-	double t1 = time_stamp();
-	const int THREADS = 4;
-	int groups = (int) ceil((float) codeBlocks / THREADS);
-	
-	size_t global_work_size[1] = {groups * THREADS};
-	size_t local_work_size[1] = {THREADS};
-    // execute kernel
-	err =  enqueue(1, global_work_size, local_work_size); 
+	// the runtime keeps these alive until the kernel completes
+	cl_int err = ResourceCounters::releaseBuffer(d_stBuffers);
     SAMPLE_CHECK_ERRORS(err);
+	if (useSVM) {
+		// freed by the queue once the kernel has completed
+		void* shared[2] = { h_codestreamBuffers, h_infos };
+		err = SharedMemory::freeAfter(queue, 2, shared);
+		SAMPLE_CHECK_ERRORS(err);
+		h_codestreamBuffers = NULL;
+		h_infos = NULL;
+	} else {
+		err = ResourceCounters::releaseBuffer(d_codestreamBuffers);
+		SAMPLE_CHECK_ERRORS(err);
+		err = ResourceCounters::releaseBuffer(d_infos);
+		SAMPLE_CHECK_ERRORS(err);
+	}
+	d_stBuffers = 0;
+	d_codestreamBuffers = 0;
+	d_infos = 0;
+	d_decodedCoefficientsBuffers = 0;
 
-	double t2 = time_stamp();
-	return (t2 - t1)* 1000;
-
+	return kernelErr;
 }
 
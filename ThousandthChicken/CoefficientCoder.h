@@ -2,7 +2,9 @@
 
 #pragma once
 #include "DeviceKernel.h"
-#include <list>
+#include "StagingRing.h"
+#include "SharedMemory.h"
+#include <vector>
 #include "codestream_image.h"
 
 #define MAX_CODESTREAM_SIZE (4096 * 4) /// TODO: figure out
@@ -11,41 +13,17 @@
 #define HL_SUBBAND		1
 #define HH_SUBBAND		2
 
-typedef struct _CodeBlockAdditionalInfo CodeBlockAdditionalInfo;
-
-
-typedef struct
-{
-	int significantBits;
-	int codingPasses;
-	int subband;
-	int width;
-	int height;
-
-	int nominalWidth;
-	int nominalHeight;
-
-	int magbits;
-	int compType;
-	int dwtLevel;
-	float stepSize;
-
-	unsigned char *codestream;
-	int length;
-	type_codeblock *cblk;
-} EntropyCodingTaskInfo;
 
 class CoefficientCoder : 	public DeviceKernel
 {
 public:
 	CoefficientCoder(KernelInitInfoBase initInfo);
 	virtual ~CoefficientCoder(void);
-	void decode_tile(type_tile *tile);
+	tDeviceRC decode_tile(type_tile *tile);
+	tDeviceRC decode_tile_comp(type_tile_comp *tile_comp);
 private:
-	void decodeInit(EntropyCodingTaskInfo *infos, int count, void** coefficients);
-	float decode(int codeBlocks);
-	void convert_to_decoding_task(EntropyCodingTaskInfo &task, type_codeblock &cblk, int& offset);
-	void extract_cblks(type_tile *tile, std::list<type_codeblock *> &out_cblks);
+	void decodeInit(type_tile_comp *tile_comp);
+	tDeviceRC decode(int codeBlocks);
 
 	unsigned char* h_codestreamBuffers;
 	CodeBlockAdditionalInfo *h_infos;
@@ -54,5 +32,10 @@ private:
 	cl_mem d_stBuffers;
 	cl_mem d_infos;
 
+	// pinned buffers the code-blocks and their infos are uploaded through
+	StagingRing* staging;
+	// code-blocks and infos are written straight into shared virtual memory instead
+	bool useSVM;
+
 };
 
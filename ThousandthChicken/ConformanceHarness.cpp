@@ -0,0 +1,386 @@
+// License: please see LICENSE1 file for more details.
+
+#include "ConformanceHarness.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "ResourceCounters.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+
+// Starts a new peak memory measurement where the platform allows it
+static void resetPeakMemory()
+{
+#ifdef __linux__
+	// writing 5 to clear_refs resets the peak resident set size (VmHWM)
+	FILE* fp = fopen("/proc/self/clear_refs", "w");
+	if (fp) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+#endif
+}
+
+// Peak resident memory of the process in KB, 0 if unknown
+static unsigned long long peakMemoryKB()
+{
+#if defined(_WIN32) || defined(WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / 1024;
+	return 0;
+#elif defined(__linux__)
+	unsigned long long peak = 0;
+	char line[256];
+	FILE* fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "VmHWM: %llu kB", &peak) == 1)
+			break;
+	}
+	fclose(fp);
+	return peak;
+#else
+	return 0;
+#endif
+}
+
+static std::string baseName(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// 64 bit FNV-1a over the image geometry and samples
+static unsigned long long imageChecksum(const DecodedImage& image)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned int header[3] = { image.width, image.height, image.numComponents };
+	const unsigned char* bytes = (const unsigned char*)header;
+	for (size_t i = 0; i < sizeof(header); ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	bytes = (const unsigned char*)image.data;
+	size_t size = (size_t)image.width * image.height * image.numComponents * sizeof(int);
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// Value of "key": "value" in a single line JSON object, empty if absent
+static std::string jsonString(const char* line, const char* key)
+{
+	std::string pattern = std::string("\"") + key + "\": \"";
+	const char* p = strstr(line, pattern.c_str());
+	if (!p)
+		return "";
+	p += pattern.size();
+	const char* end = strchr(p, '"');
+	return end ? std::string(p, end) : "";
+}
+
+// Value of "key": number in a single line JSON object, -1 if absent
+static double jsonNumber(const char* line, const char* key)
+{
+	std::string pattern = std::string("\"") + key + "\": ";
+	const char* p = strstr(line, pattern.c_str());
+	return p ? atof(p + pattern.size()) : -1;
+}
+
+
+ConformanceHarness::ConformanceHarness(ocl_args_d_t* ocl, int iterations, double tolerancePercent) :
+									  ocl(ocl),
+									  decoder(ocl),
+									  stages(ocl, 1),
+									  iterations(iterations < 1 ? 1 : iterations),
+									  tolerance(tolerancePercent)
+{
+}
+
+
+ConformanceHarness::~ConformanceHarness(void)
+{
+}
+
+/**
+ * @brief Reads reference checksums, one "<checksum> <name>" line per file.
+ * @return number of references read, -1 if the file cannot be opened
+ */
+int ConformanceHarness::loadReferences(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "r");
+	if (!fp)
+		return -1;
+	char line[1024];
+	char name[1024];
+	unsigned long long checksum;
+	int count = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%llx %1023s", &checksum, name) == 2) {
+			references[name] = checksum;
+			count++;
+		}
+	}
+	fclose(fp);
+	return count;
+}
+
+/**
+ * @brief Reads a baseline written by writeBaseline.
+ * @return number of files in the baseline, -1 if the file cannot be opened
+ */
+int ConformanceHarness::loadBaseline(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "r");
+	if (!fp)
+		return -1;
+	char line[4096];
+	int count = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		std::string name = jsonString(line, "name");
+		if (name.empty())
+			continue;
+		Baseline b;
+		b.decodeMs = jsonNumber(line, "decode_ms");
+		b.peakKB = (unsigned long long)jsonNumber(line, "peak_kb");
+		baseline[name] = b;
+		count++;
+	}
+	fclose(fp);
+	return count;
+}
+
+void ConformanceHarness::check(ConformanceResult& result)
+{
+	char message[256];
+	if (!result.decoded) {
+		result.failure = "decode failed";
+		return;
+	}
+
+	std::map<std::string, unsigned long long>::iterator ref = references.find(result.name);
+	if (ref != references.end() && ref->second != result.checksum) {
+		sprintf(message, "checksum %016llx, reference %016llx", result.checksum, ref->second);
+		result.failure = message;
+		return;
+	}
+
+	std::map<std::string, Baseline>::iterator base = baseline.find(result.name);
+	if (base == baseline.end())
+		return;
+	double limit = 1.0 + tolerance / 100.0;
+	if (base->second.decodeMs > 0 && result.decodeMs > base->second.decodeMs * limit) {
+		sprintf(message, "decode %.2f ms, baseline %.2f ms (+%.1f%%)", result.decodeMs, base->second.decodeMs,
+			(result.decodeMs / base->second.decodeMs - 1.0) * 100.0);
+		result.failure = message;
+	} else if (base->second.peakKB > 0 && result.peakKB > base->second.peakKB * limit) {
+		sprintf(message, "peak memory %llu KB, baseline %llu KB (+%.1f%%)", result.peakKB, base->second.peakKB,
+			((double)result.peakKB / base->second.peakKB - 1.0) * 100.0);
+		result.failure = message;
+	}
+}
+
+/**
+ * @brief Decodes every file, keeping the fastest of the timed decodes, then decodes it once
+ * more stage by stage for the breakdown.
+ * @return number of files that failed
+ */
+int ConformanceHarness::run(const std::vector<std::string>& fileNames)
+{
+	int failures = 0;
+	for (size_t i = 0; i < fileNames.size(); ++i) {
+		ConformanceResult result;
+		result.name = baseName(fileNames[i]);
+		result.decoded = true;
+		result.checksum = 0;
+		result.decodeMs = 0;
+
+		resetPeakMemory();
+		for (int it = 0; it < iterations; ++it) {
+			DecodedImage image;
+			double t1 = time_stamp();
+			int rc = decoder.decode(fileNames[i], &image);
+			double ms = (time_stamp() - t1) * 1000;
+			if (rc != 0) {
+				result.decoded = false;
+				break;
+			}
+			if (it == 0 || ms < result.decodeMs)
+				result.decodeMs = ms;
+			result.checksum = imageChecksum(image);
+		}
+		result.peakKB = peakMemoryKB();
+
+		size_t first = stages.getResults().size();
+		if (result.decoded && stages.runFile(fileNames[i]) == 0) {
+			const std::vector<StageResult>& r = stages.getResults();
+			for (size_t s = first; s < r.size(); ++s)
+				result.stages.push_back(std::make_pair(r[s].stage, r[s].seconds * 1000));
+		}
+
+		check(result);
+		if (!result.failure.empty())
+			failures++;
+		results.push_back(result);
+	}
+	return failures;
+}
+
+/**
+ * @brief Inverse transforms numComponents equally sized components once batched through a tile
+ * buffer, with the components as far apart as the decoder places them, and once component by
+ * component, with both wavelets, and compares the results.
+ *
+ * Sizes that are not a power of two put the components at a distance that is no multiple of
+ * the width of the lower levels, which is what breaks a 3D copy of the LL bands.
+ * @return number of wavelets whose batched transform failed or differs
+ */
+int ConformanceHarness::checkBatchedDWT(unsigned int width, unsigned int height, unsigned short numComponents, unsigned char levels)
+{
+	KernelSet set(KernelInitInfoBase(ocl->commandQueue, "-I ./"));
+	size_t alignment = requiredOpenCLAlignment(ocl->device) / sizeof(int);
+	if (alignment == 0)
+		alignment = 1;
+	size_t samples = (size_t)width * height;
+	size_t stride = (samples + alignment - 1) / alignment * alignment;
+	size_t total = stride * numComponents;
+
+	// small integers, exact as floats for the 9/7 wavelet as well
+	std::vector<int> coefficients(total);
+	unsigned int seed = 1;
+	for (size_t i = 0; i < total; ++i) {
+		seed = seed * 1103515245 + 12345;
+		coefficients[i] = (int)((seed >> 16) & 0xff) - 128;
+	}
+
+	int failures = 0;
+	for (unsigned char wavelet = 0; wavelet < 2; ++wavelet) {
+		std::vector<int> input(coefficients);
+		if (wavelet) {
+			for (size_t i = 0; i < total; ++i) {
+				float value = (float)coefficients[i];
+				memcpy(&input[i], &value, sizeof(value));
+			}
+		}
+
+		type_image img;
+		memset(&img, 0, sizeof(img));
+		img.num_components = numComponents;
+		img.wavelet_type = wavelet;
+		type_tile tile;
+		memset(&tile, 0, sizeof(tile));
+		tile.parent_img = &img;
+		std::vector<type_tile_comp> comps(numComponents);
+		memset(&comps[0], 0, numComponents * sizeof(type_tile_comp));
+		tile.tile_comp = &comps[0];
+		for (unsigned short c = 0; c < numComponents; ++c) {
+			comps[c].parent_tile = &tile;
+			comps[c].tile_comp_no = c;
+			comps[c].width = width;
+			comps[c].height = height;
+			comps[c].num_dlvls = levels;
+			comps[c].img_data_offset = (unsigned int)(c * stride);
+		}
+
+		// all components batched through one tile buffer
+		cl_int err = CL_SUCCESS;
+		std::vector<int> batched(total), single(total);
+		cl_mem data = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, total * sizeof(int), &input[0], &err);
+		SAMPLE_CHECK_ERRORS(err);
+		ResourceCounters::bufferCreated(data);
+		tile.img_data_d = data;
+		tDeviceRC rc = set.dwt->iwt(&tile);
+		if (rc == DeviceSuccess)
+			rc = clEnqueueReadBuffer(set.getQueue(), data, CL_TRUE, 0, total * sizeof(int), &batched[0], 0, NULL, NULL);
+		ResourceCounters::releaseBuffer(data);
+
+		// the same components one by one, each in a buffer of its own
+		tile.img_data_d = NULL;
+		for (unsigned short c = 0; c < numComponents; ++c) {
+			data = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, samples * sizeof(int), &input[c * stride], &err);
+			SAMPLE_CHECK_ERRORS(err);
+			ResourceCounters::bufferCreated(data);
+			comps[c].img_data_d = data;
+		}
+		if (rc == DeviceSuccess)
+			rc = set.dwt->iwt(&tile);
+		for (unsigned short c = 0; c < numComponents; ++c) {
+			if (rc == DeviceSuccess)
+				rc = clEnqueueReadBuffer(set.getQueue(), (cl_mem)comps[c].img_data_d, CL_TRUE, 0, samples * sizeof(int), &single[c * stride], 0, NULL, NULL);
+			ResourceCounters::releaseBuffer((cl_mem)comps[c].img_data_d);
+		}
+
+		const char* name = wavelet ? "9/7" : "5/3";
+		if (rc != DeviceSuccess) {
+			LogError("Error: %s inverse DWT of %u components of %ux%u failed: %s\n", name, numComponents, width, height, TranslateOpenCLError(rc));
+			failures++;
+			continue;
+		}
+		for (unsigned short c = 0; c < numComponents; ++c) {
+			if (memcmp(&batched[c * stride], &single[c * stride], samples * sizeof(int))) {
+				LogError("Error: batched %s inverse DWT of %ux%u differs in component %u of %u\n", name, width, height, c, numComponents);
+				failures++;
+				break;
+			}
+		}
+	}
+	return failures;
+}
+
+int ConformanceHarness::writeReferences(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "w");
+	if (!fp) {
+		LogError("Error: cannot write %s\n", fileName.c_str());
+		return -1;
+	}
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (results[i].decoded)
+			fprintf(fp, "%016llx %s\n", results[i].checksum, results[i].name.c_str());
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * @brief Writes the results as JSON with one file object per line, which is what loadBaseline reads.
+ */
+int ConformanceHarness::writeBaseline(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "w");
+	if (!fp) {
+		LogError("Error: cannot write %s\n", fileName.c_str());
+		return -1;
+	}
+	fprintf(fp, "{\n\"files\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const ConformanceResult& r = results[i];
+		fprintf(fp, "  {\"name\": \"%s\", \"checksum\": \"%016llx\", \"decode_ms\": %.3f, \"peak_kb\": %llu, \"stages\": {",
+			r.name.c_str(), r.checksum, r.decodeMs, r.peakKB);
+		for (size_t s = 0; s < r.stages.size(); ++s)
+			fprintf(fp, "%s\"%s\": %.3f", s ? ", " : "", r.stages[s].first.c_str(), r.stages[s].second);
+		fprintf(fp, "}}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "]\n}\n");
+	fclose(fp);
+	return 0;
+}
+
+void ConformanceHarness::print()
+{
+	printf("\n%-32s %16s %12s %12s  %s\n", "file", "checksum", "decode ms", "peak KB", "result");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const ConformanceResult& r = results[i];
+		printf("%-32s %016llx %12.2f %12llu  %s\n", r.name.c_str(), r.checksum, r.decodeMs, r.peakKB,
+			r.failure.empty() ? "ok" : r.failure.c_str());
+		for (size_t s = 0; s < r.stages.size(); ++s)
+			printf("    %-12s %10.3f ms\n", r.stages[s].first.c_str(), r.stages[s].second);
+	}
+}
@@ -0,0 +1,69 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "Decoder.h"
+#include "StageBenchmark.h"
+#include <map>
+#include <string>
+#include <vector>
+
+struct ocl_args_d_t;
+
+/** @brief Outcome of decoding one corpus file */
+struct ConformanceResult
+{
+	/** File name without directory, the key into references and baselines */
+	std::string name;
+	bool decoded;
+	/** FNV-1a hash of the image size and all decoded samples */
+	unsigned long long checksum;
+	/** Fastest of the timed decodes, in milliseconds */
+	double decodeMs;
+	/** Peak resident memory of the process while decoding the file, in KB */
+	unsigned long long peakKB;
+	/** Per-stage times in milliseconds, in StageBenchmark order */
+	std::vector<std::pair<std::string, double> > stages;
+	/** Why the file failed, empty if it passed */
+	std::string failure;
+};
+
+/**
+ * @brief Decodes a corpus and checks every file against reference checksums and a timing baseline.
+ *
+ * References are text lines "<checksum> <name>", as written by writeReferences. Baselines are the
+ * JSON written by writeBaseline; a file fails if its decode time or peak memory exceeds the
+ * baseline by more than the tolerance, or if its checksum differs from the reference.
+ */
+class ConformanceHarness
+{
+public:
+	ConformanceHarness(ocl_args_d_t* ocl, int iterations = 3, double tolerancePercent = 10.0);
+	~ConformanceHarness(void);
+	int loadReferences(const std::string& fileName);
+	int loadBaseline(const std::string& fileName);
+	int run(const std::vector<std::string>& fileNames);
+	int checkBatchedDWT(unsigned int width, unsigned int height, unsigned short numComponents, unsigned char levels);
+	int writeReferences(const std::string& fileName);
+	int writeBaseline(const std::string& fileName);
+	void print();
+	const std::vector<ConformanceResult>& getResults() { return results; }
+
+private:
+	struct Baseline
+	{
+		double decodeMs;
+		unsigned long long peakKB;
+	};
+
+	void check(ConformanceResult& result);
+
+	ocl_args_d_t* ocl;
+	Decoder decoder;
+	StageBenchmark stages;
+	int iterations;
+	double tolerance;
+	std::map<std::string, unsigned long long> references;
+	std::map<std::string, Baseline> baseline;
+	std::vector<ConformanceResult> results;
+};
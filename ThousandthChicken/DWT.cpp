@@ -1,9 +1,13 @@
 // License: please see LICENSE4 file for more details.
 
 #include "DWT.h"
+#include "DWTKernel.cpp"
 #include "basic.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
 #include <math.h>
 #include <malloc.h>
+#include <string.h>
 
 
 #define DWT53	0
@@ -18,8 +22,6 @@ DWT::DWT(KernelInitInfoBase initInfo) : initInfo(initInfo)
 	r53 = new DWTReverse53(initInfo);
 	f97 = new DWTForward97(initInfo);
 	r97 = new DWTReverse97(initInfo);
-
-	memset(d_idata, 0, 256 * sizeof(tDeviceMem));
 }
 
 
@@ -33,83 +35,149 @@ DWT::~DWT(void)
 		delete f97;
 	if (r97)
 		delete r97;
-
-	for (int i = 0; i < 256; ++i) {
-		cl_int err = clReleaseMemObject((cl_mem)d_idata[i]);
-		SAMPLE_CHECK_ERRORS(err);
-	}
 }
 
 
-
 /**
- * @brief Perform the inverse wavelet transform on a 2D matrix
- *
- * We assume that top left coordinates u0 and v0 input tile matrix are both even.See Annex F of ISO/EIC IS 15444-1.
+ * @brief Creates a zeroed buffer for the output of the transform passes.
  *
- * @param filter Kind of wavelet 53 | 97.
- * @param d_idata Input array.
- * @param d_odata Output array.
- * @param img_size Input image size.
- * @param step Output image size.
- * @param nlevels Number of levels.
+ * The caller releases it once the transform has been enqueued; the runtime keeps it alive until then.
  */
-tDeviceMem DWT::iwt_2d(short filter, type_tile_comp *tile_comp) {
-	/* Input data */
-	d_idata[tile_comp->tile_comp_no] = (tDeviceMem)tile_comp->img_data_d;
-	/* Result data */
-
-	int dataSize = tile_comp->parent_tile->parent_img->wavelet_type ? sizeof(type_data) : sizeof(int);
-
-	/* Image data size */
-	const unsigned int smem_size = dataSize * tile_comp->width * tile_comp->height;
-	
-    cl_int err = CL_SUCCESS;
+cl_mem DWT::createScratch(size_t bytes)
+{
+	cl_int err = CL_SUCCESS;
 	cl_context context  = NULL;
 
-    // Obtaing the OpenCL context from the command-queue properties
+	// Obtaing the OpenCL context from the command-queue properties
 	err = clGetCommandQueueInfo(initInfo.cmd_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+	SAMPLE_CHECK_ERRORS(err);
+
+	cl_mem scratch = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	if (scratch == (cl_mem)0)
+		throw Error("Failed to create idwt output Buffer!");
+	ResourceCounters::bufferCreated(scratch);
+	cl_int pattern = 0;
+	cl_event traceEvent;
+	err = clEnqueueFillBuffer(initInfo.cmd_queue, scratch, &pattern, sizeof(pattern), 0, bytes, 0, NULL, Tracer::event(&traceEvent));
+	SAMPLE_CHECK_ERRORS(err);
+	Tracer::device(traceEvent, "fill idwt output");
+	ResourceCounters::add(COUNTER_FILLS);
+	ResourceCounters::add(COUNTER_FILL_BYTES, bytes);
+	return scratch;
+}
+
+/**
+ * @brief Copies the transformed samples back, so later stages find them where the coefficients were.
+ */
+tDeviceRC DWT::copyBack(cl_mem scratch, cl_mem data, size_t bytes)
+{
+	cl_event traceEvent;
+	cl_int err = clEnqueueCopyBuffer(initInfo.cmd_queue, scratch, data, 0, 0, bytes, 0, NULL, Tracer::event(&traceEvent));
 	if (CL_SUCCESS != err)
 	{
-		LogError("Error: clGetCommandQueueInfo (CL_QUEUE_CONTEXT) returned %s.\n", TranslateOpenCLError(err));
-		return 0;
+		LogError("Error: clEnqueueCopyBuffer (idwt output) returned %s.\n", TranslateOpenCLError(err));
+		return err;
 	}
+	Tracer::device(traceEvent, "copy idwt output");
+	ResourceCounters::add(COUNTER_COPIES);
+	ResourceCounters::add(COUNTER_COPY_BYTES, bytes);
+	return err;
+}
 
-	//allocate d_odata on device and initialize it to zero
-	cl_mem d_odata = clCreateBuffer(context, CL_MEM_READ_WRITE ,  smem_size, NULL, &err);
-    SAMPLE_CHECK_ERRORS(err);
-    if (d_odata == (cl_mem)0)
-        throw Error("Failed to create d_odata Buffer!");
-	cl_int pattern = 0;
-	clEnqueueFillBuffer(initInfo.cmd_queue, d_odata, &pattern, dataSize, 0, smem_size, 0, NULL, NULL);
+/**
+ * @brief Perform the inverse wavelet transform on count equally sized 2D matrices
+ *
+ * We assume that top left coordinates u0 and v0 input tile matrix are both even.See Annex F of ISO/EIC IS 15444-1.
+ * The matrices are stride samples apart and form the third dimension of every launch, so the
+ * number of launches depends on the number of levels only.
+ *
+ * @param filter Kind of wavelet 53 | 97.
+ * @param data Input array; overwritten by the passes.
+ * @param scratch Output array, laid out like data.
+ * @param first First tile component of the batch, gives size and number of levels.
+ * @param offset Start of the first matrix, in samples.
+ * @param count Number of matrices.
+ * @param stride Distance between matrices, in samples.
+ */
+tDeviceRC DWT::iwt_batch(short filter, cl_mem data, cl_mem scratch, type_tile_comp *first, int offset, int count, int stride) {
 	switch(filter)
 	{
 		case DWT97:
-			r97->run(d_idata[tile_comp->tile_comp_no] , d_odata, tile_comp->width, tile_comp->height, tile_comp->num_dlvls);
-			break;
+			return r97->run(data, scratch, first->width, first->height, first->num_dlvls, offset, count, stride);
 		case DWT53:
-			r53->run(d_idata[tile_comp->tile_comp_no] , d_odata, tile_comp->width, tile_comp->height, tile_comp->num_dlvls);
-			break;
+			return r53->run(data, scratch, first->width, first->height, first->num_dlvls, offset, count, stride);
 	}
-	tile_comp->img_data_d = d_odata;
-	return d_odata;
+	return CL_INVALID_VALUE;
 }
 
-void DWT::iwt(type_tile *tile)
+/**
+ * @brief Inverse wavelet transform of all components of a tile in place.
+ *
+ * Runs of consecutive components with the same size and number of levels are transformed
+ * together through the tile buffer, so a tile of equally sized components takes as many
+ * launches as a single component does.
+ */
+tDeviceRC DWT::iwt(type_tile *tile)
 {
-//	println_start(INFO);
-	int i;
-	type_tile_comp *tile_comp;
 	type_image *img = tile->parent_img;
+	short filter = img->wavelet_type ? DWT97 : DWT53;
+	cl_mem data = (cl_mem)tile->img_data_d;
+	tDeviceRC rc = DeviceSuccess;
+	if (!data) {
+		for (unsigned int i = 0; i < img->num_components && rc == DeviceSuccess; i++)
+			rc = iwt_tile_comp(tile->tile_comp + i);
+		return rc;
+	}
 
-	/* Process components from tile */
-	for(i = 0; i < tile->parent_img->num_components; i++)
-	{
-		tile_comp = &(tile->tile_comp[i]);
-		// error condition if null
-		if (!iwt_2d(img->wavelet_type ? DWT97 : DWT53, tile_comp))
-			return;
+	size_t bytes = 0;
+	cl_int err = clGetMemObjectInfo(data, CL_MEM_SIZE, sizeof(size_t), &bytes, NULL);
+	SAMPLE_CHECK_ERRORS(err);
+	cl_mem scratch = createScratch(bytes);
+
+	unsigned int i = 0;
+	while (i < img->num_components) {
+		type_tile_comp *first = tile->tile_comp + i;
+		unsigned int count = 1;
+		int stride = 0;
+		while (i + count < img->num_components) {
+			type_tile_comp *next = tile->tile_comp + i + count;
+			type_tile_comp *prev = next - 1;
+			int distance = (int)(next->img_data_offset - prev->img_data_offset);
+			if (next->width != first->width || next->height != first->height || next->num_dlvls != first->num_dlvls)
+				break;
+			if (count > 1 && distance != stride)
+				break;
+			stride = distance;
+			count++;
+		}
+		rc = iwt_batch(filter, data, scratch, first, (int)first->img_data_offset, count, stride);
+		if (rc != DeviceSuccess)
+			break;
+		i += count;
 	}
-//	println_end(INFO);
+
+	// a failed pass leaves the scratch buffer half transformed, the tile keeps its coefficients
+	if (rc == DeviceSuccess)
+		rc = copyBack(scratch, data, bytes);
+	err = ResourceCounters::releaseBuffer(scratch);
+	SAMPLE_CHECK_ERRORS(err);
+	return rc;
 }
 
+/**
+ * @brief Inverse wavelet transform of a single tile component in place.
+ */
+tDeviceRC DWT::iwt_tile_comp(type_tile_comp *tile_comp)
+{
+	type_image *img = tile_comp->parent_tile->parent_img;
+	cl_mem data = (cl_mem)tile_comp->img_data_d;
+	size_t bytes = (size_t)tile_comp->width * tile_comp->height * sizeof(int);
+	cl_mem scratch = createScratch(bytes);
+	tDeviceRC rc = iwt_batch(img->wavelet_type ? DWT97 : DWT53, data, scratch, tile_comp, 0, 1, 0);
+	if (rc == DeviceSuccess)
+		rc = copyBack(scratch, data, bytes);
+	cl_int err = ResourceCounters::releaseBuffer(scratch);
+	SAMPLE_CHECK_ERRORS(err);
+	return rc;
+}
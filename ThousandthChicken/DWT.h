@@ -16,10 +16,13 @@ class DWT
 public:
 	DWT(KernelInitInfoBase initInfo);
 	~DWT(void);
-	 void iwt(type_tile *tile);
+	 tDeviceRC iwt(type_tile *tile);
+	 tDeviceRC iwt_tile_comp(type_tile_comp *tile_comp);
 
 private:
-	tDeviceMem iwt_2d(short filter, type_tile_comp *tile_comp);
+	tDeviceRC iwt_batch(short filter, cl_mem data, cl_mem scratch, type_tile_comp *first, int offset, int count, int stride);
+	cl_mem createScratch(size_t bytes);
+	tDeviceRC copyBack(cl_mem scratch, cl_mem data, size_t bytes);
 
 
 private:
@@ -28,7 +31,6 @@ private:
 	DWTReverse53* r53;
 	DWTForward97* f97;
 	DWTReverse97* r97;
-	tDeviceMem  d_idata[256];
 
 };
 
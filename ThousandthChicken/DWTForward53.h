@@ -9,6 +9,6 @@ public:
 	DWTForward53(KernelInitInfoBase initInfo);
 	virtual ~DWTForward53(void);
 private:
-	void dwt(int sizeX, int sizeY, int levels) ;
+	tDeviceRC dwt(int sizeX, int sizeY, int levels) ;
 };
 
@@ -17,15 +17,18 @@ DWTForward97::~DWTForward97(void)
   /// @param sizeX   width of input image (in pixels)
   /// @param sizeY   height of input image (in pixels)
   /// @param levels  number of recursive DWT levels
-  void DWTForward97::dwt(  int sizeX, int sizeY, int levels) {
+  tDeviceRC DWTForward97::dwt(  int sizeX, int sizeY, int levels) {
   // select right width of kernel for the size of the image
+    tDeviceRC err;
     if(sizeX >= 960) {
-      enqueue(192, 8, sizeX, sizeY);
+      err = enqueue(192, 8, sizeX, sizeY);
     } else if (sizeX >= 480) {
-      enqueue(128, 6,sizeX, sizeY);
+      err = enqueue(128, 6,sizeX, sizeY);
     } else {
-      enqueue(64, 6,  sizeX, sizeY);
+      err = enqueue(64, 6,  sizeX, sizeY);
     }
+    if (err != DeviceSuccess)
+      return err;
     
     // if this was not the last level, continue recursively with other levels
     if(levels > 1) {
@@ -33,11 +36,12 @@ DWTForward97::~DWTForward97(void)
       const int llSizeX = divRndUp(sizeX, 2);
       const int llSizeY = divRndUp(sizeY, 2);
 	  
-	  tDeviceRC err = copyLLBandToSrc(llSizeX, llSizeY);
+	  err = copyLLBandToSrc(llSizeX, llSizeY);
 	  if (err != DeviceSuccess)
-		  return;  
+		  return err;  
       
       // run remaining levels of FDWT
-      dwt(llSizeX, llSizeY, levels - 1);
+      return dwt(llSizeX, llSizeY, levels - 1);
     }
+    return DeviceSuccess;
   }
\ No newline at end of file
@@ -9,6 +9,6 @@ public:
 	DWTForward97(KernelInitInfoBase initInfo);
 	virtual ~DWTForward97(void);
 private:
-	void dwt(int sizeX, int sizeY, int levels) ;
+	tDeviceRC dwt(int sizeX, int sizeY, int levels) ;
 };
 
@@ -3,6 +3,9 @@
 
 #include "DWTKernel.h"
 #include "dwt_common.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+#include <string.h>
 
 
 template <typename T> DWTKernel<T>::DWTKernel(int impulseDiameter, 
@@ -12,7 +15,12 @@ template <typename T> DWTKernel<T>::DWTKernel(int impulseDiameter,
 															dstMem(0),
 															dimX(0),
 															dimY(0),
+															offset(0),
+															slices(1),
+															sliceStride(0),
 															ownsMemory(false),
+															sharedSrc(NULL),
+															sharedDst(NULL),
 															waveletImpulseDiameter(impulseDiameter)
 {
 }
@@ -24,7 +32,7 @@ template <typename T> DWTKernel<T>::~DWTKernel(void)
 
 		// free memory on device
 		if (srcMem) {
-			error_code = clReleaseMemObject(srcMem);
+			error_code = ResourceCounters::releaseBuffer(srcMem);
 			if (CL_SUCCESS != error_code)
 			{
 				LogError("Error: clReleaseMemObject (input) returned %s.\n", TranslateOpenCLError(error_code));
@@ -32,12 +40,17 @@ template <typename T> DWTKernel<T>::~DWTKernel(void)
 		}
 
 		if (dstMem) {
-			error_code = clReleaseMemObject(dstMem);
+			error_code = ResourceCounters::releaseBuffer(dstMem);
 			if (CL_SUCCESS != error_code)
 			{
 				LogError("Error: clReleaseMemObject (output) returned %s.\n", TranslateOpenCLError(error_code));
 			}
 		}
+		if (sharedSrc || sharedDst) {
+			finish();
+			SharedMemory::free(context, sharedSrc);
+			SharedMemory::free(context, sharedDst);
+		}
 	}
 }
 
@@ -58,6 +71,18 @@ template <typename T> cl_int DWTKernel<T>::run(T* in, int sizeX, int sizeY, int
 		return error_code;
 	}
 
+	if (SharedMemory::supported(device)) {
+		// the kernels work on the shared copy in place and the output needs no map
+		size_t bytes = sizeX * sizeY * sizeof(T);
+		sharedSrc = (T*)SharedMemory::alloc(context, bytes);
+		sharedDst = (T*)SharedMemory::alloc(context, bytes);
+		memcpy(sharedSrc, in, bytes);
+		srcMem = SharedMemory::wrap(context, sharedSrc, bytes);
+		dstMem = SharedMemory::wrap(context, sharedDst, bytes);
+		ownsMemory = true;
+		return run(srcMem, dstMem, sizeX, sizeY, levels);
+	}
+
 	// allocate memory on device
 	srcMem = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeX * sizeY * sizeof(T), in, &error_code);
     if (CL_SUCCESS != error_code)
@@ -65,6 +90,9 @@ template <typename T> cl_int DWTKernel<T>::run(T* in, int sizeX, int sizeY, int
         LogError("Error: clCreateBuffer (in) returned %s.\n", TranslateOpenCLError(error_code));
         return error_code;
     }
+	ResourceCounters::bufferCreated(srcMem);
+	ResourceCounters::add(COUNTER_WRITES);
+	ResourceCounters::add(COUNTER_WRITE_BYTES, sizeX * sizeY * sizeof(T));
 
 	dstMem = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeX * sizeY * sizeof(T), NULL, &error_code);
     if (CL_SUCCESS != error_code)
@@ -72,9 +100,9 @@ template <typename T> cl_int DWTKernel<T>::run(T* in, int sizeX, int sizeY, int
         LogError("Error: clCreateBuffer (out) returned %s.\n", TranslateOpenCLError(error_code));
         return error_code;
     }
+	ResourceCounters::bufferCreated(dstMem);
 	ownsMemory = true;
-	run(srcMem, dstMem, sizeX, sizeY, levels);
-	return CL_SUCCESS;
+	return run(srcMem, dstMem, sizeX, sizeY, levels);
 }
 
 
@@ -86,16 +114,17 @@ template <typename T> cl_int DWTKernel<T>::run(T* in, int sizeX, int sizeY, int
   /// @param out      output buffer
   /// @param sx       width of the input image 
   /// @param sy       height of the input image
-template <typename T>  void DWTKernel<T>::enqueue (int WIN_SX, int WIN_SY, const int sx, const int sy) {
+template <typename T>  tDeviceRC DWTKernel<T>::enqueue (int WIN_SX, int WIN_SY, const int sx, const int sy) {
 
-	if (setWindowKernelArgs(WIN_SX, WIN_SY) != CL_SUCCESS)
-	  return;
+	cl_int error_code = setWindowKernelArgs(WIN_SX, WIN_SY);
+	if (CL_SUCCESS != error_code)
+	  return error_code;
 
-	cl_int error_code = setImageSizeKernelArgs(sx, sy);
+	error_code = setImageSizeKernelArgs(sx, sy);
 	if (CL_SUCCESS != error_code)
 	{
 		LogError("Error: setImageSizeKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
-		return;
+		return error_code;
 	}
 
 	// allocate local data 
@@ -106,7 +135,7 @@ template <typename T>  void DWTKernel<T>::enqueue (int WIN_SX, int WIN_SY, const
 	if (CL_SUCCESS != error_code)
 	{
 		LogError("Error: clSetKernelArg returned %s.\n", TranslateOpenCLError(error_code));
-		return;
+		return error_code;
 	}
 
 	// compute optimal number of steps of each sliding window
@@ -115,51 +144,71 @@ template <typename T>  void DWTKernel<T>::enqueue (int WIN_SX, int WIN_SY, const
 	if (CL_SUCCESS != error_code)
 	{
 		LogError("Error: clSetKernelArg returned %s.\n", TranslateOpenCLError(error_code));
-		return;
+		return error_code;
 	}
 
-    size_t global_work_size[3] = {divRndUp(sx, WIN_SX) * WIN_SX, divRndUp(sy, WIN_SY * steps),1};
-	size_t local_work_size[3] = {WIN_SX,1,1};
+    if (trace_enabled()) {
+        // decomposition level of this pass, 1 at full size
+        int level = 1;
+        for (int s = dimX; s > sx; s = divRndUp(s, 2))
+            level++;
+        trace_set_level(level);
+    }
+
+    size_t global_work_size[3] = {(size_t)divRndUp(sx, WIN_SX) * WIN_SX, (size_t)divRndUp(sy, WIN_SY * steps), (size_t)slices};
+	size_t local_work_size[3] = {(size_t)WIN_SX,1,1};
 
-	DeviceKernel::enqueue(2,global_work_size, local_work_size);
+	// the third dimension picks the slice, see the kernels' sliceStride
+	return DeviceKernel::enqueue(slices > 1 ? 3 : 2, global_work_size, local_work_size);
   }
 
 template <typename T> tDeviceRC DWTKernel<T>::copyLLBandToSrc(int LLSizeX, int LLSizeY){
 	  // copy forward or reverse transformed LL band from output back into the input
-	size_t bufferOffset[] = { 0, 0, 0};
 	cl_int err = CL_SUCCESS;
 
-	// The region size must be given in bytes
-	size_t region[] = {LLSizeX * sizeof(T), LLSizeY, 1 };
-			
+	// The LL band of every slice is LLSizeX x LLSizeY contiguous samples, so all slices go in one
+	// 3D copy of single-row slices: with the row pitch set to the slice distance, that distance
+	// need not be a multiple of the LL row length. The region size must be given in bytes.
+	size_t region[] = {(size_t)LLSizeX * LLSizeY * sizeof(T), 1, (size_t)slices };
+	size_t pitch = slices > 1 ? (size_t)sliceStride * sizeof(T) : 0;
+	size_t bufferOffset[] = { (size_t)offset * sizeof(T), 0, 0};
+	cl_event traceEvent;
 	err = clEnqueueCopyBufferRect ( queue, 	//copy command will be queued
-				    dstMem,		
-					srcMem,		
+				    dstMem,
+					srcMem,
 					bufferOffset,	//offset associated with src_buffer
 					bufferOffset,     //offset associated with src_buffer
 					region,		//(width, height, depth) in bytes of the 2D or 3D rectangle being copied
-					region[0],   //length of each row in bytes
-					0, //length of each 2D slice in bytes 
-					region[0] ,   //length of each row in bytes
-					0, //length of each 2D slice in bytes
+					pitch,   //length of each row in bytes, the slice distance
+					pitch,   //length of each 2D slice in bytes
+					pitch,   //length of each row in bytes, the slice distance
+					pitch,
 					0,
 					NULL,
-					NULL);
+					Tracer::event(&traceEvent));
 	if (CL_SUCCESS != err)
 	{
 		LogError("Error: clEnqueueCopyBufferRect (srcMem) returned %s.\n", TranslateOpenCLError(err));
+		return err;
 	}
+	Tracer::device(traceEvent, "copy LL band");
+	ResourceCounters::add(COUNTER_COPIES);
+	ResourceCounters::add(COUNTER_COPY_BYTES, region[0] * region[2]);
 	return err;
 
 }
 
 
 
-template <typename T> cl_int DWTKernel<T>::run(cl_mem in, cl_mem out, int sizeX, int sizeY, int levels){
+template <typename T> cl_int DWTKernel<T>::run(cl_mem in, cl_mem out, int sizeX, int sizeY, int levels,
+												int firstOffset, int numSlices, int stride){
 	srcMem = in;
 	dstMem = out;
 	dimX = sizeX;
 	dimY = sizeY;
+	offset = firstOffset;
+	slices = numSlices;
+	sliceStride = numSlices > 1 ? stride : 0;
 
 	cl_int error_code = clSetKernelArg(myKernel, 3, sizeof(cl_mem), &srcMem);
 	if (CL_SUCCESS != error_code)
@@ -173,17 +222,40 @@ template <typename T> cl_int DWTKernel<T>::run(cl_mem in, cl_mem out, int sizeX,
 		LogError("Error: clSetKernelArg returned %s.\n", TranslateOpenCLError(error_code));
 		return error_code;
 	}
-	dwt(sizeX, sizeY, levels);
-	return CL_SUCCESS;
+	error_code = clSetKernelArg(myKernel, 8, sizeof(int), &offset);
+	if (CL_SUCCESS != error_code)
+	{
+		LogError("Error: clSetKernelArg returned %s.\n", TranslateOpenCLError(error_code));
+		return error_code;
+	}
+	error_code = clSetKernelArg(myKernel, 9, sizeof(int), &sliceStride);
+	if (CL_SUCCESS != error_code)
+	{
+		LogError("Error: clSetKernelArg returned %s.\n", TranslateOpenCLError(error_code));
+		return error_code;
+	}
+	return dwt(sizeX, sizeY, levels);
 }
 
 template <typename T> T* DWTKernel<T>::mapOutputBufferToHost(){
 		
+	if (sharedDst) {
+		finish();
+		return sharedDst;
+	}
+
 	cl_int error_code = CL_SUCCESS;
-	void* hostPtr = clEnqueueMapBuffer(queue, dstMem, true, CL_MAP_READ, 0, dimX * dimY * sizeof(T), 0, NULL, NULL, &error_code);
+	cl_event traceEvent;
+	void* hostPtr = clEnqueueMapBuffer(queue, dstMem, true, CL_MAP_READ, 0, dimX * dimY * sizeof(T), 0, NULL, Tracer::event(&traceEvent), &error_code);
     if (CL_SUCCESS != error_code)
     {
         LogError("Error: clEnqueueMapBuffer return %s.\n", TranslateOpenCLError(error_code));
+    }
+    else
+    {
+        Tracer::device(traceEvent, "map");
+        ResourceCounters::add(COUNTER_MAPS);
+        ResourceCounters::add(COUNTER_MAP_BYTES, dimX * dimY * sizeof(T));
     }
 	return (T*)hostPtr;
 	
@@ -2,18 +2,20 @@
 #pragma once
 #include "DeviceKernel.h"
 #include "platform.h"
+#include "SharedMemory.h"
 
 template <typename T> class DWTKernel : public DeviceKernel
 {
 public:
     DWTKernel(int waveletImpulseDiameter, KernelInitInfo initInfo);
     virtual ~DWTKernel(void);
-    tDeviceRC run(tDeviceMem in, tDeviceMem out, int sizeX, int sizeY, int levels);
+    tDeviceRC run(tDeviceMem in, tDeviceMem out, int sizeX, int sizeY, int levels,
+                  int offset = 0, int slices = 1, int sliceStride = 0);
     tDeviceRC run(T* in, int sizeX, int sizeY, int levels);
     T* mapOutputBufferToHost();
 protected:
-    virtual void dwt( int sizeX, int sizeY, int levels) =0;
-    void enqueue (int WIN_SX, int WIN_SY, const int sx, const int sy);
+    virtual tDeviceRC dwt( int sizeX, int sizeY, int levels) =0;
+    tDeviceRC enqueue (int WIN_SX, int WIN_SY, const int sx, const int sy);
     int calcTransformDataBufferSize(int winsizex, int winsizey);
     tDeviceRC setWindowKernelArgs(int WIN_SX, int WIN_SY);
     tDeviceRC setImageSizeKernelArgs(int sx, int sy);
@@ -23,7 +25,14 @@ protected:
     tDeviceMem dstMem;
     int dimX;
     int dimY;
+    // images transformed by one launch: slices images of dimX x dimY, sliceStride samples apart from offset
+    int offset;
+    int slices;
+    int sliceStride;
     bool ownsMemory;
+    // with shared virtual memory, the buffers created by run(T*) alias these
+    T* sharedSrc;
+    T* sharedDst;
     int waveletImpulseDiameter;
 };
 
@@ -9,6 +9,6 @@ public:
 	DWTReverse53(KernelInitInfoBase initInfo);
 	virtual ~DWTReverse53(void);
 private:
-	void dwt( int sizeX, int sizeY, int levels) ;
+	tDeviceRC dwt( int sizeX, int sizeY, int levels) ;
 };
 
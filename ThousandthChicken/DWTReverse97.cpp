@@ -21,25 +21,27 @@ DWTReverse97::~DWTReverse97(void)
   /// @param sizeX   width of input image (in pixels)
   /// @param sizeY   height of input image (in pixels)
   /// @param levels  number of recursive DWT levels
-  void DWTReverse97::dwt(  int sizeX, int sizeY, int levels) {
+  tDeviceRC DWTReverse97::dwt(  int sizeX, int sizeY, int levels) {
     if(levels > 1) {
       // let this function recursively reverse transform deeper levels first
       const int llSizeX = divRndUp(sizeX, 2);
       const int llSizeY = divRndUp(sizeY, 2);
-      dwt( llSizeX, llSizeY, levels - 1);
+      tDeviceRC err = dwt( llSizeX, llSizeY, levels - 1);
+      if (err != DeviceSuccess)
+          return err;
 
-      tDeviceRC err = copyLLBandToSrc(llSizeX, llSizeY);
+      err = copyLLBandToSrc(llSizeX, llSizeY);
       if (err != DeviceSuccess)
-          return;
+          return err;
     }
     
     // select right width of kernel for the size of the image
     if(sizeX >= 960) {
-      enqueue(192, 8, sizeX, sizeY);
+      return enqueue(192, 8, sizeX, sizeY);
     } else if (sizeX >= 480) {
-      enqueue(128, 6,sizeX, sizeY);
+      return enqueue(128, 6,sizeX, sizeY);
     } else {
-      enqueue(64, 6, sizeX, sizeY);
+      return enqueue(64, 6, sizeX, sizeY);
     }
   }
 
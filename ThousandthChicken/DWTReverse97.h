@@ -10,6 +10,6 @@ public:
 	DWTReverse97(KernelInitInfoBase initInfo);
 	virtual ~DWTReverse97(void);
 private:
-	void dwt( int sizeX, int sizeY, int levels) ;
+	tDeviceRC dwt( int sizeX, int sizeY, int levels) ;
 };
 
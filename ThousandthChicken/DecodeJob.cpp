@@ -0,0 +1,123 @@
+// License: please see LICENSE1 file for more details.
+
+#include "DecodeJob.h"
+#include "Decoder.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "codestream_image.h"
+#include "codestream_image_types.h"
+
+
+DecodeJob::DecodeJob(Decoder* decoder, const std::string& fileName, DecodeCompletionCallback callback, void* userData) :
+									decoder(decoder),
+									fileName(fileName),
+									img(NULL),
+									done(0),
+									callback(callback),
+									userData(userData),
+									admitted(false),
+									callbackPending(false),
+									status(CL_COMPLETE),
+									submitted(time_stamp()),
+									finished(0),
+									startCounters(ResourceCounters::snapshot())
+{
+	complete = false;
+	usage = ResourceSnapshot();
+}
+
+
+DecodeJob::~DecodeJob(void)
+{
+	if (img)
+		collect(NULL);
+	// the runtime thread may still be inside onComplete
+	waitForCallback();
+	if (admitted)
+		decoder->leave(this);
+	if (done)
+		clReleaseEvent(done);
+}
+
+/**
+ * @brief Registers the completion callback. Called by the decoder once everything is enqueued.
+ */
+tDeviceRC DecodeJob::start()
+{
+	callbackPending = true;
+	cl_int err = clSetEventCallback(done, CL_COMPLETE, onComplete, this);
+	if (CL_SUCCESS != err)
+	{
+		callbackPending = false;
+		LogError("Error: clSetEventCallback returned %s.\n", TranslateOpenCLError(err));
+	}
+	return err;
+}
+
+void CL_CALLBACK DecodeJob::onComplete(cl_event /*event*/, cl_int status, void* userData)
+{
+	DecodeJob* job = (DecodeJob*)userData;
+	job->status = status;
+	job->finished = time_stamp();
+	job->complete = true;
+	if (job->callback)
+		job->callback(job, job->userData);
+
+	// last touch of the job: once the waiter sees this it may delete the job
+	std::lock_guard<std::mutex> guard(job->callbackLock);
+	job->callbackPending = false;
+	job->callbackReturned.notify_all();
+}
+
+/**
+ * @brief Blocks until the completion callback has returned. The event completing does not
+ * mean that the runtime has run the callback yet.
+ */
+void DecodeJob::waitForCallback()
+{
+	std::unique_lock<std::mutex> guard(callbackLock);
+	while (callbackPending)
+		callbackReturned.wait(guard);
+}
+
+tDeviceRC DecodeJob::wait()
+{
+	cl_int err = clWaitForEvents(1, &done);
+	if (CL_SUCCESS != err)
+	{
+		LogError("Error: clWaitForEvents returned %s.\n", TranslateOpenCLError(err));
+	}
+	return err;
+}
+
+/**
+ * @brief Waits for the job, copies the decoded samples into out (if not NULL) and releases
+ * all host and device memory of the image. The image tree goes back to the decoder for the
+ * next frame with the same main header.
+ * @return 0 on success
+ */
+int DecodeJob::collect(DecodedImage* out)
+{
+	if (!img)
+		return -1;
+
+	tDeviceRC err = wait();
+	// status is written by the callback, which may run after the event has completed; the
+	// callback runs for abnormally terminated commands as well
+	waitForCallback();
+	// taken before the tile buffers are released, so live bytes include this image
+	usage = ResourceCounters::difference(startCounters, ResourceCounters::snapshot());
+	if (out)
+		out->allocate(img->width, img->height, img->num_components);
+	for (unsigned int i = 0; i < img->num_tiles; i++) {
+		if (out && err == DeviceSuccess)
+			decoder->gatherTile(img->tile + i, out);
+		decoder->releaseTileBuffers(img->tile + i);
+	}
+
+	if (admitted)
+		decoder->leave(this);
+	decoder->recycle(img);
+	img = NULL;
+	return (err == DeviceSuccess && status == CL_COMPLETE) ? 0 : -1;
+}
@@ -0,0 +1,70 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "platform.h"
+#include "DecodedImage.h"
+#include "ResourceCounters.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Decoder;
+class DecodeJob;
+struct type_image;
+
+typedef void (*DecodeCompletionCallback)(DecodeJob* job, void* userData);
+
+/**
+ * @brief Handle to an image whose device work is in flight.
+ *
+ * Returned by Decoder::decodeAsync as soon as the image is parsed and all of its work is
+ * enqueued. The completion callback runs on an OpenCL runtime thread once the device has
+ * finished and the results are read back; it must not block or call OpenCL, but may hand the
+ * job over to a thread that calls collect(). A job must be collected or deleted before
+ * its decoder is destroyed.
+ */
+class DecodeJob
+{
+public:
+	DecodeJob(Decoder* decoder, const std::string& fileName, DecodeCompletionCallback callback, void* userData);
+	~DecodeJob(void);
+	bool isComplete() const { return complete; }
+	tDeviceRC wait();
+	int collect(DecodedImage* out);
+	const std::string& getFileName() const { return fileName; }
+	type_image* getImage() { return img; }
+	// seconds from submission until the device finished, valid once complete
+	double getElapsed() const { return finished - submitted; }
+	// counters from submission until collect, valid once collected
+	const ResourceSnapshot& getUsage() const { return usage; }
+
+private:
+	friend class Decoder;
+	static void CL_CALLBACK onComplete(cl_event event, cl_int status, void* userData);
+	tDeviceRC start();
+	void waitForCallback();
+
+	Decoder* decoder;
+	/** The parsed image refers to this name, so the job keeps its own copy */
+	std::string fileName;
+	type_image* img;
+	/** Completes when all stages have finished and the results are read back */
+	cl_event done;
+	DecodeCompletionCallback callback;
+	void* userData;
+	/** Holds one of the decoder's job slots and a reservation with its planner until collect */
+	bool admitted;
+	std::atomic<bool> complete;
+	/** The completion callback is registered and has not returned yet */
+	bool callbackPending;
+	std::mutex callbackLock;
+	std::condition_variable callbackReturned;
+	cl_int status;
+	double submitted;
+	double finished;
+	ResourceSnapshot startCounters;
+	ResourceSnapshot usage;
+};
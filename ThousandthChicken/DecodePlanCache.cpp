@@ -0,0 +1,63 @@
+// License: please see LICENSE1 file for more details.
+
+#include "DecodePlanCache.h"
+#include "codestream.h"
+#include "codestream_image.h"
+#include <string.h>
+
+
+DecodePlanCache::DecodePlanCache(size_t maxTrees) : maxTrees(maxTrees),
+													hits(0),
+													misses(0)
+{
+}
+
+
+DecodePlanCache::~DecodePlanCache(void)
+{
+	for (std::list<type_image*>::iterator it = trees.begin(); it != trees.end(); ++it)
+		free_image(*it);
+}
+
+type_image* DecodePlanCache::acquire(const unsigned char* header, unsigned int length)
+{
+	unsigned long long headerHash = hash_main_header(header, length);
+	type_image* img = NULL;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (std::list<type_image*>::iterator it = trees.begin(); it != trees.end(); ++it) {
+			if ((*it)->header_hash == headerHash && (*it)->header_length == length &&
+				!memcmp((*it)->header, header, length)) {
+				img = *it;
+				trees.erase(it);
+				break;
+			}
+		}
+		if (img)
+			hits++;
+		else
+			misses++;
+	}
+	if (img)
+		recycle_image(img);
+	return img;
+}
+
+void DecodePlanCache::release(type_image* img)
+{
+	// only trees whose main header was parsed completely can take another frame
+	if (maxTrees == 0 || !img->tile || !img->header_length) {
+		free_image(img);
+		return;
+	}
+	type_image* evicted = NULL;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		trees.push_front(img);
+		if (trees.size() > maxTrees) {
+			evicted = trees.back();
+			trees.pop_back();
+		}
+	}
+	free_image(evicted);
+}
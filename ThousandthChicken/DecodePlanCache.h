@@ -0,0 +1,44 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "codestream_image_types.h"
+#include <list>
+#include <mutex>
+
+/**
+ * @brief Image trees of finished decodes, kept for frames with an identical main header.
+ *
+ * Camera feeds send long runs of frames with the same SIZ/COD/QCD parameters. A tree built for
+ * one of them already holds the tiles, components, resolution levels, subbands, code-blocks,
+ * tag trees and the code-block infos of the coefficient coder, so a later frame with the same
+ * main header only has to parse its packets into it.
+ *
+ * Trees are looked up by the hash of their main header and handed out only if their header bytes
+ * are identical, so a hash collision never reuses a tree built for another header. The least
+ * recently released trees are freed first.
+ */
+class DecodePlanCache
+{
+public:
+	DecodePlanCache(size_t maxTrees = 8);
+	~DecodePlanCache(void);
+	/**
+	 * @brief Takes a tree built for this main header out of the cache.
+	 * @param header the main header, SOC up to the first SOT
+	 * @return tree ready to parse the next frame into, NULL if there is none
+	 */
+	type_image* acquire(const unsigned char* header, unsigned int length);
+	/** @brief Keeps the tree of a collected image; its tile buffers must have been released */
+	void release(type_image* img);
+	size_t getHits() const { return hits; }
+	size_t getMisses() const { return misses; }
+
+private:
+	/** most recently released first */
+	std::list<type_image*> trees;
+	size_t maxTrees;
+	size_t hits;
+	size_t misses;
+	std::mutex lock;
+};
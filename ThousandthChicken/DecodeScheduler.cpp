@@ -0,0 +1,239 @@
+// License: please see LICENSE1 file for more details.
+
+#include "DecodeScheduler.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "codestream_image_types.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+
+
+DecodeScheduler::DecodeScheduler(ocl_args_d_t* ocl, int numLanes) : readback(NULL)
+{
+	if (numLanes < 1)
+		numLanes = 1;
+
+	for (int i = 0; i < numLanes; ++i) {
+		cl_int err = CL_SUCCESS;
+		cl_command_queue queue = clCreateCommandQueue(ocl->context, ocl->device, CL_QUEUE_PROFILING_ENABLE, &err);
+		SAMPLE_CHECK_ERRORS(err);
+		ownedQueues.push_back(queue);
+		lanes.push_back(new KernelSet(KernelInitInfoBase(queue, "-I ./")));
+	}
+	readback = new StagingRing(ocl->context, 16);
+}
+
+
+DecodeScheduler::~DecodeScheduler(void)
+{
+	releaseEvents();
+	delete readback;
+	for (size_t i = 0; i < lanes.size(); ++i)
+		delete lanes[i];
+	for (size_t i = 0; i < ownedQueues.size(); ++i)
+		clReleaseCommandQueue(ownedQueues[i]);
+}
+
+size_t DecodeScheduler::addNode(decode_stage stage, type_tile* tile, type_tile_comp* tile_comp, int lane)
+{
+	DecodeNode node;
+	node.stage = stage;
+	node.tile = tile;
+	node.tile_comp = tile_comp;
+	node.lane = lane;
+	node.done = 0;
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+/**
+ * @brief Builds the stage graph for all tiles of an image. Nodes are stored in dependency order.
+ * @param img
+ */
+void DecodeScheduler::build(type_image* img)
+{
+	reset();
+	for (unsigned int i = 0; i < img->num_tiles; i++)
+		addTile(img->tile + i);
+}
+
+void DecodeScheduler::reset()
+{
+	releaseEvents();
+	nodes.clear();
+}
+
+/**
+ * @brief Appends the stage nodes of one tile to the graph.
+ * @param tile
+ */
+void DecodeScheduler::addTile(type_tile* tile)
+{
+	type_image* img = tile->parent_img;
+	int numLanes = getNumLanes();
+	unsigned int i = tile->tile_no;
+
+	std::vector<size_t> dequantized;
+	for (unsigned int j = 0; j < img->num_components; j++) {
+		type_tile_comp* tile_comp = tile->tile_comp + j;
+		int lane = (int)((i * img->num_components + j) % numLanes);
+
+		size_t tier1 = addNode(STAGE_TIER1, tile, tile_comp, lane);
+		size_t dequantize = addNode(STAGE_DEQUANTIZE, tile, tile_comp, lane);
+		nodes[dequantize].dependencies.push_back(tier1);
+		dequantized.push_back(dequantize);
+	}
+	// the inverse DWT covers all components of the tile in one batch
+	size_t idwt = addNode(STAGE_IDWT, tile, NULL, (int)(i % numLanes));
+	nodes[idwt].dependencies = dequantized;
+	size_t mct = addNode(STAGE_MCT, tile, NULL, (int)(i % numLanes));
+	nodes[mct].dependencies.push_back(idwt);
+	size_t read = addNode(STAGE_READBACK, tile, NULL, (int)(i % numLanes));
+	nodes[read].dependencies.push_back(mct);
+}
+
+tDeviceRC DecodeScheduler::dispatchNode(DecodeNode& node)
+{
+	KernelSet* set = lanes[node.lane];
+	trace_set_context(node.tile->tile_no, node.tile_comp ? (int)node.tile_comp->tile_comp_no : -1, -1);
+
+	// dependencies on the same in-order queue are already satisfied by queue order
+	std::vector<cl_event> waitList;
+	for (size_t i = 0; i < node.dependencies.size(); ++i) {
+		DecodeNode& dep = nodes[node.dependencies[i]];
+		if (dep.lane != node.lane)
+			waitList.push_back(dep.done);
+	}
+	tDeviceRC err = set->deviceQueue->enqueueBarrier((cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0]);
+	if (err != DeviceSuccess)
+		return err;
+
+	switch (node.stage) {
+	case STAGE_TIER1:
+		err = set->coder->decode_tile_comp(node.tile_comp);
+		if (err != DeviceSuccess)
+			return err;
+		break;
+	case STAGE_DEQUANTIZE:
+		err = set->quantizer->dequantize_tile_comp(node.tile_comp);
+		if (err != DeviceSuccess)
+			return err;
+		break;
+	case STAGE_IDWT:
+		err = set->dwt->iwt(node.tile);
+		if (err != DeviceSuccess)
+			return err;
+		break;
+	case STAGE_MCT:
+		err = set->preprocessor->decode_tile(node.tile);
+		if (err != DeviceSuccess)
+			return err;
+		break;
+	case STAGE_READBACK:
+		for (unsigned int j = 0; j < node.tile->parent_img->num_components; j++) {
+			type_tile_comp* comp = node.tile->tile_comp + j;
+			// already host visible in shared virtual memory
+			if (comp->img_data_h)
+				continue;
+			comp->img_data_h = readback->download(set->getQueue(), (cl_mem)comp->img_data_d,
+				(size_t)comp->width * comp->height * sizeof(int), &err);
+			if (err != DeviceSuccess)
+				return err;
+		}
+		break;
+	}
+
+	return set->deviceQueue->enqueueMarker(&node.done);
+}
+
+/**
+ * @brief Enqueues every node of the graph and flushes all queues. Does not wait for completion.
+ */
+tDeviceRC DecodeScheduler::dispatch()
+{
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		tDeviceRC err = dispatchNode(nodes[i]);
+		if (err != DeviceSuccess) {
+			releaseCoefficients();
+			return err;
+		}
+	}
+	for (size_t i = 0; i < lanes.size(); ++i) {
+		tDeviceRC err = lanes[i]->deviceQueue->flush();
+		if (err != DeviceSuccess)
+			return err;
+	}
+	return DeviceSuccess;
+}
+
+/**
+ * @brief Releases the coefficients of tile components whose dequantization was never dispatched.
+ */
+void DecodeScheduler::releaseCoefficients()
+{
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		type_tile_comp* comp = nodes[i].tile_comp;
+		if (nodes[i].stage == STAGE_TIER1 && comp->coefficients) {
+			ResourceCounters::releaseBuffer((cl_mem)comp->coefficients);
+			comp->coefficients = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Makes the first queue wait for everything dispatched so far on the other queues,
+ * so that commands enqueued on it afterwards see the finished image.
+ */
+tDeviceRC DecodeScheduler::join()
+{
+	std::vector<cl_event> tails;
+	tDeviceRC rc = DeviceSuccess;
+	for (size_t i = 1; i < lanes.size() && rc == DeviceSuccess; ++i) {
+		cl_event tail = 0;
+		rc = lanes[i]->deviceQueue->enqueueMarker(&tail);
+		if (rc == DeviceSuccess)
+			tails.push_back(tail);
+	}
+	if (rc == DeviceSuccess && !tails.empty())
+		rc = lanes[0]->deviceQueue->enqueueBarrier((cl_uint)tails.size(), &tails[0]);
+	for (size_t i = 0; i < tails.size(); ++i)
+		clReleaseEvent(tails[i]);
+	return rc;
+}
+
+/**
+ * @brief Waits until all queues have drained.
+ */
+tDeviceRC DecodeScheduler::finish()
+{
+	tDeviceRC rc = DeviceSuccess;
+	for (size_t i = 0; i < lanes.size(); ++i) {
+		tDeviceRC err = lanes[i]->deviceQueue->finish();
+		if (err != DeviceSuccess)
+			rc = err;
+	}
+	releaseEvents();
+	return rc;
+}
+
+cl_event DecodeScheduler::retainTileDone(type_tile* tile)
+{
+	for (size_t i = nodes.size(); i > 0; --i) {
+		DecodeNode& node = nodes[i - 1];
+		if (node.stage == STAGE_READBACK && node.tile == tile && node.done) {
+			clRetainEvent(node.done);
+			return node.done;
+		}
+	}
+	return 0;
+}
+
+void DecodeScheduler::releaseEvents()
+{
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		if (nodes[i].done) {
+			clReleaseEvent(nodes[i].done);
+			nodes[i].done = 0;
+		}
+	}
+}
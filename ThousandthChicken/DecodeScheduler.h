@@ -0,0 +1,74 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "KernelSet.h"
+#include "StagingRing.h"
+#include <vector>
+
+struct ocl_args_d_t;
+
+typedef enum {
+	STAGE_TIER1,		///Code-block decoding of one tile component
+	STAGE_DEQUANTIZE,	///Dequantization of one tile component
+	STAGE_IDWT,			///Inverse wavelet transform of all components of one tile
+	STAGE_MCT,			///Inverse color transform or DC level shift of one tile
+	STAGE_READBACK		///Non-blocking read of the tile components into pinned host memory
+} decode_stage;
+
+struct DecodeNode
+{
+	decode_stage stage;
+	type_tile* tile;
+	/** NULL for tile level stages */
+	type_tile_comp* tile_comp;
+	/** Kernel set (and therefore queue) the node runs on */
+	int lane;
+	/** Nodes that must complete before this one starts */
+	std::vector<size_t> dependencies;
+	/** Completes when the node has finished on the device */
+	cl_event done;
+};
+
+/**
+ * @brief Runs the decoder stages of an image as a dependency graph over several command queues.
+ *
+ * Every tile component is a chain Tier-1 -> dequantization, and every tile finishes with one
+ * batched inverse DWT node that depends on the dequantization of all its components, an MCT
+ * node and a readback node on the same queue. Chains are spread round-robin over the queues, so
+ * independent components overlap on the device, and the readback of one tile overlaps with
+ * the kernels of the next.
+ * A node waits on its dependencies from other queues with a barrier, and signals its own
+ * completion with a marker event; the host does not block until finish() is called.
+ */
+class DecodeScheduler
+{
+public:
+	DecodeScheduler(ocl_args_d_t* ocl, int numLanes);
+	~DecodeScheduler(void);
+	void build(type_image* img);
+	void reset();
+	void addTile(type_tile* tile);
+	tDeviceRC dispatch();
+	tDeviceRC join();
+	tDeviceRC finish();
+	/** @brief Returns a retained event that completes once the dispatched tile has been read back */
+	cl_event retainTileDone(type_tile* tile);
+	/** @brief Returns the pinned memory a tile component was read back into */
+	void releaseReadback(void* host) { readback->release(host); }
+	cl_command_queue getQueue() { return lanes[0]->getQueue(); }
+	int getNumLanes() { return (int)lanes.size(); }
+
+private:
+	size_t addNode(decode_stage stage, type_tile* tile, type_tile_comp* tile_comp, int lane);
+	tDeviceRC dispatchNode(DecodeNode& node);
+	void releaseCoefficients();
+	void releaseEvents();
+
+	std::vector<KernelSet*> lanes;
+	/** Every scheduler creates its own queues, so decoders sharing a context never wait on each other */
+	std::vector<cl_command_queue> ownedQueues;
+	std::vector<DecodeNode> nodes;
+	/** Tile components are read back into these until their image is collected */
+	StagingRing* readback;
+};
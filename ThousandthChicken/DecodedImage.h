@@ -0,0 +1,61 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Decoded samples of a whole image on the host, one plane per component.
+ */
+struct DecodedImage
+{
+	DecodedImage() : width(0), height(0), numComponents(0), data(NULL)
+	{}
+	~DecodedImage()
+	{
+		free(data);
+	}
+
+	void allocate(unsigned int w, unsigned int h, unsigned int comps)
+	{
+		free(data);
+		width = w;
+		height = h;
+		numComponents = comps;
+		data = (int*)calloc((size_t)w * h * comps, sizeof(int));
+	}
+
+	int* plane(unsigned int comp)
+	{
+		return data + (size_t)comp * width * height;
+	}
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int numComponents;
+	int* data;
+
+private:
+	DecodedImage(const DecodedImage&);
+	DecodedImage& operator=(const DecodedImage&);
+};
+
+/**
+ * @brief One decoded tile, handed to a DecodedTileSink while it still lives in readback memory.
+ */
+struct DecodedTile
+{
+	unsigned int tileNo;
+	/** Top left corner of the tile in the image */
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned int numComponents;
+	/** Samples of every component, width * height row by row; only valid during the sink call */
+	const int* const* planes;
+};
+
+/** @brief Receives the tiles of a tile-streaming decode in the order they complete */
+typedef void (*DecodedTileSink)(const DecodedTile& tile, void* userData);
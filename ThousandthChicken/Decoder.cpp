@@ -8,53 +8,61 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "codestream_image_types.h"
 #include "logger.h"
 #include "boxes.h"
 #include "io_buffered_stream.h"
 #include "codestream.h"
+#include "codestream_markers.h"
+#include "codestream_image.h"
 #include "basic.h"
 #include <time.h>
 #include "MemoryMapped.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+#include "SharedMemory.h"
 
 
-Decoder* decoder = NULL;
+// covers the JP2 header boxes and the main header of almost every file
+#define PROBE_PREFIX_BYTES (16 * 1024)
 
-void handleCodeBlock(type_codeblock* cblk, unsigned char* codestream) {
-	if (decoder)
-		decoder->parsedCodeBlock(cblk, codestream);
+static void handleCodeBlock(type_codeblock* cblk, unsigned char* codestream, void* userData) {
+	((Decoder*)userData)->parsedCodeBlock(cblk, codestream);
+}
 
+static void handleTileParts(type_image* img, type_tile_part* parts, type_parse_context* ctx) {
+	((Decoder*)ctx->user_data)->parseTileParts(img, parts, ctx);
 }
 
 
 
 
-Decoder::Decoder(ocl_args_d_t* ocl) : _ocl(ocl),
-	                                  coder(NULL),
-									  quantizer(NULL),
-									  dwt(NULL),
-									  preprocessor(NULL),
-									  dev_alignment(128)
+Decoder::Decoder(ocl_args_d_t* ocl, int numQueues) : _ocl(ocl),
+	                                  scheduler(NULL),
+									  planner(NULL),
+									  jobsInFlight(0),
+									  maxJobsInFlight(4),
+									  parsePool(NULL),
+									  dev_alignment(128),
+									  useSVM(false)
 {
 	/*"-g -s \"c:\\src\\ThousandthChicken\\ThousandthChicken\\coefficient_coder.cl\""*/
-	coder = new  CoefficientCoder(KernelInitInfoBase(_ocl->commandQueue, "-I ./"));
-	quantizer = new Quantizer(KernelInitInfoBase(_ocl->commandQueue, "-I ./"));
-	preprocessor = new Preprocessor(KernelInitInfoBase(_ocl->commandQueue, "-I ./"));
+	scheduler = new DecodeScheduler(_ocl, numQueues);
 	dev_alignment = requiredOpenCLAlignment(_ocl->device);
-	codeBlockCallback = handleCodeBlock;
+	useSVM = SharedMemory::supported(_ocl->device);
+	planner = MemoryPlanner::forContext(_ocl->context);
 }
 
 
 Decoder::~Decoder(void)
 {
-	if (coder)
-		delete coder;
-	if (quantizer)
-		delete quantizer;
-	if (dwt)
-		delete dwt;
-	if (preprocessor)
-		delete preprocessor;
+	if (scheduler)
+		delete scheduler;
+	if (parsePool)
+		delete parsePool;
+	for (std::map<std::string, TileIndex*>::iterator it = indexes.begin(); it != indexes.end(); ++it)
+		delete it->second;
 }
 
 void init_dec_buffer(unsigned char* data, unsigned long int dataLength, type_buffer *src_buff) {
@@ -68,9 +76,26 @@ void init_dec_buffer(unsigned char* data, unsigned long int dataLength, type_buf
 	src_buff->byte = 0;
 }
 
+/** The tile-parts of an image being parsed by the parse threads */
+struct TilePartsJob {
+	type_image* img;
+	type_tile_part* parts;
+	type_parse_context* ctx;
+};
+
+static void parseTilePart(unsigned int tileNo, void* userData) {
+	TilePartsJob* job = (TilePartsJob*)userData;
+	type_buffer buffer;
+	init_dec_buffer(job->parts[tileNo].data, job->parts[tileNo].length, &buffer);
+	decode_tiles(&buffer, job->img->tile + tileNo, job->ctx);
+}
+
 void Decoder::parsedCodeBlock(type_codeblock* cblk, unsigned char* codestream) {
 
-	cblk->codestream = (unsigned char*)aligned_malloc(cblk->length, dev_alignment);
+	TraceSpan span("stage code-block");
+	type_tile* tile = cblk->parent_sb->parent_res_lvl->parent_tile_comp->parent_tile;
+	type_arena* arena = tile->arena ? tile->arena : tile->parent_img->arena;
+	cblk->codestream = (unsigned char*)arena_alloc_aligned(arena, cblk->length, dev_alignment);
 	memcpy(cblk->codestream, codestream, cblk->length);
 
 	//1. enqueue write to device memory
@@ -78,140 +103,879 @@ void Decoder::parsedCodeBlock(type_codeblock* cblk, unsigned char* codestream) {
 	//2. when enough codeblocks have been parsed, launch kernel
 }
 
-cl_int Decoder::mapComponentToHost(type_tile_comp* tile_comp){
-		
-	cl_int error_code = CL_SUCCESS;
-	tile_comp->img_data_h = clEnqueueMapBuffer(_ocl->commandQueue, (cl_mem)tile_comp->img_data_d, true, CL_MAP_READ, 
-		                                0, tile_comp->width * tile_comp->height * sizeof(int), 0, NULL, NULL, &error_code);
-    if (CL_SUCCESS != error_code)
-    {
-        LogError("Error: clEnqueueMapBuffer return %s.\n", TranslateOpenCLError(error_code));
-    }
-	return error_code;
+/**
+ * @brief Sets the host threads parse() reads packet headers with. With more than one thread
+ * all tile-parts are located by their Psot lengths first and the tiles are then parsed
+ * concurrently; 1, the default, parses the tiles one after the other.
+ * @param numThreads 0 for one thread per hardware thread
+ */
+void Decoder::setParseThreads(unsigned int numThreads)
+{
+	if (parsePool) {
+		delete parsePool;
+		parsePool = NULL;
+	}
+	if (numThreads != 1)
+		parsePool = new ThreadPool(numThreads);
 }
 
+/**
+ * @brief Parses the packets of all tiles of img on the parse threads. Every tile parses into
+ * its own arena, so the threads share nothing but the main header, which is only read.
+ */
+void Decoder::parseTileParts(type_image* img, type_tile_part* parts, type_parse_context* ctx)
+{
+	TraceSpan span("parse tile-parts");
+	bool ownArenas = true;
+	for (unsigned int i = 0; i < img->num_tiles; i++) {
+		type_tile* tile = img->tile + i;
+		// one chunk the size of the tile-part holds most of its code-blocks
+		if (!tile->arena)
+			tile->arena = arena_create((size_t)parts[i].length + dev_alignment);
+		ownArenas = ownArenas && tile->arena != NULL;
+	}
+
+	TilePartsJob job = { img, parts, ctx };
+	if (ownArenas && parsePool) {
+		parsePool->run(img->num_tiles, parseTilePart, &job);
+	} else {
+		for (unsigned int i = 0; i < img->num_tiles; i++)
+			parseTilePart(i, &job);
+	}
+}
 
-int Decoder::decode(std::string fileName)
+/**
+ * @brief Parses a JP2 file or a raw codestream into an image tree. Code-block codestreams are
+ * copied out of the file, so the tree does not reference the mapped file after return.
+ *
+ * If an image with the same main header has been collected before, its tree is reused and
+ * only the packets of this file are parsed.
+ * @param fileName must outlive the returned image
+ * @return NULL if the file could not be opened
+ */
+type_image* Decoder::parse(const std::string& fileName)
 {
-	decoder = this;
-	type_image *img = (type_image *)malloc(sizeof(type_image));
-	memset(img, 0, sizeof(type_image));
-	img->in_file = fileName.c_str();
-	
+	type_parse_context ctx;
+	ctx.code_block_callback = handleCodeBlock;
+	ctx.user_data = this;
+	ctx.parse_tile_parts = parsePool ? handleTileParts : NULL;
+
 	// map file to memory
 	MemoryMapped data(fileName, MemoryMapped::WholeFile, MemoryMapped::SequentialScan);
 	if (!data.isValid())
 	{
 	printf("File not found\n");
-	return -2;
+	return NULL;
 	}
 
   // raw pointer to mapped memory
     unsigned char* buffer = (unsigned char*)data.getData();
 
-	type_buffer *src_buff = (type_buffer *) malloc(sizeof(type_buffer));
-	memset(src_buff, 0, sizeof(type_buffer));
-	src_buff->data = buffer;
-	src_buff->bp = buffer;
-	src_buff->size = data.size();
+	bool jp2 = strstr(fileName.c_str(), ".jp2") != NULL;
+	size_t codestreamSize = (size_t)data.size();
+	const unsigned char* codestream = jp2 ? jp2_find_codestream(buffer, codestreamSize, &codestreamSize) : buffer;
+	unsigned int headerLength = codestream ? main_header_length(codestream, codestreamSize) : 0;
 
-	double t1 = time_stamp();
-	type_tile *tile;
-	unsigned int i,j;
-	if(strstr(img->in_file, ".jp2") != NULL) {
+	// the image and everything parsed into it live in one arena, see free_image
+	type_image *img = headerLength ? plans.acquire(codestream, headerLength) : NULL;
+	if (!img)
+		img = create_image();
+	img->in_file = fileName.c_str();
+
+	// the codestream is parsed in place, boxes included; only code-blocks are copied out
+	type_buffer src_buff;
+	init_dec_buffer(buffer, data.size(), &src_buff);
+	if(jp2) {
 		println(INFO, "It's a JP2 file");
 
 		//parse the JP2 boxes
-		jp2_parse_boxes(src_buff, img);
-
-		for (i = 0; i < img->num_tiles; i++) {
-			type_tile* tile = img->tile + i;
-
-			for (j = 0; j < tile->parent_img->num_components; j++) {
-				type_tile_comp* tile_comp = tile->tile_comp + j;
-				
-				//allocate image tile component memory on device 
-				cl_int err = CL_SUCCESS;
-				tile_comp->img_data_h = NULL;
-				tile_comp->img_data_d = (void*)clCreateBuffer(_ocl->context, CL_MEM_READ_WRITE, tile_comp->width * tile_comp->height * sizeof(int), NULL, &err);
-				SAMPLE_CHECK_ERRORS(err);
-				if (tile_comp->img_data_d  == 0)
-					throw Error("Failed to create tile component Buffer!");
+		TraceSpan span("parse boxes");
+		jp2_parse_boxes(&src_buff, img, &ctx);
+	} else {
+		decode_codestream(&src_buff, img, &ctx);
+	}
+	return img;
+}
+
+void Decoder::recycle(type_image* img)
+{
+	plans.release(img);
+}
+
+/**
+ * @brief Reads the image parameters of a JP2 file or a raw codestream from its first bytes.
+ *
+ * Needs neither a decoder nor an OpenCL context. Only a prefix of the file is mapped, unless
+ * the JP2 boxes in front of the codestream are longer than that.
+ * @return PROBE_OK, PROBE_TRUNCATED or PROBE_INVALID; -2 if the file could not be opened
+ */
+int Decoder::probe(const std::string& fileName, type_image_info* info)
+{
+	MemoryMapped data(fileName, PROBE_PREFIX_BYTES, MemoryMapped::SequentialScan);
+	if (!data.isValid())
+		return -2;
+	int rc = probe(data.getData(), data.mappedSize(), info);
+	if (rc == PROBE_TRUNCATED && data.mappedSize() < data.size()) {
+		if (!data.remap(0, MemoryMapped::WholeFile))
+			return -2;
+		rc = probe(data.getData(), data.mappedSize(), info);
+	}
+	return rc;
+}
+
+/**
+ * @brief Reads the image parameters of a JP2 file or a raw codestream in memory.
+ * @param size may cover just the start of the file
+ */
+int Decoder::probe(const unsigned char* data, size_t size, type_image_info* info)
+{
+	if (!jp2_has_signature(data, size))
+		return probe_codestream(data, size, info);
+
+	size_t codestreamSize = 0;
+	const unsigned char* codestream = jp2_find_codestream(data, size, &codestreamSize);
+	if (!codestream)
+		return PROBE_TRUNCATED;
+	return probe_codestream(codestream, codestreamSize, info);
+}
+
+/**
+ * @brief Allocates one device buffer per tile with every component as an aligned sub-buffer,
+ * so tile level stages such as the Part 2 array transform reach all components in one kernel.
+ */
+void Decoder::allocateTileBuffers(type_tile* tile)
+{
+	size_t alignment = dev_alignment / sizeof(int);
+	if (alignment == 0)
+		alignment = 1;
+	size_t samples = 0;
+	for (unsigned int j = 0; j < tile->parent_img->num_components; j++) {
+		type_tile_comp* tile_comp = tile->tile_comp + j;
+		tile_comp->img_data_offset = (unsigned int)samples;
+		samples += ((size_t)tile_comp->width * tile_comp->height + alignment - 1) / alignment * alignment;
+	}
+	// the kernels address the tile buffer with int offsets
+	if (samples > INT_MAX)
+		throw Error("Tile has too many samples for the device kernels!");
+
+	cl_int err = CL_SUCCESS;
+	size_t bytes = samples * sizeof(int);
+	if (useSVM) {
+		// the host reads the decoded samples in place once the image has completed
+		tile->img_data_h = SharedMemory::alloc(_ocl->context, bytes);
+		tile->img_data_d = (void*)SharedMemory::wrap(_ocl->context, tile->img_data_h, bytes);
+	} else {
+		//allocate image tile memory on device 
+		tile->img_data_h = NULL;
+		tile->img_data_d = (void*)clCreateBuffer(_ocl->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+		SAMPLE_CHECK_ERRORS(err);
+		if (tile->img_data_d  == 0)
+			throw Error("Failed to create tile Buffer!");
+		ResourceCounters::bufferCreated((cl_mem)tile->img_data_d);
+	}
+
+	for (unsigned int j = 0; j < tile->parent_img->num_components; j++) {
+		type_tile_comp* tile_comp = tile->tile_comp + j;
+		cl_buffer_region region;
+		region.origin = tile_comp->img_data_offset * sizeof(int);
+		region.size = (size_t)tile_comp->width * tile_comp->height * sizeof(int);
+		tile_comp->img_data_d = (void*)clCreateSubBuffer((cl_mem)tile->img_data_d, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+		SAMPLE_CHECK_ERRORS(err);
+		tile_comp->img_data_h = useSVM ? (int*)tile->img_data_h + tile_comp->img_data_offset : NULL;
+	}
+}
 
+/**
+ * @brief Copies the read back tile components into their place in the output planes.
+ */
+void Decoder::gatherTile(type_tile* tile, DecodedImage* out)
+{
+	for (unsigned int j = 0; j < tile->parent_img->num_components; j++) {
+		type_tile_comp* comp = tile->tile_comp + j;
+		int* src = (int*)comp->img_data_h;
+		if (!src)
+			continue;
+		int* dst = out->plane(j) + (size_t)tile->tly * out->width + tile->tlx;
+		for (unsigned int y = 0; y < comp->height; y++)
+			memcpy(dst + (size_t)y * out->width, src + (size_t)y * comp->width, comp->width * sizeof(int));
+	}
+}
+
+//release tile component device memory
+void Decoder::releaseTileBuffers(type_tile* tile)
+{
+	for (unsigned int j = 0; j < tile->parent_img->num_components; j++) {
+		type_tile_comp* comp = tile->tile_comp + j;
+		if (comp->img_data_h && !useSVM)
+			scheduler->releaseReadback(comp->img_data_h);
+		comp->img_data_h = NULL;
+	}
+	releaseDeviceBuffers(tile);
+	if (tile->img_data_h) {
+		// the wrapping buffers are gone and the image has completed, so nothing uses it any more
+		SharedMemory::free(_ocl->context, tile->img_data_h);
+		tile->img_data_h = NULL;
+	}
+}
+
+/**
+ * @brief Releases the device buffers of a tile but not its read back samples.
+ * Buffers already released are skipped.
+ */
+void Decoder::releaseDeviceBuffers(type_tile* tile)
+{
+	cl_int error_code = CL_SUCCESS;
+	for (unsigned int j = 0; j < tile->parent_img->num_components; j++) {
+		type_tile_comp* comp = tile->tile_comp + j;
+		if (!comp->img_data_d)
+			continue;
+		error_code = clReleaseMemObject((cl_mem)comp->img_data_d);
+		if (CL_SUCCESS != error_code)
+		{
+			LogError("Error: clReleaseMemObject return %s.\n", TranslateOpenCLError(error_code));
+		}
+		comp->img_data_d = NULL;
+	}
+	if (!tile->img_data_d)
+		return;
+	error_code = ResourceCounters::releaseBuffer((cl_mem)tile->img_data_d);
+	if (CL_SUCCESS != error_code)
+	{
+		LogError("Error: clReleaseMemObject return %s.\n", TranslateOpenCLError(error_code));
+	}
+	tile->img_data_d = NULL;
+}
+
+/**
+ * @brief Decodes a single tile of a parsed image on this decoder's device.
+ * @param tile
+ * @param out if not NULL, receives the decoded tile samples
+ * @return 0 on success, otherwise the device error
+ */
+int Decoder::decodeTile(type_tile* tile, DecodedImage* out)
+{
+	planner->reserve(tile, MemoryPlanner::estimateTile(tile, dev_alignment));
+	tDeviceRC rc;
+	try {
+		allocateTileBuffers(tile);
+		scheduler->reset();
+		scheduler->addTile(tile);
+		rc = scheduler->dispatch();
+	} catch (...) {
+		abandonTile(tile);
+		throw;
+	}
+	// whatever was enqueued must drain before the buffers go
+	tDeviceRC drained = scheduler->finish();
+	if (rc == DeviceSuccess)
+		rc = drained;
+
+	if (out && rc == DeviceSuccess)
+		gatherTile(tile, out);
+	releaseTileBuffers(tile);
+	planner->release(tile);
+	return rc;
+}
+
+/**
+ * @brief Decodes an image from a stream, tile-part by tile-part.
+ *
+ * Only the main header and the current tile-part need to be resident on the host. Each tile is
+ * dispatched as soon as its tile-part has been parsed, and its code-blocks are dropped once Tier-1
+ * has staged them. At most tilesInFlight tiles hold device memory; the oldest is handed to out
+ * and sink and released before another one is started.
+ * As in parse(), every tile must come in a single tile-part.
+ * @param out if not NULL, receives the decoded image
+ * @param sink if not NULL, receives every decoded tile; together with a NULL out, host and device
+ * memory stay bounded by a few tiles whatever the image size
+ * @param tilesInFlight tiles decoded at the same time, 0 for a row of tiles
+ * @return 0 on success, -1 if the stream does not hold a complete JP2 file or codestream,
+ * otherwise the device error
+ */
+int Decoder::decodeStream(InputStream* in, DecodedImage* out, DecodedTileSink sink, void* userData, unsigned int tilesInFlight)
+{
+	size_t got = 0;
+	uint64_t offset = 0;
+	const unsigned char* data = in->window(0, 12, &got);
+	if (!data)
+		return -1;
+
+	// boxes in front of the codestream are skipped by their length without being read
+	if (jp2_has_signature(data, got)) {
+		box b;
+		for (;;) {
+			data = in->window(offset, 16, &got);
+			if (!data || !read_box_header(data, got, &b))
+				return -1;
+			if (b.type == CODE_STREAM_BOX) {
+				offset += b.length - b.content_length;
+				break;
 			}
+			// a box without length runs to the end of the file
+			if (!(data[0] | data[1] | data[2] | data[3]))
+				return -1;
+			offset += b.length;
 		}
-	} else {
-		
-		type_buffer *src_buff = (type_buffer *) malloc(sizeof(type_buffer));
-		init_dec_buffer(buffer, data.size(), src_buff);
-		decode_codestream(src_buff, img);
-		free(src_buff);
-		
-	}
-
-	// Do decoding for all tiles
-	for(i = 0; i < img->num_tiles; i++) {
-		tile = img->tile + i;
-		if (coder)
-			coder->decode_tile(tile);
-		if (quantizer)
-		     quantizer->dequantize_tile(tile);
-		if (dwt)
-			dwt->iwt(tile);
-	}
-
-	if (preprocessor) {
-		if(img->use_mct == 1) {
-			// lossless decoder
-			if(img->wavelet_type == 0) {
-				preprocessor->color_decoder_lossless(img);
+	}
+
+	// the main header ends at the first SOT
+	TraceSpan span("decode stream");
+	unsigned int headerLength = 0;
+	for (size_t want = 4096; ; want *= 2) {
+		data = in->window(offset, want, &got);
+		if (!data)
+			return -1;
+		headerLength = main_header_length(data, got);
+		if (headerLength || got < want)
+			break;
+	}
+	if (!headerLength)
+		return -1;
+
+	type_image* img = plans.acquire(data, headerLength);
+	if (!img)
+		img = create_image();
+	img->in_file = "stream";
+	type_buffer buffer;
+	init_dec_buffer((unsigned char*)data, headerLength, &buffer);
+	decode_main_header(&buffer, img);
+	offset += headerLength;
+	if (out)
+		out->allocate(img->width, img->height, img->num_components);
+	if (tilesInFlight == 0)
+		tilesInFlight = img->num_xtiles;
+
+	type_parse_context ctx;
+	ctx.code_block_callback = handleCodeBlock;
+	ctx.user_data = this;
+	// tiles arrive one by one, there is nothing to parse concurrently
+	ctx.parse_tile_parts = NULL;
+	std::deque<StreamTile> inFlight;
+	StreamTilesGuard guard(this, inFlight);
+	int rc = 0;
+	for (;;) {
+		unsigned int tileNo = 0, length = 0;
+		data = in->window(offset, 12, &got);
+		if (!data || !peek_tile_part(data, got, &tileNo, &length)) {
+			if (!data || got < 2 || ((data[0] << 8) | data[1]) != EOC) {
+				LogError("Error: stream ends without EOC marker.\n");
+				rc = -1;
 			}
-			else { //lossy decoder
-				preprocessor->color_decoder_lossy(img);
+			break;
+		}
+		if (length == 0) {
+			// the last tile-part runs up to EOC
+			for (size_t want = 1024 * 1024; ; want *= 2) {
+				data = in->window(offset, want, &got);
+				if (!data || got < want)
+					break;
 			}
-		} else if (img->use_part2_mct == 1) {
-			//klt.decode_klt(img);
-			//part 2 not supported
-		} else {
-			if(img->sign == UNSIGNED) {
-				preprocessor->idc_level_shifting(img);
+			length = data && got >= 2 ? (unsigned int)got - 2 : 0;
+		}
+		data = in->window(offset, length, &got);
+		if (!data || got < length || tileNo >= img->num_tiles) {
+			LogError("Error: truncated tile-part %u.\n", tileNo);
+			rc = -1;
+			break;
+		}
+
+		type_tile* tile = img->tile + tileNo;
+		tile->arena = arena_create(0);
+		init_dec_buffer((unsigned char*)data, length, &buffer);
+		decode_tiles(&buffer, tile, &ctx);
+		offset += length;
+
+		rc = startStreamTile(tile, inFlight, out, sink, userData);
+		if (rc)
+			break;
+		if (inFlight.size() >= tilesInFlight) {
+			finishStreamTile(inFlight.front(), out, sink, userData);
+			inFlight.pop_front();
+		}
+	}
+	while (!inFlight.empty()) {
+		finishStreamTile(inFlight.front(), out, sink, userData);
+		inFlight.pop_front();
+	}
+	scheduler->reset();
+	recycle(img);
+	return rc;
+}
+
+/**
+ * @brief Decodes a file tile by tile and hands every tile to sink instead of assembling the image.
+ *
+ * The file is read through a sliding window, see decodeStream(), so images far larger than host
+ * or device memory decode with memory bounded by tilesInFlight tiles.
+ * @param tilesInFlight tiles decoded at the same time, 0 for a row of tiles
+ * @return 0 on success, -2 if the file could not be opened, -1 if it is not a complete image
+ */
+int Decoder::decodeTiles(const std::string& fileName, DecodedTileSink sink, void* userData, unsigned int tilesInFlight)
+{
+	FileInputStream in(fileName);
+	if (!in.isValid())
+		return -2;
+	return decodeStream(&in, NULL, sink, userData, tilesInFlight);
+}
+
+/**
+ * @brief The tile index of a file, from memory, from its sidecar or built by parsing the file.
+ * @param rebuild parse the file again even if the index looks current
+ * @return NULL if the file cannot be parsed
+ */
+const TileIndex* Decoder::index(const std::string& fileName, bool rebuild)
+{
+	std::map<std::string, TileIndex*>::iterator it = indexes.find(fileName);
+	if (it != indexes.end()) {
+		if (!rebuild && it->second->isCurrent(fileName))
+			return it->second;
+		delete it->second;
+		indexes.erase(it);
+	}
+	TileIndex* index = TileIndex::open(fileName, rebuild);
+	if (index)
+		indexes[fileName] = index;
+	return index;
+}
+
+/**
+ * @brief Decodes the tiles of a file that intersect a region, without Tier-2 parsing.
+ *
+ * Code-block offsets, lengths and significant bits come from the file's tile index, see index(),
+ * so only the main header and the code-blocks of the wanted tiles and resolutions are read.
+ * Code-blocks of resolution levels above maxResolution are neither read nor uploaded; the tiles
+ * still come out at full size, with the detail of those levels left out.
+ * @param sink receives every decoded tile, in raster order
+ * @return 0 on success, -2 if the file could not be opened, -1 if the index does not fit it,
+ * otherwise the device error
+ */
+int Decoder::decodeRegion(const std::string& fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+						  DecodedTileSink sink, void* userData, unsigned int maxResolution)
+{
+	const TileIndex* idx = index(fileName);
+	if (!idx)
+		return -2;
+	MemoryMapped data(fileName, MemoryMapped::WholeFile, MemoryMapped::RandomAccess);
+	if (!data.isValid() || data.size() != idx->fileSize)
+		return -2;
+
+	TraceSpan span("decode region");
+	const unsigned char* base = data.getData();
+	type_image* img = NULL;
+	for (int attempt = 0; attempt < 2 && !img; attempt++) {
+		if (attempt) {
+			// the file was rewritten without changing its size or modification time
+			idx = index(fileName, true);
+			if (!idx || data.size() != idx->fileSize)
+				return -2;
+		}
+		img = plans.acquire(base + idx->headerOffset, idx->headerLength);
+		if (!img)
+			img = create_image();
+		img->in_file = fileName.c_str();
+		type_buffer buffer;
+		init_dec_buffer((unsigned char*)base + idx->headerOffset, idx->headerLength, &buffer);
+		decode_main_header(&buffer, img);
+		if (img->header_hash != idx->headerHash) {
+			recycle(img);
+			img = NULL;
+		}
+	}
+	if (!img)
+		return -1;
+	if (img->num_tiles != idx->tiles.size()) {
+		recycle(img);
+		return -1;
+	}
+
+	std::deque<StreamTile> inFlight;
+	StreamTilesGuard guard(this, inFlight);
+	int rc = 0;
+	for (unsigned int t = 0; t < img->num_tiles && rc == 0; t++) {
+		type_tile* tile = img->tile + t;
+		if (tile->brx <= x || tile->tlx >= x + width || tile->bry <= y || tile->tly >= y + height)
+			continue;
+
+		const unsigned char* tilePart = base + idx->tiles[t].offset;
+		size_t n = idx->tiles[t].firstCodeBlock;
+		tile->arena = arena_create(0);
+		for (unsigned int c = 0; c < img->num_components && rc == 0; c++) {
+			type_tile_comp* tile_comp = tile->tile_comp + c;
+			for (unsigned int r = 0; r < tile_comp->num_rlvls && rc == 0; r++) {
+				type_res_lvl* res_lvl = tile_comp->res_lvls + r;
+				bool wanted = res_lvl->res_lvl_no <= maxResolution;
+				for (unsigned int s = 0; s < res_lvl->num_subbands && rc == 0; s++) {
+					type_subband* sb = res_lvl->subbands + s;
+					if (n + sb->num_cblks > idx->codeBlocks.size()) {
+						rc = -1;
+						break;
+					}
+					for (unsigned int k = 0; k < sb->num_cblks; k++) {
+						type_codeblock* cblk = sb->cblks + k;
+						const CodeBlockIndexEntry& entry = idx->codeBlocks[n++];
+						if ((uint64_t)entry.offset + entry.length > idx->tiles[t].length) {
+							rc = -1;
+							break;
+						}
+						cblk->length = wanted ? entry.length : 0;
+						cblk->significant_bits = wanted ? entry.significantBits : 0;
+						cblk->num_coding_passes = wanted ? entry.numCodingPasses : 0;
+						cblk->codestream = (unsigned char*)tilePart;
+						if (cblk->length)
+							parsedCodeBlock(cblk, (unsigned char*)tilePart + entry.offset);
+					}
+				}
 			}
 		}
+		if (rc) {
+			arena_destroy(tile->arena);
+			tile->arena = NULL;
+			break;
+		}
+
+		rc = startStreamTile(tile, inFlight, NULL, sink, userData);
+		if (rc)
+			break;
+		if (inFlight.size() >= 2) {
+			finishStreamTile(inFlight.front(), NULL, sink, userData);
+			inFlight.pop_front();
+		}
+	}
+	while (!inFlight.empty()) {
+		finishStreamTile(inFlight.front(), NULL, sink, userData);
+		inFlight.pop_front();
 	}
+	scheduler->reset();
+	recycle(img);
+	return rc;
+}
 
-	clFinish(_ocl->commandQueue);
-	//map component memory from device to host
-	for (i = 0; i < img->num_tiles; i++) {
-		type_tile* tile = img->tile + i;
-		for (j = 0; j < tile->parent_img->num_components; j++) {
-			    mapComponentToHost( tile->tile_comp + j);
+/**
+ * @brief Dispatches a parsed tile of a streaming decode and frees its code-block arena.
+ *
+ * Only this thread releases the tiles in flight, so if the tile does not fit into the budget
+ * next to them they are finished first instead of being waited for.
+ * @return DeviceSuccess, otherwise the tile has been released and is not in flight
+ */
+tDeviceRC Decoder::startStreamTile(type_tile* tile, std::deque<StreamTile>& inFlight, DecodedImage* out, DecodedTileSink sink, void* userData)
+{
+	size_t bytes = MemoryPlanner::estimateTile(tile, dev_alignment);
+	while (!planner->tryReserve(tile, bytes)) {
+		if (inFlight.empty()) {
+			planner->reserve(tile, bytes);
+			break;
 		}
+		finishStreamTile(inFlight.front(), out, sink, userData);
+		inFlight.pop_front();
+	}
+	tDeviceRC rc;
+	try {
+		allocateTileBuffers(tile);
+		scheduler->reset();
+		scheduler->addTile(tile);
+		rc = scheduler->dispatch();
+	} catch (...) {
+		abandonTile(tile);
+		arena_destroy(tile->arena);
+		tile->arena = NULL;
+		throw;
+	}
+	// Tier-1 has copied the code-blocks into its staging memory
+	if (tile->arena) {
+		arena_destroy(tile->arena);
+		tile->arena = NULL;
+	}
+	if (rc != DeviceSuccess) {
+		abandonTile(tile);
+		return rc;
+	}
+	inFlight.push_back(StreamTile(tile, scheduler->retainTileDone(tile)));
+	return DeviceSuccess;
+}
+
+/**
+ * @brief Waits for a tile of a streaming decode, hands it to out and sink and releases its buffers.
+ */
+void Decoder::finishStreamTile(StreamTile& pending, DecodedImage* out, DecodedTileSink sink, void* userData)
+{
+	type_tile* tile = pending.first;
+	if (pending.second) {
+		cl_int err = clWaitForEvents(1, &pending.second);
+		SAMPLE_CHECK_ERRORS(err);
+		clReleaseEvent(pending.second);
+	}
+	if (out)
+		gatherTile(tile, out);
+	if (sink) {
+		std::vector<const int*> planes(tile->parent_img->num_components);
+		for (unsigned int j = 0; j < planes.size(); j++)
+			planes[j] = (const int*)tile->tile_comp[j].img_data_h;
+		DecodedTile decoded;
+		decoded.tileNo = tile->tile_no;
+		decoded.x = tile->tlx;
+		decoded.y = tile->tly;
+		decoded.width = tile->width;
+		decoded.height = tile->height;
+		decoded.numComponents = (unsigned int)planes.size();
+		decoded.planes = planes.empty() ? NULL : &planes[0];
+		sink(decoded, userData);
+	}
+	releaseTileBuffers(tile);
+	planner->release(tile);
+}
+
+/**
+ * @brief Undoes a single tile whose dispatch has failed or thrown: drains the queues and releases
+ * the tile's device memory and its reservation, so later reservations do not wait for it.
+ */
+void Decoder::abandonTile(type_tile* tile)
+{
+	scheduler->finish();
+	scheduler->reset();
+	releaseTileBuffers(tile);
+	planner->release(tile);
+}
+
+/**
+ * @brief Releases the tiles of a streaming decode that has thrown, without handing them on.
+ */
+void Decoder::dropStreamTiles(std::deque<StreamTile>& inFlight)
+{
+	scheduler->finish();
+	scheduler->reset();
+	for (size_t i = 0; i < inFlight.size(); i++) {
+		if (inFlight[i].second)
+			clReleaseEvent(inFlight[i].second);
+		releaseTileBuffers(inFlight[i].first);
+		planner->release(inFlight[i].first);
 	}
+	inFlight.clear();
+}
+
+/**
+ * @brief Limits how many uncollected jobs one decoder may hold; 4 by default.
+ * @param jobs maximum number of jobs in flight, 0 is treated as 1
+ */
+void Decoder::setMaxJobsInFlight(unsigned int jobs)
+{
+	std::lock_guard<std::mutex> lock(jobsLock);
+	maxJobsInFlight = jobs ? jobs : 1;
+	jobLeft.notify_all();
+}
+
+/**
+ * @brief Takes a job slot, waiting for another job to be collected if all slots are taken.
+ */
+void Decoder::admit(DecodeJob* job)
+{
+	std::unique_lock<std::mutex> lock(jobsLock);
+	while (jobsInFlight >= maxJobsInFlight)
+		jobLeft.wait(lock);
+	jobsInFlight++;
+	job->admitted = true;
+}
+
+/**
+ * @brief Returns the job slot and the memory reservation of a collected job.
+ */
+void Decoder::leave(DecodeJob* job)
+{
+	planner->release(job);
+	std::lock_guard<std::mutex> lock(jobsLock);
+	jobsInFlight--;
+	job->admitted = false;
+	jobLeft.notify_all();
+}
+
+/**
+ * @brief Parses an image and enqueues all of its device work without waiting for it.
+ *
+ * Several jobs may be in flight on one decoder; jobs must be submitted from a single thread.
+ * Submitting blocks while the maximum number of jobs is uncollected or the memory budget is
+ * exhausted, so when more than one job is outstanding they must be collected on another
+ * thread, as BatchDecoder's writer does.
+ * @param fileName
+ * @param callback called from an OpenCL runtime thread once the job has completed
+ * @param userData passed to callback
+ * @return job handle, NULL if the file could not be opened. The caller deletes it.
+ */
+DecodeJob* Decoder::decodeAsync(const std::string& fileName, DecodeCompletionCallback callback, void* userData)
+{
+	DecodeJob* job = new DecodeJob(this, fileName, callback, userData);
+	job->img = parse(job->fileName);
+	if (!job->img) {
+		delete job;
+		return NULL;
+	}
+	try {
+		submit(job);
+	} catch (...) {
+		recycle(abandon(job));
+		throw;
+	}
+	return job;
+}
+
+/**
+ * @brief Enqueues the device work of an image that has already been parsed.
+ *
+ * Parsing does not touch the device, so another thread may parse the next image meanwhile.
+ * @param img parsed image, owned by the returned job; if this throws, img stays with the caller
+ * @param fileName the name img was parsed from; must outlive the job
+ */
+DecodeJob* Decoder::decodeAsync(type_image* img, const std::string& fileName, DecodeCompletionCallback callback, void* userData)
+{
+	DecodeJob* job = new DecodeJob(this, fileName, callback, userData);
+	job->img = img;
+	try {
+		submit(job);
+	} catch (...) {
+		abandon(job);
+		throw;
+	}
+	return job;
+}
+
+/**
+ * @brief Undoes a submit that has thrown: drains the queues, releases the device memory of the
+ * job's image and deletes the job.
+ * @return the job's image, without device buffers
+ */
+type_image* Decoder::abandon(DecodeJob* job)
+{
+	type_image* img = job->img;
+	scheduler->finish();
+	scheduler->reset();
+	for (unsigned int i = 0; i < img->num_tiles; i++)
+		releaseTileBuffers(img->tile + i);
+	job->img = NULL;
+	delete job;
+	return img;
+}
+
+/**
+ * @brief Enqueues the device work of a parsed image once its estimated device memory fits into
+ * the budget; images that never fit are decoded in batches of tiles, see submitBatched().
+ */
+void Decoder::submit(DecodeJob* job)
+{
+	admit(job);
+	type_image *img = job->img;
+	size_t bytes = MemoryPlanner::estimateImage(img, dev_alignment);
+	if (bytes > planner->getBudget() && img->num_tiles > 1) {
+		submitBatched(job);
+		return;
+	}
+	// held until the job is collected
+	planner->reserve(job, bytes);
+
+	unsigned int i;
+	for (i = 0; i < img->num_tiles; i++)
+		allocateTileBuffers(img->tile + i);
+
+	// Do decoding for all tiles: stages of independent components overlap across queues,
+	// and every tile is read back into pinned memory as soon as its MCT has finished
+	scheduler->build(img);
+	cl_int err = scheduler->dispatch();
+	if (err == CL_SUCCESS)
+		err = scheduler->join();
+	if (err != CL_SUCCESS) {
+		// the job releases the buffers once whatever was enqueued has drained
+		scheduler->finish();
+		scheduler->reset();
+	}
+	SAMPLE_CHECK_ERRORS(err);
+
+	err = clEnqueueMarkerWithWaitList(scheduler->getQueue(), 0, NULL, &job->done);
+	SAMPLE_CHECK_ERRORS(err);
+	Tracer::device(job->done, "decode done", true);
+	err = clFlush(scheduler->getQueue());
+	SAMPLE_CHECK_ERRORS(err);
+
+	scheduler->reset();
+	job->start();
+}
+
+/**
+ * @brief Decodes an image larger than the memory budget in batches of tiles that fit.
+ *
+ * Every batch is decoded and read back before the next one is allocated, so only the read back
+ * samples stay until the job is collected. In shared virtual memory the samples are the device
+ * buffers and are kept as well. Unlike submit() this waits for the device.
+ */
+void Decoder::submitBatched(DecodeJob* job)
+{
+	type_image *img = job->img;
+	std::vector<unsigned int> ends = planner->planBatches(img, dev_alignment);
+	unsigned int first = 0;
+	for (size_t b = 0; b < ends.size(); b++) {
+		size_t bytes = 0;
+		for (unsigned int i = first; i < ends[b]; i++)
+			bytes += MemoryPlanner::estimateTile(img->tile + i, dev_alignment);
+		planner->reserve(job, bytes);
+
+		scheduler->reset();
+		for (unsigned int i = first; i < ends[b]; i++) {
+			allocateTileBuffers(img->tile + i);
+			scheduler->addTile(img->tile + i);
+		}
+		cl_int err = scheduler->dispatch();
+		cl_int drained = scheduler->finish();
+		if (err == CL_SUCCESS)
+			err = drained;
+		if (err != CL_SUCCESS)
+			scheduler->reset();
+		SAMPLE_CHECK_ERRORS(err);
+		if (!useSVM) {
+			for (unsigned int i = first; i < ends[b]; i++)
+				releaseDeviceBuffers(img->tile + i);
+		}
+		planner->release(job);
+		first = ends[b];
+	}
+
+	cl_int err = clEnqueueMarkerWithWaitList(scheduler->getQueue(), 0, NULL, &job->done);
+	SAMPLE_CHECK_ERRORS(err);
+	Tracer::device(job->done, "decode done", true);
+	err = clFlush(scheduler->getQueue());
+	SAMPLE_CHECK_ERRORS(err);
+
+	scheduler->reset();
+	job->start();
+}
+
+/**
+ * @brief Decodes a file and waits for it.
+ * @param out if not NULL, receives the decoded image
+ * @return 0 on success, -2 if the file could not be opened, -1 if decoding failed
+ */
+int Decoder::decode(std::string fileName, DecodedImage* out)
+{
+	double t1 = time_stamp();
+	ResourceCounters::resetPeaks();
+	DecodeJob* job = NULL;
+	try {
+		job = decodeAsync(fileName);
+	} catch (const Error& error) {
+		// a stage failed to enqueue, e.g. an MCT the tile does not fit
+		LogError("Error: decoding %s failed: %s\n", fileName.c_str(), error.what());
+		return -1;
+	}
+	if (!job)
+		return -2;
+	job->wait();
 
 	double t2 = time_stamp();
 	int diff =  (int)((t2 - t1)*1000);
 	printf("Decode time: %d ms ",diff);
 
-	//release tile component device memory
-	cl_int error_code = CL_SUCCESS;
-	for (i = 0; i < img->num_tiles; i++) {
-		type_tile* tile = img->tile + i;
-		for (j = 0; j < tile->parent_img->num_components; j++) {
-			type_tile_comp* comp = tile->tile_comp + j;
-			error_code = clEnqueueUnmapMemObject(_ocl->commandQueue,(cl_mem)comp->img_data_d, comp->img_data_h,0,NULL,NULL);
-			if (CL_SUCCESS != error_code)
-			{
-				LogError("Error: clEnqueueUnmapMemObject return %s.\n", TranslateOpenCLError(error_code));
-			}
-			error_code = clReleaseMemObject((cl_mem)comp->img_data_d);
-			if (CL_SUCCESS != error_code)
-			{
-				LogError("Error: clReleaseMemObject return %s.\n", TranslateOpenCLError(error_code));
-			}
-		}
+	int rc = job->collect(out);
+	if (ResourceCounters::reporting()) {
+		ResourceCounters::print(job->getUsage(), "Decode resources:");
+		printf("Decode plans: %lu reused, %lu built\n", (unsigned long)plans.getHits(), (unsigned long)plans.getMisses());
+		printf("Device memory: budget %.1f MB, peak reserved %.1f MB, %lu waits for capacity\n",
+			planner->getBudget() / 1048576.0, planner->getPeakReserved() / 1048576.0, planner->getWaits());
 	}
-
-	free_image(img);
-	scanf("%d");
-	return 0;
-}
\ No newline at end of file
+	delete job;
+	return rc;
+}
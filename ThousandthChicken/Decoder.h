@@ -2,10 +2,19 @@
 
 #pragma once
 
-#include "CoefficientCoder.h"
-#include "Quantizer.h"
-#include "DWT.h"
-#include "Preprocessor.h"
+#include "DecodeScheduler.h"
+#include "DecodedImage.h"
+#include "DecodeJob.h"
+#include "DecodePlanCache.h"
+#include "MemoryPlanner.h"
+#include "codestream.h"
+#include "InputStream.h"
+#include "ThreadPool.h"
+#include "TileIndex.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
 
 
@@ -14,20 +23,71 @@ struct ocl_args_d_t;
 class Decoder
 {
 public:
-	Decoder(ocl_args_d_t* ocl);
+	Decoder(ocl_args_d_t* ocl, int numQueues = 2);
 	~Decoder(void);
-	int decode(std::string fileName);
+	int decode(std::string fileName, DecodedImage* out = NULL);
+	DecodeJob* decodeAsync(const std::string& fileName, DecodeCompletionCallback callback = NULL, void* userData = NULL);
+	DecodeJob* decodeAsync(type_image* img, const std::string& fileName, DecodeCompletionCallback callback = NULL, void* userData = NULL);
+	type_image* parse(const std::string& fileName);
+	static int probe(const std::string& fileName, type_image_info* info);
+	static int probe(const unsigned char* data, size_t size, type_image_info* info);
+	int decodeTile(type_tile* tile, DecodedImage* out);
+	int decodeStream(InputStream* in, DecodedImage* out = NULL, DecodedTileSink sink = NULL, void* userData = NULL, unsigned int tilesInFlight = 2);
+	int decodeTiles(const std::string& fileName, DecodedTileSink sink, void* userData = NULL, unsigned int tilesInFlight = 2);
+	int decodeRegion(const std::string& fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+		DecodedTileSink sink, void* userData = NULL, unsigned int maxResolution = (unsigned int)-1);
+	const TileIndex* index(const std::string& fileName, bool rebuild = false);
 	void parsedCodeBlock(type_codeblock* cblk, unsigned char* codestream);
+	void setParseThreads(unsigned int numThreads);
+	void setMaxJobsInFlight(unsigned int jobs);
+	void parseTileParts(type_image* img, type_tile_part* parts, type_parse_context* ctx);
+	/** @brief Frees a parsed image, or keeps its tree for the next frame with the same main header */
+	void recycle(type_image* img);
 private:
+	friend class DecodeJob;
+	friend class StageBenchmark;
+	void allocateTileBuffers(type_tile* tile);
+	void gatherTile(type_tile* tile, DecodedImage* out);
+	void releaseTileBuffers(type_tile* tile);
+	void releaseDeviceBuffers(type_tile* tile);
+	void admit(DecodeJob* job);
+	void leave(DecodeJob* job);
+	void submit(DecodeJob* job);
+	void submitBatched(DecodeJob* job);
+	type_image* abandon(DecodeJob* job);
+	/** A tile of a streaming decode and the event of its readback */
+	typedef std::pair<type_tile*, cl_event> StreamTile;
+	tDeviceRC startStreamTile(type_tile* tile, std::deque<StreamTile>& inFlight, DecodedImage* out, DecodedTileSink sink, void* userData);
+	void finishStreamTile(StreamTile& pending, DecodedImage* out, DecodedTileSink sink, void* userData);
+	void abandonTile(type_tile* tile);
+	void dropStreamTiles(std::deque<StreamTile>& inFlight);
+	/** Drops the tiles still in flight when a streaming decode unwinds */
+	struct StreamTilesGuard {
+		Decoder* decoder;
+		std::deque<StreamTile>& inFlight;
+		StreamTilesGuard(Decoder* d, std::deque<StreamTile>& tiles) : decoder(d), inFlight(tiles) {}
+		~StreamTilesGuard() { if (!inFlight.empty()) decoder->dropStreamTiles(inFlight); }
+	};
 
 	ocl_args_d_t* _ocl;
-	CoefficientCoder* coder;
-	Quantizer* quantizer;
-	DWT* dwt;
-	Preprocessor* preprocessor;
+	DecodeScheduler* scheduler;
+	/** Trees of collected images, reused by frames with an identical main header */
+	DecodePlanCache plans;
+	/** Device memory budget shared with every decoder of the context */
+	MemoryPlanner* planner;
+	/** Jobs submitted and not collected yet, at most maxJobsInFlight */
+	unsigned int jobsInFlight;
+	unsigned int maxJobsInFlight;
+	std::mutex jobsLock;
+	std::condition_variable jobLeft;
+	/** Tile indexes of the files decoded by region, by file name */
+	std::map<std::string, TileIndex*> indexes;
+	/** Threads parse() parses tiles with; NULL parses them in order on the calling thread */
+	ThreadPool* parsePool;
 
 	cl_uint dev_alignment ;
-	cl_int mapComponentToHost(type_tile_comp* tile_comp);
+	/** Tile components live in shared virtual memory and need no readback */
+	bool useSVM;
 
 
 };
@@ -1,18 +1,18 @@
 // License: please see LICENSE1 file for more details.
 #include "DeviceKernel.h"
-
-#include "opencv2/core/core.hpp"
-#include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/highgui/highgui.hpp"
-
-using namespace cv;
+#include "Tracer.h"
+#include "ResourceCounters.h"
+#include <map>
+#include <mutex>
+#include <stdio.h>
 
 
 DeviceKernel::DeviceKernel(KernelInitInfo initInfo) : myKernel(0),
                                     queue(initInfo.cmd_queue),
                                     program(0),
                                     device(0),
-                                    context(0)
+                                    context(0),
+                                    traceName(initInfo.programName + ":" + initInfo.kernelName)
 {
     CreateAndBuildKernel(initInfo.programName, initInfo.kernelName, initInfo.buildOptions);
     deviceQueue = new DeviceQueue(QueueInfo(queue));
@@ -37,8 +37,7 @@ int ReadSourceFromFile(const char* fileName, char** source, size_t* sourceSize)
 {
     int errorCode = CL_SUCCESS;
 
-    FILE* fp = NULL;
-    fopen_s(&fp, fileName, "rb");
+    FILE* fp = fopen(fileName, "rb");
     if (fp == NULL)
     {
         LogError("Error: Couldn't find program source file '%s'.\n", fileName);
@@ -58,45 +57,22 @@ int ReadSourceFromFile(const char* fileName, char** source, size_t* sourceSize)
         else {
             fread(*source, 1, *sourceSize, fp);
         }
+        fclose(fp);
     }
     return errorCode;
 }
 
 
-// Create and build the OpenCL program and create the kernel
-// The kernel returns in ocl
-int DeviceKernel::CreateAndBuildKernel(string openCLFileName, string kernelName, string buildOptions)
+// Create and build an OpenCL program from a source file
+static cl_program BuildProgram(cl_context context, cl_device_id device, const string& openCLFileName, const string& buildOptions, cl_int* errorCode)
 {
     cl_int error_code;
     size_t src_size = 0;
-
-    // Obtaing the OpenCL context from the command-queue properties
-    error_code = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
-    if (CL_SUCCESS != error_code)
-    {
-        LogError("Error: clGetCommandQueueInfo (CL_QUEUE_CONTEXT) returned %s.\n", TranslateOpenCLError(error_code));
-        goto Finish;
-    }
-
-    // Obtain the OpenCL device from the command-queue properties
-    error_code = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
-    if (CL_SUCCESS != error_code)
-    {
-        LogError("Error: clGetCommandQueueInfo (CL_QUEUE_DEVICE) returned %s.\n", TranslateOpenCLError(error_code));
-        goto Finish;
-    }
-
-
-    error_code = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMemorySize, 0);
-    if (CL_SUCCESS != error_code)
-    {
-        LogError("Error: clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE) returned %s.\n", TranslateOpenCLError(error_code));
-        goto Finish;
-    }
+    char* source = NULL;
+    cl_program program = NULL;
 
     // Upload the OpenCL C source code from the input file to source
     // The size of the C program is returned in sourceSize
-    char* source = NULL;
     error_code = ReadSourceFromFile(openCLFileName.c_str(), &source, &src_size);
     if (CL_SUCCESS != error_code)
     {
@@ -130,21 +106,93 @@ int DeviceKernel::CreateAndBuildKernel(string openCLFileName, string kernelName,
         printf("Build Fail Log: \n\t%s\n", build_log);
 
         delete[] build_log;
+        clReleaseProgram(program);
+        program = NULL;
         goto Finish;
     }
+Finish:
+    if (source)
+    {
+        delete[] source;
+        source = NULL;
+    }
+    *errorCode = error_code;
+    return program;
+}
+
+// Programs are built once per context, device, source file and build options, and shared by
+// every kernel instance. Each DeviceKernel still creates its own cl_kernel, so instances used
+// from different threads never share kernel arguments.
+typedef pair<pair<cl_context, cl_device_id>, string> ProgramKey;
+static map<ProgramKey, cl_program> programCache;
+static mutex programCacheLock;
+
+// Returns a retained program from the cache, building it on first use
+static cl_program AcquireProgram(cl_context context, cl_device_id device, const string& openCLFileName, const string& buildOptions, cl_int* errorCode)
+{
+    ProgramKey key(make_pair(context, device), openCLFileName + "\n" + buildOptions);
+
+    lock_guard<mutex> guard(programCacheLock);
+    map<ProgramKey, cl_program>::iterator it = programCache.find(key);
+    if (it == programCache.end())
+    {
+        cl_program program = BuildProgram(context, device, openCLFileName, buildOptions, errorCode);
+        if (!program)
+            return NULL;
+        it = programCache.insert(make_pair(key, program)).first;
+    }
+    *errorCode = clRetainProgram(it->second);
+    return it->second;
+}
+
+// Drop the cache's references, e.g. before the contexts are released
+void DeviceKernel::ReleaseProgramCache()
+{
+    lock_guard<mutex> guard(programCacheLock);
+    for (map<ProgramKey, cl_program>::iterator it = programCache.begin(); it != programCache.end(); ++it)
+        clReleaseProgram(it->second);
+    programCache.clear();
+}
+
+// Get the (shared) OpenCL program and create this instance's kernel
+int DeviceKernel::CreateAndBuildKernel(string openCLFileName, string kernelName, string buildOptions)
+{
+    cl_int error_code;
+
+    // Obtaing the OpenCL context from the command-queue properties
+    error_code = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: clGetCommandQueueInfo (CL_QUEUE_CONTEXT) returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    // Obtain the OpenCL device from the command-queue properties
+    error_code = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: clGetCommandQueueInfo (CL_QUEUE_DEVICE) returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+
+    error_code = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMemorySize, 0);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE) returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    program = AcquireProgram(context, device, openCLFileName, buildOptions, &error_code);
+    if (!program)
+        return error_code;
 
     // Create the required kernel
     myKernel = clCreateKernel(program, kernelName.c_str(), &error_code);
     if (CL_SUCCESS != error_code)
     {
         LogError("Error: clCreateKernel returned %s.\n", TranslateOpenCLError(error_code));
-        goto Finish;
-    }
-Finish:
-    if (source)
-    {
-        delete[] source;
-        source = NULL;
+        return error_code;
     }
     return error_code;
 }
@@ -187,11 +235,14 @@ tDeviceRC DeviceKernel::enqueue(int dimension, size_t global_work_offset[3], siz
     // The number of dimensions to be used by the global work-items and by work-items in the work-group is 2
     // The global IDs start at offset (0, 0)
     // The command should be executed immediately (without conditions)
-    cl_int error_code = clEnqueueNDRangeKernel(queue, myKernel, dimension, global_work_offset, global_work_size, local_work_size, 0, NULL, NULL);
+    cl_event traceEvent;
+    cl_int error_code = clEnqueueNDRangeKernel(queue, myKernel, dimension, global_work_offset, global_work_size, local_work_size, 0, NULL, Tracer::event(&traceEvent));
     if (CL_SUCCESS != error_code)
     {
         LogError("Error: clEnqueueNDRangeKernel returned %s.\n", TranslateOpenCLError(error_code));
         return error_code;
     }
+    Tracer::device(traceEvent, traceName);
+    ResourceCounters::add(COUNTER_LAUNCHES);
 	return CL_SUCCESS;
 }
@@ -19,6 +19,8 @@ public:
 	tDeviceRC enqueue(int dimension, size_t global_work_offset[3], size_t global_work_size[3], size_t local_work_size[3]);
 	tDeviceRC execute(int dimension, size_t global_work_offset[3], size_t global_work_size[3],  size_t local_work_size[3]);
 	tDeviceRC finish() { return deviceQueue->finish();}
+	cl_ulong getLocalMemorySize() { return localMemorySize;}
+	static void ReleaseProgramCache();
 protected:
 	int CreateAndBuildKernel(string openCLFileName, string kernelName, string buildOptions);
 	cl_kernel myKernel;
@@ -28,5 +30,7 @@ protected:
 	cl_device_id device;
 	cl_context context;
 	DeviceQueue* deviceQueue;
+	// program and kernel name, labels this kernel's launches in traces
+	string traceName;
 };
 
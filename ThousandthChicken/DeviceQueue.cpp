@@ -1,5 +1,6 @@
 #include "DeviceQueue.h"
 #include "ocl_util.h"
+#include "Tracer.h"
 
 DeviceQueue::DeviceQueue(QueueInfo info) : queue(info.cmd_queue)
 {
@@ -33,4 +34,32 @@ tDeviceRC DeviceQueue::flush(void)
         return error_code;
     }
     return CL_SUCCESS;
-}
\ No newline at end of file
+}
+
+tDeviceRC DeviceQueue::enqueueBarrier(cl_uint numEvents, const cl_event* events)
+{
+    if (numEvents == 0)
+        return CL_SUCCESS;
+    cl_event traceEvent;
+    cl_int error_code = clEnqueueBarrierWithWaitList(queue, numEvents, events, Tracer::event(&traceEvent));
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: clEnqueueBarrierWithWaitList returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    Tracer::device(traceEvent, "barrier");
+    return CL_SUCCESS;
+}
+
+tDeviceRC DeviceQueue::enqueueMarker(cl_event* event)
+{
+    cl_int error_code = clEnqueueMarkerWithWaitList(queue, 0, NULL, event);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: clEnqueueMarkerWithWaitList returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    if (event)
+        Tracer::device(*event, "marker", true);
+    return CL_SUCCESS;
+}
@@ -10,6 +10,11 @@ public:
 	~DeviceQueue(void);
 	tDeviceRC finish();
 	tDeviceRC flush();
+	// hold back later commands in this queue until the given events complete
+	tDeviceRC enqueueBarrier(cl_uint numEvents, const cl_event* events);
+	// returns an event that completes when all earlier commands in this queue complete
+	tDeviceRC enqueueMarker(cl_event* event);
+	cl_command_queue getQueue() { return queue;}
 private:
 	cl_command_queue queue;
 };
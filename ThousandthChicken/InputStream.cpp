@@ -0,0 +1,98 @@
+// License: please see LICENSE1 file for more details.
+
+#include "InputStream.h"
+#include <string.h>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+// mappings must start at a multiple of the page size, and of the allocation granularity on Windows
+#define MAPPING_ALIGNMENT (64 * 1024)
+
+
+FileInputStream::FileInputStream(const std::string& fileName, size_t windowBytes) :
+									file(fileName, windowBytes, MemoryMapped::SequentialScan),
+									windowBytes(windowBytes),
+									mappedOffset(0)
+{
+	peakResident = file.mappedSize();
+}
+
+const unsigned char* FileInputStream::window(uint64_t offset, size_t bytes, size_t* got)
+{
+	*got = 0;
+	if (offset >= file.size())
+		return NULL;
+	if (offset + bytes > file.size())
+		bytes = (size_t)(file.size() - offset);
+
+	if (!file.getData() || offset < mappedOffset || offset + bytes > mappedOffset + file.mappedSize()) {
+		uint64_t start = offset & ~(uint64_t)(MAPPING_ALIGNMENT - 1);
+		size_t length = (size_t)(offset - start) + bytes;
+		if (length < windowBytes)
+			length = windowBytes;
+		if (!file.remap(start, length))
+			return NULL;
+		mappedOffset = start;
+		if (file.mappedSize() > peakResident)
+			peakResident = file.mappedSize();
+	}
+	*got = bytes;
+	return file.getData() + (size_t)(offset - mappedOffset);
+}
+
+
+PipeInputStream::PipeInputStream(FILE* fp, size_t chunkBytes) : fp(fp),
+									chunkBytes(chunkBytes),
+									bufferOffset(0),
+									eof(false)
+{
+#if defined(_WIN32) || defined(WIN32)
+	_setmode(_fileno(fp), _O_BINARY);
+#endif
+}
+
+const unsigned char* PipeInputStream::window(uint64_t offset, size_t bytes, size_t* got)
+{
+	*got = 0;
+	if (offset < bufferOffset)
+		return NULL;
+
+	// drop what lies in front of the window
+	size_t drop = (size_t)(offset - bufferOffset);
+	if (drop >= buffer.size()) {
+		// skipped bytes that were never buffered are read and discarded
+		uint64_t skip = offset - bufferOffset - buffer.size();
+		buffer.clear();
+		std::vector<unsigned char> scratch(chunkBytes);
+		while (skip > 0 && !eof) {
+			size_t n = fread(&scratch[0], 1, skip < chunkBytes ? (size_t)skip : chunkBytes, fp);
+			if (n == 0)
+				eof = true;
+			skip -= n;
+		}
+		bufferOffset = offset - skip;
+	} else if (drop > 0) {
+		buffer.erase(buffer.begin(), buffer.begin() + drop);
+		bufferOffset = offset;
+	}
+
+	while (buffer.size() < bytes && !eof) {
+		size_t have = buffer.size();
+		size_t want = bytes - have > chunkBytes ? bytes - have : chunkBytes;
+		buffer.resize(have + want);
+		size_t n = fread(&buffer[have], 1, want, fp);
+		buffer.resize(have + n);
+		if (n < want)
+			eof = true;
+	}
+	if (buffer.capacity() > peakResident)
+		peakResident = buffer.capacity();
+
+	if (offset != bufferOffset)
+		return NULL;
+	*got = buffer.size() < bytes ? buffer.size() : bytes;
+	return buffer.empty() ? NULL : &buffer[0];
+}
@@ -0,0 +1,72 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "MemoryMapped.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Forward-only source of an encoded image that keeps a bounded window of it resident.
+ *
+ * The parser asks for the bytes of one header or tile-part at a time; bytes in front of the
+ * last requested offset may be dropped, so memory stays at the size of the largest tile-part
+ * rather than the size of the file.
+ */
+class InputStream
+{
+public:
+	virtual ~InputStream(void) {}
+	/**
+	 * @brief Makes bytes [offset, offset + bytes) resident.
+	 * @param offset must not be smaller than the offset of the previous call
+	 * @param got receives the number of bytes returned, fewer than bytes at the end of the stream
+	 * @return the bytes, valid until the next call; NULL if none are left or the stream could not be read
+	 */
+	virtual const unsigned char* window(uint64_t offset, size_t bytes, size_t* got) = 0;
+	/** @brief Largest window held so far, in bytes */
+	size_t getPeakResident() const { return peakResident; }
+
+protected:
+	InputStream(void) : peakResident(0) {}
+	size_t peakResident;
+};
+
+/**
+ * @brief Slides a memory mapping over a file with MemoryMapped::remap.
+ */
+class FileInputStream : public InputStream
+{
+public:
+	/** @param windowBytes smallest mapping; larger requests map more */
+	FileInputStream(const std::string& fileName, size_t windowBytes = 4 * 1024 * 1024);
+	bool isValid() const { return file.isValid(); }
+	const unsigned char* window(uint64_t offset, size_t bytes, size_t* got);
+
+private:
+	MemoryMapped file;
+	size_t windowBytes;
+	/** File offset of the current mapping */
+	uint64_t mappedOffset;
+};
+
+/**
+ * @brief Reads a pipe or any other stdio stream in chunks into a buffer that only holds
+ * the bytes from the current window on.
+ */
+class PipeInputStream : public InputStream
+{
+public:
+	/** @param fp read until end of file; not closed */
+	PipeInputStream(FILE* fp, size_t chunkBytes = 1024 * 1024);
+	const unsigned char* window(uint64_t offset, size_t bytes, size_t* got);
+
+private:
+	FILE* fp;
+	size_t chunkBytes;
+	std::vector<unsigned char> buffer;
+	/** Stream offset of buffer[0] */
+	uint64_t bufferOffset;
+	bool eof;
+};
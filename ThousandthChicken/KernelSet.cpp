@@ -0,0 +1,32 @@
+// License: please see LICENSE1 file for more details.
+
+#include "KernelSet.h"
+
+
+KernelSet::KernelSet(KernelInitInfoBase initInfo) : coder(NULL),
+									  quantizer(NULL),
+									  dwt(NULL),
+									  preprocessor(NULL),
+									  deviceQueue(NULL)
+{
+	coder = new CoefficientCoder(initInfo);
+	quantizer = new Quantizer(initInfo);
+	dwt = new DWT(initInfo);
+	preprocessor = new Preprocessor(initInfo);
+	deviceQueue = new DeviceQueue(initInfo);
+}
+
+
+KernelSet::~KernelSet(void)
+{
+	if (coder)
+		delete coder;
+	if (quantizer)
+		delete quantizer;
+	if (dwt)
+		delete dwt;
+	if (preprocessor)
+		delete preprocessor;
+	if (deviceQueue)
+		delete deviceQueue;
+}
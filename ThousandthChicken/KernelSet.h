@@ -0,0 +1,29 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "CoefficientCoder.h"
+#include "Quantizer.h"
+#include "DWT.h"
+#include "Preprocessor.h"
+#include "DeviceQueue.h"
+
+/**
+ * @brief The decoder stage kernels bound to one command queue.
+ *
+ * Kernel objects carry their arguments, so every queue that runs stages concurrently
+ * needs its own set.
+ */
+class KernelSet
+{
+public:
+	KernelSet(KernelInitInfoBase initInfo);
+	~KernelSet(void);
+	cl_command_queue getQueue() { return deviceQueue->getQueue(); }
+
+	CoefficientCoder* coder;
+	Quantizer* quantizer;
+	DWT* dwt;
+	Preprocessor* preprocessor;
+	DeviceQueue* deviceQueue;
+};
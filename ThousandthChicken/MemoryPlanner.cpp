@@ -0,0 +1,183 @@
+// License: please see LICENSE1 file for more details.
+
+#include "MemoryPlanner.h"
+#include "codestream_image_types.h"
+#include "CoefficientCoder.h"
+
+using namespace std;
+
+static map<cl_context, MemoryPlanner*> planners;
+static mutex plannersLock;
+static size_t defaultBudget = 0;
+
+MemoryPlanner::MemoryPlanner(size_t budget) : budget(budget),
+										reserved(0),
+										peakReserved(0),
+										waits(0)
+{
+}
+
+MemoryPlanner* MemoryPlanner::forContext(cl_context context)
+{
+	lock_guard<mutex> guard(plannersLock);
+	map<cl_context, MemoryPlanner*>::iterator it = planners.find(context);
+	if (it != planners.end())
+		return it->second;
+
+	size_t budget = defaultBudget;
+	if (budget == 0) {
+		// the smallest device of the context decides
+		cl_uint numDevices = 0;
+		cl_int err = clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES, sizeof(cl_uint), &numDevices, NULL);
+		vector<cl_device_id> devices(numDevices);
+		if (err == CL_SUCCESS && numDevices)
+			err = clGetContextInfo(context, CL_CONTEXT_DEVICES, numDevices * sizeof(cl_device_id), &devices[0], NULL);
+		cl_ulong smallest = 0;
+		for (cl_uint i = 0; err == CL_SUCCESS && i < numDevices; i++) {
+			cl_ulong size = 0;
+			if (clGetDeviceInfo(devices[i], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &size, NULL) == CL_SUCCESS && (!smallest || size < smallest))
+				smallest = size;
+		}
+		budget = smallest ? (size_t)(smallest / 4 * 3) : (size_t)-1;
+	}
+	MemoryPlanner* planner = new MemoryPlanner(budget);
+	planners[context] = planner;
+	return planner;
+}
+
+void MemoryPlanner::setDefaultBudget(size_t bytes)
+{
+	lock_guard<mutex> guard(plannersLock);
+	defaultBudget = bytes;
+}
+
+void MemoryPlanner::releaseAll()
+{
+	lock_guard<mutex> guard(plannersLock);
+	for (map<cl_context, MemoryPlanner*>::iterator it = planners.begin(); it != planners.end(); ++it)
+		delete it->second;
+	planners.clear();
+}
+
+size_t MemoryPlanner::estimateTile(const type_tile* tile, size_t alignment)
+{
+	const type_image* img = tile->parent_img;
+	alignment /= sizeof(int);
+	if (alignment == 0)
+		alignment = 1;
+
+	size_t samples = 0;
+	size_t tier1 = 0;
+	for (unsigned int j = 0; j < img->num_components; j++) {
+		const type_tile_comp* tile_comp = tile->tile_comp + j;
+		size_t compSamples = (size_t)tile_comp->width * tile_comp->height;
+		samples += (compSamples + alignment - 1) / alignment * alignment;
+		// coefficients, staged codestreams, coder state and code-block infos; the components of a
+		// tile may be in Tier-1 at the same time on different queues
+		tier1 += (size_t)tile_comp->coefficients_size * sizeof(int)
+			+ (size_t)tile_comp->num_cblks * MAX_CODESTREAM_SIZE
+			+ (size_t)tile_comp->state_size * sizeof(unsigned int)
+			+ (size_t)tile_comp->num_cblks * sizeof(CodeBlockAdditionalInfo);
+		// dequantization gathers one subband at a time, never more than the component
+		tier1 += compSamples * sizeof(int);
+	}
+	// the tile buffer and the inverse DWT's scratch buffer of the same size
+	size_t bytes = 2 * samples * sizeof(int) + tier1;
+	// the Part 2 array transform keeps its float outputs next to the tile
+	if (img->use_part2_mct)
+		bytes += samples * sizeof(float);
+	return bytes;
+}
+
+size_t MemoryPlanner::estimateImage(const type_image* img, size_t alignment)
+{
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < img->num_tiles; i++)
+		bytes += estimateTile(img->tile + i, alignment);
+	return bytes;
+}
+
+vector<unsigned int> MemoryPlanner::planBatches(const type_image* img, size_t alignment) const
+{
+	vector<unsigned int> ends;
+	size_t batch = 0;
+	for (unsigned int i = 0; i < img->num_tiles; i++) {
+		size_t bytes = estimateTile(img->tile + i, alignment);
+		if (batch && batch + bytes > budget) {
+			ends.push_back(i);
+			batch = 0;
+		}
+		batch += bytes;
+	}
+	if (img->num_tiles)
+		ends.push_back(img->num_tiles);
+	return ends;
+}
+
+void MemoryPlanner::reserve(const void* owner, size_t bytes)
+{
+	unique_lock<mutex> guard(lock);
+	bool waited = false;
+	while (reserved && reserved + bytes > budget) {
+		waited = true;
+		freed.wait(guard);
+	}
+	if (waited)
+		waits++;
+	reserved += bytes;
+	owners[owner] += bytes;
+	if (reserved > peakReserved)
+		peakReserved = reserved;
+}
+
+bool MemoryPlanner::tryReserve(const void* owner, size_t bytes)
+{
+	lock_guard<mutex> guard(lock);
+	if (reserved && reserved + bytes > budget)
+		return false;
+	reserved += bytes;
+	owners[owner] += bytes;
+	if (reserved > peakReserved)
+		peakReserved = reserved;
+	return true;
+}
+
+void MemoryPlanner::release(const void* owner)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		map<const void*, size_t>::iterator it = owners.find(owner);
+		if (it == owners.end())
+			return;
+		reserved -= it->second;
+		owners.erase(it);
+	}
+	freed.notify_all();
+}
+
+void MemoryPlanner::setBudget(size_t bytes)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		budget = bytes;
+	}
+	freed.notify_all();
+}
+
+size_t MemoryPlanner::getReserved()
+{
+	lock_guard<mutex> guard(lock);
+	return reserved;
+}
+
+size_t MemoryPlanner::getPeakReserved()
+{
+	lock_guard<mutex> guard(lock);
+	return peakReserved;
+}
+
+unsigned long MemoryPlanner::getWaits()
+{
+	lock_guard<mutex> guard(lock);
+	return waits;
+}
@@ -0,0 +1,74 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "platform.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct type_image;
+struct type_tile;
+
+/**
+ * @brief Estimates the device memory of a decode and admits decodes into a per context budget.
+ *
+ * Every decode job and every streamed tile of the decoders sharing a context reserves its estimate
+ * before allocating anything and waits in reserve() until enough of the budget is free, instead
+ * of failing an allocation halfway through a stage. Images larger than the budget are decoded in
+ * batches of tiles that fit.
+ */
+class MemoryPlanner
+{
+public:
+	/** @brief The planner of a context, created with the default budget on first use */
+	static MemoryPlanner* forContext(cl_context context);
+	/** @brief Budget of planners created from now on; 0 picks 3/4 of the device's global memory */
+	static void setDefaultBudget(size_t bytes);
+	static void releaseAll();
+
+	/** @brief Peak device bytes of decoding tile: tile buffer, Tier-1 buffers, subbands and DWT scratch */
+	static size_t estimateTile(const type_tile* tile, size_t alignment);
+	/** @brief Peak device bytes of decoding all tiles of img at once */
+	static size_t estimateImage(const type_image* img, size_t alignment);
+
+	/**
+	 * @brief Splits the tiles of img into runs of consecutive tiles that each fit the budget.
+	 * @return the end of every run; a tile larger than the budget gets a run of its own
+	 */
+	std::vector<unsigned int> planBatches(const type_image* img, size_t alignment) const;
+
+	/**
+	 * @brief Waits until bytes fit into the budget and reserves them for owner, a decode job or
+	 * a tile.
+	 *
+	 * A request is only let through without fitting if nothing else is reserved, so that a tile
+	 * larger than the budget still decodes. Whoever holds the reservations waited for must
+	 * release them on another thread, or this never returns; see tryReserve().
+	 */
+	void reserve(const void* owner, size_t bytes);
+	/** @brief Reserves bytes for owner if that is possible without waiting */
+	bool tryReserve(const void* owner, size_t bytes);
+	/** @brief Releases everything owner has reserved */
+	void release(const void* owner);
+
+	size_t getBudget() const { return budget; }
+	void setBudget(size_t bytes);
+	size_t getReserved();
+	size_t getPeakReserved();
+	/** @brief Number of reservations that had to wait for capacity */
+	unsigned long getWaits();
+
+private:
+	MemoryPlanner(size_t budget);
+
+	size_t budget;
+	size_t reserved;
+	size_t peakReserved;
+	unsigned long waits;
+	/** Bytes held per owner */
+	std::map<const void*, size_t> owners;
+	std::mutex lock;
+	std::condition_variable freed;
+};
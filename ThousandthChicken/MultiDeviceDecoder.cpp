@@ -0,0 +1,302 @@
+// License: please see LICENSE1 file for more details.
+
+#include "MultiDeviceDecoder.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "codestream_image.h"
+#include "codestream_image_types.h"
+#include "Affinity.h"
+#include <thread>
+
+
+MultiDeviceDecoder::MultiDeviceDecoder(std::vector<ocl_args_d_t*>& devices, int numQueues) : devices(devices)
+{
+	for (size_t i = 0; i < devices.size(); ++i) {
+		decoders.push_back(new Decoder(devices[i], numQueues));
+		queues.push_back(new TileQueue());
+		throughput.push_back(0);
+		nodes.push_back(-1);
+	}
+	stats.resize(devices.size());
+	weights.resize(devices.size());
+	failed = false;
+}
+
+
+MultiDeviceDecoder::~MultiDeviceDecoder(void)
+{
+	for (size_t i = 0; i < decoders.size(); ++i) {
+		delete decoders[i];
+		delete queues[i];
+	}
+}
+
+/**
+ * @brief Deals tiles out in contiguous runs, each device getting a share of the pixels
+ * proportional to its throughput.
+ */
+void MultiDeviceDecoder::distribute(type_image* img)
+{
+	// devices that have not been measured yet are assumed to be of average speed
+	double known = 0;
+	int numKnown = 0;
+	for (size_t d = 0; d < throughput.size(); ++d) {
+		if (throughput[d] > 0) {
+			known += throughput[d];
+			numKnown++;
+		}
+	}
+	double total = 0;
+	for (size_t d = 0; d < throughput.size(); ++d) {
+		weights[d] = throughput[d] > 0 ? throughput[d] : (numKnown ? known / numKnown : 1.0);
+		total += weights[d];
+	}
+
+	size_t imagePixels = (size_t)img->width * img->height;
+	size_t device = 0;
+	double share = imagePixels * weights[0] / total;
+	double assigned = 0;
+	for (unsigned int i = 0; i < img->num_tiles; i++) {
+		type_tile* tile = img->tile + i;
+		size_t pixels = (size_t)tile->width * tile->height;
+		// move on once this device's share is filled, but never leave the last device empty-handed
+		while (assigned >= share && device + 1 < queues.size()) {
+			device++;
+			assigned = 0;
+			share = imagePixels * weights[device] / total;
+		}
+		queues[device]->tiles.push_back(tile);
+		queues[device]->pixels += pixels;
+		assigned += pixels;
+	}
+}
+
+/**
+ * @brief Next tile for a device: the front of its own deque, otherwise the back of the
+ * deque with the longest estimated drain time.
+ */
+type_tile* MultiDeviceDecoder::take(size_t device)
+{
+	{
+		TileQueue* own = queues[device];
+		std::lock_guard<std::mutex> guard(own->lock);
+		if (!own->tiles.empty()) {
+			type_tile* tile = own->tiles.front();
+			own->tiles.pop_front();
+			own->pixels -= (size_t)tile->width * tile->height;
+			return tile;
+		}
+	}
+
+	while (true) {
+		size_t victim = queues.size();
+		double longest = 0;
+		for (size_t d = 0; d < queues.size(); ++d) {
+			if (d == device)
+				continue;
+			std::lock_guard<std::mutex> guard(queues[d]->lock);
+			double drain = queues[d]->pixels / weights[d];
+			if (!queues[d]->tiles.empty() && drain > longest) {
+				longest = drain;
+				victim = d;
+			}
+		}
+		if (victim == queues.size())
+			return NULL;
+
+		TileQueue* other = queues[victim];
+		std::lock_guard<std::mutex> guard(other->lock);
+		// the victim may have drained in the meantime; look again
+		if (other->tiles.empty())
+			continue;
+		type_tile* tile = other->tiles.back();
+		other->tiles.pop_back();
+		other->pixels -= (size_t)tile->width * tile->height;
+		stats[device].stolen++;
+		return tile;
+	}
+}
+
+/**
+ * @brief Pins the workers of NUMA sub-devices to their nodes.
+ *
+ * OpenCL does not tell which processors a sub-device runs on. The sub-devices of a NUMA
+ * partition come in node order, so sub-device i is taken to be node i only if there is one
+ * per node and each has as many compute units as its node has processors; otherwise no
+ * worker is pinned.
+ */
+void MultiDeviceDecoder::pinToNumaNodes()
+{
+	int numNodes = numaNodeCount();
+	bool verified = (int)devices.size() == numNodes;
+	for (size_t d = 0; d < devices.size() && verified; ++d) {
+		cl_device_partition_property type[4] = {0, 0, 0, 0};
+		cl_uint units = 0;
+		verified = clGetDeviceInfo(devices[d]->device, CL_DEVICE_PARTITION_TYPE, sizeof(type), type, NULL) == CL_SUCCESS &&
+			type[0] == CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN && type[1] == CL_DEVICE_AFFINITY_DOMAIN_NUMA &&
+			clGetDeviceInfo(devices[d]->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL) == CL_SUCCESS &&
+			(int)units == numaNodeCpuCount((int)d);
+	}
+	if (!verified) {
+		LogInfo("Info: cannot tell which NUMA node each of %d devices runs on; workers are not pinned.\n", (int)devices.size());
+		return;
+	}
+	for (size_t d = 0; d < nodes.size(); ++d)
+		nodes[d] = (int)d;
+}
+
+/**
+ * @brief Pins the calling worker to its device's node. Pages the worker touches first, such
+ * as those of the image trees it parses, are then allocated on that node.
+ */
+void MultiDeviceDecoder::pinWorker(size_t device)
+{
+	if (nodes[device] >= 0 && !pinThreadToNumaNode(nodes[device]))
+		LogInfo("Info: could not pin device %d to NUMA node %d.\n", (int)device, nodes[device]);
+}
+
+void MultiDeviceDecoder::worker(size_t device, DecodedImage* out)
+{
+	pinWorker(device);
+	try {
+		type_tile* tile;
+		while (!failed && (tile = take(device)) != NULL) {
+			double t1 = time_stamp();
+			int rc = decoders[device]->decodeTile(tile, out);
+			if (rc) {
+				LogError("Error: device %d: tile %u failed (%d)\n", (int)device, tile->tile_no, rc);
+				failed = true;
+				break;
+			}
+			stats[device].busy += time_stamp() - t1;
+			stats[device].pixels += (size_t)tile->width * tile->height;
+			stats[device].tiles++;
+		}
+	} catch (const Error& error) {
+		LogError("Error: device %d: %s\n", (int)device, error.what());
+		failed = true;
+	}
+}
+
+int MultiDeviceDecoder::decode(std::string fileName, DecodedImage* out)
+{
+	if (decoders.empty())
+		return -1;
+
+	double t1 = time_stamp();
+	type_image *img = decoders[0]->parse(fileName);
+	if (!img)
+		return -2;
+
+	if (out)
+		out->allocate(img->width, img->height, img->num_components);
+
+	failed = false;
+	for (size_t d = 0; d < stats.size(); ++d)
+		memset(&stats[d], 0, sizeof(DeviceStats));
+	distribute(img);
+
+	std::vector<std::thread*> workers;
+	for (size_t d = 0; d < decoders.size(); ++d)
+		workers.push_back(new std::thread(&MultiDeviceDecoder::worker, this, d, out));
+	for (size_t d = 0; d < workers.size(); ++d) {
+		workers[d]->join();
+		delete workers[d];
+	}
+
+	double t2 = time_stamp();
+	int diff =  (int)((t2 - t1)*1000);
+	printf("Decode time: %d ms\n",diff);
+
+	// fold this image's measurements into the weights used for the next one
+	for (size_t d = 0; d < stats.size(); ++d) {
+		if (stats[d].tiles && stats[d].busy > 0) {
+			double measured = stats[d].pixels / stats[d].busy;
+			throughput[d] = throughput[d] > 0 ? 0.5 * (throughput[d] + measured) : measured;
+		}
+		printf("Device %d: %d tiles (%d stolen), %.2f MPixel/s\n", (int)d, stats[d].tiles, stats[d].stolen,
+			stats[d].busy > 0 ? stats[d].pixels / stats[d].busy / 1e6 : 0.0);
+	}
+
+	// anything left behind after a failure
+	for (size_t d = 0; d < queues.size(); ++d) {
+		queues[d]->tiles.clear();
+		queues[d]->pixels = 0;
+	}
+
+	decoders[0]->recycle(img);
+	return failed ? -1 : 0;
+}
+
+/**
+ * @brief Routes whole images to devices: every device's worker parses and decodes the next
+ * unclaimed image on its own, so the parsed tree stays local to its node.
+ */
+void MultiDeviceDecoder::imageWorker(size_t device, const std::vector<std::string>* fileNames)
+{
+	pinWorker(device);
+	try {
+		size_t i;
+		while (!failed && (i = nextImage++) < fileNames->size()) {
+			double t1 = time_stamp();
+			type_image *img = decoders[device]->parse((*fileNames)[i]);
+			if (!img) {
+				LogError("Error: device %d: could not parse %s\n", (int)device, (*fileNames)[i].c_str());
+				failed = true;
+				break;
+			}
+			try {
+				for (unsigned int t = 0; t < img->num_tiles && !failed; t++) {
+					type_tile* tile = img->tile + t;
+					int rc = decoders[device]->decodeTile(tile, NULL);
+					if (rc) {
+						LogError("Error: device %d: tile %u of %s failed (%d)\n", (int)device, t, (*fileNames)[i].c_str(), rc);
+						failed = true;
+						break;
+					}
+					stats[device].pixels += (size_t)tile->width * tile->height;
+					stats[device].tiles++;
+				}
+			} catch (...) {
+				decoders[device]->recycle(img);
+				throw;
+			}
+			decoders[device]->recycle(img);
+			stats[device].busy += time_stamp() - t1;
+			stats[device].images++;
+		}
+	} catch (const Error& error) {
+		LogError("Error: device %d: %s\n", (int)device, error.what());
+		failed = true;
+	}
+}
+
+/**
+ * @brief Decodes a list of images, each one entirely on one device.
+ * @return number of images decoded per second, or -1 on failure
+ */
+double MultiDeviceDecoder::decodeImages(const std::vector<std::string>& fileNames)
+{
+	failed = false;
+	nextImage = 0;
+	for (size_t d = 0; d < stats.size(); ++d)
+		memset(&stats[d], 0, sizeof(DeviceStats));
+
+	double t1 = time_stamp();
+	std::vector<std::thread*> workers;
+	for (size_t d = 0; d < decoders.size(); ++d)
+		workers.push_back(new std::thread(&MultiDeviceDecoder::imageWorker, this, d, &fileNames));
+	for (size_t d = 0; d < workers.size(); ++d) {
+		workers[d]->join();
+		delete workers[d];
+	}
+	double elapsed = time_stamp() - t1;
+
+	for (size_t d = 0; d < stats.size(); ++d)
+		printf("Device %d (node %d): %d images, %.2f MPixel/s\n", (int)d, nodes[d], stats[d].images,
+			stats[d].busy > 0 ? stats[d].pixels / stats[d].busy / 1e6 : 0.0);
+
+	if (failed)
+		return -1;
+	return elapsed > 0 ? fileNames.size() / elapsed : 0;
+}
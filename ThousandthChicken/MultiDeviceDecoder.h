@@ -0,0 +1,72 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "Decoder.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ocl_args_d_t;
+
+/**
+ * @brief Decodes the tiles of an image on several OpenCL devices (or sub-devices).
+ *
+ * The image is parsed once on the host. Tiles are then dealt out to per-device deques in
+ * proportion to each device's measured throughput; a device that runs dry steals from the
+ * back of the deque that would take longest to drain. Every device runs its own Decoder,
+ * and thus its own kernel sets, and decoded tiles are gathered into one DecodedImage.
+ */
+class MultiDeviceDecoder
+{
+public:
+	MultiDeviceDecoder(std::vector<ocl_args_d_t*>& devices, int numQueues);
+	~MultiDeviceDecoder(void);
+	int decode(std::string fileName, DecodedImage* out = NULL);
+	double decodeImages(const std::vector<std::string>& fileNames);
+	// run the pipeline of NUMA sub-device i on threads pinned to node i, if that can be verified
+	void pinToNumaNodes();
+	size_t getNumDevices() { return decoders.size(); }
+
+private:
+	struct TileQueue
+	{
+		TileQueue() : pixels(0) {}
+		std::mutex lock;
+		std::deque<type_tile*> tiles;
+		/** Pixels still queued, used to pick a victim when stealing */
+		size_t pixels;
+	};
+
+	struct DeviceStats
+	{
+		int images;
+		int tiles;
+		int stolen;
+		size_t pixels;
+		double busy;
+	};
+
+	void distribute(type_image* img);
+	type_tile* take(size_t device);
+	void worker(size_t device, DecodedImage* out);
+	void imageWorker(size_t device, const std::vector<std::string>* fileNames);
+	void pinWorker(size_t device);
+
+	/** Owned by the caller, like the decoders' environments */
+	std::vector<ocl_args_d_t*> devices;
+	std::vector<Decoder*> decoders;
+	std::vector<TileQueue*> queues;
+	std::vector<DeviceStats> stats;
+	/** Smoothed pixels per second of every device, carried over between images; 0 until measured */
+	std::vector<double> throughput;
+	/** Relative device speeds used for the current image */
+	std::vector<double> weights;
+	std::atomic<bool> failed;
+	/** NUMA node each device's worker is pinned to, -1 if not pinned */
+	std::vector<int> nodes;
+	/** Next image for imageWorker */
+	std::atomic<size_t> nextImage;
+};
@@ -2,6 +2,18 @@
 #include "Preprocessor.h"
 #include "codestream_image_types.h"
 #include "logger.h"
+#include "ResourceCounters.h"
+#include "basic.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/** Side of the square blocks preprocess_mct_array.cl works on, see MCT_TILE */
+#define MCT_TILE 16
+/** Upper bound on the work-group size of preprocess_mct_wavelet.cl, see GROUP_PIXELS */
+#define WAVELET_GROUP_PIXELS 64
 
 Preprocessor::Preprocessor(KernelInitInfoBase initInfo) :
 											initInfo(initInfo),
@@ -10,7 +22,9 @@ Preprocessor::Preprocessor(KernelInitInfoBase initInfo) :
 											rct(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_rct.cl", "rct_kernel") )),
 											rctInverse(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_rct_inverse.cl", "tcr_kernel") )),
 											dcShift(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_dc_level_shift.cl", "fdc_level_shift_kernel") )),
-											dcShiftInverse(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_dc_level_shift_inverse.cl", "idc_level_shift_kernel") ))
+											dcShiftInverse(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_dc_level_shift_inverse.cl", "idc_level_shift_kernel") )),
+											arrayMct(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_mct_array.cl", "array_mct_kernel") )),
+											arrayMctStore(new DeviceKernel( KernelInitInfo(initInfo, "preprocess_mct_array.cl", "array_mct_store_kernel") ))
 
 {
 }
@@ -30,6 +44,12 @@ Preprocessor::~Preprocessor(void)
 		delete dcShift;
 	if (dcShiftInverse)
 		delete dcShiftInverse;
+	if (arrayMct)
+		delete arrayMct;
+	if (arrayMctStore)
+		delete arrayMctStore;
+	for (std::map<string, DeviceKernel*>::iterator it = waveletKernels.begin(); it != waveletKernels.end(); ++it)
+		delete it->second;
 }
 
 /**
@@ -42,13 +62,28 @@ Preprocessor::~Preprocessor(void)
  * @return Returns 0 on success.
  */
 int Preprocessor::color_trans_gpu(type_image *img, color_trans_type type) {
+	for(unsigned int i = 0; i < img->num_tiles; i++) {
+		if (color_trans_tile(&(img->tile[i]), type) != DeviceSuccess)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Color transformation of a single tile.
+ *
+ * @param tile type_tile to will be transformed.
+ * @param type Type of color transformation that should be performed.
+ *
+ * @return DeviceSuccess, CL_INVALID_VALUE unless the tile has three components
+ */
+tDeviceRC Preprocessor::color_trans_tile(type_tile *tile, color_trans_type type) {
+	type_image *img = tile->parent_img;
 	if(img->num_components != 3) {
 		println(INFO, "Error: Color transformation not possible. The number of components != 3.");
-		return -1;
+		return CL_INVALID_VALUE;
 	}
 
-	unsigned int tile_size = 0, i;
-	type_tile *tile;
 	int level_shift = img->num_range_bits - 1;
 
 	int min = img->sign == SIGNED ? -(1 << (img->num_range_bits - 1)) : 0;
@@ -65,7 +100,7 @@ int Preprocessor::color_trans_gpu(type_image *img, color_trans_type type) {
 		break;
 	case TCR:
 		isInverse = true;
-		targetKernel = ictInverse;
+		targetKernel = rctInverse;
 		break;
 	case ICT:
 		targetKernel = ict;
@@ -75,21 +110,20 @@ int Preprocessor::color_trans_gpu(type_image *img, color_trans_type type) {
 		targetKernel = ictInverse;
 		break;
 	}
-	for(i = 0; i < img->num_tiles; i++) {
-			tile = &(img->tile[i]);
-			int* comp_a = (int*)(&(tile->tile_comp[0]))->img_data_d;
-			int* comp_b = (int*)(&(tile->tile_comp[1]))->img_data_d;
-			int* comp_c = (int*)(&(tile->tile_comp[2]))->img_data_d;
-			if (isInverse)
-				setColourTransformInverseKernelArgs<int>(targetKernel, comp_a, comp_b, comp_c, tile->width, tile->height, level_shift, min, max);
-			else
-				setColourTransformKernelArgs<int>(targetKernel, comp_a, comp_b, comp_c, tile->width, tile->height, level_shift);
+	int* comp_a = (int*)(&(tile->tile_comp[0]))->img_data_d;
+	int* comp_b = (int*)(&(tile->tile_comp[1]))->img_data_d;
+	int* comp_c = (int*)(&(tile->tile_comp[2]))->img_data_d;
+	tDeviceRC err;
+	if (isInverse)
+		err = setColourTransformInverseKernelArgs<int>(targetKernel, comp_a, comp_b, comp_c, tile->width, tile->height, level_shift, min, max);
+	else
+		err = setColourTransformKernelArgs<int>(targetKernel, comp_a, comp_b, comp_c, tile->width, tile->height, level_shift);
+	if (err != DeviceSuccess)
+		return err;
 
-			size_t local_work_size[3] = {64,1,1};
-			size_t global_work_size[3] = {tile->width * tile->height, 1,1};
-			targetKernel->enqueue(1,global_work_size, local_work_size);
-	}
-	return 0;
+	size_t local_work_size[3] = {64,1,1};
+	size_t global_work_size[3] = {(size_t)tile->width * tile->height, 1,1};
+	return targetKernel->enqueue(1,global_work_size, local_work_size);
 }
 
 
@@ -116,34 +150,39 @@ int Preprocessor::color_decoder_lossless(type_image *img) {
 
 void Preprocessor::dc_level_shifting(type_image *img, int sign)
 {
-	unsigned int i, j;
-	type_tile *tile;
+	for(unsigned int i = 0; i < img->num_tiles; i++)
+		dc_level_shifting_tile(&(img->tile[i]), sign);
+}
+
+tDeviceRC Preprocessor::dc_level_shifting_tile(type_tile *tile, int sign)
+{
+	tDeviceRC err = DeviceSuccess;
+	type_image *img = tile->parent_img;
 	int *idata;
 	int min = 0;
 	int max = (1 << img->num_range_bits) - 1;
 	int level_shift = img->num_range_bits - 1;
 
-	for(i = 0; i < img->num_tiles; i++)
+	size_t local_work_size[3] = {64,1,1};
+	size_t global_work_size[3] = {(size_t)tile->width * tile->height, 1,1};
+	for(unsigned int j = 0; j < img->num_components && err == DeviceSuccess; j++)
 	{
-		tile = &(img->tile[i]);
-		size_t local_work_size[3] = {64,1,1};
-		size_t global_work_size[3] = {tile->width * tile->height, 1,1};
-		for(j = 0; j < img->num_components; j++)
+		idata = (int*)(&(tile->tile_comp[j]))->img_data_d;
+		if(sign < 0)
+		{
+			err = setDCShiftKernelArgs<int>(dcShift,idata, tile->width, tile->height, level_shift);
+			if (err == DeviceSuccess)
+				err = dcShift->enqueue(1,global_work_size, local_work_size);
+
+		} else
 		{
-			idata = (int*)(&(tile->tile_comp[j]))->img_data_d;
-			if(sign < 0)
-			{
-				setDCShiftKernelArgs<int>(dcShift,idata, tile->width, tile->height, level_shift);
-    			ict->enqueue(1,global_work_size, local_work_size);
-
-			} else
-			{
-				setDCShiftInverseKernelArgs<int>(dcShiftInverse,idata, tile->width, tile->height, level_shift, min, max);
-				ictInverse->enqueue(1,global_work_size, local_work_size);
-
-			}
+			err = setDCShiftInverseKernelArgs<int>(dcShiftInverse,idata, tile->width, tile->height, level_shift, min, max);
+			if (err == DeviceSuccess)
+				err = dcShiftInverse->enqueue(1,global_work_size, local_work_size);
+
 		}
 	}
+	return err;
 }
 
 /**
@@ -156,9 +195,476 @@ void Preprocessor::idc_level_shifting(type_image *img)
 	dc_level_shifting(img, 1);
 }
 
+/**
+ * @brief Final decoder stage for one tile: inverse color transform or inverse DC level shifting.
+ * @param tile
+ * @return DeviceSuccess, otherwise the tile must not be read back as decoded
+ */
+tDeviceRC Preprocessor::decode_tile(type_tile *tile)
+{
+	type_image *img = tile->parent_img;
+	if(img->use_mct == 1) {
+		// lossless decoder
+		if(img->wavelet_type == 0)
+			return color_trans_tile(tile, TCR);
+		//lossy decoder
+		return color_trans_tile(tile, TCI);
+	} else if (img->use_part2_mct == 1) {
+		return array_mct_tile(tile);
+	} else if(img->sign == UNSIGNED) {
+		return dc_level_shifting_tile(tile, 1);
+	}
+	return DeviceSuccess;
+}
+
+/**
+ * @brief Reads element i of an MCT marker array; elements are stored big endian.
+ */
+static float mct_element(type_mct *mct, unsigned int i)
+{
+	unsigned int size = 1 << mct->element_type;
+	unsigned char *p = mct->data + i * size;
+	unsigned long long bits = 0;
+	for (unsigned int b = 0; b < size; b++)
+		bits = (bits << 8) | p[b];
+
+	switch (mct->element_type) {
+	case MCT_8BIT_INT:
+		return (float)(signed char)bits;
+	case MCT_16BIT_INT:
+		return (float)(short)bits;
+	case MCT_32BIT_FLOAT: {
+		unsigned int word = (unsigned int)bits;
+		float f;
+		memcpy(&f, &word, sizeof(f));
+		return f;
+	}
+	default: {
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		return (float)d;
+	}
+	}
+}
+
+static type_mct *find_mct(type_multiple_component_transformations *mct_data, int type, unsigned char index)
+{
+	for (int i = 0; i < mct_data->mcts_count[type]; i++) {
+		if (mct_data->mcts[type][i].index == index)
+			return mct_data->mcts[type] + i;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Component number i of a component collection; numbers are 8 or 16 bit wide.
+ */
+static unsigned int collection_component(unsigned char *components, unsigned char type, unsigned int i)
+{
+	if (type == 0)
+		return components[i];
+	return (components[2 * i] << 8) | components[2 * i + 1];
+}
+
+static cl_mem create_input_buffer(cl_context context, size_t bytes, void *data)
+{
+	cl_int err = CL_SUCCESS;
+	cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, data, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	ResourceCounters::bufferCreated(buffer);
+	ResourceCounters::add(COUNTER_WRITES);
+	ResourceCounters::add(COUNTER_WRITE_BYTES, bytes);
+	return buffer;
+}
+
+/**
+ * @brief Lifting steps of a wavelet kernel, flattened for the build options of preprocess_mct_wavelet.cl.
+ */
+struct wavelet_lifting {
+	bool reversible;
+	bool symmetric;
+	int m0;
+	double scale;
+	int taps;
+	std::vector<double> alpha;
+	std::vector<int> offsets;
+	std::vector<int> shifts;
+	std::vector<int> residues;
+};
+
+/**
+ * @brief Collects the lifting steps of ATK segment index; indices 0 and 1 name the 9/7 irreversible and 5/3 reversible kernels unless an ATK segment redefines them.
+ *
+ * @return Returns false if there is no such kernel.
+ */
+static bool wavelet_lifting_steps(type_multiple_component_transformations *mct_data, unsigned char index, wavelet_lifting *lifting)
+{
+	type_atk *atk = NULL;
+	for (int i = 0; i < mct_data->atk_count; i++) {
+		if (mct_data->atks[i].index == index)
+			atk = mct_data->atks + i;
+	}
+
+	lifting->alpha.clear();
+	lifting->offsets.clear();
+	lifting->shifts.clear();
+	lifting->residues.clear();
+	if (atk) {
+		lifting->reversible = atk->wavelet_type == 1;
+		lifting->symmetric = atk->extension == 1;
+		lifting->m0 = atk->m0;
+		lifting->scale = atk->scaling_factor;
+		lifting->taps = 1;
+		for (int s = 0; s < atk->lifting_steps; s++)
+			lifting->taps = atk->steps[s].coefficient_count > lifting->taps ? atk->steps[s].coefficient_count : lifting->taps;
+		for (int s = 0; s < atk->lifting_steps; s++) {
+			type_atk_step *step = atk->steps + s;
+			for (int k = 0; k < lifting->taps; k++)
+				lifting->alpha.push_back(k < step->coefficient_count ? step->coefficients[k] : 0.0);
+			lifting->offsets.push_back(step->offset);
+			lifting->shifts.push_back(step->scaling_exponent);
+			lifting->residues.push_back(step->additive_residue);
+		}
+		return atk->lifting_steps > 0;
+	}
+
+	lifting->symmetric = true;
+	lifting->m0 = 0;
+	lifting->taps = 2;
+	if (index == 0) {
+		static const double alpha97[4] = {-1.586134342, -0.052980118, 0.882911075, 0.443506852};
+		lifting->reversible = false;
+		lifting->scale = 1.230174105;
+		for (int s = 0; s < 4; s++) {
+			lifting->alpha.push_back(alpha97[s]);
+			lifting->alpha.push_back(alpha97[s]);
+			lifting->offsets.push_back(s & 1 ? -1 : 0);
+			lifting->shifts.push_back(0);
+			lifting->residues.push_back(0);
+		}
+		return true;
+	}
+	if (index == 1) {
+		lifting->reversible = true;
+		lifting->scale = 1.0;
+		lifting->alpha.push_back(-1.0);
+		lifting->alpha.push_back(-1.0);
+		lifting->alpha.push_back(1.0);
+		lifting->alpha.push_back(1.0);
+		lifting->offsets.push_back(0);
+		lifting->offsets.push_back(-1);
+		lifting->shifts.push_back(1);
+		lifting->shifts.push_back(2);
+		lifting->residues.push_back(1);
+		lifting->residues.push_back(2);
+		return true;
+	}
+	return false;
+}
+
+static string option_list(const char *name, const std::vector<int> &values)
+{
+	string option = string(" -D ") + name + "={";
+	char number[32];
+	for (size_t i = 0; i < values.size(); i++) {
+		sprintf(number, i ? ",%d" : "%d", values[i]);
+		option += number;
+	}
+	return option + "}";
+}
+
+static string option_list(const char *name, const std::vector<double> &values, bool integers)
+{
+	string option = string(" -D ") + name + "={";
+	char number[32];
+	for (size_t i = 0; i < values.size(); i++) {
+		if (integers)
+			sprintf(number, i ? ",%d" : "%d", (int)floor(values[i] + 0.5));
+		else
+			sprintf(number, i ? ",%.9ef" : "%.9ef", values[i]);
+		option += number;
+	}
+	return option + "}";
+}
+
+static tDeviceRC set_kernel_arg(DeviceKernel *kernel, cl_uint index, size_t size, const void *value)
+{
+	cl_int error_code = clSetKernelArg(kernel->getKernel(), index, size, value);
+	if (DeviceSuccess != error_code)
+	{
+		LogError("Error: clSetKernelArg (array mct) returned %s.\n", TranslateOpenCLError(error_code));
+	}
+	return error_code;
+}
+
+/**
+ * @brief Part 2 array based inverse multiple component transform of one tile, followed by inverse DC level shifting.
+ *
+ * Component collections are applied in the order of their MCC segments.
+ * @return DeviceSuccess, CL_INVALID_VALUE if the MCT segments do not fit the tile, otherwise
+ * the error of the first collection that failed
+ */
+tDeviceRC Preprocessor::array_mct_tile(type_tile *tile)
+{
+	type_image *img = tile->parent_img;
+	type_multiple_component_transformations *mct_data = img->mct_data;
+	if (!mct_data || !tile->img_data_d) {
+		println(INFO, "Error: Multiple component transformation needs MCT data and a tile buffer.");
+		return CL_INVALID_VALUE;
+	}
+
+	for (int i = 0; i < mct_data->mccs_count; i++) {
+		type_mcc *mcc = mct_data->mccs + i;
+		for (int j = 0; j < mcc->count; j++) {
+			tDeviceRC err = array_mct_collection(tile, mcc->data + j);
+			if (err != DeviceSuccess)
+				return err;
+		}
+	}
+
+	if (img->sign == UNSIGNED)
+		return dc_level_shifting_tile(tile, 1);
+	return DeviceSuccess;
+}
+
+/**
+ * @brief Transforms one component collection: outputs = matrix * inputs + offsets, for every pixel of the tile.
+ *
+ * All components live in the tile buffer, so one launch covers the whole collection. The
+ * products go to a scratch buffer first, because output components may also be inputs.
+ * @return DeviceSuccess, CL_INVALID_VALUE for a missing or wrong-sized matrix or offset array
+ */
+tDeviceRC Preprocessor::array_mct_collection(type_tile *tile, type_mcc_data *collection)
+{
+	type_image *img = tile->parent_img;
+	type_multiple_component_transformations *mct_data = img->mct_data;
+	if (collection->type & 2)
+		return wavelet_mct_collection(tile, collection);
+
+	int inputs = collection->input_count;
+	int outputs = collection->output_count;
+	size_t tilePixels = (size_t)tile->width * tile->height;
+	if (tilePixels > INT_MAX) {
+		println_var(INFO, "Error: Tile %u is too large for the multiple component transform.", tile->tile_no);
+		return CL_INVALID_VALUE;
+	}
+	int pixels = (int)tilePixels;
+	if (inputs == 0 || outputs == 0)
+		return DeviceSuccess;
+
+	std::vector<int> inputOffsets(inputs);
+	std::vector<int> outputOffsets(outputs);
+	for (int i = 0; i < inputs; i++) {
+		unsigned int c = collection_component(collection->input_components, collection->input_component_type, i);
+		if (c >= img->num_components)
+			return CL_INVALID_VALUE;
+		inputOffsets[i] = (int)tile->tile_comp[c].img_data_offset;
+	}
+	for (int i = 0; i < outputs; i++) {
+		unsigned int c = collection_component(collection->output_components, collection->output_component_type, i);
+		if (c >= img->num_components)
+			return CL_INVALID_VALUE;
+		outputOffsets[i] = (int)tile->tile_comp[c].img_data_offset;
+	}
+
+	// index 0 means no matrix (identity) or no offsets
+	std::vector<float> matrix(outputs * inputs, 0.0f);
+	if (collection->decorrelation_transform_matrix) {
+		type_mct *mct = find_mct(mct_data, MCT_DECORRELATION_TRANSFORMATION, collection->decorrelation_transform_matrix);
+		if (!mct || mct->length != (unsigned int)(outputs * inputs)) {
+			println_var(INFO, "Error: No %dx%d transform matrix with index %d.", outputs, inputs, collection->decorrelation_transform_matrix);
+			return CL_INVALID_VALUE;
+		}
+		for (int i = 0; i < outputs * inputs; i++)
+			matrix[i] = mct_element(mct, i);
+	} else {
+		if (inputs != outputs)
+			return CL_INVALID_VALUE;
+		for (int i = 0; i < outputs; i++)
+			matrix[i * inputs + i] = 1.0f;
+	}
+	std::vector<float> offsets(outputs, 0.0f);
+	if (collection->deccorelation_transform_offset) {
+		type_mct *mct = find_mct(mct_data, MCT_DECORRELATION_OFFSET, collection->deccorelation_transform_offset);
+		if (!mct || mct->length != (unsigned int)outputs) {
+			println_var(INFO, "Error: No offset array of %d elements with index %d.", outputs, collection->deccorelation_transform_offset);
+			return CL_INVALID_VALUE;
+		}
+		for (int i = 0; i < outputs; i++)
+			offsets[i] = mct_element(mct, i);
+	}
+
+	cl_context context = NULL;
+	cl_int err = clGetCommandQueueInfo(initInfo.cmd_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+	SAMPLE_CHECK_ERRORS(err);
+	cl_mem d_inputOffsets = create_input_buffer(context, inputs * sizeof(int), &inputOffsets[0]);
+	cl_mem d_outputOffsets = create_input_buffer(context, outputs * sizeof(int), &outputOffsets[0]);
+	cl_mem d_matrix = create_input_buffer(context, outputs * inputs * sizeof(float), &matrix[0]);
+	cl_mem d_offsets = create_input_buffer(context, outputs * sizeof(float), &offsets[0]);
+	cl_mem d_result = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t)outputs * pixels * sizeof(float), NULL, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	ResourceCounters::bufferCreated(d_result);
+
+	cl_mem d_tile = (cl_mem)tile->img_data_d;
+	int argNum = 0;
+	err = set_kernel_arg(arrayMct, argNum++, sizeof(cl_mem), &d_tile);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(cl_mem), &d_inputOffsets);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(cl_mem), &d_matrix);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(cl_mem), &d_result);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(int), &inputs);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(int), &outputs);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMct, argNum++, sizeof(int), &pixels);
+	if (DeviceSuccess == err) {
+		size_t local_work_size[3] = {MCT_TILE, MCT_TILE, 1};
+		size_t global_work_size[3] = {(size_t)(pixels + MCT_TILE - 1) / MCT_TILE * MCT_TILE, (size_t)(outputs + MCT_TILE - 1) / MCT_TILE * MCT_TILE, 1};
+		err = arrayMct->enqueue(2, global_work_size, local_work_size);
+	}
+
+	argNum = 0;
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMctStore, argNum++, sizeof(cl_mem), &d_tile);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMctStore, argNum++, sizeof(cl_mem), &d_outputOffsets);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMctStore, argNum++, sizeof(cl_mem), &d_offsets);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMctStore, argNum++, sizeof(cl_mem), &d_result);
+	if (DeviceSuccess == err) err = set_kernel_arg(arrayMctStore, argNum++, sizeof(int), &pixels);
+	if (DeviceSuccess == err) {
+		size_t local_work_size[3] = {64, 1, 1};
+		size_t global_work_size[3] = {(size_t)(pixels + 63) / 64 * 64, (size_t)outputs, 1};
+		err = arrayMctStore->enqueue(2, global_work_size, local_work_size);
+	}
+
+	// the runtime keeps these alive until the kernels have completed
+	ResourceCounters::releaseBuffer(d_inputOffsets);
+	ResourceCounters::releaseBuffer(d_outputOffsets);
+	ResourceCounters::releaseBuffer(d_matrix);
+	ResourceCounters::releaseBuffer(d_offsets);
+	ResourceCounters::releaseBuffer(d_result);
+	return err;
+}
+
+/**
+ * @brief Inverse 1-D wavelet transform across the components of one collection, for every pixel of the tile.
+ *
+ * The lifting steps of the ATK segment are compiled into the kernel, so a collection of hundreds
+ * of components is a single launch. Kernels are built once per distinct set of build options.
+ * @return DeviceSuccess, CL_INVALID_VALUE for an unknown ATK, CL_OUT_OF_RESOURCES if the
+ * collection does not fit in local memory
+ */
+tDeviceRC Preprocessor::wavelet_mct_collection(type_tile *tile, type_mcc_data *collection)
+{
+	type_image *img = tile->parent_img;
+	type_multiple_component_transformations *mct_data = img->mct_data;
+
+	int components = collection->input_count;
+	size_t tilePixels = (size_t)tile->width * tile->height;
+	if (tilePixels > INT_MAX) {
+		println_var(INFO, "Error: Tile %u is too large for the multiple component transform.", tile->tile_no);
+		return CL_INVALID_VALUE;
+	}
+	int pixels = (int)tilePixels;
+	if (components == 0)
+		return DeviceSuccess;
+	if (components != collection->output_count) {
+		println(INFO, "Error: Wavelet based multiple component transformation needs as many inputs as outputs.");
+		return CL_INVALID_VALUE;
+	}
+
+	wavelet_lifting lifting;
+	if (!wavelet_lifting_steps(mct_data, collection->atk, &lifting)) {
+		println_var(INFO, "Error: No wavelet kernel with ATK index %d.", collection->atk);
+		return CL_INVALID_VALUE;
+	}
+
+	// levels come from the ADS segment; stop once the low-pass band is down to one component
+	int levels = 1;
+	for (int i = 0; i < mct_data->ads_count; i++) {
+		if (mct_data->adses[i].index == collection->ads)
+			levels = mct_data->adses[i].IOads;
+	}
+	int length = components;
+	for (int l = 0; l < levels; l++) {
+		if (length <= 1) {
+			levels = l;
+			break;
+		}
+		length = (length + 1 - lifting.m0) / 2;
+	}
+	if (levels == 0)
+		return DeviceSuccess;
+
+	// every work-item keeps two columns of the collection in local memory
+	size_t groupPixels = WAVELET_GROUP_PIXELS;
+	while (groupPixels > 1 && 2 * components * groupPixels * sizeof(int) > arrayMct->getLocalMemorySize())
+		groupPixels >>= 1;
+	if (2 * components * groupPixels * sizeof(int) > arrayMct->getLocalMemorySize()) {
+		println_var(INFO, "Error: %d components do not fit in local memory.", components);
+		return CL_OUT_OF_RESOURCES;
+	}
+
+	char value[64];
+	string options;
+	sprintf(value, " -D REVERSIBLE=%d -D SYMMETRIC=%d -D M0=%d", lifting.reversible ? 1 : 0, lifting.symmetric ? 1 : 0, lifting.m0);
+	options += value;
+	sprintf(value, " -D COMPONENTS=%d -D LEVELS=%d -D GROUP_PIXELS=%d", components, levels, (int)groupPixels);
+	options += value;
+	sprintf(value, " -D STEPS=%d -D TAPS=%d -D SCALE=%.9ef", (int)lifting.offsets.size(), lifting.taps, lifting.scale);
+	options += value;
+	options += option_list("ALPHA", lifting.alpha, lifting.reversible);
+	options += option_list("OFFSETS", lifting.offsets);
+	options += option_list("SHIFTS", lifting.shifts);
+	options += option_list("RESIDUES", lifting.residues);
+	DeviceKernel *kernel = waveletKernel(options);
+
+	std::vector<int> inputOffsets(components);
+	std::vector<int> outputOffsets(components);
+	for (int i = 0; i < components; i++) {
+		unsigned int in = collection_component(collection->input_components, collection->input_component_type, i);
+		unsigned int out = collection_component(collection->output_components, collection->output_component_type, i);
+		if (in >= img->num_components || out >= img->num_components)
+			return CL_INVALID_VALUE;
+		inputOffsets[i] = (int)tile->tile_comp[in].img_data_offset;
+		outputOffsets[i] = (int)tile->tile_comp[out].img_data_offset;
+	}
+
+	cl_context context = NULL;
+	cl_int err = clGetCommandQueueInfo(initInfo.cmd_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+	SAMPLE_CHECK_ERRORS(err);
+	cl_mem d_inputOffsets = create_input_buffer(context, components * sizeof(int), &inputOffsets[0]);
+	cl_mem d_outputOffsets = create_input_buffer(context, components * sizeof(int), &outputOffsets[0]);
+
+	cl_mem d_tile = (cl_mem)tile->img_data_d;
+	int argNum = 0;
+	err = set_kernel_arg(kernel, argNum++, sizeof(cl_mem), &d_tile);
+	if (DeviceSuccess == err) err = set_kernel_arg(kernel, argNum++, sizeof(cl_mem), &d_inputOffsets);
+	if (DeviceSuccess == err) err = set_kernel_arg(kernel, argNum++, sizeof(cl_mem), &d_outputOffsets);
+	if (DeviceSuccess == err) err = set_kernel_arg(kernel, argNum++, sizeof(int), &pixels);
+	if (DeviceSuccess == err) {
+		size_t local_work_size[3] = {groupPixels, 1, 1};
+		size_t global_work_size[3] = {(pixels + groupPixels - 1) / groupPixels * groupPixels, 1, 1};
+		err = kernel->enqueue(1, global_work_size, local_work_size);
+	}
+
+	// the runtime keeps these alive until the kernel has completed
+	ResourceCounters::releaseBuffer(d_inputOffsets);
+	ResourceCounters::releaseBuffer(d_outputOffsets);
+	return err;
+}
+
+/**
+ * @brief Returns the wavelet_mct_kernel built with the given specialisation options, building it on first use.
+ */
+DeviceKernel* Preprocessor::waveletKernel(string options)
+{
+	std::map<string, DeviceKernel*>::iterator it = waveletKernels.find(options);
+	if (it != waveletKernels.end())
+		return it->second;
+	DeviceKernel *kernel = new DeviceKernel( KernelInitInfo(initInfo.cmd_queue, "preprocess_mct_wavelet.cl", "wavelet_mct_kernel", initInfo.buildOptions + options) );
+	waveletKernels[options] = kernel;
+	return kernel;
+}
+
 template <class T>  tDeviceRC Preprocessor::setColourTransformKernelArgs(DeviceKernel* myKernel,
 																     T *img_r, T *img_g, T *img_b, 
-																	 const unsigned short width, const unsigned short height,
+																	 const unsigned int width, const unsigned int height,
 																	 const int level_shift)
 {
 	cl_int error_code =  DeviceSuccess;
@@ -184,13 +690,13 @@ template <class T>  tDeviceRC Preprocessor::setColourTransformKernelArgs(DeviceK
 		LogError("Error: setColourTransformKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
 		return error_code;
 	}
-	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned short), &width);
+	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned int), &width);
 	if (DeviceSuccess != error_code)
 	{
 		LogError("Error: setColourTransformKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
 		return error_code;
 	}
-	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned short), &height);
+	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned int), &height);
 	if (DeviceSuccess != error_code)
 	{
 		LogError("Error: setColourTransformKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
@@ -207,7 +713,7 @@ template <class T>  tDeviceRC Preprocessor::setColourTransformKernelArgs(DeviceK
 
 template <class T>  tDeviceRC Preprocessor::setColourTransformInverseKernelArgs(DeviceKernel* myKernel,
 																     T *img_r, T *img_g, T *img_b, 
-																	 const unsigned short width, const unsigned short height,
+																	 const unsigned int width, const unsigned int height,
 																	 const int level_shift,
 																	 const int minimum,
 																	 const int maximum)
@@ -240,7 +746,7 @@ template <class T>  tDeviceRC Preprocessor::setColourTransformInverseKernelArgs(
 
 template <class T>  tDeviceRC Preprocessor::setDCShiftKernelArgs(DeviceKernel* myKernel,
 																     T *input, 
-																	 const unsigned short width, const unsigned short height,
+																	 const unsigned int width, const unsigned int height,
 																	 const int level_shift)
 {
 	cl_int error_code =  DeviceSuccess;
@@ -254,13 +760,13 @@ template <class T>  tDeviceRC Preprocessor::setDCShiftKernelArgs(DeviceKernel* m
 		LogError("Error: setDCShiftKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
 		return error_code;
 	}
-	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned short), &width);
+	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned int), &width);
 	if (DeviceSuccess != error_code)
 	{
 		LogError("Error: setDCShiftKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
 		return error_code;
 	}
-	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned short), &height);
+	error_code = clSetKernelArg(targetKernel, argNum++, sizeof(unsigned int), &height);
 	if (DeviceSuccess != error_code)
 	{
 		LogError("Error: setDCShiftKernelArgs returned %s.\n", TranslateOpenCLError(error_code));
@@ -277,7 +783,7 @@ template <class T>  tDeviceRC Preprocessor::setDCShiftKernelArgs(DeviceKernel* m
 
 template <class T>  tDeviceRC Preprocessor::setDCShiftInverseKernelArgs(DeviceKernel* myKernel,
 																     T *input, 
-																	 const unsigned short width, const unsigned short height,
+																	 const unsigned int width, const unsigned int height,
 																	 const int level_shift,
 																	 const int minimum,
 																	 const int maximum)
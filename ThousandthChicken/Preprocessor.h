@@ -2,8 +2,11 @@
 #pragma once
 
 #include "DeviceKernel.h"
+#include <map>
 
 typedef struct type_image type_image;
+typedef struct type_tile type_tile;
+typedef struct type_mcc_data type_mcc_data;
 
 
 typedef enum {
@@ -22,28 +25,35 @@ public:
 	void idc_level_shifting(type_image *img);
 	int color_decoder_lossy(type_image *img);
 	int color_decoder_lossless(type_image *img);
+	tDeviceRC decode_tile(type_tile *tile);
 
 private:
 	void dc_level_shifting(type_image *img, int sign);
+	tDeviceRC dc_level_shifting_tile(type_tile *tile, int sign);
 	int color_trans_gpu(type_image *img, color_trans_type type) ;
+	tDeviceRC color_trans_tile(type_tile *tile, color_trans_type type) ;
+	tDeviceRC array_mct_tile(type_tile *tile);
+	tDeviceRC array_mct_collection(type_tile *tile, type_mcc_data *collection);
+	tDeviceRC wavelet_mct_collection(type_tile *tile, type_mcc_data *collection);
+	DeviceKernel* waveletKernel(string options);
 	template <class T>  tDeviceRC setColourTransformKernelArgs(DeviceKernel* myKernel,
 		                                                       T *img_r, T *img_g, T *img_b,
-															   const unsigned short width, const unsigned short height, 
+															   const unsigned int width, const unsigned int height, 
 															   const int level_shift);
 	template <class T>  tDeviceRC setColourTransformInverseKernelArgs(DeviceKernel* myKernel,
 		                                                       T *img_r, T *img_g, T *img_b,
-															   const unsigned short width, const unsigned short height, 
+															   const unsigned int width, const unsigned int height, 
 															   const int level_shift,
 															   const int minimum,
 															   const int maximum);
 
 	template <class T>  tDeviceRC setDCShiftKernelArgs(DeviceKernel* myKernel,
 		                                                       T *input,
-															   const unsigned short width, const unsigned short height, 
+															   const unsigned int width, const unsigned int height, 
 															   const int level_shift);
 	template <class T>  tDeviceRC setDCShiftInverseKernelArgs(DeviceKernel* myKernel,
 		                                                       T *input,
-															   const unsigned short width, const unsigned short height, 
+															   const unsigned int width, const unsigned int height, 
 															   const int level_shift,
 															   const int minimum,
 															   const int maximum);
@@ -59,6 +69,11 @@ private:
 	DeviceKernel* dcShift;
 	DeviceKernel* dcShiftInverse;
 
+	DeviceKernel* arrayMct;
+	DeviceKernel* arrayMctStore;
+	// wavelet_mct_kernel specialisations, keyed by their build options
+	std::map<string, DeviceKernel*> waveletKernels;
+
 
 
 };
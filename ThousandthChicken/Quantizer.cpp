@@ -5,11 +5,12 @@
 
 #include "codestream_image_types.h"
 #include "basic.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
 
 
 Quantizer::Quantizer(KernelInitInfoBase initInfo)  : 
-	                    initInfo(initInfo),
-						d_subbandCodeblockCoefficients(0)
+	                    initInfo(initInfo)
 	                   
 {
 	 losslessKernel = new DeviceKernel( KernelInitInfo(initInfo, "quantizer_lossless_inverse.cl", "subband_dequantization_lossless") );
@@ -23,18 +24,11 @@ Quantizer::~Quantizer(void)
 		delete losslessKernel;
 	if (lossyKernel)
 		delete lossyKernel;
-
-	//release memory when finished dequant
-	if (d_subbandCodeblockCoefficients) {
-		cl_int err = clReleaseMemObject(d_subbandCodeblockCoefficients);
-	    SAMPLE_CHECK_ERRORS(err);
-	}
-
 }
 
 
 
-tDeviceRC Quantizer::dequantizationInit(type_subband *sb, void* coefficients)
+tDeviceRC Quantizer::dequantizationInit(type_subband *sb, void* coefficients, cl_mem* subbandCoefficients)
 {
 	type_res_lvl *res_lvl = sb->parent_res_lvl;
 	type_tile_comp *tile_comp = res_lvl->parent_tile_comp;
@@ -77,15 +71,17 @@ tDeviceRC Quantizer::dequantizationInit(type_subband *sb, void* coefficients)
 	}
 
 	//allocate device memory for coefficient data for all codeblocks from this sub band
-	d_subbandCodeblockCoefficients = clCreateBuffer(context, CL_MEM_READ_WRITE ,   sb->width * sb->height * sizeof(int), NULL, &err);
+	cl_mem d_subbandCodeblockCoefficients = clCreateBuffer(context, CL_MEM_READ_WRITE ,   (size_t)sb->width * sb->height * sizeof(int), NULL, &err);
     SAMPLE_CHECK_ERRORS(err);
     if (d_subbandCodeblockCoefficients == (cl_mem)0)
         throw Error("Failed to create d_decodedCoefficientsBuffers Buffer!");
+	ResourceCounters::bufferCreated(d_subbandCodeblockCoefficients);
 
 	//printf("%d %d %d\n", sb->num_cblks, tile_comp->cblk_w, tile_comp->cblk_h);
 
 	
 	int* d_coefficients = (int*)coefficients;
+	trace_set_level(sb->parent_res_lvl->dec_lvl_no);
 	// fill subband coefficients buffer
 	for (i = 0; i < sb->num_cblks; i++)
 	{
@@ -100,6 +96,7 @@ tDeviceRC Quantizer::dequantizationInit(type_subband *sb, void* coefficients)
 	   // The region size must be given in bytes
 		size_t region[] = { cblk->width * sizeof(int), cblk->height,1};
 		
+		cl_event traceEvent;
 		err = clEnqueueCopyBufferRect ( initInfo.cmd_queue, 	//copy command will be queued
    					  (cl_mem)(d_coefficients),		
    					  d_subbandCodeblockCoefficients,		
@@ -112,25 +109,30 @@ tDeviceRC Quantizer::dequantizationInit(type_subband *sb, void* coefficients)
 					  0, //length of each 2D slice in bytes
 					  0,
 					  NULL,
-					  NULL);
+					  Tracer::event(&traceEvent));
 		if (CL_SUCCESS != err)
 		{
 			LogError("Error: clEnqueueCopyBufferRect (srcMem) returned %s.\n", TranslateOpenCLError(err));
+			ResourceCounters::releaseBuffer(d_subbandCodeblockCoefficients);
+			return err;
 		}
-		return CL_SUCCESS;
+		Tracer::device(traceEvent, "copy code-block");
+		ResourceCounters::add(COUNTER_COPIES);
+		ResourceCounters::add(COUNTER_COPY_BYTES, region[0] * region[1]);
 				  
 	}
+	*subbandCoefficients = d_subbandCodeblockCoefficients;
 	return DeviceSuccess;
 }
 
-type_subband* Quantizer::dequantization(type_subband *sb, void** coefficients)
+tDeviceRC Quantizer::dequantization(type_subband *sb, cl_mem subbandCoefficients)
 {
 	type_res_lvl *res_lvl = sb->parent_res_lvl;
 	type_tile_comp *tile_comp = res_lvl->parent_tile_comp;
 	int odataOffset = sb->tlx + sb->tly * tile_comp->width;
 
-	cl_int2 isize = {sb->width, sb->height};
-	cl_int2 osize = {tile_comp->width, tile_comp->height};
+	cl_int2 isize = {(cl_int)sb->width, (cl_int)sb->height};
+	cl_int2 osize = {(cl_int)tile_comp->width, (cl_int)tile_comp->height};
 	cl_int2 cblk_size = {tile_comp->cblk_w, tile_comp->cblk_h};
 
 	type_image *img = tile_comp->parent_tile->parent_img;
@@ -140,7 +142,7 @@ type_subband* Quantizer::dequantization(type_subband *sb, void** coefficients)
 	/////////////////////////////////////
 	//set kernel arguments
 	int argNum = 0;
-	tDeviceRC err = clSetKernelArg(quantKernel, argNum++, sizeof(cl_mem), coefficients);
+	tDeviceRC err = clSetKernelArg(quantKernel, argNum++, sizeof(cl_mem), &subbandCoefficients);
     SAMPLE_CHECK_ERRORS(err);
 	
 	err = clSetKernelArg(quantKernel, argNum++, sizeof(cl_int2),  &isize);
@@ -168,51 +170,61 @@ type_subband* Quantizer::dequantization(type_subband *sb, void** coefficients)
 	size_t global_work_size[3] = {sb->num_xcblks * BLOCKSIZEX,   sb->num_ycblks * BLOCKSIZEY,1};
 	size_t local_work_size[3] = {BLOCKSIZEX, BLOCKSIZEY,1};
     // execute kernel
-	quant->enqueue(2,global_work_size, local_work_size);
-    SAMPLE_CHECK_ERRORS(err);
-
-	return sb;
+	err = quant->enqueue(2,global_work_size, local_work_size);
+	if (CL_SUCCESS != err)
+	{
+		LogError("Error: dequantization kernel returned %s.\n", TranslateOpenCLError(err));
+	}
+	return err;
 }
 
 /**
  * @brief Do dequantization for every subbands from tile.
  * @param tile
  */
-void Quantizer::dequantize_tile(type_tile *tile)
+tDeviceRC Quantizer::dequantize_tile(type_tile *tile)
 {
 	type_image *img = tile->parent_img;
-	for (int i = 0; i < img->num_components; i++)
-	{
-		type_tile_comp *tile_comp = tile->tile_comp + i;
-		for (int j = 0; j < tile_comp->num_rlvls; j++)
-		{
-			type_res_lvl *res_lvl = tile_comp->res_lvls + j;
-			for (int k = 0; k < res_lvl->num_subbands; k++)
-			{
-				type_subband *sb = res_lvl->subbands + k;
-				if (dequantizationInit(sb, tile->coefficients) != DeviceSuccess)
-					return;
-			}
-		}
+	for (int i = 0; i < img->num_components; i++) {
+		tDeviceRC err = dequantize_tile_comp(tile->tile_comp + i);
+		if (err != DeviceSuccess)
+			return err;
 	}
-	clFinish(initInfo.cmd_queue);
-	for (int i = 0; i < img->num_components; i++)
+	return DeviceSuccess;
+}
+
+/**
+ * @brief Do dequantization for every subband of a tile component.
+ *
+ * Copies and dequantization kernels are queued on the same in-order queue, so no host
+ * synchronization is needed between them.
+ * @param tile_comp
+ * @return DeviceSuccess or the first error; the decoded coefficients are released either way
+ */
+tDeviceRC Quantizer::dequantize_tile_comp(type_tile_comp *tile_comp)
+{
+	tDeviceRC err = DeviceSuccess;
+	for (int j = 0; j < tile_comp->num_rlvls && err == DeviceSuccess; j++)
 	{
-		type_tile_comp *tile_comp = tile->tile_comp + i;
-		for (int j = 0; j < tile_comp->num_rlvls; j++)
+		type_res_lvl *res_lvl = tile_comp->res_lvls + j;
+		for (int k = 0; k < res_lvl->num_subbands && err == DeviceSuccess; k++)
 		{
-			type_res_lvl *res_lvl = tile_comp->res_lvls + j;
-			for (int k = 0; k < res_lvl->num_subbands; k++)
-			{
-				type_subband *sb = res_lvl->subbands + k;
-				dequantization(sb, &tile->coefficients);
-			}
+			type_subband *sb = res_lvl->subbands + k;
+			cl_mem subbandCoefficients = 0;
+			err = dequantizationInit(sb, tile_comp->coefficients, &subbandCoefficients);
+			if (err != DeviceSuccess)
+				break;
+			err = dequantization(sb, subbandCoefficients);
+			// released once the dequantization kernel has completed
+			cl_int released = ResourceCounters::releaseBuffer(subbandCoefficients);
+			if (err == DeviceSuccess)
+				err = released;
 		}
 	}
-	//release decoded coefficients buffer
-	//TODO: release memory when finished dequant
-	//cl_int err = clReleaseMemObject((cl_mem)tile->coefficients);
-    //SAMPLE_CHECK_ERRORS(err);
+	//release decoded coefficients buffer once queued work has consumed it
+	cl_int released = ResourceCounters::releaseBuffer((cl_mem)tile_comp->coefficients);
+	tile_comp->coefficients = NULL;
+	return err != DeviceSuccess ? err : released;
 }
 
 /**
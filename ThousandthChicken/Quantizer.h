@@ -6,22 +6,23 @@
 
 struct type_subband;
 struct type_tile;
+struct type_tile_comp;
 
 class Quantizer 
 {
 public:
 	Quantizer(KernelInitInfoBase initInfo);
 	virtual ~Quantizer(void);
-	void dequantize_tile(type_tile *tile);
+	tDeviceRC dequantize_tile(type_tile *tile);
+	tDeviceRC dequantize_tile_comp(type_tile_comp *tile_comp);
 
 private:
-	type_subband* dequantization(type_subband *sb, void** coefficients);
-	tDeviceRC dequantizationInit(type_subband *sb, void* coefficients);
+	tDeviceRC dequantization(type_subband *sb, cl_mem subbandCoefficients);
+	tDeviceRC dequantizationInit(type_subband *sb, void* coefficients, cl_mem* subbandCoefficients);
 	int get_exp_subband_gain(int orient);
 	KernelInitInfoBase initInfo;
 	DeviceKernel* lossyKernel;
 	DeviceKernel* losslessKernel;
-	cl_mem d_subbandCodeblockCoefficients;
 
 };
 
@@ -0,0 +1,151 @@
+// License: please see LICENSE1 file for more details.
+
+#include "ResourceCounters.h"
+#include <stdio.h>
+#include <atomic>
+
+static std::atomic<unsigned long long> counters[COUNTER_COUNT];
+static std::atomic<bool> reportUsage(false);
+
+static const char* counterNames[COUNTER_COUNT] = {
+	"buffers created",
+	"buffers released",
+	"buffer bytes",
+	"writes",
+	"write bytes",
+	"reads",
+	"read bytes",
+	"maps",
+	"map bytes",
+	"unmaps",
+	"copies",
+	"copy bytes",
+	"fills",
+	"fill bytes",
+	"kernel launches",
+	"host allocations",
+	"host frees",
+	"host bytes",
+	"svm allocations",
+	"svm frees",
+	"svm bytes",
+	"staged upload bytes",
+	"staged upload ns",
+	"staged download bytes",
+	"staged download ns",
+	"device live bytes",
+	"device peak bytes",
+	"host live bytes",
+	"host peak bytes"
+};
+
+static void raisePeak(resource_counter peak, unsigned long long live)
+{
+	unsigned long long current = counters[peak];
+	while (live > current && !counters[peak].compare_exchange_weak(current, live))
+		;
+}
+
+// runs when the runtime destroys the buffer, i.e. after the last reference is gone
+static void CL_CALLBACK bufferDestroyed(cl_mem /*buffer*/, void* userData)
+{
+	counters[COUNTER_DEVICE_LIVE_BYTES] -= (unsigned long long)(size_t)userData;
+}
+
+void ResourceCounters::add(resource_counter counter, unsigned long long amount)
+{
+	counters[counter] += amount;
+}
+
+void ResourceCounters::bufferCreated(cl_mem buffer)
+{
+	if (!buffer)
+		return;
+	size_t bytes = 0;
+	clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size_t), &bytes, NULL);
+	counters[COUNTER_BUFFERS_CREATED]++;
+	counters[COUNTER_BUFFER_BYTES] += bytes;
+	if (clSetMemObjectDestructorCallback(buffer, bufferDestroyed, (void*)bytes) == CL_SUCCESS)
+		raisePeak(COUNTER_DEVICE_PEAK_BYTES, counters[COUNTER_DEVICE_LIVE_BYTES] += bytes);
+}
+
+cl_int ResourceCounters::releaseBuffer(cl_mem buffer)
+{
+	counters[COUNTER_BUFFERS_RELEASED]++;
+	return clReleaseMemObject(buffer);
+}
+
+void ResourceCounters::hostAllocated(size_t bytes)
+{
+	counters[COUNTER_HOST_ALLOCS]++;
+	counters[COUNTER_HOST_BYTES] += bytes;
+	raisePeak(COUNTER_HOST_PEAK_BYTES, counters[COUNTER_HOST_LIVE_BYTES] += bytes);
+}
+
+void ResourceCounters::hostFreed(size_t bytes)
+{
+	counters[COUNTER_HOST_FREES]++;
+	counters[COUNTER_HOST_LIVE_BYTES] -= bytes;
+}
+
+void ResourceCounters::svmAllocated(size_t bytes)
+{
+	counters[COUNTER_SVM_ALLOCS]++;
+	counters[COUNTER_SVM_BYTES] += bytes;
+}
+
+void ResourceCounters::svmFreed(unsigned int count)
+{
+	counters[COUNTER_SVM_FREES] += count;
+}
+
+unsigned long long ResourceCounters::get(resource_counter counter)
+{
+	return counters[counter];
+}
+
+void ResourceCounters::resetPeaks()
+{
+	counters[COUNTER_DEVICE_PEAK_BYTES] = counters[COUNTER_DEVICE_LIVE_BYTES].load();
+	counters[COUNTER_HOST_PEAK_BYTES] = counters[COUNTER_HOST_LIVE_BYTES].load();
+}
+
+ResourceSnapshot ResourceCounters::snapshot()
+{
+	ResourceSnapshot s;
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+		s.values[i] = counters[i];
+	return s;
+}
+
+ResourceSnapshot ResourceCounters::difference(const ResourceSnapshot& begin, const ResourceSnapshot& end)
+{
+	ResourceSnapshot d;
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+		d.values[i] = end.values[i] - begin.values[i];
+	for (int i = COUNTER_DEVICE_LIVE_BYTES; i < COUNTER_COUNT; ++i)
+		d.values[i] = end.values[i];
+	return d;
+}
+
+void ResourceCounters::print(const ResourceSnapshot& usage, const char* title)
+{
+	printf("%s\n", title);
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+		printf("  %-21s %llu\n", counterNames[i], usage.values[i]);
+	// bytes per nanosecond is GB/s
+	if (usage.values[COUNTER_STAGED_UPLOAD_NS])
+		printf("  upload bandwidth      %.2f GB/s\n", (double)usage.values[COUNTER_STAGED_UPLOAD_BYTES] / usage.values[COUNTER_STAGED_UPLOAD_NS]);
+	if (usage.values[COUNTER_STAGED_DOWNLOAD_NS])
+		printf("  download bandwidth    %.2f GB/s\n", (double)usage.values[COUNTER_STAGED_DOWNLOAD_BYTES] / usage.values[COUNTER_STAGED_DOWNLOAD_NS]);
+}
+
+void ResourceCounters::setReporting(bool enable)
+{
+	reportUsage = enable;
+}
+
+bool ResourceCounters::reporting()
+{
+	return reportUsage;
+}
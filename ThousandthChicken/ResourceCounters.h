@@ -0,0 +1,79 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+typedef enum {
+	COUNTER_BUFFERS_CREATED,
+	COUNTER_BUFFERS_RELEASED,
+	COUNTER_BUFFER_BYTES,       ///bytes of all device buffers created
+	COUNTER_WRITES,
+	COUNTER_WRITE_BYTES,
+	COUNTER_READS,
+	COUNTER_READ_BYTES,
+	COUNTER_MAPS,
+	COUNTER_MAP_BYTES,
+	COUNTER_UNMAPS,
+	COUNTER_COPIES,             ///buffer and rect copies
+	COUNTER_COPY_BYTES,
+	COUNTER_FILLS,
+	COUNTER_FILL_BYTES,
+	COUNTER_LAUNCHES,
+	COUNTER_HOST_ALLOCS,        ///aligned_malloc calls
+	COUNTER_HOST_FREES,
+	COUNTER_HOST_BYTES,
+	COUNTER_SVM_ALLOCS,         ///shared virtual memory allocations
+	COUNTER_SVM_FREES,
+	COUNTER_SVM_BYTES,
+	COUNTER_STAGED_UPLOAD_BYTES,    ///bytes of completed staging ring writes
+	COUNTER_STAGED_UPLOAD_NS,       ///device time of those writes
+	COUNTER_STAGED_DOWNLOAD_BYTES,
+	COUNTER_STAGED_DOWNLOAD_NS,
+	COUNTER_DEVICE_LIVE_BYTES,  ///device buffer bytes currently allocated
+	COUNTER_DEVICE_PEAK_BYTES,
+	COUNTER_HOST_LIVE_BYTES,    ///aligned_malloc bytes currently allocated
+	COUNTER_HOST_PEAK_BYTES,
+	COUNTER_COUNT
+} resource_counter;
+
+/** @brief Values of all counters at one point in time */
+struct ResourceSnapshot
+{
+	unsigned long long values[COUNTER_COUNT];
+};
+
+/**
+ * @brief Process wide registry of device allocations, transfers, kernel launches and host
+ * staging allocations.
+ *
+ * Call sites count themselves; the counters are plain atomics and always on. Usage of one
+ * decode is the difference of two snapshots, with peaks measured from the last resetPeaks().
+ * When several decodes run at once their usage is mixed.
+ */
+class ResourceCounters
+{
+public:
+	static void add(resource_counter counter, unsigned long long amount = 1);
+	/** @brief Counts a new buffer; its bytes stay live until the runtime destroys it */
+	static void bufferCreated(cl_mem buffer);
+	/** @brief clReleaseMemObject that counts the release */
+	static cl_int releaseBuffer(cl_mem buffer);
+	static void hostAllocated(size_t bytes);
+	static void hostFreed(size_t bytes);
+	/** @brief Counts a shared virtual memory allocation; the bytes are live while it is wrapped in a buffer */
+	static void svmAllocated(size_t bytes);
+	/** @brief Counts count shared virtual memory frees, direct or enqueued */
+	static void svmFreed(unsigned int count = 1);
+	static unsigned long long get(resource_counter counter);
+	/** @brief Restarts peak tracking from the currently live bytes */
+	static void resetPeaks();
+	static ResourceSnapshot snapshot();
+	/** @brief Usage between two snapshots; live and peak values are taken from end */
+	static ResourceSnapshot difference(const ResourceSnapshot& begin, const ResourceSnapshot& end);
+	static void print(const ResourceSnapshot& usage, const char* title);
+	/** @brief Whether decoders report per decode usage (the -stats option) */
+	static void setReporting(bool enable);
+	static bool reporting();
+};
@@ -0,0 +1,113 @@
+// License: please see LICENSE1 file for more details.
+
+#include "SharedMemory.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "ResourceCounters.h"
+#include <atomic>
+
+static std::atomic<bool> svmEnabled(true);
+
+
+void SharedMemory::setEnabled(bool enable)
+{
+	svmEnabled = enable;
+}
+
+#ifdef CL_VERSION_2_0
+
+bool SharedMemory::supported(cl_device_id device)
+{
+	if (!svmEnabled || !device)
+		return false;
+
+	// devices before 2.0 reject the query
+	cl_device_svm_capabilities caps = 0;
+	if (clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, NULL) != CL_SUCCESS)
+		return false;
+	if (!(caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER))
+		return false;
+
+	// on a discrete GPU shared memory would put every stage on the bus
+	cl_device_type type = 0;
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+	return (type & CL_DEVICE_TYPE_CPU) || unified;
+}
+
+void* SharedMemory::alloc(cl_context context, size_t bytes)
+{
+	void* ptr = clSVMAlloc(context, CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER, bytes, 0);
+	if (!ptr)
+		throw Error("Failed to allocate shared virtual memory!");
+	ResourceCounters::svmAllocated(bytes);
+	return ptr;
+}
+
+void SharedMemory::free(cl_context context, void* ptr)
+{
+	if (!ptr)
+		return;
+	clSVMFree(context, ptr);
+	ResourceCounters::svmFreed();
+}
+
+cl_mem SharedMemory::wrap(cl_context context, void* ptr, size_t bytes)
+{
+	cl_int err = CL_SUCCESS;
+	cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, bytes, ptr, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	ResourceCounters::bufferCreated(buffer);
+	return buffer;
+}
+
+cl_int SharedMemory::setKernelArg(cl_kernel kernel, cl_uint index, const void* ptr)
+{
+	return clSetKernelArgSVMPointer(kernel, index, ptr);
+}
+
+cl_int SharedMemory::freeAfter(cl_command_queue queue, cl_uint count, void** ptrs)
+{
+	cl_int err = clEnqueueSVMFree(queue, count, ptrs, NULL, NULL, 0, NULL, NULL);
+	if (CL_SUCCESS != err)
+	{
+		LogError("Error: clEnqueueSVMFree returned %s.\n", TranslateOpenCLError(err));
+	}
+	else
+		ResourceCounters::svmFreed(count);
+	return err;
+}
+
+#else
+
+bool SharedMemory::supported(cl_device_id device)
+{
+	return false;
+}
+
+void* SharedMemory::alloc(cl_context context, size_t bytes)
+{
+	throw Error("Shared virtual memory needs OpenCL 2.0 headers!");
+}
+
+void SharedMemory::free(cl_context context, void* ptr)
+{
+}
+
+cl_mem SharedMemory::wrap(cl_context context, void* ptr, size_t bytes)
+{
+	throw Error("Shared virtual memory needs OpenCL 2.0 headers!");
+}
+
+cl_int SharedMemory::setKernelArg(cl_kernel kernel, cl_uint index, const void* ptr)
+{
+	return CL_INVALID_OPERATION;
+}
+
+cl_int SharedMemory::freeAfter(cl_command_queue queue, cl_uint count, void** ptrs)
+{
+	return CL_INVALID_OPERATION;
+}
+
+#endif
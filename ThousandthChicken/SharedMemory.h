@@ -0,0 +1,32 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "platform.h"
+
+/**
+ * @brief Fine-grained shared virtual memory for devices that share the host's memory.
+ *
+ * On OpenCL 2.x CPU devices (and integrated GPUs) every buffer is host memory anyway. With
+ * fine-grained buffer SVM the host reads and writes device data in place, so the staging
+ * ring, COPY_HOST_PTR uploads and readbacks are skipped. Inputs the host produces are passed
+ * to kernels as SVM pointers; buffers the stage kernels take as cl_mem wrap an SVM allocation
+ * with CL_MEM_USE_HOST_PTR, which OpenCL 2.0 guarantees to alias the allocation.
+ *
+ * Compiled out when the OpenCL headers predate 2.0, in which case supported() is false.
+ */
+class SharedMemory
+{
+public:
+	/** @brief True if SVM is enabled and the device has unified memory with fine-grained buffer SVM */
+	static bool supported(cl_device_id device);
+	/** @brief Allows turning SVM off to compare against the copying path (the -nosvm option) */
+	static void setEnabled(bool enable);
+	static void* alloc(cl_context context, size_t bytes);
+	static void free(cl_context context, void* ptr);
+	/** @brief Buffer object aliasing an SVM allocation of at least bytes */
+	static cl_mem wrap(cl_context context, void* ptr, size_t bytes);
+	static cl_int setKernelArg(cl_kernel kernel, cl_uint index, const void* ptr);
+	/** @brief Frees allocations once the commands enqueued on queue so far have completed */
+	static cl_int freeAfter(cl_command_queue queue, cl_uint count, void** ptrs);
+};
@@ -0,0 +1,483 @@
+// License: please see LICENSE1 file for more details.
+
+#include "StageBenchmark.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "Decoder.h"
+#include "MemoryMapped.h"
+#include "ResourceCounters.h"
+#include "codestream_image.h"
+#include "codestream_image_types.h"
+#include "io_buffered_stream.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include "DWTKernel.cpp"
+
+enum file_stage {
+	FILE_TIER2,
+	FILE_TIER1,
+	FILE_DEQUANTIZE,
+	FILE_IDWT,
+	FILE_MCT,
+	FILE_STAGES
+};
+
+static const char* fileStageNames[FILE_STAGES] = { "tier2", "tier1", "dequantize", "idwt", "mct" };
+
+
+StageBenchmark::StageBenchmark(ocl_args_d_t* ocl, int iterations) : ocl(ocl),
+									  set(NULL),
+									  iterations(iterations < 1 ? 1 : iterations)
+{
+	set = new KernelSet(KernelInitInfoBase(ocl->commandQueue, "-I ./"));
+}
+
+
+StageBenchmark::~StageBenchmark(void)
+{
+	if (set)
+		delete set;
+}
+
+void StageBenchmark::finish()
+{
+	cl_int err = clFinish(set->getQueue());
+	SAMPLE_CHECK_ERRORS(err);
+}
+
+void StageBenchmark::add(const char* stage, const std::string& input, const std::string& params,
+						 int iterations, double seconds, double samples, double bytes, unsigned long long launches)
+{
+	StageResult r;
+	r.stage = stage;
+	r.input = input;
+	r.params = params;
+	r.iterations = iterations;
+	r.seconds = seconds / iterations;
+	r.samples = samples;
+	r.bytes = bytes;
+	r.launches = (double)launches / iterations;
+	results.push_back(r);
+}
+
+/**
+ * @brief Times one DWT kernel on a square synthetic image.
+ * @param T sample type of the kernel
+ */
+template <typename K, typename T> void StageBenchmark::timeDWT(const char* name, int size, int levels)
+{
+	K kernel(KernelInitInfoBase(set->getQueue(), "-I ./"));
+	const size_t numSamples = (size_t)size * size;
+	const size_t bytes = numSamples * sizeof(T);
+
+	std::vector<T> ramp(numSamples);
+	for (size_t i = 0; i < numSamples; ++i)
+		ramp[i] = (T)((int)(i % 255) - 128);
+
+	cl_int err = CL_SUCCESS;
+	cl_mem src = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes, &ramp[0], &err);
+	SAMPLE_CHECK_ERRORS(err);
+	cl_mem dst = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+	SAMPLE_CHECK_ERRORS(err);
+
+	// first run builds and caches the program on the device
+	kernel.run(src, dst, size, size, levels);
+	finish();
+
+	unsigned long long launches = ResourceCounters::get(COUNTER_LAUNCHES);
+	double t1 = time_stamp();
+	for (int i = 0; i < iterations; ++i) {
+		kernel.run(src, dst, size, size, levels);
+		finish();
+	}
+	double elapsed = time_stamp() - t1;
+
+	char params[64];
+	sprintf(params, "%dx%d levels=%d", size, size, levels);
+	add(name, "synthetic", params, iterations, elapsed, (double)numSamples, (double)bytes, ResourceCounters::get(COUNTER_LAUNCHES) - launches);
+
+	clReleaseMemObject(dst);
+	clReleaseMemObject(src);
+}
+
+/**
+ * @brief Times forward and reverse 5/3 and 9/7 transforms over all combinations of
+ * square image sizes and decomposition levels.
+ */
+void StageBenchmark::runDWT(const std::vector<int>& sizes, const std::vector<int>& levels)
+{
+	for (size_t s = 0; s < sizes.size(); ++s) {
+		for (size_t l = 0; l < levels.size(); ++l) {
+			timeDWT<DWTForward53, int>("DWTForward53", sizes[s], levels[l]);
+			timeDWT<DWTReverse53, int>("DWTReverse53", sizes[s], levels[l]);
+			timeDWT<DWTForward97, float>("DWTForward97", sizes[s], levels[l]);
+			timeDWT<DWTReverse97, float>("DWTReverse97", sizes[s], levels[l]);
+		}
+	}
+}
+
+/**
+ * @brief Times Preprocessor::decode_tile on a synthetic three component 8 bit tile.
+ * @param useMct 1 for an inverse colour transform, 0 for the inverse DC level shift only
+ * @param waveletType selects the reversible (0) or irreversible (1) colour transform
+ */
+void StageBenchmark::timePreprocess(const char* name, int size, unsigned char useMct, unsigned char waveletType)
+{
+	const int numComps = 3;
+	const size_t numSamples = (size_t)size * size;
+
+	type_image img;
+	type_tile tile;
+	type_tile_comp comps[numComps];
+	memset(&img, 0, sizeof(img));
+	memset(&tile, 0, sizeof(tile));
+	memset(comps, 0, sizeof(comps));
+
+	img.width = img.height = (unsigned int)size;
+	img.num_components = numComps;
+	img.num_range_bits = 8;
+	img.sign = UNSIGNED;
+	img.use_mct = useMct;
+	img.wavelet_type = waveletType;
+	img.num_tiles = 1;
+	img.tile = &tile;
+	tile.width = tile.height = (unsigned int)size;
+	tile.tile_comp = comps;
+	tile.parent_img = &img;
+
+	std::vector<int> ramp(numSamples);
+	for (size_t i = 0; i < numSamples; ++i)
+		ramp[i] = (int)(i % 255) - 128;
+	for (int c = 0; c < numComps; ++c) {
+		cl_int err = CL_SUCCESS;
+		comps[c].width = comps[c].height = (unsigned int)size;
+		comps[c].tile_comp_no = c;
+		comps[c].parent_tile = &tile;
+		comps[c].img_data_d = (void*)clCreateBuffer(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, numSamples * sizeof(int), &ramp[0], &err);
+		SAMPLE_CHECK_ERRORS(err);
+	}
+
+	set->preprocessor->decode_tile(&tile);
+	finish();
+
+	unsigned long long launches = ResourceCounters::get(COUNTER_LAUNCHES);
+	double t1 = time_stamp();
+	for (int i = 0; i < iterations; ++i) {
+		set->preprocessor->decode_tile(&tile);
+		finish();
+	}
+	double elapsed = time_stamp() - t1;
+
+	char params[64];
+	sprintf(params, "%dx%dx%d", size, size, numComps);
+	add(name, "synthetic", params, iterations, elapsed, (double)(numSamples * numComps),
+		(double)(numSamples * numComps * sizeof(int)), ResourceCounters::get(COUNTER_LAUNCHES) - launches);
+
+	for (int c = 0; c < numComps; ++c)
+		clReleaseMemObject((cl_mem)comps[c].img_data_d);
+}
+
+void StageBenchmark::runPreprocess(const std::vector<int>& sizes)
+{
+	for (size_t s = 0; s < sizes.size(); ++s) {
+		timePreprocess("rctInverse", sizes[s], 1, 0);
+		timePreprocess("ictInverse", sizes[s], 1, 1);
+		timePreprocess("dcShiftInverse", sizes[s], 0, 0);
+	}
+}
+
+/** Field widths of a synthetic packet header: inclusion, zero bit-planes, passes, comma code and length bits */
+static const int tier2Fields[] = { 1, 1, 1, 2, 1, 5, 1, 1, 1, 7, 3, 12, 1, 16 };
+static const int numTier2Fields = sizeof(tier2Fields) / sizeof(tier2Fields[0]);
+
+/**
+ * @brief Times packet header bit reading on a synthetic stream of size * size / 8 bytes,
+ * with bit-by-bit read_bits() against the 64 bit type_bit_reader.
+ *
+ * About one byte in 64 is 0xFF, so both readers go through bit unstuffing.
+ */
+void StageBenchmark::timeTier2(int size)
+{
+	const size_t numBytes = (size_t)size * size / 8 + 8;
+	std::vector<unsigned char> stream(numBytes);
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < numBytes; ++i) {
+		seed = seed * 1103515245 + 12345;
+		unsigned char byte = (unsigned char)(seed >> 16);
+		if ((seed >> 8) % 64 == 0)
+			byte = 0xff;
+		if (i > 0 && stream[i - 1] == 0xff)
+			byte &= 0x7f;
+		stream[i] = byte;
+	}
+
+	type_buffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.start = &stream[0];
+	buffer.end = &stream[0] + numBytes;
+
+	// read_bits() decides how many fields fit; the last eight bytes are left for the reader's lookahead
+	unsigned int expected = 0;
+	int numFields = 0;
+	buffer.bp = buffer.start;
+	while (buffer.bp < buffer.end - 8) {
+		expected += read_bits(&buffer, tier2Fields[numFields % numTier2Fields]);
+		numFields++;
+	}
+	double bytesRead = (double)(buffer.bp - buffer.start);
+
+	char params[64];
+	sprintf(params, "%d fields", numFields);
+	unsigned int checksum = 0;
+	double t1 = time_stamp();
+	for (int it = 0; it < iterations; ++it) {
+		buffer.bp = buffer.start;
+		buffer.byte = 0;
+		buffer.bits_count = 0;
+		checksum = 0;
+		for (int f = 0; f < numFields; ++f)
+			checksum += read_bits(&buffer, tier2Fields[f % numTier2Fields]);
+	}
+	add("tier2 read_bits", "synthetic", params, iterations, time_stamp() - t1, numFields, bytesRead, 0);
+
+	t1 = time_stamp();
+	for (int it = 0; it < iterations; ++it) {
+		type_bit_reader reader;
+		buffer.bp = buffer.start;
+		buffer.byte = 0;
+		bit_reader_init(&reader, &buffer);
+		checksum = 0;
+		for (int f = 0; f < numFields; ++f)
+			checksum += bit_reader_read(&reader, tier2Fields[f % numTier2Fields]);
+		bit_reader_align(&reader);
+	}
+	add("tier2 bit_reader", "synthetic", params, iterations, time_stamp() - t1, numFields, bytesRead, 0);
+
+	if (checksum != expected)
+		LogError("Error: bit reader checksum %08x differs from read_bits %08x\n", checksum, expected);
+}
+
+void StageBenchmark::runTier2(const std::vector<int>& sizes)
+{
+	for (size_t s = 0; s < sizes.size(); ++s)
+		timeTier2(sizes[s]);
+}
+
+static double codeBlockBytes(type_image* img)
+{
+	double bytes = 0;
+	for (unsigned int i = 0; i < img->num_tiles; i++) {
+		type_tile* tile = img->tile + i;
+		for (unsigned int j = 0; j < img->num_components; j++) {
+			type_tile_comp* tile_comp = tile->tile_comp + j;
+			for (int r = 0; r < tile_comp->num_rlvls; r++) {
+				type_res_lvl* res_lvl = tile_comp->res_lvls + r;
+				for (int s = 0; s < res_lvl->num_subbands; s++) {
+					type_subband* sb = res_lvl->subbands + s;
+					for (unsigned int c = 0; c < sb->num_cblks; c++)
+						bytes += sb->cblks[c].length;
+				}
+			}
+		}
+	}
+	return bytes;
+}
+
+/**
+ * @brief Decodes a file stage by stage, draining the queue between stages, and records
+ * the time of every stage summed over all tiles and components.
+ * @return 0 on success, -1 if the file could not be parsed
+ */
+int StageBenchmark::runFile(const std::string& fileName)
+{
+	double fileBytes = 0;
+	{
+		MemoryMapped data(fileName, MemoryMapped::WholeFile, MemoryMapped::SequentialScan);
+		if (!data.isValid()) {
+			LogError("Error: cannot open %s\n", fileName.c_str());
+			return -1;
+		}
+		fileBytes = (double)data.size();
+	}
+
+	// header only: neither packets nor the device are touched
+	type_image_info info;
+	double t0 = time_stamp();
+	for (int it = 0; it < iterations; ++it) {
+		if (Decoder::probe(fileName, &info) != PROBE_OK) {
+			LogError("Error: cannot probe %s\n", fileName.c_str());
+			return -1;
+		}
+	}
+	add("probe", fileName, "", iterations, time_stamp() - t0, 0, 0, 0);
+
+	// Tier-2 alone with the tiles located by Psot and parsed on one thread per hardware thread
+	{
+		Decoder threaded(ocl, 1);
+		threaded.setParseThreads(0);
+		double seconds = 0;
+		for (int it = 0; it <= iterations; ++it) {
+			double t1 = time_stamp();
+			type_image* img = threaded.parse(fileName);
+			double t2 = time_stamp();
+			if (!img)
+				return -1;
+			free_image(img);
+			if (it > 0)
+				seconds += t2 - t1;
+		}
+		char params[64];
+		sprintf(params, "%u threads", std::thread::hardware_concurrency());
+		add("tier2 threads", fileName, params, iterations, seconds, 0, fileBytes, 0);
+	}
+
+	// the decoder's kernels are never used, it only collects the parsed code-blocks
+	Decoder parser(ocl, 1);
+	double elapsed[FILE_STAGES] = {0};
+	unsigned long long launches[FILE_STAGES] = {0};
+	double samples = 0;
+	double bytes[FILE_STAGES] = {0};
+
+	// iteration 0 warms up the programs and the file cache and is not counted
+	for (int it = 0; it <= iterations; ++it) {
+		double t1 = time_stamp();
+		type_image* img = parser.parse(fileName);
+		double t2 = time_stamp();
+		if (!img)
+			return -1;
+
+		unsigned int i, j;
+		// tile buffers as the decoder lays them out, so the Part 2 transforms take their tile level path
+		for (i = 0; i < img->num_tiles; i++)
+			parser.allocateTileBuffers(img->tile + i);
+		double imageSamples = (double)img->width * img->height * img->num_components;
+		double compressedBytes = codeBlockBytes(img);
+
+		double stageTime[FILE_STAGES] = {0};
+		unsigned long long stageLaunches[FILE_STAGES] = {0};
+		stageTime[FILE_TIER2] = t2 - t1;
+		tDeviceRC rc = DeviceSuccess;
+		int stage;
+		for (stage = FILE_TIER1; stage < FILE_STAGES; ++stage) {
+			unsigned long long l = ResourceCounters::get(COUNTER_LAUNCHES);
+			t1 = time_stamp();
+			for (i = 0; i < img->num_tiles && rc == DeviceSuccess; i++) {
+				type_tile* tile = img->tile + i;
+				if (stage == FILE_MCT) {
+					rc = set->preprocessor->decode_tile(tile);
+					continue;
+				}
+				for (j = 0; j < img->num_components && rc == DeviceSuccess; j++) {
+					type_tile_comp* tile_comp = tile->tile_comp + j;
+					if (stage == FILE_TIER1)
+						rc = set->coder->decode_tile_comp(tile_comp);
+					else if (stage == FILE_DEQUANTIZE)
+						rc = set->quantizer->dequantize_tile_comp(tile_comp);
+					else
+						rc = set->dwt->iwt_tile_comp(tile_comp);
+				}
+			}
+			finish();
+			if (rc != DeviceSuccess)
+				break;
+			stageTime[stage] = time_stamp() - t1;
+			stageLaunches[stage] = ResourceCounters::get(COUNTER_LAUNCHES) - l;
+		}
+
+		for (i = 0; i < img->num_tiles; i++) {
+			type_tile* tile = img->tile + i;
+			for (j = 0; j < img->num_components; j++) {
+				// coefficients of components a failed stage left behind
+				type_tile_comp* tile_comp = tile->tile_comp + j;
+				if (tile_comp->coefficients) {
+					ResourceCounters::releaseBuffer((cl_mem)tile_comp->coefficients);
+					tile_comp->coefficients = NULL;
+				}
+			}
+			parser.releaseTileBuffers(tile);
+		}
+		free_image(img);
+		if (rc != DeviceSuccess) {
+			LogError("Error: stage %s failed on %s (%d)\n", fileStageNames[stage], fileName.c_str(), rc);
+			return -1;
+		}
+
+		if (it == 0)
+			continue;
+		for (int stage = 0; stage < FILE_STAGES; ++stage) {
+			elapsed[stage] += stageTime[stage];
+			launches[stage] += stageLaunches[stage];
+		}
+		samples = imageSamples;
+		bytes[FILE_TIER2] = fileBytes;
+		bytes[FILE_TIER1] = compressedBytes;
+		bytes[FILE_DEQUANTIZE] = bytes[FILE_IDWT] = bytes[FILE_MCT] = imageSamples * sizeof(int);
+	}
+
+	for (int stage = 0; stage < FILE_STAGES; ++stage)
+		add(fileStageNames[stage], fileName, "", iterations, elapsed[stage], samples, bytes[stage], launches[stage]);
+	return 0;
+}
+
+void StageBenchmark::print()
+{
+	printf("%-16s %-24s %-20s %12s %14s %14s %10s\n", "stage", "input", "params", "ms", "MSamples/s", "MB/s", "launches");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const StageResult& r = results[i];
+		double rate = r.seconds > 0 ? 1.0 / r.seconds : 0;
+		printf("%-16s %-24s %-20s %12.3f %14.2f %14.2f %10.1f\n", r.stage.c_str(), r.input.c_str(), r.params.c_str(),
+			r.seconds * 1000, r.samples * rate / 1e6, r.bytes * rate / 1e6, r.launches);
+	}
+}
+
+int StageBenchmark::writeCSV(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "w");
+	if (!fp) {
+		LogError("Error: cannot write %s\n", fileName.c_str());
+		return -1;
+	}
+	fprintf(fp, "stage,input,params,iterations,seconds,samples,bytes,launches,samples_per_s,bytes_per_s\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const StageResult& r = results[i];
+		double rate = r.seconds > 0 ? 1.0 / r.seconds : 0;
+		fprintf(fp, "%s,\"%s\",%s,%d,%.9f,%.0f,%.0f,%.1f,%.1f,%.1f\n", r.stage.c_str(), r.input.c_str(), r.params.c_str(),
+			r.iterations, r.seconds, r.samples, r.bytes, r.launches, r.samples * rate, r.bytes * rate);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static std::string jsonEscape(const std::string& s)
+{
+	std::string out;
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (s[i] == '"' || s[i] == '\\')
+			out += '\\';
+		out += s[i];
+	}
+	return out;
+}
+
+int StageBenchmark::writeJSON(const std::string& fileName)
+{
+	FILE* fp = fopen(fileName.c_str(), "w");
+	if (!fp) {
+		LogError("Error: cannot write %s\n", fileName.c_str());
+		return -1;
+	}
+	fprintf(fp, "[\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const StageResult& r = results[i];
+		double rate = r.seconds > 0 ? 1.0 / r.seconds : 0;
+		fprintf(fp, "  {\"stage\": \"%s\", \"input\": \"%s\", \"params\": \"%s\", \"iterations\": %d, \"seconds\": %.9f, "
+			"\"samples\": %.0f, \"bytes\": %.0f, \"launches\": %.1f, \"samples_per_s\": %.1f, \"bytes_per_s\": %.1f}%s\n",
+			r.stage.c_str(), jsonEscape(r.input).c_str(), r.params.c_str(), r.iterations, r.seconds,
+			r.samples, r.bytes, r.launches, r.samples * rate, r.bytes * rate, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "]\n");
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,64 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "KernelSet.h"
+#include <string>
+#include <vector>
+
+struct ocl_args_d_t;
+
+/** @brief Timing of one stage on one input, averaged over the timed iterations */
+struct StageResult
+{
+	std::string stage;
+	std::string input;
+	/** Stage parameters, e.g. size and levels of a DWT */
+	std::string params;
+	int iterations;
+	/** Mean wall time of one iteration, in seconds */
+	double seconds;
+	/** Samples processed per iteration */
+	double samples;
+	/** Input bytes consumed per iteration */
+	double bytes;
+	/** Kernel launches per iteration */
+	double launches;
+};
+
+/**
+ * @brief Times each decoder stage in isolation.
+ *
+ * Every stage is enqueued on its own and the queue drained before the clock stops, so a
+ * result covers the stage's host work, its transfers and its kernels, but nothing else.
+ * Synthetic inputs cover the stages that do not need a codestream (DWT, preprocessing) and
+ * the packet header bit reading of Tier-2;
+ * corpus files cover the whole chain from Tier-2 parsing to the inverse colour transform.
+ */
+class StageBenchmark
+{
+public:
+	StageBenchmark(ocl_args_d_t* ocl, int iterations = 10);
+	~StageBenchmark(void);
+	void runDWT(const std::vector<int>& sizes, const std::vector<int>& levels);
+	void runPreprocess(const std::vector<int>& sizes);
+	void runTier2(const std::vector<int>& sizes);
+	int runFile(const std::string& fileName);
+	void print();
+	int writeCSV(const std::string& fileName);
+	int writeJSON(const std::string& fileName);
+	const std::vector<StageResult>& getResults() { return results; }
+
+private:
+	template <typename K, typename T> void timeDWT(const char* name, int size, int levels);
+	void timePreprocess(const char* name, int size, unsigned char useMct, unsigned char waveletType);
+	void timeTier2(int size);
+	void add(const char* stage, const std::string& input, const std::string& params,
+	         int iterations, double seconds, double samples, double bytes, unsigned long long launches);
+	void finish();
+
+	ocl_args_d_t* ocl;
+	KernelSet* set;
+	int iterations;
+	std::vector<StageResult> results;
+};
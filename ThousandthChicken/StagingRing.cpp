@@ -0,0 +1,221 @@
+// License: please see LICENSE1 file for more details.
+
+#include "StagingRing.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+
+
+struct TransferRecord
+{
+	size_t bytes;
+	bool upload;
+};
+
+// adds the device time of a finished transfer to the bandwidth counters
+static void CL_CALLBACK transferComplete(cl_event event, cl_int status, void* userData)
+{
+	TransferRecord* record = (TransferRecord*)userData;
+	cl_ulong start = 0, end = 0;
+	if (status == CL_COMPLETE &&
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS &&
+		end > start) {
+		ResourceCounters::add(record->upload ? COUNTER_STAGED_UPLOAD_BYTES : COUNTER_STAGED_DOWNLOAD_BYTES, record->bytes);
+		ResourceCounters::add(record->upload ? COUNTER_STAGED_UPLOAD_NS : COUNTER_STAGED_DOWNLOAD_NS, end - start);
+	}
+	delete record;
+}
+
+static void watchTransfer(cl_event event, size_t bytes, bool upload)
+{
+	TransferRecord* record = new TransferRecord;
+	record->bytes = bytes;
+	record->upload = upload;
+	if (clSetEventCallback(event, CL_COMPLETE, transferComplete, record) != CL_SUCCESS)
+		delete record;
+}
+
+
+StagingRing::StagingRing(cl_context context, size_t maxSlots) : context(context),
+									maxSlots(maxSlots ? maxSlots : 1),
+									next(0)
+{
+}
+
+
+StagingRing::~StagingRing(void)
+{
+	for (size_t i = 0; i < slots.size(); ++i)
+		destroySlot(slots[i]);
+}
+
+size_t StagingRing::createSlot(cl_command_queue queue, size_t bytes)
+{
+	cl_int err = CL_SUCCESS;
+	Slot slot;
+	slot.size = bytes;
+	slot.fence = 0;
+	slot.held = false;
+	slot.queue = queue;
+	clRetainCommandQueue(queue);
+	slot.buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	if (slot.buffer == (cl_mem)0)
+		throw Error("Failed to create staging Buffer!");
+	ResourceCounters::bufferCreated(slot.buffer);
+
+	// mapped once; the pointer stays valid until the slot is destroyed
+	slot.host = clEnqueueMapBuffer(queue, slot.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0, NULL, NULL, &err);
+	SAMPLE_CHECK_ERRORS(err);
+	ResourceCounters::add(COUNTER_MAPS);
+	ResourceCounters::add(COUNTER_MAP_BYTES, bytes);
+	slots.push_back(slot);
+	return slots.size() - 1;
+}
+
+void StagingRing::destroySlot(Slot& slot)
+{
+	if (slot.fence) {
+		clWaitForEvents(1, &slot.fence);
+		clReleaseEvent(slot.fence);
+		slot.fence = 0;
+	}
+	if (slot.buffer) {
+		cl_int err = clEnqueueUnmapMemObject(slot.queue, slot.buffer, slot.host, 0, NULL, NULL);
+		if (CL_SUCCESS != err)
+		{
+			LogError("Error: clEnqueueUnmapMemObject returned %s.\n", TranslateOpenCLError(err));
+		}
+		else
+		{
+			ResourceCounters::add(COUNTER_UNMAPS);
+		}
+		ResourceCounters::releaseBuffer(slot.buffer);
+		clReleaseCommandQueue(slot.queue);
+		slot.buffer = 0;
+	}
+	slot.host = NULL;
+}
+
+StagingRing::Slot* StagingRing::find(void* staging)
+{
+	for (size_t i = 0; i < slots.size(); ++i) {
+		if (slots[i].host == staging)
+			return &slots[i];
+	}
+	return NULL;
+}
+
+void* StagingRing::acquire(cl_command_queue queue, size_t bytes)
+{
+	cl_event fence = 0;
+	size_t chosen = slots.size();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size_t count = slots.size();
+		size_t idle = count;
+		// prefer a free slot whose last transfer has already completed
+		for (size_t k = 0; k < count && chosen == count; ++k) {
+			size_t i = (next + k) % count;
+			if (slots[i].held)
+				continue;
+			if (idle == count)
+				idle = i;
+			cl_int status = CL_COMPLETE;
+			if (slots[i].fence)
+				clGetEventInfo(slots[i].fence, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+			if (status == CL_COMPLETE)
+				chosen = i;
+		}
+		if (chosen == count) {
+			if (count < maxSlots || idle == count)
+				chosen = createSlot(queue, bytes);
+			else
+				chosen = idle;
+		}
+		Slot& slot = slots[chosen];
+		slot.held = true;
+		fence = slot.fence;
+		slot.fence = 0;
+		next = chosen + 1;
+	}
+
+	if (fence) {
+		TraceSpan span("staging wait");
+		clWaitForEvents(1, &fence);
+		clReleaseEvent(fence);
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	Slot& slot = slots[chosen];
+	if (slot.size < bytes) {
+		// grow in place: the slot keeps its position in the ring
+		destroySlot(slot);
+		size_t grown = createSlot(queue, bytes);
+		slots[chosen] = slots[grown];
+		slots.pop_back();
+		slots[chosen].held = true;
+	}
+	return slots[chosen].host;
+}
+
+tDeviceRC StagingRing::upload(cl_command_queue queue, void* staging, cl_mem dst, size_t bytes)
+{
+	cl_event fence = 0;
+	cl_int err = clEnqueueWriteBuffer(queue, dst, CL_FALSE, 0, bytes, staging, 0, NULL, &fence);
+	if (CL_SUCCESS != err)
+	{
+		LogError("Error: clEnqueueWriteBuffer returned %s.\n", TranslateOpenCLError(err));
+		release(staging);
+		return err;
+	}
+	Tracer::device(fence, "staged write", true);
+	ResourceCounters::add(COUNTER_WRITES);
+	ResourceCounters::add(COUNTER_WRITE_BYTES, bytes);
+	watchTransfer(fence, bytes, true);
+	// start the transfer now, so it overlaps with kernels already queued elsewhere
+	clFlush(queue);
+
+	std::lock_guard<std::mutex> guard(lock);
+	Slot* slot = find(staging);
+	if (!slot) {
+		clReleaseEvent(fence);
+		return CL_INVALID_VALUE;
+	}
+	slot->fence = fence;
+	slot->held = false;
+	return DeviceSuccess;
+}
+
+void* StagingRing::download(cl_command_queue queue, cl_mem src, size_t bytes, tDeviceRC* rc)
+{
+	void* staging = acquire(queue, bytes);
+	cl_event fence = 0;
+	cl_int err = clEnqueueReadBuffer(queue, src, CL_FALSE, 0, bytes, staging, 0, NULL, &fence);
+	if (rc)
+		*rc = err;
+	if (CL_SUCCESS != err)
+	{
+		LogError("Error: clEnqueueReadBuffer returned %s.\n", TranslateOpenCLError(err));
+		release(staging);
+		return NULL;
+	}
+	Tracer::device(fence, "staged read", true);
+	ResourceCounters::add(COUNTER_READS);
+	ResourceCounters::add(COUNTER_READ_BYTES, bytes);
+	watchTransfer(fence, bytes, false);
+
+	std::lock_guard<std::mutex> guard(lock);
+	find(staging)->fence = fence;
+	return staging;
+}
+
+void StagingRing::release(void* staging)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Slot* slot = find(staging);
+	if (slot)
+		slot->held = false;
+}
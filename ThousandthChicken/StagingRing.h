@@ -0,0 +1,63 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include "platform.h"
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Reusable pinned host buffers for uploads and readbacks.
+ *
+ * Every slot is a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped for its lifetime, so the
+ * runtime can transfer straight from and into it. Transfers are non-blocking; a slot keeps
+ * the event of its last transfer as a fence and is handed out again only once that fence
+ * has completed. Upload slots go back to the ring as soon as their write is enqueued,
+ * readback slots when the host releases them after reading.
+ *
+ * The ring grows to maxSlots and then reuses slots round-robin. If every slot is held by
+ * readbacks that have not been released yet, it grows further rather than deadlock.
+ */
+class StagingRing
+{
+public:
+	StagingRing(cl_context context, size_t maxSlots);
+	~StagingRing(void);
+	/**
+	 * @brief Returns the host pointer of a slot of at least bytes, waiting for its fence.
+	 * @param queue used to map a new slot
+	 */
+	void* acquire(cl_command_queue queue, size_t bytes);
+	/** @brief Enqueues a non-blocking write of an acquired slot into dst and returns the slot to the ring */
+	tDeviceRC upload(cl_command_queue queue, void* staging, cl_mem dst, size_t bytes);
+	/**
+	 * @brief Enqueues a non-blocking read of src into a slot that stays held until release().
+	 * @return host pointer, valid to read once later commands on queue have completed
+	 */
+	void* download(cl_command_queue queue, cl_mem src, size_t bytes, tDeviceRC* rc);
+	/** @brief Returns a readback slot to the ring */
+	void release(void* staging);
+	size_t getSlotCount() const { return slots.size(); }
+
+private:
+	struct Slot
+	{
+		cl_mem buffer;
+		void* host;
+		/** Queue the slot was mapped on, needed to unmap it */
+		cl_command_queue queue;
+		size_t size;
+		/** Last transfer from or into the slot, 0 if none is pending */
+		cl_event fence;
+		bool held;
+	};
+	size_t createSlot(cl_command_queue queue, size_t bytes);
+	void destroySlot(Slot& slot);
+	Slot* find(void* staging);
+
+	cl_context context;
+	size_t maxSlots;
+	size_t next;
+	std::vector<Slot> slots;
+	std::mutex lock;
+};
@@ -0,0 +1,79 @@
+// License: please see LICENSE1 file for more details.
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int numThreads) : generation(0),
+									stopping(false),
+									busy(0),
+									task(NULL),
+									userData(NULL),
+									numItems(0),
+									nextItem(0)
+{
+	if (numThreads == 0)
+		numThreads = thread::hardware_concurrency();
+	for (unsigned int i = 1; i < numThreads; ++i)
+		workers.push_back(thread(&ThreadPool::worker, this));
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+		started.notify_all();
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+/**
+ * @brief Calls task for every item in [0, numItems) on the pool and returns when all are done.
+ */
+void ThreadPool::run(unsigned int numItems, ThreadPoolTask task, void* userData)
+{
+	lock_guard<mutex> serial(runLock);
+	{
+		lock_guard<mutex> guard(lock);
+		this->task = task;
+		this->userData = userData;
+		this->numItems = numItems;
+		nextItem = 0;
+		busy = workers.size();
+		++generation;
+		started.notify_all();
+	}
+	work();
+
+	unique_lock<mutex> guard(lock);
+	while (busy)
+		finished.wait(guard);
+}
+
+void ThreadPool::worker()
+{
+	unsigned long long seen = 0;
+	for (;;) {
+		{
+			unique_lock<mutex> guard(lock);
+			while (!stopping && generation == seen)
+				started.wait(guard);
+			if (stopping)
+				return;
+			seen = generation;
+		}
+		work();
+
+		lock_guard<mutex> guard(lock);
+		if (--busy == 0)
+			finished.notify_one();
+	}
+}
+
+void ThreadPool::work()
+{
+	for (unsigned int item = nextItem++; item < numItems; item = nextItem++)
+		task(item, userData);
+}
@@ -0,0 +1,49 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Runs item number item of a ThreadPool::run call */
+typedef void (*ThreadPoolTask)(unsigned int item, void* userData);
+
+/**
+ * @brief Fixed set of host threads sharing out the items of one run call at a time.
+ *
+ * The calling thread takes items as well, so a pool of one thread runs everything in place.
+ * Items are handed out one by one, so that uneven items, e.g. tiles of different sizes,
+ * keep every thread busy.
+ */
+class ThreadPool
+{
+public:
+	/** @brief numThreads counts the calling thread; 0 starts one thread per hardware thread */
+	ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool(void);
+	void run(unsigned int numItems, ThreadPoolTask task, void* userData);
+	unsigned int getNumThreads() const { return (unsigned int)workers.size() + 1; }
+private:
+	void worker();
+	void work();
+
+	std::vector<std::thread> workers;
+	/** Serializes run calls */
+	std::mutex runLock;
+	std::mutex lock;
+	std::condition_variable started;
+	std::condition_variable finished;
+	/** Counts run calls, so that every worker joins every call exactly once */
+	unsigned long long generation;
+	bool stopping;
+	/** Workers that have not finished the current call yet */
+	size_t busy;
+
+	ThreadPoolTask task;
+	void* userData;
+	unsigned int numItems;
+	std::atomic<unsigned int> nextItem;
+};
@@ -0,0 +1,244 @@
+// License: please see LICENSE1 file for more details.
+
+#include "TileIndex.h"
+#include "MemoryMapped.h"
+#include "codestream.h"
+#include "codestream_image.h"
+#include "codestream_image_types.h"
+#include "boxes.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// "TCX" and the format version
+#define SIDECAR_MAGIC 0x01584354u
+#define SIDECAR_HEADER_BYTES 48
+#define SIDECAR_TILE_BYTES 16
+#define SIDECAR_CODE_BLOCK_BYTES 10
+
+// the index only needs to know where the code-block is, not a copy of it
+static void pointCodeBlock(type_codeblock* cblk, unsigned char* codestream, void* /*userData*/)
+{
+	cblk->codestream = codestream;
+}
+
+static void put32(std::vector<unsigned char>& out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static void put64(std::vector<unsigned char>& out, uint64_t v)
+{
+	put32(out, (uint32_t)v);
+	put32(out, (uint32_t)(v >> 32));
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+TileIndex::TileIndex() : fileSize(0),
+						fileTime(0),
+						headerOffset(0),
+						headerLength(0),
+						headerHash(0)
+{
+}
+
+bool TileIndex::identify(const std::string& fileName, uint64_t* size, uint64_t* time)
+{
+#if defined(_WIN32) || defined(WIN32)
+	struct _stat64 st;
+	if (_stat64(fileName.c_str(), &st))
+		return false;
+#else
+	struct stat st;
+	if (stat(fileName.c_str(), &st))
+		return false;
+#endif
+	*size = (uint64_t)st.st_size;
+	*time = (uint64_t)st.st_mtime;
+	return true;
+}
+
+bool TileIndex::isCurrent(const std::string& fileName) const
+{
+	uint64_t size = 0, time = 0;
+	return identify(fileName, &size, &time) && size == fileSize && time == fileTime;
+}
+
+bool TileIndex::build(const std::string& fileName)
+{
+	if (!identify(fileName, &fileSize, &fileTime))
+		return false;
+	MemoryMapped data(fileName, MemoryMapped::WholeFile, MemoryMapped::SequentialScan);
+	if (!data.isValid())
+		return false;
+
+	const unsigned char* base = data.getData();
+	size_t size = (size_t)data.size();
+	size_t length = size;
+	const unsigned char* codestream = jp2_has_signature(base, size) ? jp2_find_codestream(base, size, &length) : base;
+	unsigned int header = codestream ? main_header_length(codestream, length) : 0;
+	if (!header)
+		return false;
+
+	type_image* img = create_image();
+	if (!img)
+		return false;
+	img->in_file = fileName.c_str();
+	type_parse_context ctx;
+	ctx.code_block_callback = pointCodeBlock;
+	ctx.user_data = NULL;
+	ctx.parse_tile_parts = NULL;
+	type_buffer buffer;
+	memset(&buffer, 0, sizeof(type_buffer));
+	buffer.data = buffer.start = buffer.bp = (unsigned char*)codestream;
+	buffer.size = length;
+	buffer.end = buffer.data + length;
+	decode_main_header(&buffer, img);
+
+	headerOffset = codestream - base;
+	headerLength = header;
+	headerHash = img->header_hash;
+	tiles.resize(img->num_tiles);
+	codeBlocks.clear();
+	for (unsigned int t = 0; t < img->num_tiles; t++) {
+		type_tile* tile = img->tile + t;
+		unsigned char* start = buffer.bp;
+		decode_tiles(&buffer, tile, &ctx);
+		tiles[t].offset = start - base;
+		tiles[t].length = (uint32_t)(buffer.bp - start);
+		tiles[t].firstCodeBlock = (uint32_t)codeBlocks.size();
+
+		for (unsigned int c = 0; c < img->num_components; c++) {
+			type_tile_comp* tile_comp = tile->tile_comp + c;
+			for (unsigned int r = 0; r < tile_comp->num_rlvls; r++) {
+				type_res_lvl* res_lvl = tile_comp->res_lvls + r;
+				for (unsigned int s = 0; s < res_lvl->num_subbands; s++) {
+					type_subband* sb = res_lvl->subbands + s;
+					for (unsigned int k = 0; k < sb->num_cblks; k++) {
+						type_codeblock* cblk = sb->cblks + k;
+						CodeBlockIndexEntry entry;
+						entry.offset = (uint32_t)(cblk->codestream - start);
+						entry.length = cblk->length;
+						entry.significantBits = cblk->significant_bits;
+						entry.numCodingPasses = (uint8_t)cblk->num_coding_passes;
+						codeBlocks.push_back(entry);
+					}
+				}
+			}
+		}
+	}
+	free_image(img);
+	return true;
+}
+
+bool TileIndex::save(const std::string& path) const
+{
+	std::vector<unsigned char> out;
+	out.reserve(SIDECAR_HEADER_BYTES + tiles.size() * SIDECAR_TILE_BYTES + codeBlocks.size() * SIDECAR_CODE_BLOCK_BYTES);
+	put32(out, SIDECAR_MAGIC);
+	put64(out, fileSize);
+	put64(out, fileTime);
+	put64(out, headerOffset);
+	put32(out, headerLength);
+	put64(out, headerHash);
+	put32(out, (uint32_t)tiles.size());
+	put32(out, (uint32_t)codeBlocks.size());
+	for (size_t i = 0; i < tiles.size(); i++) {
+		put64(out, tiles[i].offset);
+		put32(out, tiles[i].length);
+		put32(out, tiles[i].firstCodeBlock);
+	}
+	for (size_t i = 0; i < codeBlocks.size(); i++) {
+		put32(out, codeBlocks[i].offset);
+		put32(out, codeBlocks[i].length);
+		out.push_back(codeBlocks[i].significantBits);
+		out.push_back(codeBlocks[i].numCodingPasses);
+	}
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	bool ok = fwrite(&out[0], 1, out.size(), f) == out.size();
+	return fclose(f) == 0 && ok;
+}
+
+bool TileIndex::load(const std::string& path)
+{
+	MemoryMapped data(path, MemoryMapped::WholeFile, MemoryMapped::SequentialScan);
+	if (!data.isValid() || data.size() < SIDECAR_HEADER_BYTES)
+		return false;
+	const unsigned char* p = data.getData();
+	if (get32(p) != SIDECAR_MAGIC)
+		return false;
+	uint32_t numTiles = get32(p + 40);
+	uint32_t numCodeBlocks = get32(p + 44);
+	if (data.size() != SIDECAR_HEADER_BYTES + (uint64_t)numTiles * SIDECAR_TILE_BYTES + (uint64_t)numCodeBlocks * SIDECAR_CODE_BLOCK_BYTES)
+		return false;
+
+	fileSize = get64(p + 4);
+	fileTime = get64(p + 12);
+	headerOffset = get64(p + 20);
+	headerLength = get32(p + 28);
+	headerHash = get64(p + 32);
+	p += SIDECAR_HEADER_BYTES;
+	tiles.resize(numTiles);
+	for (uint32_t i = 0; i < numTiles; i++, p += SIDECAR_TILE_BYTES) {
+		tiles[i].offset = get64(p);
+		tiles[i].length = get32(p + 8);
+		tiles[i].firstCodeBlock = get32(p + 12);
+		if (tiles[i].firstCodeBlock > numCodeBlocks)
+			return false;
+	}
+	codeBlocks.resize(numCodeBlocks);
+	for (uint32_t i = 0; i < numCodeBlocks; i++, p += SIDECAR_CODE_BLOCK_BYTES) {
+		codeBlocks[i].offset = get32(p);
+		codeBlocks[i].length = get32(p + 4);
+		codeBlocks[i].significantBits = p[8];
+		codeBlocks[i].numCodingPasses = p[9];
+	}
+	return inBounds();
+}
+
+bool TileIndex::inBounds() const
+{
+	if (headerOffset > fileSize || headerLength > fileSize - headerOffset)
+		return false;
+	for (size_t t = 0; t < tiles.size(); t++) {
+		const TileIndexEntry& tile = tiles[t];
+		if (tile.offset > fileSize || tile.length > fileSize - tile.offset)
+			return false;
+		// a tile's code-blocks run up to the first one of the next tile
+		size_t end = t + 1 < tiles.size() ? tiles[t + 1].firstCodeBlock : codeBlocks.size();
+		if (tile.firstCodeBlock > end)
+			return false;
+		for (size_t i = tile.firstCodeBlock; i < end; i++) {
+			if ((uint64_t)codeBlocks[i].offset + codeBlocks[i].length > tile.length)
+				return false;
+		}
+	}
+	return true;
+}
+
+TileIndex* TileIndex::open(const std::string& fileName, bool rebuild)
+{
+	TileIndex* index = new TileIndex();
+	if (!rebuild && index->load(sidecarName(fileName)) && index->isCurrent(fileName))
+		return index;
+	if (!index->build(fileName)) {
+		delete index;
+		return NULL;
+	}
+	// archives may be read-only; the index then only lives as long as the caller keeps it
+	index->save(sidecarName(fileName));
+	return index;
+}
@@ -0,0 +1,70 @@
+// License: please see LICENSE1 file for more details.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** @brief Where the bytes of a code-block are and what Tier-1 needs to know about them */
+struct CodeBlockIndexEntry
+{
+	/** From the SOT marker of the code-block's tile-part */
+	uint32_t offset;
+	uint32_t length;
+	uint8_t significantBits;
+	uint8_t numCodingPasses;
+};
+
+struct TileIndexEntry
+{
+	/** Tile-part from its SOT marker on, from the start of the file */
+	uint64_t offset;
+	uint32_t length;
+	/** The tile's code-blocks start here in TileIndex::codeBlocks, in component, resolution
+	 * level, subband, raster order */
+	uint32_t firstCodeBlock;
+};
+
+/**
+ * @brief Tier-2 results of a file: the tile-parts and, per code-block, offset, length, passes and
+ * significant bits.
+ *
+ * Built by parsing every packet header once and kept in a sidecar next to the file, so that
+ * later decodes of some tiles go straight to their code-block bytes without touching the rest
+ * of the file. The sidecar is bound to the file's size and modification time.
+ */
+class TileIndex
+{
+public:
+	TileIndex();
+	/** @brief Parses the whole file once to build the index */
+	bool build(const std::string& fileName);
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+	/** @brief True if the index was built from fileName as it is now */
+	bool isCurrent(const std::string& fileName) const;
+
+	/**
+	 * @brief The sidecar of fileName if it is current, otherwise a new index, saved as sidecar if possible
+	 * @param rebuild ignore the sidecar, e.g. because it no longer matches the file's contents
+	 */
+	static TileIndex* open(const std::string& fileName, bool rebuild = false);
+	static std::string sidecarName(const std::string& fileName) { return fileName + ".tcx"; }
+	/** @brief Size and modification time of a file */
+	static bool identify(const std::string& fileName, uint64_t* size, uint64_t* time);
+
+	uint64_t fileSize;
+	uint64_t fileTime;
+	/** Main header: SOC up to the first SOT, from the start of the file */
+	uint64_t headerOffset;
+	uint32_t headerLength;
+	/** hash_main_header() of the main header */
+	uint64_t headerHash;
+	std::vector<TileIndexEntry> tiles;
+	std::vector<CodeBlockIndexEntry> codeBlocks;
+
+private:
+	/** @brief True if the header, the tile-parts and their code-blocks all lie within the file */
+	bool inBounds() const;
+};
@@ -0,0 +1,263 @@
+// License: please see LICENSE1 file for more details.
+
+#include "Tracer.h"
+#include "ocl_util.h"
+#include "basic.h"
+#include <stdio.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+#define MAX_SPAN_DEPTH 32
+
+struct HostSpan
+{
+	const char* name;
+	int thread;
+	double begin;
+	double end;
+};
+
+struct DeviceCommand
+{
+	cl_event event;
+	std::string name;
+	/** Queue and device are looked up at enqueue time, they may be gone when the trace is written */
+	cl_command_queue queue;
+	cl_device_id device;
+	int thread;
+	int tile;
+	int comp;
+	int level;
+	/** Host time right after the command was enqueued, used to align the device clock */
+	double enqueued;
+};
+
+static std::atomic<bool> tracing(false);
+static std::mutex traceLock;
+static std::string traceFile;
+static double traceEpoch = 0;
+static std::vector<HostSpan> hostSpans;
+static std::vector<DeviceCommand> deviceCommands;
+static std::atomic<int> threadCount(0);
+
+static TRACE_THREAD_LOCAL int threadIndex = -1;
+static TRACE_THREAD_LOCAL int spanDepth = 0;
+static TRACE_THREAD_LOCAL const char* spanNames[MAX_SPAN_DEPTH];
+static TRACE_THREAD_LOCAL double spanBegin[MAX_SPAN_DEPTH];
+static TRACE_THREAD_LOCAL int contextTile = -1;
+static TRACE_THREAD_LOCAL int contextComp = -1;
+static TRACE_THREAD_LOCAL int contextLevel = -1;
+
+static int currentThread()
+{
+	if (threadIndex < 0)
+		threadIndex = threadCount++;
+	return threadIndex;
+}
+
+// microseconds since tracing started
+static double now()
+{
+	return (time_stamp() - traceEpoch) * 1e6;
+}
+
+extern "C" int trace_enabled(void)
+{
+	return tracing ? 1 : 0;
+}
+
+extern "C" void trace_begin(const char* name)
+{
+	if (!tracing)
+		return;
+	if (spanDepth < MAX_SPAN_DEPTH) {
+		spanNames[spanDepth] = name;
+		spanBegin[spanDepth] = now();
+	}
+	spanDepth++;
+}
+
+extern "C" void trace_end(void)
+{
+	if (!tracing || spanDepth == 0)
+		return;
+	spanDepth--;
+	if (spanDepth >= MAX_SPAN_DEPTH)
+		return;
+	HostSpan span;
+	span.name = spanNames[spanDepth];
+	span.thread = currentThread();
+	span.begin = spanBegin[spanDepth];
+	span.end = now();
+	std::lock_guard<std::mutex> guard(traceLock);
+	hostSpans.push_back(span);
+}
+
+extern "C" void trace_set_context(int tile, int comp, int level)
+{
+	contextTile = tile;
+	contextComp = comp;
+	contextLevel = level;
+}
+
+extern "C" void trace_set_level(int level)
+{
+	contextLevel = level;
+}
+
+/**
+ * @brief Starts recording. The trace is written to fileName by stop().
+ * @return false if a trace is already being recorded
+ */
+bool Tracer::start(const std::string& fileName)
+{
+	std::lock_guard<std::mutex> guard(traceLock);
+	if (tracing)
+		return false;
+	traceFile = fileName;
+	traceEpoch = time_stamp();
+	hostSpans.clear();
+	deviceCommands.clear();
+	tracing = true;
+	return true;
+}
+
+cl_event* Tracer::event(cl_event* slot)
+{
+	if (!tracing)
+		return NULL;
+	*slot = NULL;
+	return slot;
+}
+
+void Tracer::device(cl_event ev, const std::string& name, bool retain)
+{
+	if (!tracing || !ev)
+		return;
+	if (retain)
+		clRetainEvent(ev);
+	DeviceCommand cmd;
+	cmd.event = ev;
+	cmd.name = name;
+	cmd.queue = NULL;
+	cmd.device = NULL;
+	clGetEventInfo(ev, CL_EVENT_COMMAND_QUEUE, sizeof(cl_command_queue), &cmd.queue, NULL);
+	clGetCommandQueueInfo(cmd.queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &cmd.device, NULL);
+	cmd.thread = currentThread();
+	cmd.tile = contextTile;
+	cmd.comp = contextComp;
+	cmd.level = contextLevel;
+	cmd.enqueued = now();
+	std::lock_guard<std::mutex> guard(traceLock);
+	deviceCommands.push_back(cmd);
+}
+
+static void writeArgs(FILE* fp, const DeviceCommand& cmd)
+{
+	if (cmd.tile >= 0)
+		fprintf(fp, ", \"tile\": %d", cmd.tile);
+	if (cmd.comp >= 0)
+		fprintf(fp, ", \"component\": %d", cmd.comp);
+	if (cmd.level >= 0)
+		fprintf(fp, ", \"level\": %d", cmd.level);
+}
+
+/**
+ * @brief Stops recording, waits for the recorded device commands and writes the trace.
+ *
+ * Host spans are in process 0, one track per host thread. Device commands are in process 1,
+ * one track per command queue, placed at their profiled start and end. Device clocks are
+ * aligned to the host clock per device, assuming a command is queued no later than the
+ * host call that enqueued it returns.
+ * @return 0 on success, -1 if not tracing or the file cannot be written
+ */
+int Tracer::stop()
+{
+	if (!tracing)
+		return -1;
+	tracing = false;
+
+	std::lock_guard<std::mutex> guard(traceLock);
+	FILE* fp = fopen(traceFile.c_str(), "w");
+	if (!fp) {
+		LogError("Error: cannot write trace %s\n", traceFile.c_str());
+		for (size_t i = 0; i < deviceCommands.size(); ++i)
+			clReleaseEvent(deviceCommands[i].event);
+		deviceCommands.clear();
+		return -1;
+	}
+
+	fprintf(fp, "{\"traceEvents\": [\n");
+	fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"host\"}},\n");
+	fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"device\"}}");
+	for (size_t i = 0; i < hostSpans.size(); ++i) {
+		const HostSpan& s = hostSpans[i];
+		fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"host\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+			s.name, s.thread, s.begin, s.end - s.begin);
+	}
+
+	// profiling info of every command, then the clock offset of every device
+	struct Profile {
+		cl_ulong queued, submit, start, end;
+		bool valid;
+	};
+	std::vector<Profile> profiles(deviceCommands.size());
+	std::map<cl_device_id, double> offsets;
+	std::map<cl_command_queue, int> queues;
+	for (size_t i = 0; i < deviceCommands.size(); ++i) {
+		Profile& p = profiles[i];
+		cl_event ev = deviceCommands[i].event;
+		p.valid = clWaitForEvents(1, &ev) == CL_SUCCESS &&
+			clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &p.queued, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &p.submit, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &p.start, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &p.end, NULL) == CL_SUCCESS;
+		if (!p.valid)
+			continue;
+		const DeviceCommand& cmd = deviceCommands[i];
+		double offset = cmd.enqueued - p.queued / 1000.0;
+		if (!offsets.count(cmd.device) || offset < offsets[cmd.device])
+			offsets[cmd.device] = offset;
+		if (!queues.count(cmd.queue)) {
+			int index = (int)queues.size();
+			queues[cmd.queue] = index;
+			fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"queue %d\"}}", index, index);
+		}
+	}
+
+	int skipped = 0;
+	for (size_t i = 0; i < deviceCommands.size(); ++i) {
+		const DeviceCommand& cmd = deviceCommands[i];
+		const Profile& p = profiles[i];
+		if (p.valid) {
+			double offset = offsets[cmd.device];
+			fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"device\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+				"\"args\": {\"queued\": %.3f, \"submit\": %.3f, \"host_thread\": %d",
+				cmd.name.c_str(), queues[cmd.queue], offset + p.start / 1000.0, (p.end - p.start) / 1000.0,
+				offset + p.queued / 1000.0, offset + p.submit / 1000.0, cmd.thread);
+			writeArgs(fp, cmd);
+			fprintf(fp, "}}");
+		} else {
+			skipped++;
+		}
+		clReleaseEvent(cmd.event);
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+
+	if (skipped)
+		LogInfo("Trace: %d device commands without profiling info were skipped\n", skipped);
+	LogInfo("Trace: %d host spans, %d device commands written to %s\n", (int)hostSpans.size(),
+		(int)(deviceCommands.size() - skipped), traceFile.c_str());
+	hostSpans.clear();
+	deviceCommands.clear();
+	return 0;
+}
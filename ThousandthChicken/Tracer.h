@@ -0,0 +1,60 @@
+// License: please see LICENSE1 file for more details.
+#pragma once
+
+/*
+ * Optional timeline of host spans and device commands, written as Chrome trace-event JSON
+ * (open in Perfetto or chrome://tracing). All calls are cheap no-ops unless tracing was started.
+ */
+
+#include "CL/cl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int trace_enabled(void);
+/* open a host span on the calling thread; name must be a string literal */
+void trace_begin(const char* name);
+/* close the innermost open host span of the calling thread */
+void trace_end(void);
+/* tile, component and resolution level attached to the device commands this thread enqueues, -1 if none */
+void trace_set_context(int tile, int comp, int level);
+void trace_set_level(int level);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+class Tracer
+{
+public:
+	static bool start(const std::string& fileName);
+	static int stop();
+	/** @brief event argument for a clEnqueue* call: slot if tracing, NULL otherwise */
+	static cl_event* event(cl_event* slot);
+	/**
+	 * @brief Records a device command enqueued by this thread.
+	 * @param retain true if the caller keeps its own reference to ev
+	 */
+	static void device(cl_event ev, const std::string& name, bool retain = false);
+};
+
+/** @brief Host span for the enclosing scope */
+class TraceSpan
+{
+public:
+	TraceSpan(const char* name) : active(trace_enabled() != 0)
+	{
+		if (active)
+			trace_begin(name);
+	}
+	~TraceSpan()
+	{
+		if (active)
+			trace_end();
+	}
+private:
+	bool active;
+};
+#endif
@@ -0,0 +1,164 @@
+// License: please see LICENSE2 file for more details.
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "logger.h"
+
+/* every allocation is aligned for any scalar type */
+#define ARENA_ALIGNMENT 16
+
+struct _type_arena_chunk {
+	type_arena_chunk *next;
+	/** Creation order within the arena */
+	size_t serial;
+	size_t size;
+	size_t used;
+};
+
+/* chunk data starts after the header, rounded up to the alignment */
+#define CHUNK_HEADER ((sizeof(type_arena_chunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static type_arena_chunk *chunk_create(type_arena *arena, size_t size)
+{
+	type_arena_chunk *chunk = (type_arena_chunk *) malloc(CHUNK_HEADER + size);
+	if (!chunk) {
+		println_var(INFO, "Error: unable to allocate arena chunk of %lu bytes", (unsigned long)size);
+		exit(0);
+	}
+	chunk->next = NULL;
+	chunk->serial = arena->chunk_count++;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+/**
+ * @brief Creates an arena.
+ *
+ * @param chunk_size Size of the chunks allocations are carved from, 0 for ARENA_CHUNK_SIZE.
+ */
+type_arena *arena_create(size_t chunk_size)
+{
+	type_arena *arena = (type_arena *) malloc(sizeof(type_arena));
+	if (!arena)
+		return NULL;
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+	arena->chunk_count = 0;
+	arena->chunks = chunk_create(arena, arena->chunk_size);
+	arena->allocated = 0;
+	return arena;
+}
+
+/**
+ * @brief Allocates bytes aligned to alignment, a power of two. The memory is zeroed.
+ */
+void *arena_alloc_aligned(type_arena *arena, size_t bytes, size_t alignment)
+{
+	type_arena_chunk *chunk = arena->chunks;
+	unsigned char *base;
+	size_t start;
+
+	if (alignment < ARENA_ALIGNMENT)
+		alignment = ARENA_ALIGNMENT;
+	base = (unsigned char *) chunk + CHUNK_HEADER;
+	start = ((size_t)(base + chunk->used) + alignment - 1) & ~(alignment - 1);
+	start -= (size_t)base;
+	if (start + bytes > chunk->size) {
+		if (bytes + alignment > arena->chunk_size / 4) {
+			/* large blocks get a chunk of their own behind the current one, which stays open */
+			type_arena_chunk *own = chunk_create(arena, bytes + alignment);
+			own->next = chunk->next;
+			chunk->next = own;
+			chunk = own;
+		} else {
+			chunk = chunk_create(arena, arena->chunk_size);
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+		base = (unsigned char *) chunk + CHUNK_HEADER;
+		start = (((size_t)base + alignment - 1) & ~(alignment - 1)) - (size_t)base;
+	}
+	chunk->used = start + bytes;
+	arena->allocated += bytes;
+	memset(base + start, 0, bytes);
+	return base + start;
+}
+
+/**
+ * @brief Allocates zeroed bytes, aligned for any scalar type.
+ */
+void *arena_alloc(type_arena *arena, size_t bytes)
+{
+	return arena_alloc_aligned(arena, bytes, ARENA_ALIGNMENT);
+}
+
+/**
+ * @brief Replacement for realloc: returns a block of new_bytes starting with the contents of old.
+ * The old block is not reused.
+ */
+void *arena_grow(type_arena *arena, void *old, size_t old_bytes, size_t new_bytes)
+{
+	void *block = arena_alloc(arena, new_bytes);
+	if (old)
+		memcpy(block, old, old_bytes < new_bytes ? old_bytes : new_bytes);
+	return block;
+}
+
+/**
+ * @brief Records the current position, so that everything allocated after it can be released
+ * with arena_rewind() while earlier allocations stay valid.
+ */
+void arena_mark(type_arena *arena, type_arena_mark *mark)
+{
+	mark->chunk = arena->chunks;
+	mark->used = arena->chunks->used;
+	mark->chunk_count = arena->chunk_count;
+	mark->allocated = arena->allocated;
+}
+
+/**
+ * @brief Releases every allocation made after mark. Marks taken later than mark become invalid.
+ */
+void arena_rewind(type_arena *arena, const type_arena_mark *mark)
+{
+	/* chunks are created in serial order; newer ones are either in front of the marked chunk
+	   or, holding a single large block, linked in right behind the chunk that was current */
+	type_arena_chunk **link = &arena->chunks;
+	while (*link) {
+		type_arena_chunk *chunk = *link;
+		if (chunk->serial >= mark->chunk_count) {
+			*link = chunk->next;
+			free(chunk);
+		} else {
+			link = &chunk->next;
+		}
+	}
+	arena->chunks = mark->chunk;
+	arena->chunks->used = mark->used;
+	arena->allocated = mark->allocated;
+}
+
+/**
+ * @brief Releases every allocation but keeps the newest chunk for reuse.
+ */
+void arena_reset(type_arena *arena)
+{
+	type_arena_chunk *chunk = arena->chunks->next;
+	while (chunk) {
+		type_arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunks->next = NULL;
+	arena->chunks->used = 0;
+	arena->allocated = 0;
+}
+
+void arena_destroy(type_arena *arena)
+{
+	if (!arena)
+		return;
+	arena_reset(arena);
+	free(arena->chunks);
+	free(arena);
+}
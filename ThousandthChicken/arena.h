@@ -0,0 +1,53 @@
+// License: please see LICENSE2 file for more details.
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/** Default size of an arena chunk; larger requests get a chunk of their own */
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+typedef struct _type_arena_chunk type_arena_chunk;
+
+/** Position in an arena that later allocations can be rolled back to, see arena_rewind() */
+typedef struct _type_arena_mark {
+	/** Chunk that was serving allocations */
+	type_arena_chunk *chunk;
+	/** Bytes used in that chunk */
+	size_t used;
+	/** Chunks created so far */
+	size_t chunk_count;
+	size_t allocated;
+} type_arena_mark;
+
+/**
+ * Bump allocator for the parse structures of one image.
+ *
+ * Allocations are never freed one by one; destroying the arena releases them all at once.
+ */
+typedef struct _type_arena {
+	/** Chunk allocations are served from, followed by the full ones */
+	type_arena_chunk *chunks;
+	/** Size of new chunks */
+	size_t chunk_size;
+	/** Bytes handed out since creation or the last reset */
+	size_t allocated;
+	/** Chunks created since creation; numbers the chunks so marks know which ones are newer */
+	size_t chunk_count;
+} type_arena;
+
+type_arena *arena_create(size_t chunk_size);
+void *arena_alloc(type_arena *arena, size_t bytes);
+void *arena_alloc_aligned(type_arena *arena, size_t bytes, size_t alignment);
+void *arena_grow(type_arena *arena, void *old, size_t old_bytes, size_t new_bytes);
+void arena_mark(type_arena *arena, type_arena_mark *mark);
+void arena_rewind(type_arena *arena, const type_arena_mark *mark);
+void arena_reset(type_arena *arena);
+void arena_destroy(type_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,5 +1,6 @@
 // License: please see LICENSE1 file for more details.
 #include "basic.h"
+#include "ResourceCounters.h"
 
 #include <iostream>
 #include <exception>
@@ -104,16 +105,18 @@ void* aligned_malloc (size_t size, size_t alignment)
     //assert(size/sizeof(void*)*sizeof(void*) == size);
 
     // allocate extra memory and convert to size_t to perform calculations
-    char* orig = new char[size + alignment + sizeof(void*)];
+    char* orig = new char[size + alignment + 2 * sizeof(void*)];
     // calculate an aligned position in the allocated region
     // assumption: (size_t)orig does not lose lower bits
     char* aligned =
         orig + (
-        (((size_t)orig + alignment + sizeof(void*)) & ~(alignment - 1)) -
+        (((size_t)orig + alignment + 2 * sizeof(void*)) & ~(alignment - 1)) -
         (size_t)orig
         );
-    // save the original pointer to use it in aligned_free
+    // save the original pointer to use it in aligned_free, and the size for the counters
     *((char**)aligned - 1) = orig;
+    *((size_t*)aligned - 2) = size;
+    ResourceCounters::hostAllocated(size);
     return aligned;
 }
 
@@ -121,6 +124,7 @@ void* aligned_malloc (size_t size, size_t alignment)
 void aligned_free (void *aligned)
 {
     if(!aligned)return; // behaves as delete: calling with 0 is NOP
+    ResourceCounters::hostFreed(*((size_t*)aligned - 2));
     delete [] *((char**)aligned - 1);
 }
 
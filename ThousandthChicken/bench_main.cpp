@@ -0,0 +1,155 @@
+// License: please see LICENSE1 file for more details.
+
+// Entry point of the stage benchmark, built as a separate executable next to the decoder
+
+#include "ocl_util.h"
+#include "StageBenchmark.h"
+#include "DeviceKernel.h"
+#include "basic.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern bool quiet;
+
+struct bench_args_t
+{
+    int iterations;
+    std::vector<int> sizes;
+    std::vector<int> levels;
+    bool synthetic;
+    const char* csvFile;
+    const char* jsonFile;
+    std::vector<std::string> files;
+};
+
+// Parse a comma separated list of positive integers
+static bool ParseList(const char* arg, std::vector<int>& values)
+{
+    values.clear();
+    while (*arg)
+    {
+        int v = atoi(arg);
+        if (v < 1)
+            return false;
+        values.push_back(v);
+        arg = strchr(arg, ',');
+        if (!arg)
+            break;
+        arg++;
+    }
+    return !values.empty();
+}
+
+// The valid arguments are:
+//      -cpu / -gpu: Prefer a CPU or GPU OpenCL device
+//      -q: Run in silence mode
+//      -iterations <n>: Timed iterations per measurement
+//      -sizes <a,b,..>: Square image sizes of the synthetic DWT and preprocessing runs; the synthetic
+//                       Tier-2 run reads size * size / 8 bytes of packet header bits
+//      -levels <a,b,..>: DWT decomposition levels of the synthetic runs
+//      -nosynthetic: Only benchmark the given files
+//      -csv <file>, -json <file>: Also write the results to file
+//      anything else is a JPEG 2000 file that is decoded stage by stage
+int ParseBenchArguments(data_args_d_t* data, bench_args_t* bench, int argc, char* argv[])
+{
+    memset(data, 0, sizeof(*data));
+    data->numQueues = 1;
+    bench->iterations = 10;
+    bench->sizes.push_back(512);
+    bench->sizes.push_back(1024);
+    bench->sizes.push_back(2048);
+    bench->levels.push_back(1);
+    bench->levels.push_back(3);
+    bench->levels.push_back(5);
+    bench->synthetic = true;
+    bench->csvFile = bench->jsonFile = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-cpu"))
+            data->preferCpu = true;
+        else if (!strcmp(argv[i], "-gpu"))
+            data->preferGpu = true;
+        else if (!strcmp(argv[i], "-q"))
+            quiet = true;
+        else if (!strcmp(argv[i], "-iterations") && i + 1 < argc)
+        {
+            bench->iterations = atoi(argv[++i]);
+            if (bench->iterations < 1)
+                return CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-sizes") && i + 1 < argc)
+        {
+            if (!ParseList(argv[++i], bench->sizes))
+                return CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-levels") && i + 1 < argc)
+        {
+            if (!ParseList(argv[++i], bench->levels))
+                return CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-nosynthetic"))
+            bench->synthetic = false;
+        else if (!strcmp(argv[i], "-csv") && i + 1 < argc)
+            bench->csvFile = argv[++i];
+        else if (!strcmp(argv[i], "-json") && i + 1 < argc)
+            bench->jsonFile = argv[++i];
+        else if (argv[i][0] == '-')
+            return CL_INVALID_VALUE;
+        else
+            bench->files.push_back(argv[i]);
+    }
+    return CL_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    data_args_d_t args;
+    bench_args_t bench;
+    int error_code = ParseBenchArguments(&args, &bench, argc, argv);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Usage: %s [-cpu|-gpu] [-q] [-iterations n] [-sizes a,b] [-levels a,b] [-nosynthetic] [-csv file] [-json file] [files]\n", argv[0]);
+        return error_code;
+    }
+
+    ocl_args_d_t ocl;
+    error_code = InitOpenCL(&ocl, &args);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: InitOpenCL returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    int rc = 0;
+    try
+    {
+        StageBenchmark benchmark(&ocl, bench.iterations);
+        if (bench.synthetic)
+        {
+            benchmark.runDWT(bench.sizes, bench.levels);
+            benchmark.runPreprocess(bench.sizes);
+            benchmark.runTier2(bench.sizes);
+        }
+        for (size_t i = 0; i < bench.files.size(); ++i)
+        {
+            if (benchmark.runFile(bench.files[i]) != 0)
+                rc = -1;
+        }
+
+        benchmark.print();
+        if (bench.csvFile && benchmark.writeCSV(bench.csvFile) != 0)
+            rc = -1;
+        if (bench.jsonFile && benchmark.writeJSON(bench.jsonFile) != 0)
+            rc = -1;
+    }
+    catch (const Error& err)
+    {
+        LogError("Error: %s\n", err.what());
+        rc = -1;
+    }
+
+    DeviceKernel::ReleaseProgramCache();
+    return rc;
+}
@@ -8,14 +8,6 @@
 
 
 
-box *init_box() {
-	box *newBox = (box*)malloc(sizeof(box));
-	memset(newBox, 0, sizeof(box));
-	newBox->lbox = (unsigned char *)malloc(sizeof(char) * 5);
-	newBox->tbox = (unsigned char *)malloc(sizeof(char) * 5);
-	return newBox;
-}
-
 //dest has to be n+1 long
 char *sstrncpy(char *dest, const char *src, size_t n) {
 	println_start(INFO);
@@ -39,104 +31,76 @@ long int hex_to_long(unsigned char *hex, int length) {
 	return ret;
 }
 
-unsigned char *read_bytes(unsigned char *dest, type_buffer* buffer, long int n) {
-	memcpy(dest, buffer->bp, n);
-	buffer->bp += n;
-	dest[n] = '\0';
-	return (unsigned char *)dest;
+/* hex_to_long() is signed, and only 32 bits wide on some platforms */
+static unsigned long read_be32(const unsigned char *p) {
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
 }
 
-
-box *get_next_box(type_buffer* buffer) {
-	int read = 0;
-	box* box;
-	println_start(INFO);
-	box = init_box();
-	if( (box->lbox = read_bytes(box->lbox, buffer, 4)) == NULL)
-		return NULL;
-	box->length = hex_to_long(box->lbox, 4);
-	if(box->length == 0) {
-		return NULL;
-	}
-	if( (box->tbox = read_bytes(box->tbox, buffer, 4)) == NULL) {
-		println(INFO, "Corrupted JP2 file. Exiting.");
-		return NULL;
-	}
-	read = 8;
-
-	if(box->length == 1) { //there should be XLbox field present;
-		box->xlbox = (unsigned char*)malloc(9 * sizeof(char));
-		box->xlbox = read_bytes(box->xlbox, buffer, 8);
-		box->length = hex_to_long(box->xlbox, 8);
-		read += 8;
+/**
+ * @brief Reads the header of the box at data into b. The contents are not touched.
+ *
+ * @param available bytes from data to the end of the enclosing buffer or superbox
+ * @return 0 if no complete, valid box header fits
+ */
+int read_box_header(const unsigned char *data, unsigned long long available, box *b) {
+	unsigned long long header = 8;
+
+	if (available < 8)
+		return 0;
+	b->length = read_be32(data);
+	b->type = read_be32(data + 4);
+	if (b->length == 1) { //there should be XLbox field present;
+		if (available < 16)
+			return 0;
+		b->length = ((unsigned long long)read_be32(data + 8) << 32) | read_be32(data + 12);
+		header = 16;
+	} else if (b->length == 0) {
+		/* the last box runs to the end of the file */
+		b->length = available;
 	}
-	box->content_length = box->length - read;
-
-	box->dbox = (unsigned char*)malloc((box->content_length + 1) * sizeof(char));
-	box->dbox = read_bytes(box->dbox, buffer, box->content_length);
-	println_end(INFO);
-	return box;
+	if (b->length < header)
+		return 0;
+	b->dbox = data + header;
+	b->content_length = b->length - header;
+	b->read = 0;
+	return 1;
 }
 
-box *get_next_box_char(box *superbox) {
-	char *content;
-	box* nextBox;
-	int read,size;
-	if(superbox->read >= superbox->content_length)
-		return NULL;
-
-	content = (char*)superbox->dbox;
-	nextBox = (box*)malloc(sizeof(box));
-
-	read = superbox->read;
-	nextBox->lbox = (unsigned char*)malloc(5 * sizeof(char));
-	nextBox->lbox = (unsigned char*)sstrncpy((char*)nextBox->lbox, &content[read], 4);
-	read += 4;
-	nextBox->length = hex_to_long(nextBox->lbox, 4);
-
-	println_var(INFO, "lbox: %i", nextBox->length);
-	nextBox->tbox = (unsigned char*)malloc(5 * sizeof(char));
-	nextBox->tbox =  (unsigned char*)sstrncpy((char*)nextBox->tbox, &content[read], 4);
-	read += 4;
-
-	println(INFO, "tbox");
-	//box->length = hex_to_long(box->lbox, 4);
-//	println_var(INFO, "length: %i", box->length);
-	if(nextBox->length == 1) { //there should be XLbox field present;
-		nextBox->xlbox =  (unsigned char*)malloc(9 * sizeof(char));
-		nextBox->xlbox =  (unsigned char*)sstrncpy((char*)nextBox->xlbox, &content[read], 8);
-		nextBox->length = hex_to_long(nextBox->xlbox, 8);
-		read += 8;
+/**
+ * @brief Reads the next box of a file. The box is a view into the buffer, and skipping over
+ * it is a seek, however large its contents.
+ *
+ * @return 0 at the end of the buffer or if the box does not fit into it
+ */
+int get_next_box(type_buffer* buffer, box *b) {
+	unsigned long long available = buffer->end - buffer->bp;
+
+	if (!read_box_header(buffer->bp, available, b))
+		return 0;
+	if (b->length > available) {
+		println_var(INFO, "Corrupted JP2 file: box %lx runs past the end of the file", b->type);
+		return 0;
 	}
-
-	size = (nextBox->length - (read - superbox->read));
-	nextBox->dbox =  (unsigned char*)malloc((size+1) * sizeof(char));
-	nextBox->dbox =  (unsigned char*)sstrncpy((char*)nextBox->dbox, &content[read], size);
-	read += size;
-
-	nextBox->content_length = nextBox->length - read;
-	println(INFO, "dbox");
-	superbox->read = read;
-	println_end(INFO);
-	return nextBox;
+	b->offset = buffer->bp - buffer->start;
+	buffer->bp += b->length;
+	return 1;
 }
 
-int dispose_of(box *b) {
-	if (!b)
-		return -1;
-	println_start(INFO);
-	if(b->lbox == NULL)
-		printf("NULL!\n");
-	else
-		free(b->lbox);
-	if (b->tbox)
-	   free(b->tbox);
-	if (b->dbox)
-	   free(b->dbox);
-	if(b->xlbox)
-		free(b->xlbox);
-	free(b);
-	return 0;
+/**
+ * @brief Reads the next box inside a superbox, see get_next_box.
+ */
+int get_next_sub_box(box *superbox, box *b) {
+	unsigned long long available = superbox->content_length - superbox->read;
+
+	if (superbox->read >= superbox->content_length || !read_box_header(superbox->dbox + superbox->read, available, b))
+		return 0;
+	if (b->length > available) {
+		println_var(INFO, "Corrupted JP2 file: box %lx runs past the end of its superbox", b->type);
+		return 0;
+	}
+	b->offset = superbox->read;
+	superbox->read += b->length;
+	return 1;
 }
 
 int h_filetype_box(box *b, type_image *img) {
@@ -159,10 +123,10 @@ int h_filetype_box(box *b, type_image *img) {
 	} else
 		println(INFO, "MinV OK");
 
-	left = b->content_length - 8; //16 bytes already read from the box's contents: br,minv
+	left = (int)b->content_length - 8; //16 bytes already read from the box's contents: br,minv
 	printf("left: %i\n", left);
 	i = 1;
-	while(left) {
+	while(left >= 4) {
 		sstrncpy(cl, (const char*)&(b->dbox)[4 + i*4], 4); 
 		left -= 4;
 		i++;
@@ -185,11 +149,16 @@ int h_filetype_box(box *b, type_image *img) {
 int h_image_header_box(box *b, type_image *img) {
 	char cwidth[5], cheight[5], cnum_comp[3];
 
+	if(b->content_length < IHB_LENGTH - 8) {
+		println(INFO, "Image Header Box is too short");
+		return 1;
+	}
+
 	sstrncpy(cheight, (const char*)b->dbox, 4);
 	img->height = hex_to_long((unsigned char*)cheight, 4);
 
 	sstrncpy(cwidth, (const char*)&(b->dbox)[4], 4);
-	img->width = (unsigned short)hex_to_long((unsigned char*)cwidth, 4);
+	img->width = (unsigned int)hex_to_long((unsigned char*)cwidth, 4);
 
 	sstrncpy(cnum_comp, (const char*)&(b->dbox)[8], 2);
 	img->num_components = (unsigned short)hex_to_long((unsigned char*)cnum_comp, 2);
@@ -210,31 +179,30 @@ int h_image_header_box(box *b, type_image *img) {
 }
 
 int h_header_box(box *header_box, type_image *img) {
-	box *ihdr, *b;
+	box ihdr, b;
 	println_start(INFO);
 	header_box->read = 0;
-	ihdr = get_next_box_char(header_box); //TODO: extract box from within b
 
-	if(hex_to_long(ihdr->tbox, 4) != IMAGE_HEADER_BOX) {
+	if(!get_next_sub_box(header_box, &ihdr) || ihdr.type != IMAGE_HEADER_BOX) {
 		println(INFO, "Image Header Box should be the first one in Header superbox. Exitting!");
 		return 1;
 	} else
-		h_image_header_box(ihdr, img);
+		h_image_header_box(&ihdr, img);
 
-	while( (b = get_next_box_char(header_box)) != NULL ) {
-			if(hex_to_long(b->tbox, 4) == BITS_PER_COMPONENT_BOX) {
+	while( get_next_sub_box(header_box, &b) ) {
+			if(b.type == BITS_PER_COMPONENT_BOX) {
 				println(INFO, "Bits Per Component box");
 			} else
-			if(hex_to_long(b->tbox,4) ==  COLOR_BOX) {
+			if(b.type ==  COLOR_BOX) {
 				println(INFO, "Color Specification Box");
 			} else
-			if(hex_to_long(b->tbox,4) ==  PALETTE_BOX) {
+			if(b.type ==  PALETTE_BOX) {
 				println(INFO, "Palette Box");
 			} else
-			if(hex_to_long(b->tbox,4) ==  COMPONENT_MAPPING_BOX) {
+			if(b.type ==  COMPONENT_MAPPING_BOX) {
 				println(INFO, "Component Mapping Box");
 			} else
-			if(hex_to_long(b->tbox,4) ==  CHANNEL_DEFINITION_BOX) {
+			if(b.type ==  CHANNEL_DEFINITION_BOX) {
 				println(INFO, "Channel Definition Box");
 			}
 	}
@@ -242,66 +210,90 @@ int h_header_box(box *header_box, type_image *img) {
 	return 0;
 }
 
-void h_contiguous_codestream_box(box *cbox, type_image *img) {
-
-	long int codestream_len = cbox->content_length;
+/**
+ * @brief Decodes the codestream in place, straight from the input the box is a view of.
+ */
+void h_contiguous_codestream_box(box *cbox, type_image *img, type_parse_context *ctx) {
+	type_buffer src_buff;
 
-	type_buffer *src_buff = (type_buffer *) malloc(sizeof(type_buffer));
-	memset(src_buff, 0, sizeof(type_buffer));
-	src_buff->size = codestream_len;
-	src_buff->data = cbox->dbox;
-	src_buff->start = src_buff->data;
-	src_buff->end = src_buff->data + src_buff->size;
-	src_buff->bp = src_buff->data;
-	src_buff->bits_count = 0;
-	src_buff->byte = 0;
+	memset(&src_buff, 0, sizeof(type_buffer));
+	src_buff.size = (unsigned long int)cbox->content_length;
+	src_buff.data = (unsigned char *)cbox->dbox;
+	src_buff.start = src_buff.data;
+	src_buff.end = src_buff.data + cbox->content_length;
+	src_buff.bp = src_buff.data;
 
 	println(INFO, "Decoding codestream");
-	decode_codestream(src_buff, img);
+	decode_codestream(&src_buff, img, ctx);
 
 	println_end(INFO);
 }
 
-int jp2_parse_boxes(type_buffer* src_buff, type_image *img) {
-	box *sig = get_next_box(src_buff);
-	box *ft=NULL, *b=NULL;
+/**
+ * @brief Checks for the JP2 signature box at the start of data.
+ */
+int jp2_has_signature(const unsigned char *data, size_t size) {
+	return size >= 12 && hex_to_long((unsigned char *)data + 4, 4) == JP2_SIGNATURE_BOX
+					&& hex_to_long((unsigned char *)data + 8, 4) == JP2_SIG_BOX_CONTENT;
+}
+
+/**
+ * @brief Finds the contiguous codestream box by walking the box headers only.
+ *
+ * @param length receives the size of the codestream
+ * @return start of the codestream, NULL if the file has none
+ */
+const unsigned char *jp2_find_codestream(const unsigned char *data, size_t size, size_t *length) {
+	size_t pos = 0;
+	box b;
+
+	while (read_box_header(data + pos, size - pos, &b)) {
+		if (b.type == CODE_STREAM_BOX) {
+			/* a prefix of the file may end inside the codestream */
+			*length = (size_t)((b.length < size - pos ? b.length : size - pos) - (b.length - b.content_length));
+			return b.dbox;
+		}
+		if (b.length > size - pos)
+			return NULL;
+		pos += (size_t)b.length;
+	}
+	return NULL;
+}
+
+int jp2_parse_boxes(type_buffer* src_buff, type_image *img, type_parse_context *ctx) {
+	/* boxes are views into src_buff; boxes that are not needed, e.g. XML, UUID and IPR, are never read */
+	box sig, ft, b;
+
+	if(!get_next_box(src_buff, &sig) || !get_next_box(src_buff, &ft)) {
+		println(INFO, "Corrupted JP2 file. Exiting.");
+		return 1;
+	}
 
-	if(hex_to_long(sig->tbox, 4) != JP2_SIGNATURE_BOX)
+	if(sig.type != JP2_SIGNATURE_BOX)
 		println(INFO, "JP2 signature box should be very first box in the file: Header");
 
-	if(hex_to_long(sig->dbox, 4) != JP2_SIG_BOX_CONTENT)
+	if(sig.content_length < 4 || read_be32(sig.dbox) != JP2_SIG_BOX_CONTENT)
 		println(INFO, "JP2 signature box should be very first box in the file: Content");
 
-	if (sig)
-	  dispose_of(sig);
-	sig = NULL;
-	ft = get_next_box(src_buff);
-
-	if(hex_to_long(ft->tbox, 4) != JP2_FILETYPE_BOX)
+	if(ft.type != JP2_FILETYPE_BOX)
 		println(INFO, "JP2 filetype box should directly follow JP2 signature box");
 
-	if(h_filetype_box(ft, img))
+	if(ft.content_length < 8 || h_filetype_box(&ft, img))
 		return 1;
-	if (ft)
-	   dispose_of(ft);
-	ft = NULL;
-
-	while( (b = get_next_box(src_buff)) != NULL ) {
-		if(hex_to_long(b->tbox, 4) == JP2_HEADER_BOX) {
+	while( get_next_box(src_buff, &b) ) {
+		if(b.type == JP2_HEADER_BOX) {
 			println(INFO, "Header Box");
-			h_header_box(b,img);
+			h_header_box(&b,img);
 		} else
-		if(hex_to_long(b->tbox,4) ==  CODE_STREAM_BOX) {
+		if(b.type ==  CODE_STREAM_BOX) {
 			println(INFO, "Contiguous Codestream Box");
-			h_contiguous_codestream_box(b,img);
+			h_contiguous_codestream_box(&b,img,ctx);
 
 		} else
-		if(hex_to_long(b->tbox,4) ==  INTELLECTUAL_PROPERTY_BOX) {
+		if(b.type ==  INTELLECTUAL_PROPERTY_BOX) {
 			println(INFO, "Intellectual Property Box");
 		}
-		dispose_of(b);
 	}
-	b = NULL;
 	println_end(INFO);
 	return 0;
 }
@@ -8,6 +8,7 @@ extern "C" {
 
 #include <stdio.h>
 #include "codestream_image_types.h"
+#include "codestream.h"
 
 
 /* Main boxes */
@@ -67,20 +68,28 @@ extern "C" {
 /* base length of Bits Per Component box */
 #define BPC_LENGTH 8
 
+/** A box is a view into the input it was read from; its contents are never copied */
 typedef struct _box {
-	unsigned char *lbox;
-	unsigned char *tbox;
-	unsigned char *xlbox;
-	unsigned char *dbox;
-
-	unsigned long int length;
-	unsigned long int content_length;
-
-	unsigned long int read; ///how many bytes have been read from the content of the box
+	/** Box type, TBox */
+	unsigned long int type;
+	/** Offset of the box from the start of the buffer or the contents of the superbox */
+	unsigned long long offset;
+	/** Length of the whole box, header included */
+	unsigned long long length;
+
+	/** Box contents, DBox */
+	const unsigned char *dbox;
+	unsigned long long content_length;
+
+	unsigned long long read; ///how many bytes have been read from the content of the box
 } box;
 
-box *get_next_box(type_buffer* buffer);
-int jp2_parse_boxes(type_buffer* buffer, type_image *img);
+int read_box_header(const unsigned char *data, unsigned long long available, box *b);
+int get_next_box(type_buffer* buffer, box *b);
+int get_next_sub_box(box *superbox, box *b);
+int jp2_parse_boxes(type_buffer* buffer, type_image *img, type_parse_context *ctx);
+int jp2_has_signature(const unsigned char *data, size_t size);
+const unsigned char *jp2_find_codestream(const unsigned char *data, size_t size, size_t *length);
 
 
 #ifdef __cplusplus
@@ -9,9 +9,7 @@
 #include "config_parameters.h"
 #include "codestream_image.h"
 #include "codestream_image_mct.h"
-
-CodeBlockCallback codeBlockCallback = NULL;
-
+#include "Tracer.h"
 
 
 void read_siz_marker(type_buffer *buffer, type_image *img)
@@ -29,8 +27,7 @@ void read_siz_marker(type_buffer *buffer, type_image *img)
 	}
 
 	/* Allocate coding parameters */
-	img->coding_param = (type_coding_param *) malloc(sizeof(type_coding_param));
-	memset(img->coding_param, 0, sizeof(type_coding_param));
+	img->coding_param = (type_coding_param *) arena_alloc(img->arena, sizeof(type_coding_param));
 
 	/* Lsiz */
 	length = read_buffer(buffer, 2);
@@ -73,23 +70,29 @@ void read_siz_marker(type_buffer *buffer, type_image *img)
 	}
 
 	img->depth = img->num_components * img->num_range_bits;
-	img->num_xtiles = (img->width + (img->tile_w - 1)) / img->tile_w;
-	img->num_ytiles = (img->height + (img->tile_h - 1)) / img->tile_h;
-	img->num_tiles = img->num_xtiles * img->num_ytiles;
+	if(img->tile_w && img->tile_h)
+	{
+		img->num_xtiles = (img->width + (img->tile_w - 1)) / img->tile_w;
+		img->num_ytiles = (img->height + (img->tile_h - 1)) / img->tile_h;
+		img->num_tiles = img->num_xtiles * img->num_ytiles;
+	} else
+	{
+		println_var(INFO, "Error: Invalid tile size %ux%u", img->tile_w, img->tile_h);
+	}
 
 	img->coding_param->imgarea_height = img->height;
 	img->coding_param->imgarea_width = img->width;
 	img->coding_param->base_step = 1.0 / (float)(1 << (img->num_range_bits - 1));
 }
 
-void read_cod_marker(type_buffer *buffer, type_image *img)
+/**
+ * @brief Reads the COD marker into img and the code-block size into param, without building tiles.
+ */
+void read_cod_parameters(type_buffer *buffer, type_image *img, type_parameters *param)
 {
 	int length;
 	int marker;
 
-	type_parameters *param = (type_parameters *)malloc(sizeof(type_parameters));
-	memset(param, 0, sizeof(type_parameters));
-
 	/* Read COD marker */
 	marker = read_buffer(buffer, 2);
 
@@ -121,11 +124,19 @@ void read_cod_marker(type_buffer *buffer, type_image *img)
 	img->cblk_coding_style = read_buffer(buffer, 1);
 	/* Wavelet transform */
 	img->wavelet_type = read_buffer(buffer, 1) == 0 ? DWT_97 : DWT_53;
-
-	init_tiles(img, param);
 	/* TODO: In future read precinct partition */
+}
 
-	free(param);
+void read_cod_marker(type_buffer *buffer, type_image *img)
+{
+	type_parameters params;
+	memset(&params, 0, sizeof(type_parameters));
+
+	read_cod_parameters(buffer, img, &params);
+	/* Tile grid of the SIZ marker */
+	params.param_tile_w = img->tile_w;
+	params.param_tile_h = img->tile_h;
+	init_tiles(img, &params);
 }
 
 /**
@@ -230,8 +241,36 @@ void read_qcd_marker(type_buffer * buffer, type_image *img)
 }
 
 
+/**
+ * @brief Sets the number of magnitude bits of every subband; depends on the main header only.
+ *
+ * @param tile_comp
+ */
+void init_magnitude_bits(type_tile_comp *tile_comp)
+{
+	int k, l;
+	type_image *img = tile_comp->parent_tile->parent_img;
+	type_subband *sb_ll = &(tile_comp->res_lvls[0].subbands[0]);
+
+	for (k = 0; k < tile_comp->num_rlvls; k++) {
+		type_res_lvl *res_lvl = &(tile_comp->res_lvls[k]);
+		for (l = 0; l < res_lvl->num_subbands; l++) {
+			type_subband *sb = &(res_lvl->subbands[l]);
+			if(img->wavelet_type == DWT_53)
+			{
+				sb->mag_bits = sb->expn + tile_comp->num_guard_bits -1;
+			} else
+			{
+				sb->mag_bits = sb_ll->expn - (tile_comp->num_dlvls - res_lvl->dec_lvl_no) + tile_comp->num_guard_bits -1;
+			}
+		}
+	}
+}
+
 void read_main_header(type_buffer *buffer, type_image *img)
 {
+	unsigned int i, j;
+
 	unsigned int marker;
 
 	/* Read SOC marker */
@@ -255,6 +294,144 @@ void read_main_header(type_buffer *buffer, type_image *img)
 	if(img->use_part2_mct) {
 		read_multiple_component_transformations(buffer, img);
 	}
+
+	for (i = 0; i < img->num_tiles; i++) {
+		for (j = 0; j < img->num_components; j++) {
+			init_magnitude_bits(&(img->tile[i].tile_comp[j]));
+			init_code_block_infos(&(img->tile[i].tile_comp[j]));
+		}
+	}
+}
+
+/**
+ * @brief Finds the end of the main header.
+ *
+ * @param data Codestream, starting with the SOC marker
+ * @param size
+ * @return Bytes from SOC up to the first SOT marker, 0 if there is no complete main header
+ */
+unsigned int main_header_length(const unsigned char *data, size_t size)
+{
+	size_t pos = 2;
+
+	if (size < 2 || ((data[0] << 8) | data[1]) != SOC)
+		return 0;
+	/* every marker segment between SOC and SOT carries its length */
+	while (pos + 4 <= size) {
+		unsigned int marker = (data[pos] << 8) | data[pos + 1];
+		if (marker == SOT)
+			return (unsigned int)pos;
+		pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+	}
+	return 0;
+}
+
+/**
+ * @brief Reads the image parameters from the SIZ and COD markers of a main header, without
+ * building tiles or touching packet data. Marker segments are checked against size first.
+ *
+ * @param data Codestream, starting with the SOC marker; a prefix that covers SIZ and COD is enough
+ * @param size
+ * @param info
+ * @return PROBE_OK, PROBE_TRUNCATED or PROBE_INVALID
+ */
+int probe_codestream(const unsigned char *data, size_t size, type_image_info *info)
+{
+	type_arena *arena;
+	type_image *img;
+	type_parameters params;
+	type_buffer buffer;
+	size_t pos = 2;
+	int found = 0;
+	int rc = PROBE_TRUNCATED;
+
+	if (size < 2)
+		return PROBE_TRUNCATED;
+	if (((data[0] << 8) | data[1]) != SOC)
+		return PROBE_INVALID;
+
+	/* only SIZ allocates, so a small arena does */
+	arena = arena_create(1024);
+	if (!arena)
+		return PROBE_INVALID;
+	img = (type_image *) arena_alloc(arena, sizeof(type_image));
+	img->arena = arena;
+	memset(&params, 0, sizeof(type_parameters));
+	memset(&buffer, 0, sizeof(type_buffer));
+
+	while (pos + 4 <= size) {
+		unsigned int marker = (data[pos] << 8) | data[pos + 1];
+		unsigned int length = (data[pos + 2] << 8) | data[pos + 3];
+		if ((marker >> 8) != 0xff || marker == SOT || length < 2) {
+			rc = PROBE_INVALID;
+			break;
+		}
+		if (pos + 2 + length > size)
+			break;
+
+		buffer.data = buffer.start = buffer.bp = (unsigned char *)data + pos;
+		buffer.end = buffer.data + 2 + length;
+		buffer.size = 2 + length;
+		if (marker == SIZ) {
+			/* Lsiz covers 38 bytes and 3 per component */
+			if (length < 38 || length < 38 + 3 * ((data[pos + 38] << 8) | data[pos + 39])) {
+				rc = PROBE_INVALID;
+				break;
+			}
+			read_siz_marker(&buffer, img);
+			found |= 1;
+		} else if (marker == COD) {
+			if (length < 12) {
+				rc = PROBE_INVALID;
+				break;
+			}
+			read_cod_parameters(&buffer, img, &params);
+			found |= 2;
+		}
+		if (found == 3) {
+			rc = (img->num_components && img->num_tiles) ? PROBE_OK : PROBE_INVALID;
+			break;
+		}
+		pos += 2 + length;
+	}
+
+	if (rc == PROBE_OK) {
+		info->width = img->width;
+		info->height = img->height;
+		info->num_components = img->num_components;
+		info->num_range_bits = img->num_range_bits;
+		info->sign = img->sign;
+		info->tile_w = img->tile_w;
+		info->tile_h = img->tile_h;
+		info->num_xtiles = img->num_xtiles;
+		info->num_ytiles = img->num_ytiles;
+		info->num_tiles = img->num_tiles;
+		info->num_dlvls = img->num_dlvls;
+		info->wavelet_type = img->wavelet_type;
+		info->use_mct = img->use_mct;
+		info->use_part2_mct = img->use_part2_mct;
+		info->num_layers = img->num_layers;
+		info->prog_order = img->prog_order;
+		info->cblk_w = 1 << params.param_cblk_exp_w;
+		info->cblk_h = 1 << params.param_cblk_exp_h;
+	}
+	arena_destroy(arena);
+	return rc;
+}
+
+/**
+ * @brief FNV-1a hash of a main header, used to recognise frames that share their geometry.
+ */
+unsigned long long hash_main_header(const unsigned char *header, unsigned int length)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned int i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= header[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
 }
 
 unsigned int read_tile_header(type_buffer *buffer, type_tile *tile)
@@ -297,25 +474,25 @@ unsigned int read_tile_header(type_buffer *buffer, type_tile *tile)
 	return total_length;
 }
 
-int decode_num_coding_passes(type_buffer *buffer)
+int decode_num_coding_passes(type_bit_reader *reader)
 {
 	int n;
 
-	if (!read_bits(buffer, 1))
+	if (!bit_reader_read(reader, 1))
 		return 1;
-	if (!read_bits(buffer, 1))
+	if (!bit_reader_read(reader, 1))
 		return 2;
-	if ((n = read_bits(buffer, 2)) != 3)
+	if ((n = bit_reader_read(reader, 2)) != 3)
 		return (3 + n);
-	if ((n = read_bits(buffer, 5)) != 31)
+	if ((n = bit_reader_read(reader, 5)) != 31)
 		return (6 + n);
-	return (37 + read_bits(buffer, 7));
+	return (37 + bit_reader_read(reader, 7));
 }
 
-int get_comma_code(type_buffer *buffer)
+int get_comma_code(type_bit_reader *reader)
 {
 	int n;
-	for(n = 0; read_bits(buffer, 1); n++) ;
+	for(n = 0; bit_reader_read(reader, 1); n++) ;
 	return n;
 }
 
@@ -340,15 +517,15 @@ void decode_packet_header(type_buffer *buffer, type_res_lvl *res_lvl)
 	int packet_present;
 	type_tile_comp *tile_comp = res_lvl->parent_tile_comp;
 	type_image *img = tile_comp->parent_tile->parent_img;
-	type_res_lvl *res_lvl_zero = &(tile_comp->res_lvls[0]);
 	type_subband *sb;
 	type_codeblock *cblk;
 	unsigned int marker;
+	type_bit_reader reader;
 
 	for (i = 0; i < res_lvl->num_subbands; i++) {
 		sb = &(res_lvl->subbands[i]);
-		sb->inc_tt = tag_tree_create(sb->num_xcblks, sb->num_ycblks);
-		sb->zero_bit_plane_tt = tag_tree_create(sb->num_xcblks, sb->num_ycblks);
+		if (!sb->num_cblks)
+			continue;
 		tag_tree_reset(sb->inc_tt);
 		tag_tree_reset(sb->zero_bit_plane_tt);
 		for (j = 0; j < sb->num_cblks; j++) {
@@ -368,7 +545,8 @@ void decode_packet_header(type_buffer *buffer, type_res_lvl *res_lvl)
 		}
 	}
 
-	packet_present = read_bits(buffer, 1);
+	bit_reader_init(&reader, buffer);
+	packet_present = bit_reader_read(&reader, 1);
 
 	if(!packet_present)
 	{
@@ -385,7 +563,7 @@ void decode_packet_header(type_buffer *buffer, type_res_lvl *res_lvl)
 			if(!cblk->num_segments)
 			{
 				/* Code-block inclusion */
-				included = decode_tag_tree(buffer, sb->inc_tt, cblk->cblk_no, layer + 1);
+				included = decode_tag_tree(&reader, sb->inc_tt, cblk->cblk_no, layer + 1);
 				//printf("included %d cblkno %d resno %d\n", included, cblk->cblk_no, res_lvl->res_lvl_no);
 			} else {
 				println_var(INFO, "Error: Currently more than one layer is not supported");
@@ -400,42 +578,32 @@ void decode_packet_header(type_buffer *buffer, type_res_lvl *res_lvl)
 			{
 				int k, kmsbs;
 				/* Zero bit-plane information */
-				for(k = 0; !decode_tag_tree(buffer, sb->zero_bit_plane_tt, cblk->cblk_no, k); k++)
+				for(k = 0; !decode_tag_tree(&reader, sb->zero_bit_plane_tt, cblk->cblk_no, k); k++)
 				{
 					;
 				}
 				/* Number of insignificant bits */
 				kmsbs = k - 1;
 				//printf("kmsbs %d\n", kmsbs);
-				/* Number of magnitude bits */
-				if(img->wavelet_type == DWT_53)
-				{
-					sb->mag_bits = sb->expn + tile_comp->num_guard_bits -1;
-				} else
-				{
-					sb->mag_bits = (&res_lvl_zero->subbands[0])->expn - (tile_comp->num_dlvls - res_lvl->dec_lvl_no) + tile_comp->num_guard_bits -1;
-				}
-
-//				printf("sb->orient:%d mag_bits: %d expn:%d\n", sb->orient, sb->mag_bits, (&res_lvl_zero->subbands[0])->expn);
-				/* Number of significant bits */
+				/* Number of significant bits; the magnitude bits come from the main header */
 				cblk->significant_bits = sb->mag_bits - kmsbs;
 				//printf("mag_bits %d significant_bits %d\n", sb->mag_bits, cblk->significant_bits);
 				cblk->num_len_bits = 3;
 			}
 			/* Number of coding passes */
-			cblk->num_coding_passes = decode_num_coding_passes(buffer);
+			cblk->num_coding_passes = decode_num_coding_passes(&reader);
 			//printf("num_coding_passes %d\n", cblk->num_coding_passes);
-			increment = get_comma_code(buffer);
+			increment = get_comma_code(&reader);
 			//printf("increment %d\n", increment);
 			cblk->num_len_bits += increment;
 			//printf("cblk->numlenbits %d\n", cblk->num_len_bits);
 			/* Length of code-block compressed image data */
-			cblk->length = read_bits(buffer, cblk->num_len_bits + int_floorlog2(cblk->num_coding_passes));
+			cblk->length = bit_reader_read(&reader, cblk->num_len_bits + int_floorlog2(cblk->num_coding_passes));
 			//printf("cblk->length %d\n", cblk->length);
 		}
 	}
 
-	if (inalign(buffer))
+	if (bit_reader_align(&reader))
 	{
 		println_var(INFO, "Error: Inaligned packet header");
 	}
@@ -452,7 +620,7 @@ void decode_packet_header(type_buffer *buffer, type_res_lvl *res_lvl)
 	}
 }
 
-void decode_packet_body(type_buffer *buffer, type_res_lvl *res_lvl)
+void decode_packet_body(type_buffer *buffer, type_res_lvl *res_lvl, type_parse_context *ctx)
 {
 	int i, j;
 	type_subband *sb;
@@ -462,15 +630,15 @@ void decode_packet_body(type_buffer *buffer, type_res_lvl *res_lvl)
 		sb = &(res_lvl->subbands[i]);
 		for (j = 0; j < sb->num_cblks; j++) {
 			cblk = &(sb->cblks[j]);
-			if (codeBlockCallback)
-				codeBlockCallback(cblk, buffer->bp);
+			if (ctx && ctx->code_block_callback)
+				ctx->code_block_callback(cblk, buffer->bp, ctx->user_data);
 			skip_buffer(buffer, cblk->length);
 		}
 	}
 }
 
 
-void decode_tiles(type_buffer *buffer, type_tile *tile)
+void decode_tiles(type_buffer *buffer, type_tile *tile, type_parse_context *ctx)
 {
 	unsigned int marker, tile_part_length;
 	type_image *img = tile->parent_img;
@@ -498,9 +666,11 @@ void decode_tiles(type_buffer *buffer, type_tile *tile)
 			tile_comp = &(tile->tile_comp[comp_no]);
 			res_lvl = &(tile_comp->res_lvls[res_no]);
 			/* Decode packet header */
+			trace_begin("decode_packet_header");
 			decode_packet_header(buffer, res_lvl);
+			trace_end();
 			/* Decode packet body */
-			decode_packet_body(buffer, res_lvl);
+			decode_packet_body(buffer, res_lvl, ctx);
 		}
 	}
 
@@ -512,19 +682,42 @@ void decode_tiles(type_buffer *buffer, type_tile *tile)
  *
  * @param buffer
  * @param img
+ * @param ctx Per-decode parsing context, may be NULL
  */
-void decode_codestream(type_buffer *buffer, type_image *img)
+void decode_codestream(type_buffer *buffer, type_image *img, type_parse_context *ctx)
 {
 	type_tile *tile;
+	type_tile_part *parts;
 	unsigned int marker;
+	size_t located = 0;
 	int i;
 
-	read_main_header(buffer, img);
+	trace_begin("decode_codestream");
+	decode_main_header(buffer, img);
 
-	for (i = 0; i < img->num_tiles; i++) {
-		tile = &(img->tile[i]);
-		decode_tiles(buffer, tile);
+	if (ctx && ctx->parse_tile_parts && img->num_tiles > 1)
+	{
+		/* parts go after the tree mark, so recycle_image() drops them with the packets */
+		parts = (type_tile_part *) arena_alloc(img->arena, img->num_tiles * sizeof(type_tile_part));
+		located = locate_tile_parts(buffer->bp, buffer->end - buffer->bp, img, parts);
+		if (located)
+		{
+			ctx->parse_tile_parts(img, parts, ctx);
+			skip_buffer(buffer, (int)located);
+		} else
+		{
+			println(INFO, "Tile-parts cannot be located by Psot, parsing tiles in order");
+		}
+	}
+
+	if (!located)
+	{
+		for (i = 0; i < img->num_tiles; i++) {
+			tile = &(img->tile[i]);
+			decode_tiles(buffer, tile, ctx);
+		}
 	}
+	trace_end();
 
 	/* Read EOC marker */
 	marker = read_buffer(buffer, 2);
@@ -534,3 +727,90 @@ void decode_codestream(type_buffer *buffer, type_image *img)
 		println_var(INFO, "Error: Expected EOC(%x) marker instead of %x", EOC, marker);
 	}
 }
+
+/**
+ * @brief Reads the main header into img, or skips over it if img is a recycled tree that was
+ * built from the same main header.
+ *
+ * @param buffer must hold the whole main header, up to the first SOT marker
+ * @param img
+ */
+void decode_main_header(type_buffer *buffer, type_image *img)
+{
+	unsigned int header_length;
+
+	header_length = main_header_length(buffer->bp, buffer->end - buffer->bp);
+	if (img->tile && header_length == img->header_length && !memcmp(buffer->bp, img->header, header_length))
+	{
+		/* recycled tree of an earlier frame with this main header: only the packets are new */
+		skip_buffer(buffer, header_length);
+	} else
+	{
+		if (img->tile)
+		{
+			println_var(INFO, "Error: Recycled image tree does not match the main header of %s", img->in_file);
+		}
+		img->header_length = header_length;
+		img->header = (unsigned char *) arena_alloc(img->arena, header_length);
+		memcpy(img->header, buffer->bp, header_length);
+		read_main_header(buffer, img);
+		img->header_hash = hash_main_header(img->header, header_length);
+		arena_mark(img->arena, &img->tree_mark);
+	}
+}
+
+/**
+ * @brief Reads the SOT marker segment at data without consuming it.
+ *
+ * @param tile_no receives Isot
+ * @param length receives Psot, the length of the tile-part from SOT on; 0 if it runs up to EOC
+ * @return 0 if data does not start with a complete SOT marker segment
+ */
+int peek_tile_part(const unsigned char *data, size_t size, unsigned int *tile_no, unsigned int *length)
+{
+	if (size < 12 || ((data[0] << 8) | data[1]) != SOT)
+		return 0;
+	*tile_no = (data[4] << 8) | data[5];
+	*length = ((unsigned int)data[6] << 24) | (data[7] << 16) | (data[8] << 8) | data[9];
+	return 1;
+}
+
+/**
+ * @brief Finds the tile-part of every tile by hopping from SOT to SOT over the Psot lengths,
+ * without reading a single packet.
+ *
+ * @param data first SOT marker, right after the main header
+ * @param parts receives the tile-part of every tile, indexed by Isot
+ * @return bytes from data up to EOC; 0 if a tile is missing, repeated or split into several
+ * tile-parts, or if a tile-part runs past size
+ */
+size_t locate_tile_parts(unsigned char *data, size_t size, type_image *img, type_tile_part *parts)
+{
+	size_t pos = 0;
+	unsigned int i, tile_no, length;
+
+	for (i = 0; i < img->num_tiles; i++)
+		parts[i].data = NULL;
+
+	for (i = 0; i < img->num_tiles; i++) {
+		if (!peek_tile_part(data + pos, size - pos, &tile_no, &length) || tile_no >= img->num_tiles || parts[tile_no].data)
+			return 0;
+		/* TPsot and TNsot, decode_tiles() supports a single tile-part per tile only */
+		if (data[pos + 10] != 0 || data[pos + 11] != 1)
+			return 0;
+		if (!length)
+		{
+			/* only the last tile-part may run up to EOC */
+			if (i != img->num_tiles - 1 || size - pos < 2)
+				return 0;
+			length = (unsigned int)(size - pos - 2);
+		}
+		/* SOT marker segment and SOD */
+		if (length < 14 || length > size - pos)
+			return 0;
+		parts[tile_no].data = data + pos;
+		parts[tile_no].length = length;
+		pos += length;
+	}
+	return pos;
+}
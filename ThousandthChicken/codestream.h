@@ -9,10 +9,63 @@ extern "C" {
 #include "codestream_image_types.h"
 #include "io_buffered_stream.h"
 
-typedef void (*CodeBlockCallback)(type_codeblock* cblk, unsigned char* codestream);
+typedef void (*CodeBlockCallback)(type_codeblock* cblk, unsigned char* codestream, void* user_data);
 
-extern CodeBlockCallback codeBlockCallback;
+/** A tile-part found by locate_tile_parts() */
+typedef struct _type_tile_part {
+	/** Starts at the SOT marker */
+	unsigned char *data;
+	/** Psot, or the bytes up to EOC if Psot is 0 */
+	unsigned int length;
+} type_tile_part;
 
+struct _type_parse_context;
+
+/** Parses the packets of every tile from its tile-part, parts being indexed by tile number */
+typedef void (*TilePartsCallback)(type_image *img, type_tile_part *parts, struct _type_parse_context *ctx);
+
+/** Per-decode parsing context, so that concurrent decodes do not share any state */
+typedef struct _type_parse_context {
+	/** Called for every code-block as its packet body is read; may be NULL */
+	CodeBlockCallback code_block_callback;
+	/** Passed back to code_block_callback */
+	void *user_data;
+	/** If set, decode_codestream() locates all tile-parts first and leaves parsing them to this,
+	 * e.g. on several threads; NULL parses the tiles one after the other */
+	TilePartsCallback parse_tile_parts;
+} type_parse_context;
+
+
+/** Image parameters probe_codestream() reads from the SIZ and COD markers */
+typedef struct _type_image_info {
+	unsigned int width;
+	unsigned int height;
+	unsigned short num_components;
+	/** Bit depth of the first component */
+	unsigned char num_range_bits;
+	unsigned char sign;
+	/** Nominal tile size and tile grid as given by SIZ */
+	unsigned int tile_w;
+	unsigned int tile_h;
+	unsigned int num_xtiles;
+	unsigned int num_ytiles;
+	unsigned int num_tiles;
+	unsigned char num_dlvls;
+	/** DWT_53 or DWT_97 */
+	unsigned char wavelet_type;
+	unsigned char use_mct;
+	unsigned char use_part2_mct;
+	unsigned short num_layers;
+	unsigned char prog_order;
+	unsigned short cblk_w;
+	unsigned short cblk_h;
+} type_image_info;
+
+/** probe_codestream() results */
+#define PROBE_OK 0
+/** SIZ or COD lie beyond the given bytes */
+#define PROBE_TRUNCATED 1
+#define PROBE_INVALID -1
 
 /** Packet parameters */
 typedef struct _type_packet{
@@ -21,7 +74,14 @@ typedef struct _type_packet{
 	unsigned short *num_coding_passes;
 } type_packet;
 
-void decode_codestream(type_buffer *buffer, type_image *img);
+void decode_codestream(type_buffer *buffer, type_image *img, type_parse_context *ctx);
+void decode_main_header(type_buffer *buffer, type_image *img);
+int peek_tile_part(const unsigned char *data, size_t size, unsigned int *tile_no, unsigned int *length);
+size_t locate_tile_parts(unsigned char *data, size_t size, type_image *img, type_tile_part *parts);
+void decode_tiles(type_buffer *buffer, type_tile *tile, type_parse_context *ctx);
+unsigned int main_header_length(const unsigned char *data, size_t size);
+unsigned long long hash_main_header(const unsigned char *header, unsigned int length);
+int probe_codestream(const unsigned char *data, size_t size, type_image_info *info);
 
 
 
@@ -3,6 +3,7 @@
 #include "codestream_image.h"
 #include <stdlib.h>
 #include "config_parameters.h"
+#include "codestream_tag_tree_encode.h"
 #include <string.h>
 
 
@@ -17,10 +18,8 @@ void init_codeblocks(type_subband *sb) {
 	type_codeblock *cblk;
 	type_tile_comp *tile_comp;
 
-	sb->cblks = (type_codeblock *) malloc(sb->num_cblks * sizeof(type_codeblock));
-	memset(sb->cblks, 0, sb->num_cblks * sizeof(type_codeblock));
-
 	tile_comp = sb->parent_res_lvl->parent_tile_comp;
+	sb->cblks = (type_codeblock *) arena_alloc(tile_comp->parent_tile->parent_img->arena, sb->num_cblks * sizeof(type_codeblock));
 
 	//	println_var(INFO, "sb:tlx:%d tly:%d brx:%d bry:%d w:%d h:%d num_xcblks:%d num_ycblks:%d num_cblks:%d", sb->tlx, sb->tly, sb->brx, sb->bry, sb->width, sb->height, sb->num_xcblks, sb->num_ycblks, sb->num_cblks);
 
@@ -62,15 +61,12 @@ void init_subbands(type_res_lvl *res_lvl) {
 	type_tile *tile;
 	type_tile_comp *tile_comp;
 	unsigned char xob, yob;
-	unsigned short tmp_x, tmp_y;
-	unsigned short sb_ll_width, sb_ll_height;
-
-	res_lvl->subbands = (type_subband *) malloc(res_lvl->num_subbands * sizeof(type_subband));
-	memset(res_lvl->subbands, 0, res_lvl->num_subbands * sizeof(type_subband));
-
+	unsigned int tmp_x, tmp_y;
+	unsigned int sb_ll_width, sb_ll_height;
 
 	tile_comp = res_lvl->parent_tile_comp;
 	tile = tile_comp->parent_tile;
+	res_lvl->subbands = (type_subband *) arena_alloc(tile->parent_img->arena, res_lvl->num_subbands * sizeof(type_subband));
 
 	sb_ll_width = ((tile->width + (1 << res_lvl->dec_lvl_no) - 1) >> res_lvl->dec_lvl_no);
 	sb_ll_height = ((tile->height + (1 << res_lvl->dec_lvl_no) - 1) >> res_lvl->dec_lvl_no);
@@ -113,6 +109,12 @@ void init_subbands(type_res_lvl *res_lvl) {
 		//		printf("tlx:%d tly:%d Num cblks:%d Sb w:%d Sb h:%d\n", sb->tlx, sb->tly, sb->num_cblks, sb->width, sb->height);
 		sb->parent_res_lvl = res_lvl;
 
+		/* one precinct per resolution level, so the trees are reset for every packet rather than recreated */
+		if (sb->num_cblks) {
+			sb->inc_tt = tag_tree_create(tile->parent_img->arena, sb->num_xcblks, sb->num_ycblks);
+			sb->zero_bit_plane_tt = tag_tree_create(tile->parent_img->arena, sb->num_xcblks, sb->num_ycblks);
+		}
+
 		init_codeblocks(sb);
 	}
 	//	println_end(INFO);
@@ -128,14 +130,11 @@ void init_resolution_lvls(type_tile_comp *tile_comp) {
 	type_res_lvl *res_lvl;
 	type_tile *parent_tile;
 	/* n = 2^(Nl-r) */
-	unsigned short n;
+	unsigned int n;
 	/* Precinct width and height */
 	int prec_width, prec_height;
-	tile_comp->res_lvls = (type_res_lvl *) malloc(tile_comp->num_rlvls * sizeof(type_res_lvl));
-	memset(tile_comp->res_lvls, 0, tile_comp->num_rlvls *sizeof(type_res_lvl));
-
-
 	parent_tile = tile_comp->parent_tile;
+	tile_comp->res_lvls = (type_res_lvl *) arena_alloc(parent_tile->parent_img->arena, tile_comp->num_rlvls * sizeof(type_res_lvl));
 
 	//	println_var(INFO, "w:%d h:%d num_dlvls:%d num_rlvls:%d cblk_exp_w:%d cblk_exp_h:%d cblk_w:%d cblk_h:%d", tile_comp->width, tile_comp->height, tile_comp->num_dlvls, tile_comp->num_rlvls, tile_comp->cblk_exp_w, tile_comp->cblk_exp_h, tile_comp->cblk_w, tile_comp->cblk_h);
 
@@ -192,8 +191,7 @@ void init_tile_comps(type_tile *tile, type_parameters *param) {
 	type_image *parent_img;
 
 	parent_img = tile->parent_img;
-	tile->tile_comp = (type_tile_comp *) malloc(parent_img->num_components * sizeof(type_tile_comp));
-	memset(tile->tile_comp, 0, parent_img->num_components * sizeof(type_tile_comp));
+	tile->tile_comp = (type_tile_comp *) arena_alloc(parent_img->arena, parent_img->num_components * sizeof(type_tile_comp));
 
 	//	println_var(INFO, "no:%d tlx:%d tly:%d brx:%d bry:%d w:%d h:%d", tile->tile_no, tile->tlx, tile->tly, tile->brx, tile->bry, tile->width, tile->height);
 
@@ -232,9 +230,9 @@ void init_tiles(type_image *img, type_parameters *param) {
 	//	println_start(INFO);
 	unsigned int i = 0;
 	/* Horizontal position of the tile */
-	unsigned short p;
+	unsigned int p;
 	/* Vertical position of the tile */
-	unsigned short q;
+	unsigned int q;
 	/* Temporary pointers */
 	type_tile *tile;
 
@@ -248,8 +246,7 @@ void init_tiles(type_image *img, type_parameters *param) {
 	img->num_tiles = img->num_xtiles * img->num_ytiles;
 
 	//	cuda_h_allocate_mem((void **) &(img->tile), img->num_tiles * sizeof(type_tile));
-	img->tile = (type_tile *) malloc(img->num_tiles * sizeof(type_tile));
-	memset(img->tile, 0, img->num_tiles *sizeof(type_tile));
+	img->tile = (type_tile *) arena_alloc(img->arena, img->num_tiles * sizeof(type_tile));
 
 	//	println_var(INFO, "w:%d h:%d no_com:%d area:%d t_w:%d t_h:%d t_x:%d t_y:%d no_t:%d", img->width,img->height,img->num_components,img->area_alloc,img->tile_w,img->tile_h,img->num_xtiles,img->num_ytiles,img->num_tiles);
 
@@ -276,16 +273,103 @@ void init_tiles(type_image *img, type_parameters *param) {
 	//	println_end(INFO);
 }
 
+/**
+ * @brief Lays out the code-blocks of a tile component the way the coefficient coder kernel reads them.
+ * Needs the magnitude bits from the QCD marker.
+ *
+ * @param tile_comp
+ */
+void init_code_block_infos(type_tile_comp *tile_comp) {
+	unsigned int i, j, k, n = 0;
+	int magcon_offset = 0;
+	int coefficients_offset = 0;
+	type_arena *arena = tile_comp->parent_tile->parent_img->arena;
+
+	tile_comp->num_cblks = 0;
+	for (i = 0; i < tile_comp->num_rlvls; i++)
+		for (j = 0; j < tile_comp->res_lvls[i].num_subbands; j++)
+			tile_comp->num_cblks += tile_comp->res_lvls[i].subbands[j].num_cblks;
+	tile_comp->cblk_infos = (CodeBlockAdditionalInfo *) arena_alloc(arena, tile_comp->num_cblks * sizeof(CodeBlockAdditionalInfo));
+
+	for (i = 0; i < tile_comp->num_rlvls; i++) {
+		type_res_lvl *res_lvl = &(tile_comp->res_lvls[i]);
+		for (j = 0; j < res_lvl->num_subbands; j++) {
+			type_subband *sb = &(res_lvl->subbands[j]);
+			for (k = 0; k < sb->num_cblks; k++) {
+				type_codeblock *cblk = &(sb->cblks[k]);
+				CodeBlockAdditionalInfo *info = &(tile_comp->cblk_infos[n++]);
+
+				/* LL and LH share the context tables */
+				info->subband = sb->orient == HL ? 1 : (sb->orient == HH ? 2 : 0);
+				info->width = cblk->width;
+				info->height = cblk->height;
+				info->nominalWidth = tile_comp->cblk_w;
+				info->nominalHeight = tile_comp->cblk_h;
+				info->stripeNo = (cblk->height + 3) / 4;
+				info->magbits = sb->mag_bits;
+				info->magconOffset = magcon_offset + cblk->width;
+				info->d_coefficientsOffset = coefficients_offset;
+
+				cblk->d_coefficientsOffset = coefficients_offset;
+				coefficients_offset += tile_comp->cblk_w * tile_comp->cblk_h;
+				magcon_offset += cblk->width * (info->stripeNo + 2);
+			}
+		}
+	}
+	tile_comp->coefficients_size = coefficients_offset;
+	tile_comp->state_size = magcon_offset;
+}
+
+/**
+ * @brief Creates an empty image in a new arena; everything parsed into it goes to the same arena.
+ */
+type_image *create_image(void) {
+	type_arena *arena = arena_create(0);
+	type_image *img;
+	if (!arena)
+		return NULL;
+	img = (type_image *) arena_alloc(arena, sizeof(type_image));
+	img->arena = arena;
+	return img;
+}
+
+/**
+ * @brief Destroys the arenas tiles parsed into instead of the image's arena.
+ */
+static void free_tile_arenas(type_image *img) {
+	unsigned int i;
+	for (i = 0; i < img->num_tiles; i++) {
+		type_tile *tile = &(img->tile[i]);
+		if (tile->arena) {
+			arena_destroy(tile->arena);
+			tile->arena = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Prepares the tree of a decoded image for the next frame with an identical main header.
+ * Everything parsed after the main header is released; the tree itself stays as it is.
+ */
+void recycle_image(type_image *img) {
+	unsigned int i, j;
+	free_tile_arenas(img);
+	arena_rewind(img->arena, &img->tree_mark);
+	img->in_file = NULL;
+	for (i = 0; i < img->num_tiles; i++) {
+		type_tile *tile = &(img->tile[i]);
+		for (j = 0; j < img->num_components; j++)
+			tile->tile_comp[j].coefficients = NULL;
+	}
+}
+
+/**
+ * @brief Releases an image and its whole object tree by destroying its arena.
+ */
 void free_image(type_image* img) {
 	if (!img)
 		return;
-	if (img->coding_param)
-		free(img->coding_param);
-	img->coding_param = NULL;
 	if (img->tile)
-		free(img->tile);
-	img->tile = NULL;
-
-	free(img);
-
+		free_tile_arenas(img);
+	arena_destroy(img->arena);
 }
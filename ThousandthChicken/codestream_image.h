@@ -10,6 +10,9 @@ extern "C" {
 #include "config_parameters.h"
 
 void init_tiles(type_image *img, type_parameters *param);
+void init_code_block_infos(type_tile_comp *tile_comp);
+type_image *create_image(void);
+void recycle_image(type_image *img);
 void free_image(type_image* img);
 
 
@@ -1,5 +1,6 @@
 // License: please see LICENSE2 file for more details.
 #include <stdlib.h>
+#include <string.h>
 
 #include "codestream_image_mct.h"
 #include "io_buffered_stream.h"
@@ -20,7 +21,7 @@ void read_mct_marker(type_buffer *buffer, type_image *img) {
 	unsigned short Smct;
 	unsigned char type;
 	int i;
-	type_mct *old_mcts, *mct;
+	type_mct *mct;
 
 	/* Read MCT Marker */
 	marker = read_buffer(buffer, 2);
@@ -36,26 +37,17 @@ void read_mct_marker(type_buffer *buffer, type_image *img) {
 	
 	type = (Smct&(3<<4))>>4;
 
-	old_mcts = img->mct_data->mcts[type];
-	img->mct_data->mcts[type] = (type_mct*)realloc(img->mct_data->mcts[type], sizeof(type_mct) * (++img->mct_data->mcts_count[type]));
-	mct = &img->mct_data->mcts[type][img->mct_data->mcts_count[type]-1];
-	
-	if(img->mct_data->mcts[type] == NULL) {
-		img->mct_data->mcts[type] = old_mcts;
-		--img->mct_data->mcts_count[type];
-		println_var(INFO, "Error: Memory reallocation failed! Ignoring MCT with Smct %u Skipping data", Smct);
-		for(i=0; i<length-1; ++i) {
-			read_byte(buffer);
-		}
-	} else {
-		mct->index = Smct&0x0F;
-		mct->type = type;
-		mct->element_type = (Smct&(3<<6))>>6;
-		mct->length = length/(1<<mct->element_type);
-		mct->data = (unsigned char*)malloc(length);
-		for(i=0; i<length; ++i) {
-			mct->data[i] = read_byte(buffer);
-		}
+	img->mct_data->mcts[type] = (type_mct*)arena_grow(img->arena, img->mct_data->mcts[type],
+		sizeof(type_mct) * img->mct_data->mcts_count[type], sizeof(type_mct) * (img->mct_data->mcts_count[type] + 1));
+	mct = &img->mct_data->mcts[type][img->mct_data->mcts_count[type]++];
+
+	mct->index = Smct&0x0F;
+	mct->type = type;
+	mct->element_type = (Smct&(3<<6))>>6;
+	mct->length = length/(1<<mct->element_type);
+	mct->data = (unsigned char*)arena_alloc(img->arena, length);
+	for(i=0; i<length; ++i) {
+		mct->data[i] = read_byte(buffer);
 	}
 }
 
@@ -73,22 +65,12 @@ void read_mcc_marker(type_buffer *buffer, type_image *img) {
 	int count=0;
 	unsigned short temp_16;
 	unsigned char temp_8;
-	type_mcc *old_mccs, *mcc;
+	type_mcc *mcc;
 	type_mcc_data* mcc_data = NULL;
 
-	old_mccs = img->mct_data->mccs;
-	img->mct_data->mccs = (type_mcc*)realloc(img->mct_data->mccs, sizeof(type_mcc) * (++img->mct_data->mccs_count));
-	mcc = &img->mct_data->mccs[img->mct_data->mccs_count-1];
-	mcc->data = NULL;
-
-
-
-	if(img->mct_data->mccs == NULL) {
-		img->mct_data->mccs = old_mccs;
-		--img->mct_data->mccs_count;
-		println_var(INFO, "Error: Memory reallocation failed! Aborting read of MCC segment");
-		return;
-	}
+	img->mct_data->mccs = (type_mcc*)arena_grow(img->arena, img->mct_data->mccs,
+		sizeof(type_mcc) * img->mct_data->mccs_count, sizeof(type_mcc) * (img->mct_data->mccs_count + 1));
+	mcc = &img->mct_data->mccs[img->mct_data->mccs_count++];
 
 	/* Read MCC Marker */
 	marker = read_buffer(buffer, 2);
@@ -101,8 +83,8 @@ void read_mcc_marker(type_buffer *buffer, type_image *img) {
 	mcc->index = read_byte(buffer);
 	/* reading unknown number of component collections */ 
 	while(length>0) {
-		mcc->data = (type_mcc_data*)realloc((void*)mcc->data, sizeof(type_mcc_data)*(++count));
-		mcc_data = &mcc->data[count-1];
+		mcc->data = (type_mcc_data*)arena_grow(img->arena, mcc->data, sizeof(type_mcc_data)*count, sizeof(type_mcc_data)*(count+1));
+		mcc_data = &mcc->data[count++];
 
 		/* input component collection header */
 		mcc_data->type = read_byte(buffer)&3;
@@ -114,7 +96,7 @@ void read_mcc_marker(type_buffer *buffer, type_image *img) {
 		/* input component collection data */
 		temp_16 = mcc_data->input_count * (1<<mcc_data->input_component_type);
 		length-=temp_16;
-		mcc_data->input_components = (unsigned char*)calloc(temp_16, sizeof(unsigned char));
+		mcc_data->input_components = (unsigned char*)arena_alloc(img->arena, temp_16);
 		for(i=0; i<temp_16; ++i) {
 			mcc_data->input_components[i] = read_byte(buffer);
 		}
@@ -128,7 +110,7 @@ void read_mcc_marker(type_buffer *buffer, type_image *img) {
 		/* output component collection data */
 		temp_16 = mcc_data->output_count * (1<<mcc_data->output_component_type);
 		length-=temp_16;
-		mcc_data->output_components = (unsigned char*)calloc(temp_16, sizeof(unsigned char));
+		mcc_data->output_components = (unsigned char*)arena_alloc(img->arena, temp_16);
 		for(i=0; i<temp_16; ++i) {
 			mcc_data->output_components[i] = read_byte(buffer);
 		}
@@ -137,6 +119,7 @@ void read_mcc_marker(type_buffer *buffer, type_image *img) {
 		temp_8 = read_byte(buffer);
 		if(mcc_data->type & 2) {
 			/* wavelet based decorrelation */
+			img->mct_compression_method = 2;
 			mcc_data->atk = temp_8 & 0xF;
 			mcc_data->ads = temp_8 >> 4;
 			mcc_data->decorrelation_transform_matrix = 0x0;
@@ -167,19 +150,12 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 	int count=0;
 	unsigned short temp_16;
 	unsigned char temp_8;
-	type_mic *old_mics, *mic;
+	type_mic *mic;
 	type_mic_data* mic_data;
 
-	old_mics = img->mct_data->mics;
-	img->mct_data->mics = (type_mic*)realloc(img->mct_data->mics, sizeof(type_mic) * (++img->mct_data->mics_count));
-	mic = &img->mct_data->mics[img->mct_data->mics_count-1];
-
-	if(img->mct_data->mics == NULL) {
-		img->mct_data->mics = old_mics;
-		--img->mct_data->mics_count;
-		println_var(INFO, "Error: Memory reallocation failed! Aborting read of MIC segment");
-		return;
-	}
+	img->mct_data->mics = (type_mic*)arena_grow(img->arena, img->mct_data->mics,
+		sizeof(type_mic) * img->mct_data->mics_count, sizeof(type_mic) * (img->mct_data->mics_count + 1));
+	mic = &img->mct_data->mics[img->mct_data->mics_count++];
 
 
 
@@ -194,8 +170,8 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 	mic->index = read_byte(buffer);
 	/* reading unknown number of component collections */ 
 	while(length>0) {
-		mic->data = (type_mic_data*)realloc((void*)mic->data, sizeof(type_mic_data)*++count);
-		mic_data = &mic->data[count-1];
+		mic->data = (type_mic_data*)arena_grow(img->arena, mic->data, sizeof(type_mic_data)*count, sizeof(type_mic_data)*(count+1));
+		mic_data = &mic->data[count++];
 
 		/* input component collection header */
 		temp_16 = read_buffer(buffer,2);
@@ -206,7 +182,7 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 		/* input component collection data */
 		temp_16 = mic_data->input_count * (1<<mic_data->input_component_type);
 		length-=temp_16;
-		mic_data->input_components = (unsigned char*)calloc(temp_16, sizeof(unsigned char));
+		mic_data->input_components = (unsigned char*)arena_alloc(img->arena, temp_16);
 		for(i=0; i<temp_16; ++i) {
 			mic_data->input_components[i] = read_byte(buffer);
 		}
@@ -220,7 +196,7 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 		/* output component collection data */
 		temp_16 = mic_data->output_count * (1<<mic_data->output_component_type);
 		length-=temp_16;
-		mic_data->output_components = (unsigned char*)calloc(temp_16, sizeof(unsigned char));
+		mic_data->output_components = (unsigned char*)arena_alloc(img->arena, temp_16);
 		for(i=0; i<temp_16; ++i) {
 			mic_data->output_components[i] = read_byte(buffer);
 		}
@@ -235,6 +211,39 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 }
 
 
+/**
+ * @brief Reads one ATK coefficient of the given type.
+ */
+static double read_atk_value(type_buffer *buffer, unsigned char type) {
+	unsigned int word;
+	unsigned long long wide;
+	float f;
+	double d;
+	int i;
+
+	switch(type) {
+	case MCT_8BIT_INT:
+		return (signed char)read_byte(buffer);
+	case MCT_16BIT_INT:
+		return (short)read_buffer(buffer, 2);
+	case MCT_32BIT_FLOAT:
+		word = read_buffer(buffer, 4);
+		memcpy(&f, &word, sizeof(f));
+		return f;
+	case MCT_64BIT_DOUBLE:
+		wide = ((unsigned long long)read_buffer(buffer, 4) << 32);
+		wide |= read_buffer(buffer, 4);
+		memcpy(&d, &wide, sizeof(d));
+		return d;
+	default:
+		/* 128 bit floats are not supported */
+		for(i=0; i<16; ++i) {
+			read_byte(buffer);
+		}
+		return 0;
+	}
+}
+
 /**
  * @brief Reads ATK marker.
  *
@@ -244,21 +253,13 @@ void read_mic_marker(type_buffer *buffer, type_image *img) {
 void read_atk_marker(type_buffer *buffer, type_image *img) {
 	int marker;
 	int length;
-	int i;
-	int count;
+	int i, s;
 	unsigned short temp;
-	unsigned char* t;
 	type_atk* atk;
-	type_atk* old_atks = img->mct_data->atks;
-	img->mct_data->atks = (type_atk*)realloc(img->mct_data->atks, sizeof(type_atk) * (++img->mct_data->atk_count));
-	atk = &img->mct_data->atks[img->mct_data->atk_count-1];
-
-	if(img->mct_data->atks == NULL) {
-		img->mct_data->atks = old_atks;
-		--img->mct_data->atk_count;
-		println_var(INFO, "Error: Memory reallocation failed! Aborting read of ATK segment");
-		return;
-	}
+	type_atk_step* step;
+	img->mct_data->atks = (type_atk*)arena_grow(img->arena, img->mct_data->atks,
+		sizeof(type_atk) * img->mct_data->atk_count, sizeof(type_atk) * (img->mct_data->atk_count + 1));
+	atk = &img->mct_data->atks[img->mct_data->atk_count++];
 
 
 	/* Read ATK Marker */
@@ -269,40 +270,35 @@ void read_atk_marker(type_buffer *buffer, type_image *img) {
 	}
 	length = read_buffer(buffer, 4)-5;
 
-	temp = read_byte(buffer);
-	atk->index = temp & 0xF;
-	atk->coeff_type = (temp & 0x0070) >> 4;
-	atk->filter_category = (temp & 0x0180) >> 7;
-	atk->wavelet_type = (temp & 0x0200) >> 9;
-	atk->m0 = (temp & 0x400) >> 10;
-
-	atk->lifing_steps = read_byte(buffer);
-	atk->lifting_coefficients_per_step = read_byte(buffer);
-	atk->lifting_offset = read_byte(buffer);
-
-	count = 1<<atk->coeff_type;
-	t = (unsigned char*)calloc(count, sizeof(unsigned char));
-	for(i=0; i<count; ++i) {
-		t[i]=read_byte(buffer);
+	/* Satk is 16 bits wide: index, coefficient type, filter category, reversibility, m0, extension */
+	temp = read_buffer(buffer, 2);
+	atk->index = temp & 0xFF;
+	atk->coeff_type = (temp >> 8) & 0x7;
+	atk->filter_category = (temp >> 11) & 0x3;
+	atk->wavelet_type = (temp >> 13) & 0x1;
+	atk->m0 = (temp >> 14) & 0x1;
+	atk->extension = (temp >> 15) & 0x1;
+
+	/* Katk, irreversible transforms only */
+	atk->scaling_factor = 1.0;
+	if(atk->wavelet_type == 0) {
+		atk->scaling_factor = read_atk_value(buffer, atk->coeff_type);
 	}
 
-	if(atk->wavelet_type == 1) {
-		atk->scaling_exponent = t;
-	} else {
-		atk->scaling_factor = t;
-	}
-
-	count = atk->lifing_steps * atk->lifting_coefficients_per_step * atk->wavelet_type?1:(1<<atk->coeff_type);
-	atk->coefficients = (unsigned char*)calloc(count, sizeof(unsigned char));
-	for(i=0; i<count; ++i) {
-		atk->coefficients[i] = read_byte(buffer);
-	}
-
-	if(atk->wavelet_type == 1) {
-		count = atk->lifing_steps * (1<<atk->coeff_type);
-		atk->additive_residue = (unsigned char*)calloc(count, sizeof(unsigned char));
-		for(i=0; i<count; ++i) {
-			atk->additive_residue[i] = read_byte(buffer);
+	/* Natk, then every lifting step with its own offset, exponent, residue and coefficients */
+	atk->lifting_steps = read_byte(buffer);
+	atk->steps = (type_atk_step*)arena_alloc(img->arena, atk->lifting_steps * sizeof(type_atk_step));
+	for(s=0; s<atk->lifting_steps; ++s) {
+		step = &atk->steps[s];
+		step->offset = (signed char)read_byte(buffer);
+		if(atk->wavelet_type == 1) {
+			step->scaling_exponent = read_byte(buffer);
+			step->additive_residue = (short)read_buffer(buffer, 2);
+		}
+		step->coefficient_count = read_byte(buffer);
+		step->coefficients = (double*)arena_alloc(img->arena, step->coefficient_count * sizeof(double));
+		for(i=0; i<step->coefficient_count; ++i) {
+			step->coefficients[i] = read_atk_value(buffer, atk->coeff_type);
 		}
 	}
 }
@@ -319,18 +315,11 @@ void read_ads_marker(type_buffer *buffer, type_image *img) {
 	int length;
 	int i;
 	unsigned char temp;
-	type_ads *old_adses, *ads;
-
-	old_adses = img->mct_data->adses;
-	img->mct_data->adses = (type_ads*)realloc(img->mct_data->adses, sizeof(type_ads) * (++img->mct_data->ads_count));
-	ads = &img->mct_data->adses[img->mct_data->ads_count-1];
+	type_ads *ads;
 
-	if(img->mct_data->adses == NULL) {
-		img->mct_data->adses = old_adses;
-		--img->mct_data->ads_count;
-		println_var(INFO, "Error: Memory reallocation failed! Aborting read of ADS segment");
-		return;
-	}
+	img->mct_data->adses = (type_ads*)arena_grow(img->arena, img->mct_data->adses,
+		sizeof(type_ads) * img->mct_data->ads_count, sizeof(type_ads) * (img->mct_data->ads_count + 1));
+	ads = &img->mct_data->adses[img->mct_data->ads_count++];
 
 
 	/* Read ADS Marker */
@@ -342,22 +331,23 @@ void read_ads_marker(type_buffer *buffer, type_image *img) {
 	length = read_buffer(buffer, 4)-5;
 	ads->index = read_byte(buffer);
 	ads->IOads = read_byte(buffer);
-	ads->DOads = (unsigned char*)calloc(ads->IOads, sizeof(unsigned char));	
+	ads->DOads = (unsigned char*)arena_alloc(img->arena, ads->IOads);
+	/* four 2 bit elements per byte, most significant first */
 	i = 0;
-	while(ads->DOads - i >0) {
+	while(i < ads->IOads) {
 		if(i%4 == 0)
 			temp = read_byte(buffer);
-		ads->DOads[i] = (temp & (3 << (3-i)*2)) >> (3-i)*2;
+		ads->DOads[i] = (temp >> (3-i%4)*2) & 3;
 		++i;
 	}
 
 	ads->ISads = read_byte(buffer);
-	ads->DSads = (unsigned char*)calloc(ads->ISads, sizeof(unsigned char));	
+	ads->DSads = (unsigned char*)arena_alloc(img->arena, ads->ISads);
 	i = 0;
-	while(ads->DSads - i >0) {
+	while(i < ads->ISads) {
 		if(i%4 == 0)
 			temp = read_byte(buffer);
-		ads->DSads[i] = (temp & (3 << (3-i)*2)) >> (3-i)*2;
+		ads->DSads[i] = (temp >> (3-i%4)*2) & 3;
 		++i;
 	}
 }
@@ -365,7 +355,7 @@ void read_ads_marker(type_buffer *buffer, type_image *img) {
 
 /** Reads all data needed for performing multiple component transformations as in 15444-2 from codestream */
 void read_multiple_component_transformations(type_buffer *buffer, type_image *img) {
-	img->mct_data = (type_multiple_component_transformations*)calloc(1, sizeof(type_multiple_component_transformations));
+	img->mct_data = (type_multiple_component_transformations*)arena_alloc(img->arena, sizeof(type_multiple_component_transformations));
 	while(peek_marker(buffer)==ADS) {
 		read_ads_marker(buffer, img);
 	}
@@ -22,6 +22,7 @@ typedef struct type_mcc_data type_mcc_data;
 typedef struct type_mic type_mic;
 typedef struct type_mic_data type_mic_data;
 typedef struct type_atk type_atk;
+typedef struct type_atk_step type_atk_step;
 typedef struct type_ads type_ads;
 typedef struct type_multiple_component_transformations type_multiple_component_transformations;
 
@@ -194,42 +195,52 @@ struct type_ads {
 	unsigned char* DSads;
 };
 
+/** Lifting step of an ATK segment as in 15444-2 Annex A.3.5 */
+struct type_atk_step {
+	/** Offset of the first coefficient relative to the updated sample, Oatk */
+	signed char offset;
+
+	/** Base two scaling exponent εs, for the reversible transform only */
+	unsigned char scaling_exponent;
+
+	/** Additive residue βs, for the reversible transform only */
+	short additive_residue;
+
+	/** Number of lifting coefficients */
+	unsigned char coefficient_count;
+
+	/** Lifting coefficients αs,k */
+	double* coefficients;
+};
+
+/** ATK as in 15444-2 Annex A.3.5 */
 struct type_atk {
 	/** Index of marker segment */
 	unsigned char index;
 
-	/** Coefficients data type */
+	/** Coefficients data type, MCT_8BIT_INT to MCT_128BIT_DOUBLE */
 	unsigned char coeff_type;
 
-	/** Wavelet filters */
+	/** Wavelet filters: 0 arbitrary, 1 whole-sample symmetric */
 	unsigned char filter_category;
 
-	/** Wavelet type */
+	/** Wavelet type: 0 irreversible, 1 reversible */
 	unsigned char wavelet_type;
 
 	/** Odd/Even indexed subsequence */
 	unsigned char m0;
 
-	/** Number of lifting steps */
-	unsigned char lifing_steps;
-
-	/** Number of lifting coefficients at lifting step */
-	unsigned char lifting_coefficients_per_step;
+	/** Boundary extension: 0 constant, 1 whole-sample symmetric */
+	unsigned char extension;
 
-	/** Offset for lifting step */
-	unsigned char lifting_offset;
+	/** Scaling factor K, for the irreversible transform only */
+	double scaling_factor;
 
-	/** Base two scaling exponent for lifting step s, εs for the reversible transform only */
-	unsigned char* scaling_exponent;
-	
-	/** Scaling factor, for the irreversible transform only*/
-	unsigned char* scaling_factor;
-
-	/**The ith lifting coefficient for the jth lifting step,αs,k. The index, i, ranges from i = 0 to Natk-1 and is the inner loop (present for all of j). The index, j, ranges from j = 0 to Latk-1 and is the outer loop(incremented after a full run of i). */
-	unsigned char * coefficients;
+	/** Number of lifting steps */
+	unsigned char lifting_steps;
 
-	/** The ith additive residue for lifting step, s. The index, i, ranges from i = 0 to Natk-1. Present for reversible transformations */
-	unsigned char* additive_residue;
+	/** Lifting steps in analysis order */
+	type_atk_step* steps;
 };
 
 
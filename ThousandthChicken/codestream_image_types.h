@@ -3,6 +3,8 @@
 
 #include "codestream_tag_tree.h"
 #include "codestream_image_mct.h"
+#include "arena.h"
+#include "coefficientcoder_common.h"
 
 #define UNSIGNED 0U
 #define SIGNED 1U
@@ -33,28 +35,28 @@ struct type_codeblock
 	unsigned int cblk_no;
 
 	/** Codeblock number  in the horizontal direction */
-	unsigned short no_x;
+	unsigned int no_x;
 
 	/** Codeblock number  in the vertical direction */
-	unsigned short no_y;
+	unsigned int no_y;
 
 	/** The x-coordinate of the top-left corner of the codeblock, regarding to subband. */
-	unsigned short tlx;
+	unsigned int tlx;
 
 	/** The y-coordinate of the top-left corner of the codeblock, regarding to subband. */
-	unsigned short tly;
+	unsigned int tly;
 
 	/** The x-coordinate of the bottom-right corner of the codeblock, regarding to subband. */
-	unsigned short brx;
+	unsigned int brx;
 
 	/** The y-coordinate of the bottom-right corner of the codeblock, regarding to subband. */
-	unsigned short bry;
+	unsigned int bry;
 
 	/** Codeblock width */
-	unsigned short width;
+	unsigned int width;
 
 	/** Codeblock height */
-	unsigned short height;
+	unsigned int height;
 
 	/** Parent subband */
 	type_subband *parent_sb;
@@ -88,28 +90,28 @@ struct type_subband
 	type_orient orient;
 
 	/** The x-coordinate of the top-left corner of the subband, regarding to tile-component. tbx0 */
-	unsigned short tlx;
+	unsigned int tlx;
 
 	/** The y-coordinate of the top-left corner of the subband, regarding to tile-component. tby0 */
-	unsigned short tly;
+	unsigned int tly;
 
 	/** The x-coordinate of the bottom-right corner of the subband, regarding to tile-component. tbx1 */
-	unsigned short brx;
+	unsigned int brx;
 
 	/** The y-coordinate of the bottom-right corner of the subband, regarding to tile-component. tby1 */
-	unsigned short bry;
+	unsigned int bry;
 
 	/** Subband width */
-	unsigned short width;
+	unsigned int width;
 
 	/** Subband height */
-	unsigned short height;
+	unsigned int height;
 
 	/** Number of codeblocks in the horizontal direction in subband. */
-	unsigned short num_xcblks;
+	unsigned int num_xcblks;
 
 	/** Number of codeblocks in the vertical direction in subband. */
-	unsigned short num_ycblks;
+	unsigned int num_ycblks;
 
 	/** Total number of codeblocks in subband */
 	unsigned int num_cblks;
@@ -154,25 +156,25 @@ struct type_res_lvl
 
 	/** The x-coordinate of the top-left corner of the tile-component
 	 at this resolution. trx0 */
-	unsigned short tlx;
+	unsigned int tlx;
 
 	/** The y-coordinate of the top-left corner of the tile-component
 	 at this resolution. try0 */
-	unsigned short tly;
+	unsigned int tly;
 
 	/** The x-coordinate of the bottom-right corner of the tile-component
 	 at this resolution(plus one). trx1 */
-	unsigned short brx;
+	unsigned int brx;
 
 	/** The y-coordinate of the bottom-right corner of the tile-component
 	 at this resolution(plus one). try1 */
-	unsigned short bry;
+	unsigned int bry;
 
 	/** Resolution level width */
-	unsigned short width;
+	unsigned int width;
 
 	/** Resolution level height */
-	unsigned short height;
+	unsigned int height;
 
 	/** The exponent value for the precinct width. PPx */
 	unsigned char prc_exp_w;
@@ -181,13 +183,13 @@ struct type_res_lvl
 	unsigned char prc_exp_h;
 
 	/** Number of precincts in the horizontal direction in resolution level. numprecinctswide */
-	unsigned short num_hprc;
+	unsigned int num_hprc;
 
 	/** Number of precincts in the vertical direction in resolution level. numprecinctshigh */
-	unsigned short num_vprc;
+	unsigned int num_vprc;
 
 	/** Total number of precincts. numprecincts */
-	unsigned short num_prcs;
+	unsigned int num_prcs;
 
 	/** Number of subbands */
 	unsigned char num_subbands;
@@ -207,10 +209,10 @@ struct type_tile_comp
 
 	/** XXX: Tiles on specific components may have different sizes, because components can have various sizes. See ISO B.3 */
 	/** Tile-component width. */
-	unsigned short width;
+	unsigned int width;
 
 	/** Tile-component height */
-	unsigned short height;
+	unsigned int height;
 
 	/** Number of decomposition levels. NL. COD marker */
 	unsigned char num_dlvls;
@@ -238,12 +240,31 @@ struct type_tile_comp
 	/** Number of guard bits */
 	unsigned char num_guard_bits;
 
-	/** Tile component data on the GPU */
+	/** Tile component data on the GPU, a sub-buffer of the tile's img_data_d */
 	void* img_data_d;
 
 	/** Tile component data on the host */
 	void* img_data_h;
 
+	/** Start of this component within the tile's img_data_d, in samples */
+	unsigned int img_data_offset;
+
+	/** Decoded code-block coefficients on the GPU, stored code-block after code-block */
+	void* coefficients;
+
+	/** Code-block geometry in the layout the coefficient coder kernel reads, one per code-block in
+	 * resolution level, subband, raster order; only length and significant bits change per frame */
+	CodeBlockAdditionalInfo *cblk_infos;
+
+	/** Number of code-blocks in all resolution levels */
+	unsigned int num_cblks;
+
+	/** Size of coefficients, in samples */
+	unsigned int coefficients_size;
+
+	/** Size of the coefficient coder's state buffer, in words */
+	unsigned int state_size;
+
 	/** Resolution levels */
 	type_res_lvl *res_lvls;
 
@@ -257,24 +278,22 @@ struct type_tile
 	unsigned int tile_no;
 
 	/** The x-coord of the top left corner of the tile with respect to the original image. tx0 */
-	unsigned short tlx;
+	unsigned int tlx;
 
 	/** The y-coord of the top left corner of the tile with respect to the original image. ty0 */
-	unsigned short tly;
+	unsigned int tly;
 
 	/** The x-coord of the bottom right corner of the tile with respect to the original image. tx1 */
-	unsigned short brx;
+	unsigned int brx;
 
 	/** The y-coord of the bottom right corner of the tile with respect to the original image. ty1 */
-	unsigned short bry;
+	unsigned int bry;
 
 	/** Tile width */
-	unsigned short width;
+	unsigned int width;
 
 	/** Tile height */
-	unsigned short height;
-
-	void* coefficients;
+	unsigned int height;
 
 	/** Quantization style for each channel (ready for QCD/QCC marker) */
 	char QS;
@@ -282,6 +301,17 @@ struct type_tile
 	/** Tile on specific component/channel in host memory */
 	type_tile_comp *tile_comp;
 
+	/** All tile components on the GPU, one after another; NULL if they were allocated separately */
+	void* img_data_d;
+
+	/** Host address of img_data_d if it lives in shared virtual memory */
+	void* img_data_h;
+
+	/** If set, code-block codestreams of this tile go here instead of the image's arena, so that
+	 * a streaming decode can release them as soon as the tile has been staged, and so that
+	 * tiles can be parsed concurrently */
+	type_arena *arena;
+
 	/** Parent image */
 	type_image *parent_img;
 
@@ -293,25 +323,25 @@ struct type_coding_param
 	/* Image area */
 	/** The horizontal offset from the origin of the reference grid to the
 	 left edge of the image area. XOsiz */
-	unsigned short imgarea_tlx;
+	unsigned int imgarea_tlx;
 	/** The vertical offset from the origin of the reference grid to the
 	 left edge of the image area. YOsiz */
-	unsigned short imgarea_tly;
+	unsigned int imgarea_tly;
 
 	/** The horizontal offset from the origin of the reference grid to the
 	 right edge of the image area. Xsiz */
-	unsigned short imgarea_width;
+	unsigned int imgarea_width;
 	/** The vertical offset from the origin of the reference grid to the
 	 right edge of the image area. Ysiz */
-	unsigned short imgarea_height;
+	unsigned int imgarea_height;
 
 	/* Tile grid */
 	/** The horizontal offset from the origin of the tile grid to the
 	 origin of the reference grid. XTOsiz */
-	unsigned short tilegrid_tlx;
+	unsigned int tilegrid_tlx;
 	/** The vertical offset from the origin of the tile grid to the
 	 origin of the reference grid. YTOsiz */
-	unsigned short tilegrid_tly;
+	unsigned int tilegrid_tly;
 
 	/** The component horizontal sampling factor. XRsiz */
 	unsigned short comp_step_x;
@@ -353,10 +383,10 @@ struct type_image
 	unsigned char bil_file;
 
 	/** Image width */
-	unsigned short width;
+	unsigned int width;
 
 	/** Image height */
-	unsigned short height;
+	unsigned int height;
 
 	/** Number of channels/components. Csiz */
 	unsigned short num_components;
@@ -378,14 +408,14 @@ struct type_image
 	int area_alloc;
 
 	/** The nominal tile width. XTsiz. SIZ marker */
-	unsigned short tile_w;
+	unsigned int tile_w;
 	/** The nominal tile height. YTsiz. SIZ marker */
-	unsigned short tile_h;
+	unsigned int tile_h;
 
 	/** Number of tiles in horizontal direction. nunXtiles */
-	unsigned short num_xtiles;
+	unsigned int num_xtiles;
 	/** Number of tiles in vertical direction. numYtiles */
-	unsigned short num_ytiles;
+	unsigned int num_ytiles;
 	/** Number of all tiles */
 	unsigned int num_tiles;
 
@@ -421,5 +451,16 @@ struct type_image
 
 	/** Coding parameters */
 	type_coding_param *coding_param;
+
+	/** Holds this image and every parse structure of it; free_image() releases it in one go */
+	type_arena *arena;
+
+	/** Copy of the main header the tree was built from, SOC up to the first SOT */
+	unsigned char *header;
+	unsigned int header_length;
+	/** hash_main_header() of header */
+	unsigned long long header_hash;
+	/** End of the tree in the arena; recycle_image() drops everything parsed after it */
+	type_arena_mark tree_mark;
 };
 
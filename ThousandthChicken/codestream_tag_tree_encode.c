@@ -20,7 +20,10 @@ void tag_tree_reset(type_tag_tree *tree)
 	}
 }
 
-type_tag_tree *tag_tree_create(int num_leafs_h, int num_leafs_v)
+/**
+ * @brief Creates a tag tree in arena. The tree lives as long as the arena; reset it to reuse it.
+ */
+type_tag_tree *tag_tree_create(type_arena *arena, int num_leafs_h, int num_leafs_v)
 {
 	int nplh[32];
 	int nplv[32];
@@ -32,12 +35,7 @@ type_tag_tree *tag_tree_create(int num_leafs_h, int num_leafs_v)
 	int num_lvls;
 	int n;
 
-	tree = (type_tag_tree *) malloc(sizeof(type_tag_tree));
-	memset(tree, 0, sizeof(type_tag_tree));
-	if (!tree) {
-		println_var(INFO, "Error: unable to allocate tag tree");
-		return NULL;
-	}
+	tree = (type_tag_tree *) arena_alloc(arena, sizeof(type_tag_tree));
 	tree->num_leafs_h = num_leafs_h;
 	tree->num_leafs_v = num_leafs_v;
 
@@ -54,16 +52,10 @@ type_tag_tree *tag_tree_create(int num_leafs_h, int num_leafs_v)
 	} while (n > 1);
 
 	if (tree->num_nodes == 0) {
-		free(tree);
 		println_var(INFO, "Error: tag tree with zero nodes");
 		return NULL;
 	}
-	tree->nodes = (type_tag_tree_node*) calloc(tree->num_nodes, sizeof(type_tag_tree_node));
-	if (!tree->nodes) {
-		free(tree);
-		println_var(INFO, "Error: tag tree with null nodes");
-		return NULL;
-	}
+	tree->nodes = (type_tag_tree_node*) arena_alloc(arena, tree->num_nodes * sizeof(type_tag_tree_node));
 
 	node = tree->nodes;
 	parent_node = &tree->nodes[tree->num_leafs_h * tree->num_leafs_v];
@@ -94,7 +86,7 @@ type_tag_tree *tag_tree_create(int num_leafs_h, int num_leafs_v)
 	return tree;
 }
 
-int decode_tag_tree(type_buffer *buffer, type_tag_tree *tree, int leaf_no, int threshold)
+int decode_tag_tree(type_bit_reader *reader, type_tag_tree *tree, int leaf_no, int threshold)
 {
 	type_tag_tree_node *stk[31];
 	type_tag_tree_node **stkptr;
@@ -116,7 +108,7 @@ int decode_tag_tree(type_buffer *buffer, type_tag_tree *tree, int leaf_no, int t
 			low = node->low;
 		}
 		while (low < threshold && low < node->value) {
-			if (read_bits(buffer, 1)) {
+			if (bit_reader_read(reader, 1)) {
 				node->value = low;
 			} else {
 				++low;
@@ -10,8 +10,8 @@ extern "C" {
 #include "codestream_image_types.h"
 #include "io_buffered_stream.h"
 
-type_tag_tree *tag_tree_create(int num_leafs_h, int num_leafs_v);
-int decode_tag_tree(type_buffer *buffer, type_tag_tree *tree, int leaf_no, int threshold);
+type_tag_tree *tag_tree_create(type_arena *arena, int num_leafs_h, int num_leafs_v);
+int decode_tag_tree(type_bit_reader *reader, type_tag_tree *tree, int leaf_no, int threshold);
 void tag_tree_reset(type_tag_tree *tree);
 
 #ifdef __cplusplus
@@ -794,12 +794,13 @@ KERNEL void g_decode(GLOBAL unsigned int *stBuffers, GLOBAL unsigned char *codes
 	mqInitDec(&mqdec, codestream, codeblockInfo.length);
 	float sum_dist = 0.0f;
 
+	// also zeroes code-blocks without significant bits, such as those a region decode leaves out
+	initDecodingCoeffs(codeblockInfo, st, decodedCoefficients);
+
 	if(codeblockInfo.significantBits > 0)
 	{
 		mqResetDec(&mqdec);
 
-		initDecodingCoeffs(codeblockInfo, st, decodedCoefficients);
-		
 		BITPLANE_WINDOW_SCAN_CLEAN(codeblockInfo, st, &mqdec, &sum_dist, 0);
 
 		uploadMags(codeblockInfo, st, 30 - codeblockInfo.magbits + codeblockInfo.significantBits,decodedCoefficients);
@@ -7,8 +7,8 @@ extern "C" {
 	
 /** Image parameters */
 typedef struct _type_parameters {
-	unsigned short param_tile_w; /// Tile width. According to this and param_tile_height all the parameters of the tiles are set. -1 is no tiling (only one tile which covers entire image).
-	unsigned short param_tile_h; /// Tile height. According to this and param_tile_width all the parameters of the tiles are set. -1 is no tiling (only one tile which covers entire image).
+	unsigned int param_tile_w; /// Tile width. According to this and param_tile_height all the parameters of the tiles are set. -1 is no tiling (only one tile which covers entire image).
+	unsigned int param_tile_h; /// Tile height. According to this and param_tile_width all the parameters of the tiles are set. -1 is no tiling (only one tile which covers entire image).
 	unsigned char param_tile_comp_dlvls;
 	unsigned char param_cblk_exp_w; ///Maximum codeblock size is 2^6 x 2^6 ( 64 x 64 ).
 	unsigned char param_cblk_exp_h; ///Maximum codeblock size is 2^6 x 2^6 ( 64 x 64 ).
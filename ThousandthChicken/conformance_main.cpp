@@ -0,0 +1,176 @@
+// License: please see LICENSE1 file for more details.
+
+// Entry point of the conformance and regression harness, built as a separate executable
+
+#include "ocl_util.h"
+#include "ConformanceHarness.h"
+#include "BatchDecoder.h"
+#include "DeviceKernel.h"
+#include "basic.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern bool quiet;
+
+struct conformance_args_t
+{
+    const char* directory;
+    int iterations;
+    double tolerance;
+    const char* references;
+    const char* baseline;
+    const char* saveReferences;
+    const char* saveBaseline;
+    bool dwtCheck;
+};
+
+// The valid arguments are:
+//      -cpu / -gpu: Prefer a CPU or GPU OpenCL device
+//      -q: Run in silence mode
+//      -iterations <n>: Decodes per file, the fastest one counts (default 3)
+//      -tolerance <percent>: Allowed slowdown or memory growth against the baseline (default 10)
+//      -reference <file>: Reference checksums to compare against
+//      -baseline <file>: Baseline JSON to compare against
+//      -save-reference <file>, -save-baseline <file>: Write this run's checksums or timings
+//      -dwt-check: Compare batched against per component inverse DWTs instead of decoding a corpus;
+//                  exits with 77 (skipped) if there is no OpenCL device
+//      <directory>: Corpus of .jp2/.j2k/.j2c files
+int ParseConformanceArguments(data_args_d_t* data, conformance_args_t* conf, int argc, char* argv[])
+{
+    memset(data, 0, sizeof(*data));
+    memset(conf, 0, sizeof(*conf));
+    data->numQueues = 2;
+    conf->iterations = 3;
+    conf->tolerance = 10.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-cpu"))
+            data->preferCpu = true;
+        else if (!strcmp(argv[i], "-gpu"))
+            data->preferGpu = true;
+        else if (!strcmp(argv[i], "-q"))
+            quiet = true;
+        else if (!strcmp(argv[i], "-iterations") && i + 1 < argc)
+        {
+            conf->iterations = atoi(argv[++i]);
+            if (conf->iterations < 1)
+                return CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc)
+        {
+            conf->tolerance = atof(argv[++i]);
+            if (conf->tolerance < 0)
+                return CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-reference") && i + 1 < argc)
+            conf->references = argv[++i];
+        else if (!strcmp(argv[i], "-baseline") && i + 1 < argc)
+            conf->baseline = argv[++i];
+        else if (!strcmp(argv[i], "-save-reference") && i + 1 < argc)
+            conf->saveReferences = argv[++i];
+        else if (!strcmp(argv[i], "-save-baseline") && i + 1 < argc)
+            conf->saveBaseline = argv[++i];
+        else if (!strcmp(argv[i], "-dwt-check"))
+            conf->dwtCheck = true;
+        else if (argv[i][0] != '-' && !conf->directory)
+            conf->directory = argv[i];
+        else
+            return CL_INVALID_VALUE;
+    }
+    return conf->directory || conf->dwtCheck ? CL_SUCCESS : CL_INVALID_VALUE;
+}
+
+// Batched inverse DWTs of several components of sizes that are not powers of two
+int RunDWTCheck(data_args_d_t* args)
+{
+    ocl_args_d_t ocl;
+    int error_code = InitOpenCL(&ocl, args);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: InitOpenCL returned %s, skipping.\n", TranslateOpenCLError(error_code));
+        return 77;
+    }
+
+    int failures = 0;
+    try
+    {
+        ConformanceHarness harness(&ocl);
+        failures += harness.checkBatchedDWT(100, 100, 3, 5);
+        failures += harness.checkBatchedDWT(37, 23, 2, 3);
+    }
+    catch (const Error& err)
+    {
+        LogError("Error: %s\n", err.what());
+        return 2;
+    }
+
+    DeviceKernel::ReleaseProgramCache();
+    printf("Batched inverse DWT: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    data_args_d_t args;
+    conformance_args_t conf;
+    int error_code = ParseConformanceArguments(&args, &conf, argc, argv);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Usage: %s [-cpu|-gpu] [-q] [-iterations n] [-tolerance percent] [-reference file] [-baseline file]"
+                 " [-save-reference file] [-save-baseline file] <directory>\n"
+                 "       %s [-cpu|-gpu] -dwt-check\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    if (conf.dwtCheck)
+        return RunDWTCheck(&args);
+
+    std::vector<std::string> files;
+    if (BatchDecoder::listImages(conf.directory, files) <= 0)
+    {
+        LogError("Error: no images found in %s.\n", conf.directory);
+        return 2;
+    }
+
+    ocl_args_d_t ocl;
+    error_code = InitOpenCL(&ocl, &args);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: InitOpenCL returned %s.\n", TranslateOpenCLError(error_code));
+        return 2;
+    }
+
+    int failures = 0;
+    try
+    {
+        ConformanceHarness harness(&ocl, conf.iterations, conf.tolerance);
+        if (conf.references && harness.loadReferences(conf.references) < 0)
+        {
+            LogError("Error: cannot read references %s.\n", conf.references);
+            return 2;
+        }
+        if (conf.baseline && harness.loadBaseline(conf.baseline) < 0)
+        {
+            LogError("Error: cannot read baseline %s.\n", conf.baseline);
+            return 2;
+        }
+
+        failures = harness.run(files);
+        harness.print();
+        if (conf.saveReferences)
+            harness.writeReferences(conf.saveReferences);
+        if (conf.saveBaseline)
+            harness.writeBaseline(conf.saveBaseline);
+    }
+    catch (const Error& err)
+    {
+        LogError("Error: %s\n", err.what());
+        return 2;
+    }
+
+    DeviceKernel::ReleaseProgramCache();
+    printf("%d of %d files failed\n", failures, (int)files.size());
+    return failures ? 1 : 0;
+}
@@ -182,8 +182,13 @@ void transform(LOCAL TransformBufferINT* transformBuffer, bool CHECKED_LOADS, bo
 /// @param sizeY  height of the output image
 /// @param winSteps  number of sliding window steps
 KERNEL void run(int WIN_SIZE_X, int WIN_SIZE_Y, LOCAL int* data,
-                            GLOBAL const int * const input, GLOBAL int * const output,
-                            const int sx, const int sy, const int steps) {
+                            GLOBAL const int * const in, GLOBAL int * const out,
+                            const int sx, const int sy, const int steps,
+                            const int offset, const int sliceStride) {
+    // the third dimension selects one of several equally sized images, sliceStride samples apart
+    GLOBAL const int * const input = in + offset + getGroupId(2) * sliceStride;
+    GLOBAL int * const output = out + offset + getGroupId(2) * sliceStride;
+
     // prepare instance with buffer in shared memory
     LOCAL TransformBufferINT transformBuffer;
 	initTransformBufferINT(&transformBuffer, WIN_SIZE_X, WIN_SIZE_Y, data);
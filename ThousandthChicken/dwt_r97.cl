@@ -227,8 +227,13 @@ void transform(LOCAL TransformBufferFLOAT* transformBuffer, bool CHECKED_LOADS,
 /// @param sizeY  height of the output image
 /// @param winSteps  number of sliding window steps
 KERNEL void run(int WIN_SIZE_X, int WIN_SIZE_Y, LOCAL float* data,
-                            GLOBAL const float * const input, GLOBAL float * const output,
-                            const int sx, const int sy, const int steps) {
+                            GLOBAL const float * const in, GLOBAL float * const out,
+                            const int sx, const int sy, const int steps,
+                            const int offset, const int sliceStride) {
+    // the third dimension selects one of several equally sized images, sliceStride samples apart
+    GLOBAL const float * const input = in + offset + getGroupId(2) * sliceStride;
+    GLOBAL float * const output = out + offset + getGroupId(2) * sliceStride;
+
     // prepare instance with buffer in shared memory
     LOCAL TransformBufferFLOAT transformBuffer;
 	initTransformBufferFLOAT(&transformBuffer, WIN_SIZE_X, WIN_SIZE_Y, data);
@@ -51,10 +51,16 @@ unsigned int read_buffer(type_buffer *buffer, int n)
 {
 	int i;
 	unsigned int val = 0;
-	for(i = n - 1; i >= 0; i--)
+	if(buffer->bp + n > buffer->end)
+	{
+		println_var(INFO, "Error: Exceeded buffer bounds!");
+		exit(0);
+	}
+	for(i = 0; i < n; i++)
 	{
-		val += read_byte(buffer) << (i << 3);
+		val = (val << 8) | buffer->bp[i];
 	}
+	buffer->bp += n;
 	return val;
 }
 
@@ -131,6 +137,136 @@ unsigned int inalign(type_buffer *buffer)
 	return 0;
 }
 
+/**
+ * Starts reading bits at the current position of a byte aligned buffer.
+ *
+ * @param reader
+ * @param buffer
+ */
+void bit_reader_init(type_bit_reader *reader, type_buffer *buffer)
+{
+	reader->window = 0;
+	reader->boundaries = 0;
+	reader->bits = 0;
+	/* as in read_byte_(), a byte after 0xFF carries a stuffed zero bit */
+	reader->last_ff = (buffer->byte & 0xff) == 0xff;
+	reader->past_end = 0;
+	reader->buffer = buffer;
+}
+
+#define BYTES_01 0x0101010101010101ULL
+#define BYTES_80 0x8080808080808080ULL
+
+static void bit_reader_refill(type_bit_reader *reader)
+{
+	type_buffer *buffer = reader->buffer;
+
+	/* eight bytes without 0xFF among them can be appended as they are */
+	if(!reader->last_ff && buffer->end - buffer->bp >= 8)
+	{
+		unsigned long long word = 0, inverted;
+		int i, count;
+		for(i = 0; i < 8; i++)
+		{
+			word = (word << 8) | buffer->bp[i];
+		}
+		inverted = ~word;
+		if(((inverted - BYTES_01) & ~inverted & BYTES_80) == 0)
+		{
+			count = (64 - reader->bits) >> 3;
+			if(count == 8)
+			{
+				reader->window = word;
+				reader->boundaries = BYTES_80;
+			} else
+			{
+				reader->window |= (word >> (64 - 8 * count)) << (64 - reader->bits - 8 * count);
+				reader->boundaries |= (BYTES_80 >> (64 - 8 * count)) << (64 - reader->bits - 8 * count);
+			}
+			reader->bits += 8 * count;
+			buffer->bp += count;
+			return;
+		}
+	}
+
+	while(reader->bits <= 56 && buffer->bp < buffer->end)
+	{
+		unsigned char byte = *buffer->bp++;
+		int n = reader->last_ff ? 7 : 8;
+		reader->window |= (unsigned long long)(byte & ((1 << n) - 1)) << (64 - reader->bits - n);
+		reader->boundaries |= 1ULL << (63 - reader->bits);
+		reader->bits += n;
+		reader->last_ff = byte == 0xff;
+	}
+}
+
+/**
+ * Reads n <= 32 bits, most significant first. Bits past the end of the buffer read as zero, like read_bits().
+ *
+ * @param reader
+ * @param n
+ */
+unsigned int bit_reader_read(type_bit_reader *reader, int n)
+{
+	unsigned int val;
+	if(n == 0)
+	{
+		return 0;
+	}
+	if(reader->bits < n)
+	{
+		bit_reader_refill(reader);
+		if(reader->bits < n)
+		{
+			reader->bits = n;
+			reader->past_end = 1;
+		}
+	}
+	val = (unsigned int)(reader->window >> (64 - n));
+	reader->window <<= n;
+	reader->boundaries <<= n;
+	reader->bits -= n;
+	return val;
+}
+
+/**
+ * Drops the rest of the current byte and returns the unread bytes to the buffer. Like inalign(),
+ * skips the byte following a final 0xFF.
+ *
+ * @param reader
+ * @return Returns 1 if that byte is missing.
+ */
+unsigned int bit_reader_align(type_bit_reader *reader)
+{
+	type_buffer *buffer = reader->buffer;
+	unsigned long long unread = reader->boundaries;
+	int bytes = 0;
+
+	/* every remaining boundary starts a byte that has not been read at all */
+	while(unread)
+	{
+		bytes++;
+		unread &= unread - 1;
+	}
+	buffer->bp -= bytes;
+	reader->window = 0;
+	reader->boundaries = 0;
+	reader->bits = 0;
+
+	buffer->bits_count = 0;
+	/* a packet header always holds at least one bit, so a byte has been consumed */
+	buffer->byte = reader->past_end ? 0 : buffer->bp[-1];
+	if(buffer->byte == 0xff)
+	{
+		if(buffer->bp >= buffer->end)
+		{
+			return 1;
+		}
+		buffer->byte = (buffer->byte << 8) | *buffer->bp++;
+	}
+	return 0;
+}
+
 void enlarge_buffer_n(type_buffer *buffer, int size)
 {
 	unsigned char *old_data = buffer->data;
@@ -19,6 +19,26 @@ typedef struct _type_buffer {
 	unsigned char *end;
 } type_buffer;
 
+/**
+ * Reads packet header bits 64 at a time from a type_buffer.
+ *
+ * Bytes are loaded ahead of the bits being read, with the stuffed zero bit after every 0xFF
+ * already removed; bit_reader_align() hands the unread whole bytes back to the buffer.
+ */
+typedef struct _type_bit_reader {
+	/** Unread bits, most significant first */
+	unsigned long long window;
+	/** A set bit marks the first bit of each loaded byte, aligned like window */
+	unsigned long long boundaries;
+	/** Number of valid bits in window */
+	int bits;
+	/** The last loaded byte was 0xFF, so the next one carries 7 bits */
+	int last_ff;
+	/** Bits past the end of the buffer have been read as zero */
+	int past_end;
+	type_buffer *buffer;
+} type_bit_reader;
+
 
 void init_buffer(type_buffer *buffer);
 void enlarge_buffer(type_buffer *buffer);
@@ -40,6 +60,9 @@ unsigned int read_bits(type_buffer *buffer, int n);
 unsigned int inalign(type_buffer *buffer);
 unsigned short peek_marker(type_buffer *buffer);
 unsigned char read_byte(type_buffer *buffer);
+void bit_reader_init(type_bit_reader *reader, type_buffer *buffer);
+unsigned int bit_reader_read(type_bit_reader *reader, int n);
+unsigned int bit_reader_align(type_bit_reader *reader);
 
 #ifdef __cplusplus
 }
@@ -2,8 +2,19 @@
 
 #include "ocl_util.h"
 
+#include <thread>
+#include <atomic>
+
 #include "DWTTest.h"
 #include "Decoder.h"
+#include "MultiDeviceDecoder.h"
+#include "BatchDecoder.h"
+#include "DeviceKernel.h"
+#include "basic.h"
+#include "Tracer.h"
+#include "ResourceCounters.h"
+#include "SharedMemory.h"
+#include "MemoryPlanner.h"
 
 extern bool quiet;
 
@@ -12,10 +23,43 @@ extern bool quiet;
 //      -cpu: Prefer a CPU OpenCL device         - Set preferCpu to true
 //      -gpu: Prefer a GPU OpenCL device         - Set preferGpu to true
 //      -q:   Set global variable quite to true
+//      -input <file>: Image decoded by the default, -multi, -fission, -numa and -threads modes
+//      -queues <n>: Number of command queues used for decoding
+//      -multi: Decode on all devices of the platform
+//      -fission <n>: Split every device into sub-devices of n compute units and decode on all of them
+//      -numa: Compare whole-device decoding with one pinned sub-device per NUMA node
+//      -batch <dir>: Decode all images of a directory through the batch pipeline
+//      -threads <n>: Decode concurrently from n threads, each with its own decoder
+//      -trace <file>: Write a Chrome trace of host and device activity to file
+//      -stats: Print allocations, bytes transferred, launches and peak memory per decode
+//      -nosvm: Do not use fine-grained shared virtual memory on devices that support it
+//      -probe <file>: Print the image parameters of file from its header, without OpenCL
+//      -stream <file>: Decode file, or stdin for "-", through a sliding window instead of mapping it whole
+//      -region <file> <x,y,w,h[,r]>: Decode the tiles of file covering a region through its tile index sidecar
+//      -budget <MB>: Device memory decodes may reserve; larger images decode in batches of tiles
+//      -tiles <n>: With -stream, hand tiles to a sink with n in flight (0 a row) instead of assembling the image
+//      -parsethreads <n>: Locate all tile-parts first and parse the tiles on n host threads (0 one per hardware thread)
 int ParseArguments(data_args_d_t* data, int argc, char* argv[])
 {
     data->preferCpu      = data->preferGpu = false;
     data->vendorName     = NULL;
+    data->numQueues      = 2;
+    data->multiDevice    = false;
+    data->subDeviceUnits = 0;
+    data->numaNodes      = false;
+    data->inputFile      = NULL;
+    data->batchDirectory = NULL;
+    data->numThreads     = 0;
+    data->traceFile      = NULL;
+    data->stats          = false;
+    data->noSvm          = false;
+    data->probeFile      = NULL;
+    data->streamFile     = NULL;
+    data->streamTiles    = -1;
+    data->budgetMB       = 0;
+    data->regionFile     = NULL;
+    data->regionSpec     = NULL;
+    data->parseThreads   = 1;
     cl_int errorCode = CL_SUCCESS;
 
     for (int i = 1; i < argc ; i++)
@@ -32,6 +76,84 @@ int ParseArguments(data_args_d_t* data, int argc, char* argv[])
         {
             data->preferGpu = true;
         }
+        else if (!strcmp(argv[i], "-queues") && i + 1 < argc)
+        {
+            data->numQueues = atoi(argv[++i]);
+            if (data->numQueues < 1)
+                errorCode = CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-multi"))
+        {
+            data->multiDevice = true;
+        }
+        else if (!strcmp(argv[i], "-fission") && i + 1 < argc)
+        {
+            data->multiDevice = true;
+            data->subDeviceUnits = atoi(argv[++i]);
+            if (data->subDeviceUnits < 1)
+                errorCode = CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-numa"))
+        {
+            data->numaNodes = true;
+        }
+        else if (!strcmp(argv[i], "-input") && i + 1 < argc)
+        {
+            data->inputFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-batch") && i + 1 < argc)
+        {
+            data->batchDirectory = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+        {
+            data->traceFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-stats"))
+        {
+            data->stats = true;
+        }
+        else if (!strcmp(argv[i], "-nosvm"))
+        {
+            data->noSvm = true;
+        }
+        else if (!strcmp(argv[i], "-probe") && i + 1 < argc)
+        {
+            data->probeFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-stream") && i + 1 < argc)
+        {
+            data->streamFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-region") && i + 2 < argc)
+        {
+            data->regionFile = argv[++i];
+            data->regionSpec = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-budget") && i + 1 < argc)
+        {
+            data->budgetMB = atoi(argv[++i]);
+            if (data->budgetMB < 1)
+                errorCode = CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-tiles") && i + 1 < argc)
+        {
+            data->streamTiles = atoi(argv[++i]);
+            if (data->streamTiles < 0)
+                errorCode = CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-parsethreads") && i + 1 < argc)
+        {
+            data->parseThreads = atoi(argv[++i]);
+            if (data->parseThreads < 0)
+                errorCode = CL_INVALID_VALUE;
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            data->numThreads = atoi(argv[++i]);
+            if (data->numThreads < 1)
+                errorCode = CL_INVALID_VALUE;
+        }
         else if (!strcmp(argv[i], "-help"))
         {
             LogInfo(
@@ -43,6 +165,22 @@ int ParseArguments(data_args_d_t* data, int argc, char* argv[])
                 "      -help: print command options\n"
                 "      -i: Print device info\n"
                 "      -q: Run in silence mode\n"
+                "      -input <file>: Image to decode in the default, -multi, -fission, -numa and -threads modes\n"
+                "      -queues <n>: Number of command queues used for decoding (default 2)\n"
+                "      -multi: Decode on all devices of the platform\n"
+                "      -fission <n>: Decode on sub-devices of n compute units each\n"
+                "      -numa: Compare one device against one sub-device per NUMA node\n"
+                "      -batch <dir>: Decode all images in a directory, report images/s\n"
+                "      -threads <n>: Decode from n threads sharing one context\n"
+                "      -trace <file>: Write a Chrome trace (Perfetto) of the decode\n"
+                "      -stats: Print resource counters per decode and for the whole run\n"
+                "      -nosvm: Stage and read back through buffers even on SVM capable CPU devices\n"
+                "      -probe <file>: Print width, height, components, tiles and levels of file and exit\n"
+                "      -stream <file>: Decode file, or stdin for -, tile-part by tile-part with bounded memory\n"
+                "      -region <file> <x,y,w,h[,r]>: Decode a region (up to resolution r) using the file's tile index\n"
+                "      -budget <MB>: Device memory budget; decodes wait for capacity, large images go in tile batches\n"
+                "      -tiles <n>: With -stream, checksum tiles as they complete, n in flight (0 a row of tiles)\n"
+                "      -parsethreads <n>: Parse the packet headers of tiles on n host threads (0 all hardware threads)\n"
                 );
         }
         else
@@ -54,14 +192,195 @@ int ParseArguments(data_args_d_t* data, int argc, char* argv[])
     return errorCode;
 }
 
-int main(int argc, char* argv[])
+// Decode the same image repeatedly, first with whole devices and then with one sub-device
+// per NUMA node, each node's pipeline pinned to that node, and print both throughputs
+int RunNumaBenchmark(data_args_d_t* args, const char* inputFile)
 {
-    data_args_d_t args;
-     // Parse command line arguments
-    int error_code = ParseArguments(&args, argc, argv);
-    if (CL_SUCCESS != error_code)
+    const int numImages = 16;
+    std::vector<std::string> files(numImages, inputFile);
+    double rate[2] = {0, 0};
+    int numDevices[2] = {0, 0};
+
+    for (int pass = 0; pass < 2; ++pass)
     {
-        LogError("Error: ParseArguments returned %s.\n", TranslateOpenCLError(error_code));
+        data_args_d_t config = *args;
+        config.subDeviceUnits = 0;
+        config.numaNodes = (pass == 1);
+
+        std::vector<ocl_args_d_t*> devices;
+        int error_code = InitOpenCLDevices(devices, &config);
+        if (CL_SUCCESS == error_code)
+        {
+            MultiDeviceDecoder decoder(devices, args->numQueues);
+            if (config.numaNodes)
+                decoder.pinToNumaNodes();
+            rate[pass] = decoder.decodeImages(files);
+            numDevices[pass] = (int)devices.size();
+        }
+        for (size_t i = 0; i < devices.size(); ++i)
+            delete devices[i];
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("Error: InitOpenCLDevices returned %s.\n", TranslateOpenCLError(error_code));
+            return error_code;
+        }
+    }
+
+    printf("Whole device(s) (%d): %.2f images/s\n", numDevices[0], rate[0]);
+    printf("NUMA sub-devices (%d): %.2f images/s\n", numDevices[1], rate[1]);
+    return CL_SUCCESS;
+}
+
+// Decode the same image from several threads at once. Every thread owns a Decoder, and with it
+// its own command queues and kernels; the context and the built programs are shared.
+int RunConcurrentDecodes(ocl_args_d_t* ocl, data_args_d_t* args, const char* inputFile)
+{
+    const int decodesPerThread = 4;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    double t1 = time_stamp();
+    for (int i = 0; i < args->numThreads; ++i)
+    {
+        threads.push_back(std::thread([&]()
+        {
+            try
+            {
+                Decoder decoder(ocl, args->numQueues);
+                for (int j = 0; j < decodesPerThread; ++j)
+                {
+                    if (decoder.decode(inputFile) != 0)
+                        failures++;
+                }
+            }
+            catch (const Error& err)
+            {
+                LogError("Error: %s\n", err.what());
+                failures++;
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    double elapsed = time_stamp() - t1;
+
+    int images = args->numThreads * decodesPerThread;
+    printf("Concurrent: %d threads, %d images in %.3f s, %.2f images/s\n",
+        args->numThreads, images, elapsed, elapsed > 0 ? images / elapsed : 0.0);
+    return failures ? -1 : CL_SUCCESS;
+}
+
+// Accumulated by ChecksumTile over the tiles of a tile-streaming decode
+struct TileChecksum
+{
+    TileChecksum() : tiles(0), samples(0), hash(0) {}
+    unsigned int tiles;
+    unsigned long long samples;
+    unsigned int hash;
+};
+
+// Tile sink that only folds the samples into a checksum, so that no image is assembled
+void ChecksumTile(const DecodedTile& tile, void* userData)
+{
+    TileChecksum* sum = (TileChecksum*)userData;
+    size_t samples = (size_t)tile.width * tile.height;
+    for (unsigned int c = 0; c < tile.numComponents; c++)
+    {
+        const int* plane = tile.planes[c];
+        if (!plane)
+            continue;
+        for (size_t i = 0; i < samples; i++)
+            sum->hash = (sum->hash ^ (unsigned int)plane[i]) * 16777619u;
+    }
+    sum->tiles++;
+    sum->samples += samples * tile.numComponents;
+}
+
+// Decode a region twice: the first decode loads or builds the tile index, the second reuses it
+int RunRegion(Decoder* decoder, const char* fileName, const char* spec)
+{
+    unsigned int x = 0, y = 0, w = 0, h = 0, r = (unsigned int)-1;
+    if (sscanf(spec, "%u,%u,%u,%u,%u", &x, &y, &w, &h, &r) < 4)
+    {
+        LogError("Error: region must be x,y,width,height[,resolution], not %s.\n", spec);
+        return -1;
+    }
+    for (int pass = 0; pass < 2; pass++)
+    {
+        TileChecksum checksum;
+        double t1 = time_stamp();
+        int rc = decoder->decodeRegion(fileName, x, y, w, h, ChecksumTile, &checksum, r);
+        double t2 = time_stamp();
+        if (rc)
+        {
+            LogError("Error: cannot decode region of %s (%d).\n", fileName, rc);
+            return rc;
+        }
+        printf("Region decode %s: %.3f ms, %u tiles, checksum %08x\n", pass ? "(indexed)" : "(index loaded or built)",
+            (t2 - t1) * 1e3, checksum.tiles, checksum.hash);
+    }
+    return 0;
+}
+
+// Print the header parameters of a file; no OpenCL environment is created
+int RunProbe(const char* fileName)
+{
+    type_image_info info;
+    double t1 = time_stamp();
+    int rc = Decoder::probe(fileName, &info);
+    double t2 = time_stamp();
+    if (rc != PROBE_OK)
+    {
+        LogError("Error: cannot probe %s (%d).\n", fileName, rc);
+        return rc;
+    }
+    printf("%s: %ux%u, %u components, %u bits %s, %ux%u tiles of %ux%u, %u levels, %s, mct %u%s, %u layers, code-blocks %ux%u\n",
+        fileName, info.width, info.height, info.num_components, info.num_range_bits, info.sign ? "signed" : "unsigned",
+        info.num_xtiles, info.num_ytiles, info.tile_w, info.tile_h, info.num_dlvls,
+        info.wavelet_type == DWT_53 ? "5/3" : "9/7", info.use_mct, info.use_part2_mct ? " (Part 2)" : "",
+        info.num_layers, info.cblk_w, info.cblk_h);
+    printf("Probe time: %.1f us\n", (t2 - t1) * 1e6);
+    return 0;
+}
+
+// Run the mode selected on the command line
+int RunDecoder(data_args_d_t* args)
+{
+    int error_code = CL_SUCCESS;
+    const char* inputFile = args->inputFile;
+    bool needsInput = args->numaNodes || args->multiDevice || args->numThreads > 0 ||
+        (!args->batchDirectory && !args->regionFile && !args->streamFile);
+    if (needsInput && !inputFile)
+    {
+        LogError("Error: no image to decode, use -input <file>.\n");
+        return CL_INVALID_VALUE;
+    }
+
+    if (args->numaNodes)
+    {
+        return RunNumaBenchmark(args, inputFile);
+    }
+
+    if (args->multiDevice)
+    {
+        // one environment per device or sub-device, tiles are shared out between them
+        std::vector<ocl_args_d_t*> devices;
+        error_code = InitOpenCLDevices(devices, args);
+        if (CL_SUCCESS == error_code)
+        {
+            MultiDeviceDecoder decoder(devices, args->numQueues);
+            DecodedImage image;
+            error_code = decoder.decode(inputFile, &image);
+            if (error_code)
+                LogError("Error: cannot decode %s on %d devices.\n", inputFile, (int)decoder.getNumDevices());
+        }
+        else
+        {
+            LogError("Error: InitOpenCLDevices returned %s.\n", TranslateOpenCLError(error_code));
+        }
+        for (size_t i = 0; i < devices.size(); ++i)
+            delete devices[i];
+        DeviceKernel::ReleaseProgramCache();
         return error_code;
     }
 
@@ -69,15 +388,67 @@ int main(int argc, char* argv[])
     // find OpenCL platform and device and create OpenCL context and command-queue
     // The OpenCL parameters are returned in ocl
     ocl_args_d_t ocl;
-    error_code = InitOpenCL(&ocl, &args);
+    error_code = InitOpenCL(&ocl, args);
     if (CL_SUCCESS != error_code)
     {
         LogError("Error: InitOpenCL returned %s.\n", TranslateOpenCLError(error_code));
         return error_code;
     }
 
-	Decoder decoder(&ocl);
-	decoder.decode("c:\\src\\openjpeg-data\\input\\conformance\\file1.jp2");
+	if (args->numThreads > 0)
+	{
+		error_code = RunConcurrentDecodes(&ocl, args, inputFile);
+		DeviceKernel::ReleaseProgramCache();
+		return error_code;
+	}
+
+	Decoder decoder(&ocl, args->numQueues);
+	decoder.setParseThreads((unsigned int)args->parseThreads);
+	if (args->batchDirectory)
+	{
+		std::vector<std::string> files;
+		if (BatchDecoder::listImages(args->batchDirectory, files) <= 0)
+		{
+			LogError("Error: no images found in %s.\n", args->batchDirectory);
+			return -1;
+		}
+		BatchDecoder batch(&decoder);
+		batch.run(files);
+	}
+	else if (args->regionFile)
+	{
+		error_code = RunRegion(&decoder, args->regionFile, args->regionSpec);
+	}
+	else if (args->streamFile)
+	{
+		InputStream* in = NULL;
+		if (!strcmp(args->streamFile, "-"))
+			in = new PipeInputStream(stdin);
+		else
+			in = new FileInputStream(args->streamFile);
+		DecodedImage image;
+		TileChecksum checksum;
+		double t1 = time_stamp();
+		if (args->streamTiles >= 0)
+			error_code = decoder.decodeStream(in, NULL, ChecksumTile, &checksum, (unsigned int)args->streamTiles);
+		else
+			error_code = decoder.decodeStream(in, &image);
+		double t2 = time_stamp();
+		if (error_code)
+			LogError("Error: cannot decode stream %s.\n", args->streamFile);
+		else
+			printf("Stream decode: %.3f ms, peak %llu bytes of input resident\n",
+				(t2 - t1) * 1e3, (unsigned long long)in->getPeakResident());
+		if (!error_code && args->streamTiles >= 0)
+			printf("Tiles: %u, %llu samples, checksum %08x\n", checksum.tiles, checksum.samples, checksum.hash);
+		delete in;
+	}
+	else
+	{
+		error_code = decoder.decode(inputFile);
+		if (error_code)
+			LogError("Error: cannot decode %s.\n", inputFile);
+	}
 
 //	DWTTest dwtTester;
 //	dwtTester.test(&ocl);
@@ -85,8 +456,37 @@ int main(int argc, char* argv[])
 
 
 
+    DeviceKernel::ReleaseProgramCache();
     LogInfo("Done.\n");
 
-    return 0;
+    return error_code;
 }
 
+
+int main(int argc, char* argv[])
+{
+    data_args_d_t args;
+     // Parse command line arguments
+    int error_code = ParseArguments(&args, argc, argv);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("Error: ParseArguments returned %s.\n", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    if (args.probeFile)
+        return RunProbe(args.probeFile);
+
+    if (args.traceFile)
+        Tracer::start(args.traceFile);
+    ResourceCounters::setReporting(args.stats);
+    SharedMemory::setEnabled(!args.noSvm);
+    MemoryPlanner::setDefaultBudget((size_t)args.budgetMB << 20);
+    error_code = RunDecoder(&args);
+    MemoryPlanner::releaseAll();
+    if (args.stats)
+        ResourceCounters::print(ResourceCounters::snapshot(), "Resources for the whole run:");
+    if (args.traceFile)
+        Tracer::stop();
+    return error_code;
+}
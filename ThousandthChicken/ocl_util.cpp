@@ -464,6 +464,125 @@ int InitOpenCL(ocl_args_d_t* ocl, data_args_d_t* data)
     return CL_SUCCESS;
 }
 
+// Create a context and an in-order, profiling enabled commands-queue for a single device
+static int InitDeviceEnvironment(ocl_args_d_t* ocl, cl_platform_id platformId, cl_device_id device)
+{
+    cl_int errorCode = CL_SUCCESS;
+    cl_context_properties contextProperties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platformId, 0};
+
+    ocl->device = device;
+    ocl->context = clCreateContext(contextProperties, 1, &device, NULL, NULL, &errorCode);
+    if (errorCode != CL_SUCCESS)
+    {
+        LogError("Error: clCreateContext() returned %s.\n", TranslateOpenCLError(errorCode));
+        return errorCode;
+    }
+
+    ocl->commandQueue = clCreateCommandQueue(ocl->context, device, CL_QUEUE_PROFILING_ENABLE, &errorCode);
+    if (errorCode != CL_SUCCESS)
+    {
+        LogError("Error: clCreateCommandQueue() returned %s.\n", TranslateOpenCLError(errorCode));
+        return errorCode;
+    }
+    return CL_SUCCESS;
+}
+
+// Split a device with device fission; the sub-devices are appended to subDevices
+static cl_int PartitionDevice(cl_device_id device, const cl_device_partition_property* properties, std::vector<cl_device_id>& subDevices)
+{
+    cl_uint numSubDevices = 0;
+    cl_int errorCode = clCreateSubDevices(device, properties, 0, NULL, &numSubDevices);
+    if (errorCode != CL_SUCCESS)
+    {
+        return errorCode;
+    }
+    std::vector<cl_device_id> created(numSubDevices);
+    errorCode = clCreateSubDevices(device, properties, numSubDevices, &created[0], NULL);
+    if (errorCode != CL_SUCCESS)
+    {
+        return errorCode;
+    }
+    subDevices.insert(subDevices.end(), created.begin(), created.end());
+    return CL_SUCCESS;
+}
+
+// Intialize one OpenCL environment per device of the preferred type on the preferred platform
+// If data->subDeviceUnits is set, every device is split with device fission into sub-devices
+// of that many compute units, and each sub-device gets its own environment.
+// If data->numaNodes is set, every device is split into one sub-device per NUMA node instead;
+// devices that cannot be split that way (e.g. single node hosts) are used whole.
+// The created environments are appended to devices; the caller is responsible to delete them
+int InitOpenCLDevices(std::vector<ocl_args_d_t*>& devices, data_args_d_t* data)
+{
+    cl_int errorCode = CL_SUCCESS;
+
+    cl_platform_id platformId = FindPlatformId(data->vendorName, data->preferCpu, data->preferGpu);
+    if (platformId == NULL)
+    {
+        LogError("Error: Couldn't find a platform ID.\n");
+        return CL_INVALID_PLATFORM;
+    }
+
+    cl_device_type deviceType = TranslateDeviceType(data->preferCpu, data->preferGpu, false);
+    cl_uint numDevices = 0;
+    errorCode = clGetDeviceIDs(platformId, deviceType, 0, NULL, &numDevices);
+    if (errorCode != CL_SUCCESS || numDevices == 0)
+    {
+        LogError("Error: clGetDeviceIDs() returned %s.\n", TranslateOpenCLError(errorCode));
+        return errorCode != CL_SUCCESS ? errorCode : CL_DEVICE_NOT_FOUND;
+    }
+    std::vector<cl_device_id> rootDevices(numDevices);
+    errorCode = clGetDeviceIDs(platformId, deviceType, numDevices, &rootDevices[0], NULL);
+    if (errorCode != CL_SUCCESS)
+    {
+        LogError("Error: clGetDeviceIDs() returned %s.\n", TranslateOpenCLError(errorCode));
+        return errorCode;
+    }
+
+    std::vector<cl_device_id> targets;
+    for (cl_uint i = 0; i < numDevices; ++i)
+    {
+        if (data->numaNodes)
+        {
+            cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+            errorCode = PartitionDevice(rootDevices[i], properties, targets);
+            if (errorCode != CL_SUCCESS)
+            {
+                LogInfo("Info: NUMA partitioning not possible (%s), using the whole device.\n", TranslateOpenCLError(errorCode));
+                targets.push_back(rootDevices[i]);
+            }
+        }
+        else if (data->subDeviceUnits > 0)
+        {
+            cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)data->subDeviceUnits, 0};
+            errorCode = PartitionDevice(rootDevices[i], properties, targets);
+            if (errorCode != CL_SUCCESS)
+            {
+                LogError("Error: clCreateSubDevices() returned %s.\n", TranslateOpenCLError(errorCode));
+                return errorCode;
+            }
+        }
+        else
+        {
+            targets.push_back(rootDevices[i]);
+        }
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        ocl_args_d_t* ocl = new ocl_args_d_t();
+        devices.push_back(ocl);
+        errorCode = InitDeviceEnvironment(ocl, platformId, targets[i]);
+        if (errorCode != CL_SUCCESS)
+        {
+            return errorCode;
+        }
+    }
+    LogInfo("Info: Using %d OpenCL device(s).\n", (int)devices.size());
+
+    return CL_SUCCESS;
+}
+
 // function returns time in micro-seconds
 unsigned long long HostTime()
 {
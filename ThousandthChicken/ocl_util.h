@@ -3,6 +3,7 @@
 
 
 #include <string>
+#include <vector>
 #include "CL/cl.h"
 
 extern bool quiet;
@@ -12,6 +13,23 @@ struct data_args_d_t
     char* vendorName;                   // preferred OpenCL platform vendor name
     bool  preferCpu;                    // indicator to create context with CPU device
     bool  preferGpu;                    // indicator to create context with GPU device
+    int   numQueues;                    // number of command queues the decoder spreads stages over
+    bool  multiDevice;                  // indicator to decode on all devices of the platform
+    int   subDeviceUnits;               // if > 0, split devices into sub-devices of this many compute units
+    bool  numaNodes;                    // indicator to split devices into one sub-device per NUMA node
+    char* inputFile;                    // image decoded by the default, -multi, -fission, -numa and -threads modes
+    char* batchDirectory;               // if set, decode every image in this directory as a batch
+    int   numThreads;                   // if > 0, run this many decoders concurrently on one context
+    char* traceFile;                    // if set, write a Chrome trace of the run to this file
+    bool  stats;                        // indicator to print allocation, transfer and launch counters
+    bool  noSvm;                        // indicator to copy through buffers even where shared virtual memory works
+    char* probeFile;                    // if set, print the header parameters of this file and exit
+    char* streamFile;                   // if set, decode this file ("-" for stdin) tile-part by tile-part
+    char* regionFile;                   // if set, decode a region of this file through its tile index
+    char* regionSpec;                   // x,y,width,height[,maximum resolution level] of the region
+    int budgetMB;                       // device memory budget of decodes in MB, 0 for 3/4 of the device's memory
+    int streamTiles;                    // with streamFile: tiles in flight handed to a sink (0 a row), -1 to assemble the image
+    int parseThreads;                   // host threads parsing tiles concurrently, 0 for one per hardware thread, 1 in order
 };
 
 struct ocl_args_d_t
@@ -52,5 +70,8 @@ const char* TranslateOpenCLError(cl_int errorCode);
 // Initialize OpenCL environment - Find required platform and create a context and commands-queue
 int InitOpenCL(ocl_args_d_t* ocl, data_args_d_t* data);
 
+// Initialize one OpenCL environment (context and commands-queue) per device, or per sub-device
+int InitOpenCLDevices(std::vector<ocl_args_d_t*>& devices, data_args_d_t* data);
+
 // Returns host time in (ms)
 unsigned long long HostTime();
\ No newline at end of file
@@ -13,6 +13,6 @@
  * @param size Number of pixels in each component (width x height).
  * @param level_shift Level shift.
  */
-void KERNEL fdc_level_shift_kernel(GLOBAL int *idata, const unsigned short width, const unsigned short height, const int level_shift) {
+void KERNEL fdc_level_shift_kernel(GLOBAL int *idata, const unsigned int width, const unsigned int height, const int level_shift) {
 	idata[getGlobalId(0)] -=  1 << level_shift;
 }
@@ -13,7 +13,7 @@
  * @param size Number of pixels in each component (width x height).
  * @param level_shift Level shift.
  */
-void KERNEL idc_level_shift_kernel(GLOBAL int *idata, const unsigned short width, const unsigned short height, const int level_shift, const int minimum, const int maximum) {
+void KERNEL idc_level_shift_kernel(GLOBAL int *idata, const unsigned int width, const unsigned int height, const int level_shift, const int minimum, const int maximum) {
 	int index = getGlobalId(0);
 	idata[index] = clamp(idata[index] + (1 << level_shift), minimum, maximum);
 }
@@ -17,7 +17,7 @@ typedef float type_data;
  * @param img_b 1D array with BLUE component of the image.
  * @param size Number of pixels in each component (width x height).
  */
-void KERNEL ict_kernel(GLOBAL int *img_r, GLOBAL int *img_g, GLOBAL int *img_b, const unsigned short width, const unsigned short height, const int level_shift) {
+void KERNEL ict_kernel(GLOBAL int *img_r, GLOBAL int *img_g, GLOBAL int *img_b, const unsigned int width, const unsigned int height, const int level_shift) {
 
     int dcShift = 1 << level_shift;
 	int index = getGlobalId(0);
@@ -0,0 +1,67 @@
+// License: please see LICENSE2 file for more details.
+#include "platform.cl"
+
+#ifndef MCT_TILE
+#define MCT_TILE 16
+#endif
+
+
+/**
+ * @brief Array based inverse multiple component transform (15444-2 Annex J) of one tile.
+ *
+ * Computes result = matrix * components for all pixels of the tile as a matrix product tiled
+ * in local memory: every work-group computes MCT_TILE output components of MCT_TILE pixels,
+ * stepping through the input components MCT_TILE at a time. Every sample is read once per
+ * group of output components instead of once per output component.
+ *
+ * @param tile All components of the tile, one after another.
+ * @param inputOffsets Start of every input component in tile, in samples.
+ * @param matrix Transform matrix, outputs x inputs, row major.
+ * @param result Transformed components, outputs x pixels.
+ */
+void KERNEL array_mct_kernel(GLOBAL const int *tile, GLOBAL const int *inputOffsets, GLOBAL const float *matrix,
+                             GLOBAL float *result, const int inputs, const int outputs, const int pixels) {
+
+	LOCAL float samples[MCT_TILE][MCT_TILE];	// [input][pixel]
+	LOCAL float weights[MCT_TILE][MCT_TILE];	// [output][input]
+
+	int lp = getLocalId(0);
+	int lo = getLocalId(1);
+	int p = getGlobalId(0);
+	int o = getGlobalId(1);
+	int firstOutput = getGroupId(1) * MCT_TILE;
+
+	float sum = 0.0f;
+	for (int k0 = 0; k0 < inputs; k0 += MCT_TILE) {
+		int k = k0 + lo;
+		samples[lo][lp] = (k < inputs && p < pixels) ? (float)tile[inputOffsets[k] + p] : 0.0f;
+		int wo = firstOutput + lo;
+		int wk = k0 + lp;
+		weights[lo][lp] = (wo < outputs && wk < inputs) ? matrix[wo * inputs + wk] : 0.0f;
+		localMemoryFence();
+
+		for (int j = 0; j < MCT_TILE; j++)
+			sum += weights[lo][j] * samples[j][lp];
+		localMemoryFence();
+	}
+
+	if (p < pixels && o < outputs)
+		result[(size_t)o * pixels + p] = sum;
+}
+
+/**
+ * @brief Adds the offsets to the transformed components, rounds them and stores them in their place in the tile.
+ *
+ * @param outputOffsets Start of every output component in tile, in samples.
+ * @param offsets Offset of every output component.
+ */
+void KERNEL array_mct_store_kernel(GLOBAL int *tile, GLOBAL const int *outputOffsets, GLOBAL const float *offsets,
+                                   GLOBAL const float *result, const int pixels) {
+
+	int p = getGlobalId(0);
+	int o = getGlobalId(1);
+	if (p >= pixels)
+		return;
+
+	tile[outputOffsets[o] + p] = convert_int_sat_rte(result[(size_t)o * pixels + p] + offsets[o]);
+}
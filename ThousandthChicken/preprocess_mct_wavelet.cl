@@ -0,0 +1,121 @@
+// License: please see LICENSE2 file for more details.
+#include "platform.cl"
+
+/*
+ * Specialised at build time (Preprocessor::waveletKernel) from the ATK and ADS segments:
+ *   COMPONENTS    number of components of the collection
+ *   LEVELS        number of decomposition levels across the components
+ *   M0            1 if the low-pass subsequence starts at the odd position
+ *   SYMMETRIC     1 for whole-sample symmetric boundary extension, 0 for constant extension
+ *   REVERSIBLE    1 for integer lifting with exponents and residues
+ *   STEPS, TAPS   number of lifting steps and coefficients per step (shorter steps padded with 0)
+ *   ALPHA         STEPS x TAPS lifting coefficients, in analysis order
+ *   OFFSETS       offset of the first coefficient of every step
+ *   SHIFTS        scaling exponent of every step (reversible only)
+ *   RESIDUES      additive residue of every step (reversible only)
+ *   SCALE         scaling factor K (irreversible only)
+ *   GROUP_PIXELS  work-group size; every work-item keeps its component column in local memory
+ */
+
+#if REVERSIBLE
+typedef int type_sample;
+CONSTANT int alpha[STEPS * TAPS] = ALPHA;
+CONSTANT int shifts[STEPS] = SHIFTS;
+CONSTANT int residues[STEPS] = RESIDUES;
+#else
+typedef float type_sample;
+CONSTANT float alpha[STEPS * TAPS] = ALPHA;
+#endif
+CONSTANT int offsets[STEPS] = OFFSETS;
+
+
+/** @brief Maps a position outside [0, n) back into the signal */
+int extend(int pos, int n) {
+	if (n == 1)
+		return 0;
+#if SYMMETRIC
+	while (pos < 0 || pos >= n) {
+		if (pos < 0)
+			pos = -pos;
+		if (pos >= n)
+			pos = 2 * (n - 1) - pos;
+	}
+	return pos;
+#else
+	return clamp(pos, 0, n - 1);
+#endif
+}
+
+/**
+ * @brief Inverse 1-D wavelet transform across the components of a tile (15444-2 Annex J.4), one pixel per work-item.
+ *
+ * The input components hold the subbands of the collection as [L(LEVELS) H(LEVELS) ... H(1)].
+ * Every level interleaves its low and high subsequences, undoes the scaling and runs the
+ * lifting steps backwards. Work-items never share samples, so no barriers are needed.
+ *
+ * @param tile All components of the tile, one after another.
+ * @param inputOffsets Start of every input component in tile, in samples.
+ * @param outputOffsets Start of every output component in tile, in samples.
+ * @param pixels Number of samples per component.
+ */
+void KERNEL wavelet_mct_kernel(GLOBAL int *tile, GLOBAL const int *inputOffsets, GLOBAL const int *outputOffsets, const int pixels) {
+
+	LOCAL type_sample column[COMPONENTS][GROUP_PIXELS];
+	LOCAL type_sample interleaved[COMPONENTS][GROUP_PIXELS];
+
+	int lp = getLocalId(0);
+	int p = getGlobalId(0);
+	if (p >= pixels)
+		return;
+
+	for (int c = 0; c < COMPONENTS; c++)
+		column[c][lp] = tile[inputOffsets[c] + p];
+
+	int lengths[LEVELS + 1];
+	lengths[0] = COMPONENTS;
+	for (int l = 0; l < LEVELS; l++)
+		lengths[l + 1] = (lengths[l] + 1 - M0) / 2;
+
+	for (int l = LEVELS - 1; l >= 0; l--) {
+		int n = lengths[l];
+		int lowCount = lengths[l + 1];
+
+		// low-pass samples sit at the positions with the parity of M0
+		for (int i = 0; i < lowCount; i++)
+			interleaved[2 * i + M0][lp] = column[i][lp];
+		for (int i = 0; i < n - lowCount; i++)
+			interleaved[2 * i + 1 - M0][lp] = column[lowCount + i][lp];
+
+#if !REVERSIBLE
+		for (int j = 0; j < n; j++)
+			interleaved[j][lp] = ((j & 1) == M0) ? interleaved[j][lp] * SCALE : interleaved[j][lp] / SCALE;
+#endif
+
+		// step s updates the high-pass samples if s is even, the low-pass samples if s is odd
+		for (int s = STEPS - 1; s >= 0; s--) {
+			int target = (s & 1) ? M0 : 1 - M0;
+			for (int j = target; j < n; j += 2) {
+				// other subsequence sample 2 * (t + offset + k) + (1 - target), with t = (j - target) / 2
+				int first = j + 1 - 2 * target + 2 * offsets[s];
+				type_sample sum = 0;
+				for (int k = 0; k < TAPS; k++)
+					sum += alpha[s * TAPS + k] * interleaved[extend(first + 2 * k, n)][lp];
+#if REVERSIBLE
+				interleaved[j][lp] -= (residues[s] + sum) >> shifts[s];
+#else
+				interleaved[j][lp] -= sum;
+#endif
+			}
+		}
+
+		for (int j = 0; j < n; j++)
+			column[j][lp] = interleaved[j][lp];
+	}
+
+	for (int c = 0; c < COMPONENTS; c++)
+#if REVERSIBLE
+		tile[outputOffsets[c] + p] = column[c][lp];
+#else
+		tile[outputOffsets[c] + p] = convert_int_sat_rte(column[c][lp]);
+#endif
+}
@@ -15,7 +15,7 @@
  * @param img_b 1D array with V component of the image.
  * @param size Number of pixels in each component (width x height).
  */
-void KERNEL tcr_kernel(GLOBAL int *img_r, GLOBAL int *img_g, GLOBAL int *img_b, const unsigned short width, const unsigned short height, const int level_shift, const int minimum, const int maximum) {
+void KERNEL tcr_kernel(GLOBAL int *img_r, GLOBAL int *img_g, GLOBAL int *img_b, const unsigned int width, const unsigned int height, const int level_shift, const int minimum, const int maximum) {
 
    int dcShift = 1 << level_shift;
    int index = getGlobalId(0);